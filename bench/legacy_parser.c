@@ -0,0 +1,175 @@
+#define _GNU_SOURCE // strcasestr
+#include "legacy_parser.h"
+#include "../lib/h/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+/*
+    this is the old parser as it was, with one difference: the temporary copies it used to leak
+    are freed, otherwise a benchmark running it millions of times would measure page faults.
+*/
+
+// the string juggling is kept exactly as it was, warnings included
+#pragma GCC diagnostic ignored "-Wstringop-truncation"
+
+#define FILENAME_MAX_LEN 1024
+#define WWW_PATH ""
+
+static int legacy_http_request_parse_method(legacy_http_request* req);
+static int legacy_http_request_parse_filename(legacy_http_request* req);
+static void legacy_http_request_parse_connection(legacy_http_request* req);
+
+int legacy_count_lines(char* bytes, size_t byte_len){
+
+    char* copy = malloc(sizeof(char) * byte_len + 1); // strch destroys the string, so we make a copy of it
+    char* next;
+    int count = 0;
+
+    copy = memcpy(copy, bytes, byte_len);
+    copy[byte_len] = '\0';
+    next = strchr(copy, '\n');
+
+    while(next != NULL){
+        count++;
+        next = strchr(next + 1, '\n');
+    }
+
+    free(copy);
+    return count;
+
+}
+
+char** legacy_bytes_to_lines(char* bytes, size_t byte_len, int lines_num){
+
+    unsigned int i = 0, line_len = 0;
+    char** lines = (char**) malloc(sizeof(char*) * lines_num);
+    char* copy = malloc(sizeof(char) * byte_len + 1); // strtok_r destroys the string too :(
+    char* temp;
+    
+    strncpy(copy, bytes, byte_len);
+    copy[byte_len] = '\0';
+    
+    char* part = strtok_r(copy, "\n", &temp);
+    
+    do{
+        line_len = strlen(part);
+        lines[i] = malloc(sizeof(char) * line_len + 1);
+        strncpy(lines[i], part, line_len);
+        lines[i][line_len] = '\0';
+        i++;
+    }while ((part = strtok_r(NULL, "\n", &temp)) != NULL && i < (unsigned int) lines_num);
+
+    free(copy);
+    return lines;
+
+}
+
+int legacy_http_request_create(legacy_http_request* req, char* data, int request_length){
+
+    req->keep_alive = false;
+    req->lines_num = 0;
+    req->lines = NULL;
+    req->filename = NULL;
+    if(request_length == 0) return -1;
+    
+    req->bytes = malloc(sizeof(char) * request_length + 1);
+    memcpy(req->bytes, data, request_length); // copy the request so we can reuse the context buffer later
+    req->length = request_length;
+    req->bytes[req->length] = '\0'; // terminate the string
+    req->lines_num = legacy_count_lines(req->bytes, req->length);
+    req->filename_max_length = FILENAME_MAX_LEN;
+
+    if(req->lines_num == 0){
+        return -1;
+    }
+
+    req->lines = legacy_bytes_to_lines(req->bytes, req->length, req->lines_num);
+    legacy_http_request_parse_connection(req);
+    
+    if(legacy_http_request_parse_method(req) < 0){
+        errno = 1;
+    }
+    if(legacy_http_request_parse_filename(req) < 0){
+        errno = 2;
+    }
+    return 0;
+
+}
+
+void legacy_http_request_free(legacy_http_request* req){
+
+    for(int i = 0; req->lines && i < req->lines_num; i++) free(req->lines[i]);
+    free(req->lines);
+    free(req->bytes);
+    free(req->filename);
+
+}
+
+int legacy_http_request_parse_filename(legacy_http_request* req){
+
+    int i = 0, 
+        www_path_len = strlen(WWW_PATH), 
+        k = www_path_len;
+
+    char* first_line = req->lines[0];
+
+    char filename[www_path_len + req->filename_max_length];
+    bzero(filename, www_path_len + req->filename_max_length);
+    strncpy(filename, WWW_PATH, www_path_len);
+
+    while(first_line[i] != '/'){
+        i++;
+    } // we searched for the /, now we can start reading the filename
+
+    while(first_line[i] != ' '){
+        if(i == req->filename_max_length){
+            return -1;
+        }
+        filename[k] = first_line[i];
+        i++;
+        k++;
+    }
+    
+    int normalized = normalize_path(filename + www_path_len, k - www_path_len);
+    k = www_path_len + (normalized < 0 ? 0 : normalized); // an invalid path is an empty name
+
+    req->filename = malloc(sizeof(char) * (k + 1));
+    memcpy(req->filename, filename, k);
+    req->filename[k] = '\0';
+    req->filename_actual_length = k;
+    return 0;
+
+}
+
+int legacy_http_request_parse_method(legacy_http_request* req){
+    
+    int line_len = strlen(req->lines[0]);
+    char* first_line = malloc(sizeof(char) * line_len + 1); // again, strtok_r destroys the string
+    char* method, *temp;
+
+    strncpy(first_line, req->lines[0], line_len);
+    first_line[line_len] = '\0';
+    method = strtok_r(first_line, " ", &temp);
+
+    req->is_get = strcmp("GET", method) == 0;
+    free(first_line);
+
+    return req->is_get ? 0 : -1;
+
+}
+
+void legacy_http_request_parse_connection(legacy_http_request* req){
+
+    char* value;
+    req->keep_alive = strstr(req->lines[0], "HTTP/1.0") == NULL;
+
+    for(int i = 1; i < req->lines_num; i++){
+        if(strncasecmp(req->lines[i], "Connection:", 11) != 0) continue;
+        value = req->lines[i] + 11;
+        if(strcasestr(value, "close")) req->keep_alive = false;
+        else if(strcasestr(value, "keep-alive")) req->keep_alive = true;
+    }
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+/*
+    the line-based parser epolly used before the in-place one (lib/http_request.c),
+    kept here only so the benchmarks can compare the two.
+*/
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct {
+    char* bytes;
+    size_t length;
+    int lines_num;
+    char** lines;
+    bool is_get;
+    char* filename;
+    int filename_max_length;
+    int filename_actual_length;
+    bool keep_alive;
+} legacy_http_request;
+
+extern int legacy_count_lines(char* bytes, size_t byte_len);
+extern char** legacy_bytes_to_lines(char* bytes, size_t byte_len, int lines_num);
+extern int legacy_http_request_create(legacy_http_request* req, char* data, int request_length);
+extern void legacy_http_request_free(legacy_http_request* req);
@@ -0,0 +1,905 @@
+/*
+    load generator: many keep-alive (or not) connections driven by one epoll loop per thread.
+
+    closed loop (default): every connection sends its next request as soon as the previous response is in,
+    so the offered load follows the server. it measures the best throughput, but when the server stalls the
+    generator stalls with it and the stall is recorded once instead of for every request that should have been sent
+    (coordinated omission).
+    open loop (--rate): requests are sent on a fixed schedule, spread over the connections. the latency of a request
+    starts at the time it was *supposed* to be sent, so a stall shows up in the tail as it would for real users.
+
+    HTTP/2 (--h2): every connection starts with the prior knowledge preface and keeps --streams requests in flight,
+    a new one goes out as soon as one is answered (closed loop only). the server's windows are opened all the way,
+    so the numbers are epolly's and not flow control's.
+
+    the latencies go to a log-linear histogram (lib/histogram.c) and the percentile distribution can be written
+    in HdrHistogram's .hgrm format (--output), a one-line summary can be appended to a TSV file (--summary).
+
+    make loadgen
+    ./bin/loadgen -c 64 -d 10 --path /index.html
+    ./bin/loadgen -c 64 -d 10 --rate 20000 --no-keep-alive
+    ./bin/loadgen -c 8 -d 10 --h2 --streams 32
+*/
+#define _GNU_SOURCE
+#include "../lib/h/histogram.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PATHS 16
+#define MAX_EVENTS 256
+#define HEAD_SIZE 8192 // a response head bigger than this is an error
+#define READ_SIZE 65536
+#define NS_PER_SEC 1000000000LL
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_FRAME_HEAD 9
+#define H2_MAX_FRAME 16384
+#define H2_WINDOW_UPDATE_AFTER (1LL << 30) // DATA bytes after which the connection's window is opened again
+
+typedef enum {
+    CONN_CONNECTING,
+    CONN_WRITING,
+    CONN_READING,
+    CONN_WAITING // open loop: the response is in, the next request isn't due yet
+} connection_state;
+
+typedef struct {
+    uint32_t id; // 0: free
+    int status;
+    long long intended_ns;
+} h2_slot;
+
+typedef struct {
+    int fd;
+    connection_state state;
+    int path; // index of the request being sent (the paths are used round robin)
+    size_t sent;
+    char head[HEAD_SIZE];
+    size_t head_length;
+    bool head_done;
+    long long body_remaining;
+    int status;
+    bool closing; // the server said "Connection: close"
+    long long intended_ns; // when the request should have been sent (open loop), or when it was (closed loop)
+    long long next_ns; // open loop: when the next request is due
+    long long opened_ns; // closed loop without keep-alive: the connect time is part of the latency
+    /*
+        HTTP/2: the requests in flight, and the frames going out and coming in
+    */
+    h2_slot* slots;
+    int in_flight;
+    uint32_t next_stream;
+    bool goaway; // the server said GOAWAY: the connection is reopened once its last streams are answered
+    char* out;
+    size_t out_length;
+    size_t out_sent;
+    size_t out_size;
+    char* in;
+    size_t in_length;
+    long long window_used; // DATA bytes since the last WINDOW_UPDATE of the connection
+} connection;
+
+typedef struct {
+    char host[256];
+    int port;
+    const char* paths[MAX_PATHS];
+    int num_paths;
+    int connections;
+    int threads;
+    double duration;
+    double warmup;
+    double rate; // requests per second for the whole run, 0 means closed loop
+    bool keep_alive;
+    bool h2;
+    int streams; // HTTP/2 requests in flight per connection
+    const char* output;
+    const char* summary;
+    const char* label;
+} loadgen_config;
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    int connections;
+    double rate; // this thread's share
+    histogram latency;
+    unsigned long long requests;
+    unsigned long long errors;
+    unsigned long long non_2xx;
+    unsigned long long bytes;
+} worker;
+
+static loadgen_config config;
+static struct sockaddr_storage address;
+static socklen_t address_length;
+static char* requests[MAX_PATHS];
+static size_t request_lengths[MAX_PATHS];
+static long long start_ns; // after the warmup
+static long long end_ns;
+
+static long long now_ns(){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+
+}
+
+static void connection_open(worker* w, int epoll_fd, connection* conn){
+
+    conn->fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(conn->fd < 0){
+        perror("socket error!");
+        exit(-1);
+    }
+
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // the connection is writable once it's connected
+    conn->state = CONN_CONNECTING;
+    conn->opened_ns = now_ns();
+    if(connect(conn->fd, (struct sockaddr*) &address, address_length) < 0 && errno != EINPROGRESS){
+        perror("connect error!");
+        exit(-1);
+    }
+
+    struct epoll_event event = { .events = EPOLLOUT, .data.ptr = conn };
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) < 0){
+        perror("epoll_ctl error!");
+        exit(-1);
+    }
+
+}
+
+static void connection_watch(int epoll_fd, connection* conn, unsigned int events){
+
+    struct epoll_event event = { .events = events, .data.ptr = conn };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+
+}
+
+static void connection_reset(connection* conn){
+
+    conn->sent = 0;
+    conn->head_length = 0;
+    conn->head_done = false;
+    conn->body_remaining = 0;
+    conn->status = 0;
+    conn->closing = false;
+
+}
+
+static void connection_reopen(worker* w, int epoll_fd, connection* conn){
+
+    close(conn->fd); // closing the fd removes it from the epoll as well
+    connection_open(w, epoll_fd, conn);
+
+}
+
+static void connection_send(worker* w, int epoll_fd, connection* conn){
+
+    // writes what's left of the request, then waits for the response
+    const char* request = requests[conn->path];
+    size_t length = request_lengths[conn->path];
+
+    while(conn->sent < length){
+        ssize_t written = send(conn->fd, request + conn->sent, length - conn->sent, MSG_NOSIGNAL);
+        if(written < 0){
+            if(errno == EAGAIN){
+                if(conn->state != CONN_WRITING) connection_watch(epoll_fd, conn, EPOLLOUT);
+                conn->state = CONN_WRITING;
+                return;
+            }
+            w->errors += now_ns() >= start_ns;
+            connection_reset(conn);
+            connection_reopen(w, epoll_fd, conn);
+            return;
+        }
+        conn->sent += written;
+    }
+
+    if(conn->state != CONN_READING) connection_watch(epoll_fd, conn, EPOLLIN);
+    conn->state = CONN_READING;
+
+}
+
+static void h2_reset(connection* conn){
+
+    conn->in_flight = 0;
+    conn->next_stream = 1;
+    conn->goaway = false;
+    conn->out_length = conn->out_sent = 0;
+    conn->in_length = 0;
+    conn->window_used = 0;
+    for(int i = 0; i < config.streams; i++) conn->slots[i].id = 0;
+
+}
+
+static void h2_queue(connection* conn, const void* bytes, size_t length){
+
+    // the output only holds the requests in flight and a few control frames, it never grows
+    if(conn->out_sent == conn->out_length) conn->out_sent = conn->out_length = 0;
+    if(conn->out_length + length > conn->out_size){
+        memmove(conn->out, conn->out + conn->out_sent, conn->out_length - conn->out_sent);
+        conn->out_length -= conn->out_sent;
+        conn->out_sent = 0;
+    }
+    if(conn->out_length + length > conn->out_size){
+        fprintf(stderr, "h2 output overflow!\n");
+        exit(-1);
+    }
+    memcpy(conn->out + conn->out_length, bytes, length);
+    conn->out_length += length;
+
+}
+
+static void h2_frame(connection* conn, int type, int flags, uint32_t stream, const void* payload, size_t length){
+
+    unsigned char head[H2_FRAME_HEAD] = { length >> 16, length >> 8, length, type, flags, stream >> 24, stream >> 16, stream >> 8, stream };
+    h2_queue(conn, head, sizeof(head));
+    if(length) h2_queue(conn, payload, length);
+
+}
+
+static void h2_window_update(connection* conn, uint32_t stream, uint32_t increment){
+
+    unsigned char payload[4] = { increment >> 24, increment >> 16, increment >> 8, increment };
+    h2_frame(conn, 8, 0, stream, payload, sizeof(payload));
+
+}
+
+static void h2_request(connection* conn){
+
+    // the request is pre-encoded (check build_requests), only its stream id is filled in
+    h2_slot* slot = NULL;
+    for(int i = 0; i < config.streams && !slot; i++) if(!conn->slots[i].id) slot = &conn->slots[i];
+
+    conn->path = (conn->path + 1) % config.num_paths;
+    slot->id = conn->next_stream;
+    slot->status = 0;
+    slot->intended_ns = now_ns();
+    conn->next_stream += 2;
+    conn->in_flight++;
+
+    h2_queue(conn, requests[conn->path], request_lengths[conn->path]);
+    size_t start = conn->out_length - request_lengths[conn->path];
+    conn->out[start + 5] = slot->id >> 24;
+    conn->out[start + 6] = slot->id >> 16;
+    conn->out[start + 7] = slot->id >> 8;
+    conn->out[start + 8] = slot->id;
+
+}
+
+static void h2_flush(worker* w, int epoll_fd, connection* conn){
+
+    // the connection is always read, it's written as long as there's something to write
+    while(conn->out_sent < conn->out_length){
+        ssize_t written = send(conn->fd, conn->out + conn->out_sent, conn->out_length - conn->out_sent, MSG_NOSIGNAL);
+        if(written < 0){
+            if(errno == EAGAIN) break;
+            w->errors += now_ns() >= start_ns ? conn->in_flight : 0;
+            h2_reset(conn);
+            connection_reopen(w, epoll_fd, conn);
+            return;
+        }
+        conn->out_sent += written;
+    }
+
+    connection_state state = conn->out_sent < conn->out_length ? CONN_WRITING : CONN_READING;
+    if(state != conn->state) connection_watch(epoll_fd, conn, state == CONN_WRITING ? EPOLLIN | EPOLLOUT : EPOLLIN);
+    conn->state = state;
+
+}
+
+static void h2_start(worker* w, int epoll_fd, connection* conn){
+
+    // the preface, a SETTINGS that opens every stream's window as much as it goes, the same for the connection
+    static const unsigned char settings[] = { 0, 4, 0x7f, 0xff, 0xff, 0xff };
+
+    h2_reset(conn);
+    h2_queue(conn, H2_PREFACE, sizeof(H2_PREFACE) - 1);
+    h2_frame(conn, 4, 0, 0, settings, sizeof(settings));
+    h2_window_update(conn, 0, 0x7fffffff - 65535);
+    for(int i = 0; i < config.streams; i++) h2_request(conn);
+
+    conn->state = CONN_CONNECTING;
+    h2_flush(w, epoll_fd, conn);
+
+}
+
+static h2_slot* h2_find(connection* conn, uint32_t id){
+
+    for(int i = 0; i < config.streams; i++) if(conn->slots[i].id == id) return &conn->slots[i];
+    return NULL;
+
+}
+
+static void h2_stream_done(worker* w, connection* conn, h2_slot* slot, bool failed){
+
+    long long now = now_ns();
+
+    if(now >= start_ns && now < end_ns){
+        if(failed){
+            w->errors += 1;
+        }else{
+            w->requests += 1;
+            if(slot->status < 200 || slot->status >= 400) w->non_2xx += 1;
+            histogram_record(&w->latency, now - slot->intended_ns);
+        }
+    }
+
+    slot->id = 0;
+    conn->in_flight--;
+    if(!conn->goaway) h2_request(conn);
+
+}
+
+static int h2_status(const unsigned char* block, size_t length){
+
+    // :status comes first: an indexed field of the static table (8 to 14) or a literal with its name (8)
+    static const int indexed[] = { 200, 204, 206, 304, 400, 404, 500 };
+
+    if(length >= 1 && block[0] >= 0x88 && block[0] <= 0x8e) return indexed[block[0] - 0x88];
+    if(length >= 5 && (block[0] == 0x08 || block[0] == 0x48 || block[0] == 0x18) && block[1] == 3) return atoi((const char[]) { block[2], block[3], block[4], 0 });
+    return -1;
+
+}
+
+static void h2_read(worker* w, int epoll_fd, connection* conn){
+
+    while(true){
+
+        ssize_t received = recv(conn->fd, conn->in + conn->in_length, READ_SIZE + H2_FRAME_HEAD + H2_MAX_FRAME - conn->in_length, 0);
+        if(received < 0 && errno == EAGAIN) break;
+        if(received <= 0){
+            // the server closed the connection: what was in flight is lost
+            w->errors += now_ns() >= start_ns && !conn->goaway ? conn->in_flight : 0;
+            h2_reset(conn);
+            connection_reopen(w, epoll_fd, conn);
+            return;
+        }
+        conn->in_length += received;
+        w->bytes += now_ns() >= start_ns ? received : 0;
+
+        size_t offset = 0;
+        while(conn->in_length - offset >= H2_FRAME_HEAD){
+
+            const unsigned char* head = (const unsigned char*) conn->in + offset;
+            size_t length = head[0] << 16 | head[1] << 8 | head[2];
+            int type = head[3], flags = head[4];
+            uint32_t id = (head[5] & 0x7f) << 24 | head[6] << 16 | head[7] << 8 | head[8];
+            const unsigned char* payload = head + H2_FRAME_HEAD;
+            h2_slot* slot;
+
+            if(conn->in_length - offset - H2_FRAME_HEAD < length) break;
+            offset += H2_FRAME_HEAD + length;
+
+            switch(type){
+                case 0: // DATA
+                    conn->window_used += length;
+                    if((slot = h2_find(conn, id)) && (flags & 1)) h2_stream_done(w, conn, slot, false);
+                    break;
+                case 1: // HEADERS
+                    if((slot = h2_find(conn, id))){
+                        size_t skip = (flags & 0x8 ? 1 : 0) + (flags & 0x20 ? 5 : 0);
+                        if(!slot->status && length > skip) slot->status = h2_status(payload + skip, length - skip);
+                        if(flags & 1) h2_stream_done(w, conn, slot, false);
+                    }
+                    break;
+                case 3: // RST_STREAM
+                    if((slot = h2_find(conn, id))) h2_stream_done(w, conn, slot, true);
+                    break;
+                case 4: // SETTINGS
+                    if(!(flags & 1)) h2_frame(conn, 4, 1, 0, NULL, 0);
+                    break;
+                case 6: // PING
+                    if(!(flags & 1) && length == 8) h2_frame(conn, 6, 1, 0, payload, 8);
+                    break;
+                case 7: { // GOAWAY: the streams after the last one weren't taken, they go again on the next connection
+                    uint32_t last = length >= 4 ? (payload[0] & 0x7f) << 24 | payload[1] << 16 | payload[2] << 8 | payload[3] : 0;
+                    conn->goaway = true;
+                    for(int i = 0; i < config.streams; i++){
+                        if(conn->slots[i].id > last){
+                            conn->slots[i].id = 0;
+                            conn->in_flight--;
+                        }
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+
+        }
+
+        memmove(conn->in, conn->in + offset, conn->in_length - offset);
+        conn->in_length -= offset;
+
+    }
+
+    if(conn->goaway && conn->in_flight == 0){
+        h2_reset(conn);
+        connection_reopen(w, epoll_fd, conn);
+        return;
+    }
+    if(conn->window_used >= H2_WINDOW_UPDATE_AFTER){
+        h2_window_update(conn, 0, conn->window_used);
+        conn->window_used = 0;
+    }
+    h2_flush(w, epoll_fd, conn);
+
+}
+
+static void connection_start_request(worker* w, int epoll_fd, connection* conn){
+
+    connection_reset(conn);
+
+    if(config.rate > 0){
+        conn->intended_ns = conn->next_ns; // the schedule, not the clock: late sends count as latency
+        conn->next_ns += (long long) (NS_PER_SEC * w->connections / w->rate);
+    }else{
+        conn->intended_ns = conn->state == CONN_CONNECTING ? conn->opened_ns : now_ns();
+    }
+
+    conn->path = (conn->path + 1) % config.num_paths;
+    connection_send(w, epoll_fd, conn);
+
+}
+
+static bool parse_head(connection* conn, size_t* body_bytes){
+
+    // looks for the end of the head, then takes the status code, Content-Length and Connection
+    char* end = memmem(conn->head, conn->head_length, "\r\n\r\n", 4);
+    if(!end) return false;
+
+    *end = '\0';
+    conn->head_done = true;
+    conn->status = strncmp(conn->head, "HTTP/1.", 7) == 0 ? atoi(conn->head + 9) : -1;
+    conn->body_remaining = 0;
+
+    for(char* line = strstr(conn->head, "\r\n"); line; line = strstr(line + 2, "\r\n")){
+        if(strncasecmp(line + 2, "Content-Length:", 15) == 0) conn->body_remaining = atoll(line + 17);
+        else if(strncasecmp(line + 2, "Connection: close", 17) == 0) conn->closing = true;
+    }
+
+    *body_bytes = conn->head_length - (end + 4 - conn->head);
+    return true;
+
+}
+
+static void connection_done(worker* w, int epoll_fd, connection* conn){
+
+    long long now = now_ns();
+
+    // only what completes inside the measured window counts
+    if(now >= start_ns && now < end_ns){
+        w->requests += 1;
+        if(conn->status < 200 || conn->status >= 400) w->non_2xx += 1;
+        histogram_record(&w->latency, now - conn->intended_ns);
+    }
+
+    if(!config.keep_alive || conn->closing){
+        connection_reset(conn);
+        connection_reopen(w, epoll_fd, conn);
+        return;
+    }
+
+    if(config.rate > 0 && conn->next_ns > now){
+        // too early for the next one: the loop wakes us up when it's due
+        conn->state = CONN_WAITING;
+        connection_watch(epoll_fd, conn, 0);
+        return;
+    }
+
+    connection_start_request(w, epoll_fd, conn);
+
+}
+
+static void connection_read(worker* w, int epoll_fd, connection* conn, char* buffer){
+
+    while(conn->state == CONN_READING){
+
+        ssize_t received;
+        if(!conn->head_done) received = recv(conn->fd, conn->head + conn->head_length, HEAD_SIZE - 1 - conn->head_length, 0);
+        else received = recv(conn->fd, buffer, READ_SIZE, 0);
+
+        if(received < 0 && errno == EAGAIN) return;
+
+        // the server closed (or broke) the connection in the middle of a response, or sent a head we can't hold
+        bool broken = received <= 0;
+        if(!broken && !conn->head_done){
+            size_t body_bytes;
+            conn->head_length += received;
+            if(parse_head(conn, &body_bytes)) conn->body_remaining -= body_bytes;
+            else broken = conn->head_length >= HEAD_SIZE - 1;
+        }else if(!broken){
+            conn->body_remaining -= received;
+        }
+
+        if(broken){
+            w->errors += now_ns() >= start_ns;
+            connection_reset(conn);
+            connection_reopen(w, epoll_fd, conn);
+            return;
+        }
+
+        w->bytes += now_ns() >= start_ns ? received : 0;
+        if(conn->head_done && conn->body_remaining <= 0) connection_done(w, epoll_fd, conn);
+
+    }
+
+}
+
+static void* worker_run(void* arg){
+
+    worker* w = (worker*) arg;
+    int epoll_fd = epoll_create1(0);
+    connection* connections = calloc(w->connections, sizeof(connection));
+    char* buffer = malloc(READ_SIZE);
+    struct epoll_event events[MAX_EVENTS];
+
+    if(epoll_fd < 0 || !connections || !buffer){
+        perror("can't start the worker!");
+        exit(-1);
+    }
+
+    // the open loop schedule is staggered, so the connections don't all fire at the same instant
+    long long first = now_ns();
+    for(int i = 0; i < w->connections; i++){
+        connections[i].path = (w->id + i) % config.num_paths;
+        if(w->rate > 0) connections[i].next_ns = first + (long long) (NS_PER_SEC * i / w->rate);
+        if(config.h2){
+            connections[i].slots = calloc(config.streams, sizeof(h2_slot));
+            connections[i].out_size = 1024 + (size_t) config.streams * (HEAD_SIZE + H2_FRAME_HEAD);
+            connections[i].out = malloc(connections[i].out_size);
+            connections[i].in = malloc(READ_SIZE + H2_FRAME_HEAD + H2_MAX_FRAME);
+            if(!connections[i].slots || !connections[i].out || !connections[i].in){
+                perror("can't start the worker!");
+                exit(-1);
+            }
+        }
+        connection_open(w, epoll_fd, &connections[i]);
+    }
+
+    while(true){
+
+        long long now = now_ns();
+        if(now >= end_ns) break;
+
+        // open loop: wake up for the earliest request that is due
+        long long wake = end_ns;
+        if(w->rate > 0){
+            for(int i = 0; i < w->connections; i++){
+                if(connections[i].state != CONN_WAITING) continue;
+                if(connections[i].next_ns <= now) connection_start_request(w, epoll_fd, &connections[i]);
+                else if(connections[i].next_ns < wake) wake = connections[i].next_ns;
+            }
+            now = now_ns();
+        }
+
+        long long wait = wake > now ? wake - now : 0;
+        struct timespec timeout = { .tv_sec = wait / NS_PER_SEC, .tv_nsec = wait % NS_PER_SEC };
+        int ready = epoll_pwait2(epoll_fd, events, MAX_EVENTS, &timeout, NULL);
+        if(ready < 0 && errno != EINTR){
+            perror("epoll_pwait2 error!");
+            exit(-1);
+        }
+
+        for(int i = 0; i < ready; i++){
+            connection* conn = (connection*) events[i].data.ptr;
+
+            if(config.h2 && conn->state != CONN_CONNECTING){
+                if(events[i].events & EPOLLIN) h2_read(w, epoll_fd, conn);
+                else h2_flush(w, epoll_fd, conn);
+            }else if(conn->state == CONN_CONNECTING){
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                if(error){
+                    w->errors += now_ns() >= start_ns;
+                    connection_reopen(w, epoll_fd, conn);
+                    continue;
+                }
+                // a fresh connection either starts right away or waits for its turn (open loop)
+                if(config.h2){
+                    h2_start(w, epoll_fd, conn);
+                }else if(w->rate > 0 && conn->next_ns > now_ns()){
+                    conn->state = CONN_WAITING;
+                    connection_watch(epoll_fd, conn, 0);
+                }else{
+                    connection_start_request(w, epoll_fd, conn);
+                }
+            }else if(conn->state == CONN_WRITING){
+                connection_send(w, epoll_fd, conn);
+            }else if(conn->state == CONN_READING){
+                connection_read(w, epoll_fd, conn, buffer);
+            }
+        }
+
+    }
+
+    for(int i = 0; i < w->connections; i++){
+        close(connections[i].fd);
+        free(connections[i].slots);
+        free(connections[i].out);
+        free(connections[i].in);
+    }
+    close(epoll_fd);
+    free(connections);
+    free(buffer);
+    return NULL;
+
+}
+
+static void resolve(){
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* result;
+    char port[16];
+
+    snprintf(port, sizeof(port), "%d", config.port);
+    int error = getaddrinfo(config.host, port, &hints, &result);
+    if(error){
+        fprintf(stderr, "can't resolve %s: %s\n", config.host, gai_strerror(error));
+        exit(-1);
+    }
+
+    memcpy(&address, result->ai_addr, result->ai_addrlen);
+    address_length = result->ai_addrlen;
+    freeaddrinfo(result);
+
+}
+
+static size_t h2_string(unsigned char* out, const char* text){
+
+    // a plain (not Huffman) string: its length with a 7-bit prefix, then the bytes
+    size_t length = strlen(text), written = 0;
+
+    if(length < 127){
+        out[written++] = length;
+    }else{
+        out[written++] = 127;
+        for(length -= 127; length >= 128; length >>= 7) out[written++] = (length & 0x7f) | 0x80;
+        out[written++] = length;
+    }
+    memcpy(out + written, text, strlen(text));
+    return written + strlen(text);
+
+}
+
+static void build_requests(){
+
+    // every request is built once, the workers only copy pointers
+    if(config.h2){
+        /*
+            a HEADERS frame (END_STREAM, END_HEADERS) without its stream id: ":method GET" and ":scheme http" from the static table,
+            ":path" and ":authority" as literals with indexed names (4 and 1), never added to the server's table.
+        */
+        char authority[300];
+        snprintf(authority, sizeof(authority), "%s:%d", config.host, config.port);
+        for(int i = 0; i < config.num_paths; i++){
+            unsigned char* frame = malloc(H2_FRAME_HEAD + strlen(config.paths[i]) + strlen(authority) + 32);
+            size_t length = 0;
+            unsigned char* block = frame + H2_FRAME_HEAD;
+            block[length++] = 0x82;
+            block[length++] = 0x86;
+            block[length++] = 0x04;
+            length += h2_string(block + length, config.paths[i]);
+            block[length++] = 0x01;
+            length += h2_string(block + length, authority);
+            unsigned char head[H2_FRAME_HEAD] = { length >> 16, length >> 8, length, 1, 0x5, 0, 0, 0, 0 };
+            memcpy(frame, head, H2_FRAME_HEAD);
+            requests[i] = (char*) frame;
+            request_lengths[i] = H2_FRAME_HEAD + length;
+        }
+        return;
+    }
+
+    for(int i = 0; i < config.num_paths; i++){
+        size_t size = strlen(config.paths[i]) + strlen(config.host) + 128;
+        requests[i] = malloc(size);
+        request_lengths[i] = snprintf(requests[i], size, "GET %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: %s\r\n\r\n",
+                                      config.paths[i], config.host, config.port, config.keep_alive ? "keep-alive" : "close");
+    }
+
+}
+
+static void usage(const char* program){
+
+    printf("usage: %s [options]\n"
+           "  -H, --host HOST          server address (127.0.0.1)\n"
+           "  -p, --port PORT          server port (8080)\n"
+           "  -P, --path PATH          requested path, repeat it to rotate between paths (/index.html)\n"
+           "  -c, --connections N      open connections (64)\n"
+           "  -T, --threads N          generator threads (1)\n"
+           "  -d, --duration SECONDS   measured time (10)\n"
+           "  -w, --warmup SECONDS     time before measuring (1)\n"
+           "  -R, --rate N             open loop: N requests per second in total (default: closed loop)\n"
+           "  -k, --no-keep-alive      a new connection for every request\n"
+           "  -2, --h2                 HTTP/2 with prior knowledge (closed loop)\n"
+           "  -m, --streams N          HTTP/2 requests in flight per connection (16)\n"
+           "  -o, --output FILE        write the latency distribution (.hgrm)\n"
+           "  -s, --summary FILE       append a TSV line with the results\n"
+           "  -l, --label NAME         name of the run in the summary line\n", program);
+
+}
+
+static void parse_arguments(int argc, char** argv){
+
+    static const struct option options[] = {
+        {"host", required_argument, NULL, 'H'},
+        {"port", required_argument, NULL, 'p'},
+        {"path", required_argument, NULL, 'P'},
+        {"connections", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 'T'},
+        {"duration", required_argument, NULL, 'd'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"rate", required_argument, NULL, 'R'},
+        {"no-keep-alive", no_argument, NULL, 'k'},
+        {"h2", no_argument, NULL, '2'},
+        {"streams", required_argument, NULL, 'm'},
+        {"output", required_argument, NULL, 'o'},
+        {"summary", required_argument, NULL, 's'},
+        {"label", required_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    snprintf(config.host, sizeof(config.host), "127.0.0.1");
+    config.port = 8080;
+    config.connections = 64;
+    config.threads = 1;
+    config.duration = 10;
+    config.warmup = 1;
+    config.keep_alive = true;
+    config.streams = 16;
+    config.label = "run";
+
+    int option;
+    while((option = getopt_long(argc, argv, "H:p:P:c:T:d:w:R:k2m:o:s:l:h", options, NULL)) != -1){
+        switch(option){
+            case 'H': snprintf(config.host, sizeof(config.host), "%s", optarg); break;
+            case 'p': config.port = atoi(optarg); break;
+            case 'P':
+                if(config.num_paths == MAX_PATHS){
+                    fprintf(stderr, "too many paths (max %d)\n", MAX_PATHS);
+                    exit(-1);
+                }
+                config.paths[config.num_paths++] = optarg;
+                break;
+            case 'c': config.connections = atoi(optarg); break;
+            case 'T': config.threads = atoi(optarg); break;
+            case 'd': config.duration = atof(optarg); break;
+            case 'w': config.warmup = atof(optarg); break;
+            case 'R': config.rate = atof(optarg); break;
+            case 'k': config.keep_alive = false; break;
+            case '2': config.h2 = true; break;
+            case 'm': config.streams = atoi(optarg); break;
+            case 'o': config.output = optarg; break;
+            case 's': config.summary = optarg; break;
+            case 'l': config.label = optarg; break;
+            case 'h': usage(argv[0]); exit(0);
+            default: usage(argv[0]); exit(-1);
+        }
+    }
+
+    if(config.num_paths == 0) config.paths[config.num_paths++] = "/index.html";
+    if(config.port <= 0 || config.port > 65535 || config.connections <= 0 || config.threads <= 0 || config.duration <= 0 || config.warmup < 0 || config.rate < 0){
+        fprintf(stderr, "invalid arguments, check %s --help\n", argv[0]);
+        exit(-1);
+    }
+    if(config.h2 && (config.rate > 0 || !config.keep_alive || config.streams <= 0)){
+        fprintf(stderr, "--h2 needs the closed loop, keep-alive and at least a stream\n");
+        exit(-1);
+    }
+    if(config.threads > config.connections) config.threads = config.connections;
+
+}
+
+static void write_summary(const histogram* latency, unsigned long long requests, unsigned long long errors, unsigned long long non_2xx, double rps, double mbps){
+
+    // one line per run, the header only if the file is new (so runs from different builds can be compared)
+    struct stat st;
+    bool fresh = stat(config.summary, &st) < 0 || st.st_size == 0;
+    FILE* out = fopen(config.summary, "a");
+    if(!out){
+        perror("can't open the summary file!");
+        exit(-1);
+    }
+
+    if(fresh) fprintf(out, "label\tmode\tconnections\trate\tkeep_alive\trequests\terrors\tnon_2xx\treq_per_sec\tmb_per_sec\tp50_ms\tp90_ms\tp99_ms\tp99.9_ms\tmax_ms\n");
+    fprintf(out, "%s\t%s\t%d\t%.0f\t%d\t%llu\t%llu\t%llu\t%.1f\t%.2f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n",
+            config.label, config.rate > 0 ? "open" : "closed", config.connections, config.rate, config.keep_alive,
+            requests, errors, non_2xx, rps, mbps,
+            histogram_percentile(latency, 50) / 1e6, histogram_percentile(latency, 90) / 1e6,
+            histogram_percentile(latency, 99) / 1e6, histogram_percentile(latency, 99.9) / 1e6, latency->max / 1e6);
+    fclose(out);
+
+}
+
+int main(int argc, char** argv){
+
+    parse_arguments(argc, argv);
+    resolve();
+    build_requests();
+
+    worker* workers = calloc(config.threads, sizeof(worker));
+    if(!workers){
+        perror("system is out of memory!");
+        exit(-1);
+    }
+
+    long long now = now_ns();
+    start_ns = now + (long long) (config.warmup * NS_PER_SEC);
+    end_ns = start_ns + (long long) (config.duration * NS_PER_SEC);
+
+    printf("loadgen: %s:%d %s%s, %d connections, %d threads, %s, %s, %gs (+%gs warmup)\n",
+           config.host, config.port, config.paths[0], config.num_paths > 1 ? " (and more)" : "", config.connections, config.threads,
+           config.rate > 0 ? "open loop" : "closed loop", config.keep_alive ? "keep-alive" : "no keep-alive", config.duration, config.warmup);
+    if(config.rate > 0) printf("loadgen: target rate %.0f req/s\n", config.rate);
+    if(config.h2) printf("loadgen: HTTP/2, %d streams per connection\n", config.streams);
+    fflush(stdout);
+
+    // the connections (and the rate) are split between the threads
+    for(int i = 0; i < config.threads; i++){
+        workers[i].id = i;
+        workers[i].connections = config.connections / config.threads + (i < config.connections % config.threads);
+        workers[i].rate = config.rate * workers[i].connections / config.connections;
+        histogram_init(&workers[i].latency);
+        if(pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0){
+            perror("can't create the worker thread!");
+            exit(-1);
+        }
+    }
+
+    histogram* latency = malloc(sizeof(histogram));
+    unsigned long long requests = 0, errors = 0, non_2xx = 0, bytes = 0;
+    histogram_init(latency);
+
+    for(int i = 0; i < config.threads; i++){
+        pthread_join(workers[i].thread, NULL);
+        histogram_merge(latency, &workers[i].latency);
+        requests += workers[i].requests;
+        errors += workers[i].errors;
+        non_2xx += workers[i].non_2xx;
+        bytes += workers[i].bytes;
+    }
+
+    double rps = requests / config.duration;
+    double mbps = bytes / config.duration / (1024 * 1024);
+
+    printf("requests      %llu (%llu errors, %llu non-2xx)\n", requests, errors, non_2xx);
+    printf("throughput    %.1f req/s, %.2f MB/s\n", rps, mbps);
+    printf("latency (ms)  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f  mean %.3f\n",
+           histogram_percentile(latency, 50) / 1e6, histogram_percentile(latency, 90) / 1e6, histogram_percentile(latency, 99) / 1e6,
+           histogram_percentile(latency, 99.9) / 1e6, latency->max / 1e6, histogram_mean(latency) / 1e6);
+
+    if(config.output){
+        FILE* out = fopen(config.output, "w");
+        if(!out){
+            perror("can't open the output file!");
+            exit(-1);
+        }
+        histogram_print_distribution(latency, out, 1e6);
+        fclose(out);
+    }
+    if(config.summary) write_summary(latency, requests, errors, non_2xx, rps, mbps);
+
+    return 0;
+
+}
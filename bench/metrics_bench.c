@@ -0,0 +1,54 @@
+/*
+    what the metrics cost a request: the calls a handler makes for a keep-alive request
+    (bytes received, bytes sent, the response's status, latency and histogram) plus a whole round
+    of the event loop, which is more than a request pays when the loop takes several of them at once.
+    check bench/metrics_overhead.sh, which compares this with the CPU a request takes in the server.
+
+    make metrics-bench
+*/
+#include "../lib/h/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RUN_TIME_NS 500000000LL
+
+static long long now_ns(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+}
+
+int main(void){
+
+    handler_metrics* metrics = aligned_alloc(LOAD_CACHE_LINE, sizeof(handler_metrics));
+    struct timespec round_start;
+    long long iterations = 0, batch = 10000, start = now_ns(), elapsed;
+
+    metrics_init(metrics);
+
+    do{
+        for(long long i = 0; i < batch; i++){
+            clock_gettime(CLOCK_MONOTONIC, &round_start); // the handler reads it anyway (check load_loop_start)
+            metrics_round_start(metrics, &round_start);
+            metrics_add(metrics, METRIC_BYTES_RECEIVED, 78);
+            unsigned long long started = metrics->round_ns;
+            metrics_add(metrics, METRIC_BYTES_SENT, 512);
+            metrics_response_done(metrics, i & 1023 ? 200 : 404, started);
+            metrics_round_done(metrics, 15000 + (i & 4095));
+        }
+        iterations += batch;
+        elapsed = now_ns() - start;
+    }while(elapsed < RUN_TIME_NS);
+
+    // the clock read of the round isn't the metrics' cost, it's measured on its own and taken away
+    long long clock_start = now_ns();
+    for(long long i = 0; i < iterations; i++) clock_gettime(CLOCK_MONOTONIC, &round_start);
+    long long clock_elapsed = now_ns() - clock_start;
+
+    printf("%.1f\n", (double) (elapsed - clock_elapsed) / iterations);
+    return metrics->counters[METRIC_REQUESTS] != (unsigned long) iterations;
+
+}
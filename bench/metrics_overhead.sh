@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# make metrics-bench: what the metrics cost.
+#
+# bin/metrics_bench times the metrics calls a request makes (plus a whole round of the event loop for every request,
+# which is more than it pays), then the server takes a closed loop load and the CPU time its threads spend per
+# request is read from their schedstat: the overhead is the first divided by the second, and it should stay
+# well under 1%.
+# the same load is also run against a build without the metrics (-DMETRICS_DISABLED), alternating the two builds,
+# to compare them end to end: the median of the rounds' differences is reported too, but when the generator shares
+# the cores with the server a single round swings by more than what is being measured, so it's only a sanity check.
+#
+# METRICS_BENCH_ROUNDS (5), METRICS_BENCH_DURATION (5), METRICS_BENCH_PORT (8089)
+# and METRICS_BENCH_SERVER_FLAGS (extra epolly flags) change the defaults.
+
+set -e
+cd "$(dirname "$0")/.."
+
+ROUNDS=${METRICS_BENCH_ROUNDS:-5}
+DURATION=${METRICS_BENCH_DURATION:-5}
+PORT=${METRICS_BENCH_PORT:-8089}
+SERVER_FLAGS=${METRICS_BENCH_SERVER_FLAGS:-}
+
+ROOT=$(mktemp -d)
+RESULTS=$(mktemp)
+cp www/index.html "$ROOT/index.html"
+trap 'rm -rf "$ROOT" "$RESULTS"' EXIT INT TERM
+
+run(){
+    build=$1
+    ./bin/$build -p "$PORT" -r "$ROOT" $SERVER_FLAGS > /dev/null 2>&1 &
+    server=$!
+    sleep 0.5
+    output=$(./bin/loadgen -p "$PORT" -c 64 -d "$DURATION" -w 0 -P /index.html)
+    cpu=$(cat /proc/$server/task/*/schedstat | awk '{ sum += $1 } END { print sum }')
+    kill $server
+    wait $server 2>/dev/null || true
+    requests=$(echo "$output" | awk '/^requests/ { print $2 }')
+    rps=$(echo "$output" | awk '/^throughput/ { print $2 }')
+    per_request=$(awk -v cpu="$cpu" -v requests="$requests" 'BEGIN { printf "%.1f", cpu / requests }')
+    echo "$round $build $per_request $rps" >> "$RESULTS"
+    echo "round $round: $build $rps req/s, $per_request ns of server CPU per request"
+}
+
+round=1
+while [ $round -le "$ROUNDS" ]; do
+    run epolly
+    run epolly-nometrics
+    round=$((round + 1))
+done
+
+median(){
+    sort -n | awk '{ values[NR] = $1 } END { print NR % 2 ? values[(NR + 1) / 2] : (values[NR / 2] + values[NR / 2 + 1]) / 2 }'
+}
+
+# every round pairs the two builds: their differences are less noisy than the two sets of numbers apart
+DIFFERENCE=$(awk '$2 == "epolly" { with[$1] = $3 } $2 == "epolly-nometrics" { without[$1] = $3 } END { for(r in with) print 100 * (with[r] - without[r]) / without[r] }' "$RESULTS" | median)
+WITH=$(awk '$2 == "epolly" { print $3 }' "$RESULTS" | median)
+COST=$(./bin/metrics_bench)
+
+awk -v cost="$COST" -v with="$WITH" -v difference="$DIFFERENCE" 'BEGIN {
+    printf "metrics: %.1f ns per request (microbenchmark) out of %.1f ns of server CPU per request: overhead %.2f%%\n", cost, with, 100 * cost / with
+    printf "metrics: end to end, %+.2f%% server CPU per request with the metrics (median of the rounds, noisy)\n", difference
+}'
@@ -0,0 +1,493 @@
+/*
+    microbenchmarks of the functions every request goes through, one at a time:
+    the parser and the path normalization (against a corpus of captured requests), the mime type lookup,
+    building responses (and serializing a cached file's head) for a range of body sizes and copying
+    received bytes into a connection. the old line-based parser's count_lines and bytes_to_lines
+    (bench/legacy_parser.c) are there too, as a reference.
+
+    for every function it reports:
+        - ns/op: the best of MICROBENCH_REPEATS runs of ~MICROBENCH_RUN_NS each
+        - allocs/op: malloc(), calloc() and realloc() calls
+        - copied/op: bytes moved by memcpy() and memmove()
+    the last two are counted by wrapping those functions at link time (-Wl,--wrap, check the Makefile), so they
+    only see the calls made by epolly's code, not the ones inside libc. small copies the compiler
+    turns into plain moves don't show up either.
+
+    the results can be saved as a baseline (-s) and compared with one (-b): a function is a regression
+    if it got slower than the threshold (-t, a percentage) or if it allocates or copies more than it did.
+    the exit status is 1 if there's any, so a script can stop on it.
+
+    make microbench-baseline   # before a change
+    make microbench            # after it
+*/
+#define _GNU_SOURCE
+#include "../lib/h/http_request.h"
+#include "../lib/h/http_response.h"
+#include "../lib/h/connection_context.h"
+#include "../lib/h/memory.h"
+#include "../lib/h/http_date.h"
+#include "../lib/h/load.h"
+#include "../lib/h/utils.h"
+#include "legacy_parser.h"
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MICROBENCH_RUN_NS 100000000LL
+#define MICROBENCH_REPEATS 3
+#define MICROBENCH_MAX 64
+#define MICROBENCH_BUFFER_SIZE 2048 // the default request-buffer
+
+/*
+    the counters, bumped by the wrappers below
+*/
+static unsigned long long allocations;
+static unsigned long long copied_bytes;
+
+extern void* __real_malloc(size_t size);
+extern void* __real_calloc(size_t count, size_t size);
+extern void* __real_realloc(void* pointer, size_t size);
+extern void* __real_memcpy(void* destination, const void* source, size_t size);
+extern void* __real_memmove(void* destination, const void* source, size_t size);
+
+void* __wrap_malloc(size_t size){
+
+    allocations++;
+    return __real_malloc(size);
+
+}
+
+void* __wrap_calloc(size_t count, size_t size){
+
+    allocations++;
+    return __real_calloc(count, size);
+
+}
+
+void* __wrap_realloc(void* pointer, size_t size){
+
+    allocations++;
+    return __real_realloc(pointer, size);
+
+}
+
+void* __wrap_memcpy(void* destination, const void* source, size_t size){
+
+    copied_bytes += size;
+    return __real_memcpy(destination, source, size);
+
+}
+
+void* __wrap_memmove(void* destination, const void* source, size_t size){
+
+    copied_bytes += size;
+    return __real_memmove(destination, source, size);
+
+}
+
+/*
+    requests as real clients sent them
+*/
+typedef struct {
+    const char* name;
+    const char* bytes;
+} capture;
+
+static const capture captures[] = {
+    {
+        "wrk",
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "\r\n"
+    },
+    {
+        "curl",
+        "GET /style.css HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "User-Agent: curl/7.88.1\r\n"
+        "Accept: */*\r\n"
+        "\r\n"
+    },
+    {
+        "chrome",
+        "GET /assets/img/logo.png?v=3 HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Dest: image\r\n"
+        "Referer: https://www.example.com/index.html\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: en-US,en;q=0.9,it;q=0.8\r\n"
+        "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; _ga=GA1.2.1234567890.1234567890\r\n"
+        "\r\n"
+    },
+    {
+        "firefox-revalidate",
+        "GET /js/app.min.js HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+        "Accept: */*\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Referer: https://www.example.com/\r\n"
+        "Connection: keep-alive\r\n"
+        "If-Modified-Since: Tue, 10 Oct 2023 10:00:00 GMT\r\n"
+        "If-None-Match: \"5f2b-1a2b3c-652520a0\"\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "\r\n"
+    },
+    {
+        "video-range",
+        "GET /media/intro%20video.mp4 HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: VLC/3.0.18 LibVLC/3.0.18\r\n"
+        "Accept: */*\r\n"
+        "Range: bytes=1048576-\r\n"
+        "If-Range: \"5f2b-1a2b3c-652520a0\"\r\n"
+        "Icy-MetaData: 1\r\n"
+        "\r\n"
+    },
+    {
+        "encoded-path",
+        "GET /docs/./guide/../api%2Fv1/read%20me.txt?lang=en#top HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "User-Agent: python-requests/2.31.0\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Accept: */*\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"
+    }
+};
+
+#define CAPTURES (int) (sizeof(captures) / sizeof(captures[0]))
+
+static const char* const filenames[] = { "www/index.html", "www/css/site.css", "www/js/app.min.js", "www/img/photo.jpeg", "www/LICENSE" };
+static const size_t body_sizes[] = { 16, 1024, 16384, 262144 };
+static const size_t receive_sizes[] = { 78, 512, 2048, 8192 }; // the last one outgrows the slab buffer
+
+#define FILENAMES (int) (sizeof(filenames) / sizeof(filenames[0]))
+#define BODY_SIZES (int) (sizeof(body_sizes) / sizeof(body_sizes[0]))
+#define RECEIVE_SIZES (int) (sizeof(receive_sizes) / sizeof(receive_sizes[0]))
+
+/*
+    what a response needs around it: a handler's memory, Date and load, and a connection
+*/
+static handler_memory memory;
+static http_date date;
+static handler_load load;
+static connection_context* context;
+static char* bodies[BODY_SIZES];
+static char received[8192];
+
+static volatile long sink; // keeps the compiler from optimizing the calls away
+
+typedef struct {
+    char name[64];
+    void (*run)(int input);
+    int input;
+    double ns;
+    double allocations;
+    double copied_bytes;
+} microbench;
+
+static microbench benches[MICROBENCH_MAX];
+static int bench_count;
+static const char* filter; // only the functions whose name contains it
+
+static void run_parse(int input){
+
+    http_request req;
+    http_request_init(&req);
+    sink += http_request_parse(&req, captures[input].bytes, strlen(captures[input].bytes)) + req.headers_num;
+
+}
+
+static void run_filename(int input){
+
+    // the parse is part of it: the path is a view into the request
+    http_request req;
+    char filename[PATH_MAX];
+    http_request_init(&req);
+    http_request_parse(&req, captures[input].bytes, strlen(captures[input].bytes));
+    sink += http_request_filename(&req, "www", 3, filename, sizeof(filename));
+
+}
+
+static void run_count_lines(int input){
+
+    sink += legacy_count_lines((char*) captures[input].bytes, strlen(captures[input].bytes));
+
+}
+
+static void run_bytes_to_lines(int input){
+
+    char* bytes = (char*) captures[input].bytes;
+    size_t length = strlen(bytes);
+    int lines_num = legacy_count_lines(bytes, length);
+    char** lines = legacy_bytes_to_lines(bytes, length, lines_num);
+
+    for(int i = 0; lines && i < lines_num; i++) free(lines[i]);
+    free(lines);
+    sink += lines_num;
+
+}
+
+static void run_mimetype(int input){
+
+    sink += (long) filename_to_mimetype_header((char*) filenames[input]);
+
+}
+
+static void run_response_create(int input){
+
+    http_response* res = http_response_create(200, "Content-Type: application/octet-stream\r\n", bodies[input], body_sizes[input], context, true);
+    sink += res->iov_count;
+    http_response_destroy(res);
+
+}
+
+static void run_response_file(int input){
+
+    // the body stays in the file: no fd is needed to build the head
+    http_response* res = http_response_create_file(200, "Content-Type: application/octet-stream\r\n", -1, body_sizes[input], context, true);
+    sink += res->iov_count;
+    http_response_destroy(res);
+
+}
+
+static void run_serialize_head(int input){
+
+    int head_length;
+    char* head = http_response_serialize_head(200, "Content-Type: text/html\r\nETag: \"5f2b-1a2b3c-652520a0\"\r\n", body_sizes[input], &head_length);
+    sink += head_length;
+    free(head);
+
+}
+
+static void run_write_to_context(int input){
+
+    // a request arriving in recv()-sized pieces, then consumed
+    size_t size = receive_sizes[input];
+    for(size_t written = 0; written < size; written += MICROBENCH_BUFFER_SIZE / 2){
+        size_t piece = size - written < MICROBENCH_BUFFER_SIZE / 2 ? size - written : MICROBENCH_BUFFER_SIZE / 2;
+        write_to_context(context, received, piece);
+    }
+    context_consume(context, context->length);
+    sink += context->allocations;
+
+}
+
+static void add(const char* name, const char* label, void (*run)(int), int input){
+
+    microbench* bench = &benches[bench_count];
+    if(bench_count == MICROBENCH_MAX) return;
+    snprintf(bench->name, sizeof(bench->name), "%s/%s", name, label);
+    if(filter && !strstr(bench->name, filter)) return;
+    bench_count++;
+    bench->run = run;
+    bench->input = input;
+
+}
+
+static long long now_ns(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+}
+
+static void measure(microbench* bench){
+
+    /*
+        the counters are read over the first run only: they are the same every time.
+        the time is the best run's, the others were interrupted by something else
+    */
+    bench->ns = 0;
+
+    for(int r = 0; r < MICROBENCH_REPEATS; r++){
+
+        long long iterations = 0, batch = 100, start, elapsed;
+        unsigned long long allocations_before = allocations, copied_before = copied_bytes;
+
+        start = now_ns();
+        do{
+            for(long long i = 0; i < batch; i++) bench->run(bench->input);
+            iterations += batch;
+            elapsed = now_ns() - start;
+        }while(elapsed < MICROBENCH_RUN_NS);
+
+        double ns = (double) elapsed / iterations;
+        if(r == 0){
+            bench->allocations = (double) (allocations - allocations_before) / iterations;
+            bench->copied_bytes = (double) (copied_bytes - copied_before) / iterations;
+        }
+        if(r == 0 || ns < bench->ns) bench->ns = ns;
+
+    }
+
+}
+
+static void setup(void){
+
+    char label[32];
+
+    handler_memory_init(&memory, sizeof(connection_context), sizeof(http_response), MICROBENCH_BUFFER_SIZE);
+    http_date_init(&date);
+    load_init(&load);
+    context = slab_alloc(&memory.connections);
+    context_init(context, &memory, &date, &load, MICROBENCH_BUFFER_SIZE);
+    memset(received, 'x', sizeof(received));
+
+    for(int i = 0; i < BODY_SIZES; i++){
+        bodies[i] = malloc(body_sizes[i] + 1);
+        memset(bodies[i], 'x', body_sizes[i]);
+        bodies[i][body_sizes[i]] = '\0';
+    }
+
+    for(int i = 0; i < CAPTURES; i++) add("parse", captures[i].name, run_parse, i);
+    for(int i = 0; i < CAPTURES; i++) add("parse+filename", captures[i].name, run_filename, i);
+    for(int i = 0; i < CAPTURES; i++) add("legacy-count-lines", captures[i].name, run_count_lines, i);
+    for(int i = 0; i < CAPTURES; i++) add("legacy-bytes-to-lines", captures[i].name, run_bytes_to_lines, i);
+    for(int i = 0; i < FILENAMES; i++) add("mimetype", strrchr(filenames[i], '/') + 1, run_mimetype, i);
+    for(int i = 0; i < BODY_SIZES; i++){
+        snprintf(label, sizeof(label), "%zuB", body_sizes[i]);
+        add("response-create", label, run_response_create, i);
+        add("response-file", label, run_response_file, i);
+        add("serialize-head", label, run_serialize_head, i);
+    }
+    for(int i = 0; i < RECEIVE_SIZES; i++){
+        snprintf(label, sizeof(label), "%zuB", receive_sizes[i]);
+        add("write-to-context", label, run_write_to_context, i);
+    }
+
+}
+
+static bool save(const char* path){
+
+    FILE* out = fopen(path, "w");
+    if(!out){
+        perror(path);
+        return false;
+    }
+
+    fprintf(out, "name\tns_op\tallocs_op\tcopied_op\n");
+    for(int i = 0; i < bench_count; i++){
+        fprintf(out, "%s\t%.2f\t%.2f\t%.2f\n", benches[i].name, benches[i].ns, benches[i].allocations, benches[i].copied_bytes);
+    }
+
+    fclose(out);
+    return true;
+
+}
+
+static int compare(const char* path, double threshold){
+
+    /*
+        every function against its line in the baseline (functions that aren't there are new, and never a regression).
+        returns the regressions' count, -1 if there's no baseline
+    */
+
+    FILE* in = fopen(path, "r");
+    char line[256];
+    int regressions = 0;
+
+    if(!in) return -1;
+
+    printf("\ncompared with %s (threshold %.1f%%)\n", path, threshold);
+    printf("%-40s %10s %10s %10s\n", "function", "ns/op", "allocs/op", "copied/op");
+
+    while(fgets(line, sizeof(line), in)){
+
+        char name[64];
+        double ns, allocs, copied;
+        if(sscanf(line, "%63s %lf %lf %lf", name, &ns, &allocs, &copied) != 4) continue; // the header
+
+        for(int i = 0; i < bench_count; i++){
+
+            microbench* bench = &benches[i];
+            if(strcmp(bench->name, name) != 0) continue;
+
+            double delta = ns > 0 ? 100 * (bench->ns - ns) / ns : 0;
+            bool slower = delta > threshold;
+            bool more_allocations = bench->allocations > allocs + 0.01;
+            bool more_copies = bench->copied_bytes > copied + 0.5;
+
+            printf("%-40s %+9.1f%% %+10.2f %+10.1f%s\n", name, delta, bench->allocations - allocs, bench->copied_bytes - copied,
+                   slower || more_allocations || more_copies ? "  REGRESSION" : "");
+            regressions += slower || more_allocations || more_copies;
+
+        }
+
+    }
+
+    fclose(in);
+    return regressions;
+
+}
+
+static void usage(const char* program){
+
+    printf("usage: %s [options]\n"
+           "  -b, --baseline <file>   compare with a saved run\n"
+           "  -s, --save <file>       save this run (as the next baseline)\n"
+           "  -t, --threshold <pct>   how much slower a function can get before it's a regression (10)\n"
+           "  -f, --filter <text>     only the functions whose name contains it\n"
+           "  -h, --help              this message\n", program);
+
+}
+
+int main(int argc, char** argv){
+
+    static const struct option options[] = {
+        { "baseline", required_argument, NULL, 'b' },
+        { "save", required_argument, NULL, 's' },
+        { "threshold", required_argument, NULL, 't' },
+        { "filter", required_argument, NULL, 'f' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char* baseline = NULL;
+    const char* save_path = NULL;
+    double threshold = 10;
+    int option;
+
+    while((option = getopt_long(argc, argv, "b:s:t:f:h", options, NULL)) != -1){
+        switch(option){
+            case 'b': baseline = optarg; break;
+            case 's': save_path = optarg; break;
+            case 't': threshold = atof(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'h': usage(argv[0]); exit(0);
+            default: usage(argv[0]); exit(-1);
+        }
+    }
+
+    setup();
+
+    printf("%-40s %10s %10s %10s\n", "function", "ns/op", "allocs/op", "copied/op");
+    for(int i = 0; i < bench_count; i++){
+        measure(&benches[i]);
+        printf("%-40s %10.1f %10.2f %10.1f\n", benches[i].name, benches[i].ns, benches[i].allocations, benches[i].copied_bytes);
+    }
+
+    int regressions = 0;
+    if(baseline){
+        regressions = compare(baseline, threshold);
+        if(regressions < 0) printf("\nno baseline in %s yet (make microbench-baseline saves one)\n", baseline);
+        else printf("\n%d regression(s)\n", regressions);
+    }
+    if(save_path && save(save_path)) printf("\nsaved in %s\n", save_path);
+
+    return regressions > 0 ? 1 : 0;
+
+}
@@ -0,0 +1,150 @@
+/*
+    parser microbenchmark: the old line-based parser (bench/legacy_parser.c) against the in-place one
+    (lib/http_request.c) with every SIMD flavour the CPU supports.
+    the in-place parser is also fed in small chunks, as it happens when a request takes many recv() calls.
+
+    make parser-bench
+*/
+#include "../lib/h/http_request.h"
+#include "legacy_parser.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define RUN_TIME_NS 300000000LL // every measurement runs for ~0.3s
+#define CHUNK_SIZE 64 // bytes per "recv" in the incremental runs
+
+typedef struct {
+    const char* name;
+    const char* bytes;
+} corpus_request;
+
+static corpus_request corpus[] = {
+    {
+        "minimal",
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "\r\n"
+    },
+    {
+        "curl",
+        "GET /style.css HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "User-Agent: curl/7.88.1\r\n"
+        "Accept: */*\r\n"
+        "\r\n"
+    },
+    {
+        "browser",
+        "GET /assets/img/logo.png?v=3 HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Dest: image\r\n"
+        "Referer: https://www.example.com/index.html\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: en-US,en;q=0.9,it;q=0.8\r\n"
+        "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; _ga=GA1.2.1234567890.1234567890\r\n"
+        "If-None-Match: \"5f2b-1a2b3c\"\r\n"
+        "If-Modified-Since: Tue, 10 Oct 2023 10:00:00 GMT\r\n"
+        "\r\n"
+    }
+};
+
+static volatile long sink; // keeps the compiler from optimizing the parsing away
+
+static long long now_ns(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+}
+
+static void run_legacy(const char* bytes, size_t length){
+
+    legacy_http_request req;
+    legacy_http_request_create(&req, (char*) bytes, length);
+    sink += req.lines_num + req.keep_alive;
+    legacy_http_request_free(&req);
+
+}
+
+static void run_in_place(const char* bytes, size_t length){
+
+    http_request req;
+    http_request_init(&req);
+    sink += http_request_parse(&req, bytes, length) + req.headers_num;
+
+}
+
+static void run_incremental(const char* bytes, size_t length){
+
+    http_request req;
+    int result = HTTP_PARSE_INCOMPLETE;
+    http_request_init(&req);
+    for(size_t received = CHUNK_SIZE; result == HTTP_PARSE_INCOMPLETE; received += CHUNK_SIZE){
+        result = http_request_parse(&req, bytes, received < length ? received : length);
+    }
+    sink += result + req.headers_num;
+
+}
+
+static double measure(void (*run)(const char*, size_t), const char* bytes, size_t length){
+
+    long long iterations = 0, batch = 1000, start = now_ns(), elapsed;
+
+    do{
+        for(long long i = 0; i < batch; i++) run(bytes, length);
+        iterations += batch;
+        elapsed = now_ns() - start;
+    }while(elapsed < RUN_TIME_NS);
+
+    return (double) elapsed / iterations;
+
+}
+
+int main(void){
+
+    struct { http_simd_level level; const char* name; } levels[] = {
+        { HTTP_SIMD_SCALAR, "scalar" },
+        { HTTP_SIMD_SSE42, "sse4.2" },
+        { HTTP_SIMD_AVX2, "avx2" }
+    };
+
+    printf("%-10s %-26s %12s %10s\n", "request", "parser", "ns/op", "speedup");
+
+    for(size_t r = 0; r < sizeof(corpus) / sizeof(corpus[0]); r++){
+
+        const char* bytes = corpus[r].bytes;
+        size_t length = strlen(bytes);
+        double legacy = measure(run_legacy, bytes, length);
+
+        printf("%-10s %-26s %12.1f %9.1fx\n", corpus[r].name, "legacy (lines + strtok)", legacy, 1.0);
+
+        for(size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++){
+
+            char label[64];
+            if(!http_request_use_simd(levels[l].level)) continue;
+
+            double in_place = measure(run_in_place, bytes, length);
+            snprintf(label, sizeof(label), "in-place %s", levels[l].name);
+            printf("%-10s %-26s %12.1f %9.1fx\n", corpus[r].name, label, in_place, legacy / in_place);
+
+            double incremental = measure(run_incremental, bytes, length);
+            snprintf(label, sizeof(label), "in-place %s, %dB chunks", levels[l].name, CHUNK_SIZE);
+            printf("%-10s %-26s %12.1f %9.1fx\n", corpus[r].name, label, incremental, legacy / incremental);
+
+        }
+
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# make bench: the same scenarios, with the same files and the same server flags, every time,
+# so a run before a change and a run after it can be compared number by number.
+#
+# every run goes to bench/results/<date>-<commit>/ (one .hgrm latency distribution per scenario and summary.tsv),
+# the summary is appended to bench/results/history.tsv and compared with the previous run at the end.
+#
+# BENCH_DURATION (10), BENCH_WARMUP (2), BENCH_PORT (8089), BENCH_RATE (10000, the open loop scenario)
+# and BENCH_SERVER_FLAGS (extra epolly flags, e.g. "-e uring") change the defaults.
+
+set -e
+cd "$(dirname "$0")/.."
+
+DURATION=${BENCH_DURATION:-10}
+WARMUP=${BENCH_WARMUP:-2}
+PORT=${BENCH_PORT:-8089}
+RATE=${BENCH_RATE:-10000}
+SERVER_FLAGS=${BENCH_SERVER_FLAGS:-}
+
+REVISION=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+if ! git diff --quiet HEAD -- lib main.c 2>/dev/null; then REVISION="$REVISION+dirty"; fi
+RUN="$(date +%Y%m%d-%H%M%S)-$REVISION"
+RESULTS=bench/results
+OUT="$RESULTS/$RUN"
+mkdir -p "$OUT"
+
+# the files are generated, so every machine serves exactly the same bytes
+ROOT=$(mktemp -d)
+cp www/index.html "$ROOT/index.html"
+head -c 1024 /dev/urandom > "$ROOT/1k.bin"
+head -c 16384 /dev/urandom > "$ROOT/16k.bin"
+head -c 262144 /dev/urandom > "$ROOT/256k.bin"
+head -c 1048576 /dev/urandom > "$ROOT/1m.bin"
+
+./bin/epolly -p "$PORT" -r "$ROOT" $SERVER_FLAGS > "$OUT/server.log" 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; rm -rf "$ROOT"' EXIT INT TERM
+sleep 0.5
+if ! kill -0 $SERVER 2>/dev/null; then
+    echo "bench: the server didn't start, check $OUT/server.log"
+    exit 1
+fi
+
+scenario(){
+    label=$1
+    shift
+    echo
+    echo "== $label"
+    ./bin/loadgen -p "$PORT" -d "$DURATION" -w "$WARMUP" -l "$label" -o "$OUT/$label.hgrm" -s "$OUT/summary.tsv" "$@"
+}
+
+scenario small-keep-alive -c 64 -P /index.html
+scenario small-close -c 32 -k -P /index.html
+scenario small-open-loop -c 64 -R "$RATE" -P /index.html
+scenario mixed-sizes -c 32 -P /1k.bin -P /16k.bin -P /256k.bin -P /index.html
+scenario large -c 8 -P /1m.bin
+
+# the history keeps every run, the previous run of a scenario is the last line with its label
+PREVIOUS=""
+if [ -f "$RESULTS/history.tsv" ]; then PREVIOUS=$(tail -n 1 "$RESULTS/history.tsv" | cut -f 1); fi
+if [ ! -f "$RESULTS/history.tsv" ]; then
+    head -n 1 "$OUT/summary.tsv" | sed 's/^/run\t/' > "$RESULTS/history.tsv"
+fi
+tail -n +2 "$OUT/summary.tsv" | sed "s/^/$RUN\t/" >> "$RESULTS/history.tsv"
+
+echo
+echo "bench: results in $OUT"
+if [ -z "$PREVIOUS" ] || [ "$PREVIOUS" = "run" ]; then
+    echo "bench: no previous run to compare with"
+    exit 0
+fi
+
+echo "bench: compared with $PREVIOUS"
+awk -F '\t' -v previous="$PREVIOUS" -v current="$RUN" '
+    $1 == previous { rps[$2] = $10; p99[$2] = $14 }
+    $1 == current {
+        if(!($2 in rps)){ printf "%-18s %10.1f req/s  p99 %8.3f ms  (new)\n", $2, $10, $14; next }
+        drps = rps[$2] > 0 ? 100 * ($10 - rps[$2]) / rps[$2] : 0
+        dp99 = p99[$2] > 0 ? 100 * ($14 - p99[$2]) / p99[$2] : 0
+        printf "%-18s %10.1f req/s (%+6.1f%%)  p99 %8.3f ms (%+6.1f%%)\n", $2, $10, drps, $14, dp99
+    }' "$RESULTS/history.tsv"
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# make socket-bench: what every socket option (check h/socket_options.h) does to the connection rate and the latency.
+#
+# the server is started once per profile (the defaults, then the defaults with one option changed) and takes:
+#   - connect: a new connection for every request, so the accept path is most of the work (connection rate).
+#   - keep-alive: small requests on open connections at a fixed rate, so the latency isn't hidden by a queue.
+# every profile is compared with the defaults. on loopback the buffers and busy polling change little
+# (there's no NIC queue to poll), their numbers only mean something between two machines.
+# bin/loadgen doesn't send TFO cookies, so fast-open is only there to show it costs nothing
+# to the clients that don't use it.
+#
+# SOCKET_BENCH_DURATION (5), SOCKET_BENCH_PORT (8089), SOCKET_BENCH_RATE (10000)
+# and SOCKET_BENCH_SERVER_FLAGS (extra epolly flags, e.g. "-e uring") change the defaults.
+
+set -e
+cd "$(dirname "$0")/.."
+
+DURATION=${SOCKET_BENCH_DURATION:-5}
+PORT=${SOCKET_BENCH_PORT:-8089}
+RATE=${SOCKET_BENCH_RATE:-10000}
+SERVER_FLAGS=${SOCKET_BENCH_SERVER_FLAGS:-}
+
+ROOT=$(mktemp -d)
+RESULTS=$(mktemp)
+cp www/index.html "$ROOT/index.html"
+trap 'rm -rf "$ROOT" "$RESULTS"' EXIT INT TERM
+
+run(){
+    profile=$1
+    shift
+    ./bin/epolly -p "$PORT" -r "$ROOT" $SERVER_FLAGS "$@" > /dev/null 2>&1 &
+    server=$!
+    sleep 0.5
+    if ! kill -0 $server 2>/dev/null; then
+        echo "socket-bench: the server didn't start with $*"
+        exit 1
+    fi
+    connect=$(./bin/loadgen -p "$PORT" -c 32 -d "$DURATION" -w 1 -k -P /index.html)
+    keep_alive=$(./bin/loadgen -p "$PORT" -c 64 -d "$DURATION" -w 1 -R "$RATE" -P /index.html)
+    kill $server
+    wait $server 2>/dev/null || true
+    echo "$profile $(echo "$connect" | awk '/^throughput/ { print $2 } /^latency/ { print $8 }' | tr '\n' ' ')$(echo "$keep_alive" | awk '/^latency/ { print $4, $8 }')" >> "$RESULTS"
+}
+
+run defaults
+run no-nodelay --tcp-nodelay off
+run defer-accept --defer-accept 5
+run fast-open --fast-open 256
+run buffers --send-buffer 64k --receive-buffer 64k
+run busy-poll --busy-poll 50 --prefer-busy-poll on
+run ipv6 --ipv6 on
+
+# columns: profile, connect req/s, connect p99, keep-alive p50, keep-alive p99
+awk '
+    NR == 1 { rps = $2; p99 = $3; kp50 = $4; kp99 = $5 }
+    {
+        printf "%-13s connect %9.1f req/s (%+6.1f%%) p99 %7.3f ms (%+6.1f%%)   keep-alive p50 %7.3f ms (%+6.1f%%) p99 %7.3f ms (%+6.1f%%)\n",
+            $1, $2, 100 * ($2 - rps) / rps, $3, 100 * ($3 - p99) / p99, $4, 100 * ($4 - kp50) / kp50, $5, 100 * ($5 - kp99) / kp99
+    }' "$RESULTS"
@@ -0,0 +1,240 @@
+/*
+    a tiny app server to put behind the proxy (check lib/h/proxy.h): a thread per connection, blocking sockets,
+    keep-alive unless the client (or the route) says otherwise. it listens on a TCP port or on a Unix socket.
+
+        /health         200, for the health checks
+        /bytes/<n>      n bytes with a Content-Length (these match anywhere in the path: /api/bytes/10 too)
+        /chunked/<n>    n bytes in chunks of (at most) 4KB
+        /close/<n>      n bytes delimited by closing the connection (no Content-Length)
+        /sleep/<ms>     a small response, ms milliseconds late
+        /status/<code>  an empty response with that status
+        anything else   the request echoed back (method, target, headers and body)
+
+    make upstream
+    ./bin/upstream 9000
+    ./bin/upstream unix:/tmp/app.sock
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REQUEST_SIZE 65536
+#define CHUNK_SIZE 4096
+
+static char filler[CHUNK_SIZE];
+
+static bool send_all(int fd, const char* data, size_t length){
+
+    while(length > 0){
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if(sent <= 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+
+}
+
+static bool send_filler(int fd, long length){
+
+    while(length > 0){
+        size_t piece = length < CHUNK_SIZE ? (size_t) length : CHUNK_SIZE;
+        if(!send_all(fd, filler, piece)) return false;
+        length -= piece;
+    }
+    return true;
+
+}
+
+static long header_number(const char* head, const char* name){
+
+    // the value of a numeric header (-1 if there's none)
+    size_t length = strlen(name);
+    for(const char* line = strstr(head, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n")){
+        if(strncasecmp(line + 2, name, length) == 0 && line[2 + length] == ':') return atol(line + 3 + length);
+    }
+    return -1;
+
+}
+
+static bool wants_close(const char* head){
+
+    const char* line = strcasestr(head, "\r\nConnection:");
+    return line && strncasecmp(line + 13 + strspn(line + 13, " "), "close", 5) == 0;
+
+}
+
+static bool route(const char* target, const char* name, long* n){
+
+    // "/bytes/<n>" anywhere in the target: the proxy forwards it with the route's prefix
+    const char* found = strstr(target, name);
+    return found && sscanf(found + strlen(name), "%ld", n) == 1;
+
+}
+
+static bool respond(int fd, char* request, size_t head_length, size_t body_length){
+
+    /*
+        one response, false if the connection must be closed after it
+    */
+
+    char method[16], target[1024], head[512];
+    long n;
+    bool keep_alive = !wants_close(request);
+    const char* connection = keep_alive ? "keep-alive" : "close";
+
+    if(sscanf(request, "%15s %1023s", method, target) != 2) return false;
+    bool head_only = strcmp(method, "HEAD") == 0;
+
+    if(strstr(target, "/health")){
+        int length = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: %s\r\n\r\nok", connection);
+        return send_all(fd, head, length) && keep_alive;
+    }
+
+    if(route(target, "/bytes/", &n)){
+        int length = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %ld\r\nConnection: %s\r\n\r\n", n, connection);
+        return send_all(fd, head, length) && (head_only || send_filler(fd, n)) && keep_alive;
+    }
+
+    if(route(target, "/chunked/", &n)){
+        int length = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\nConnection: %s\r\n\r\n", connection);
+        if(!send_all(fd, head, length)) return false;
+        if(head_only) return keep_alive;
+        while(n > 0){
+            long piece = n < CHUNK_SIZE ? n : CHUNK_SIZE;
+            char size_line[32];
+            length = snprintf(size_line, sizeof(size_line), "%lx\r\n", piece);
+            if(!send_all(fd, size_line, length) || !send_filler(fd, piece) || !send_all(fd, "\r\n", 2)) return false;
+            n -= piece;
+        }
+        return send_all(fd, "0\r\nX-Trailer: done\r\n\r\n", 22) && keep_alive;
+    }
+
+    if(route(target, "/close/", &n)){
+        int length = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nConnection: close\r\n\r\n");
+        if(send_all(fd, head, length) && !head_only) send_filler(fd, n);
+        return false;
+    }
+
+    if(route(target, "/sleep/", &n)){
+        struct timespec delay = { n / 1000, (n % 1000) * 1000000L };
+        nanosleep(&delay, NULL);
+        int length = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nConnection: %s\r\n\r\nslept", connection);
+        return send_all(fd, head, length) && keep_alive;
+    }
+
+    if(route(target, "/status/", &n)){
+        int length = snprintf(head, sizeof(head), "HTTP/1.1 %ld Whatever\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n", n, connection);
+        return send_all(fd, head, length) && keep_alive;
+    }
+
+    int length = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+                          head_length + body_length, connection);
+    return send_all(fd, head, length) && (head_only || send_all(fd, request, head_length + body_length)) && keep_alive;
+
+}
+
+static void* serve(void* arg){
+
+    int fd = (int) (long) arg;
+    char* request = malloc(REQUEST_SIZE + 1);
+    size_t length = 0;
+
+    while(true){
+
+        char* head_end;
+        request[length] = '\0';
+        while(!(head_end = strstr(request, "\r\n\r\n"))){
+            if(length == REQUEST_SIZE) goto done;
+            ssize_t received = recv(fd, request + length, REQUEST_SIZE - length, 0);
+            if(received <= 0) goto done;
+            length += received;
+            request[length] = '\0';
+        }
+
+        size_t head_length = head_end + 4 - request;
+        long body_length = header_number(request, "Content-Length");
+        if(body_length < 0) body_length = 0;
+        if(head_length + body_length > REQUEST_SIZE) goto done;
+        while(length < head_length + body_length){
+            ssize_t received = recv(fd, request + length, REQUEST_SIZE - length, 0);
+            if(received <= 0) goto done;
+            length += received;
+        }
+
+        if(!respond(fd, request, head_length, body_length)) break;
+
+        // a pipelined request may be behind this one
+        size_t used = head_length + body_length;
+        memmove(request, request + used, length - used);
+        length -= used;
+
+    }
+
+done:
+    close(fd);
+    free(request);
+    return NULL;
+
+}
+
+int main(int argc, char** argv){
+
+    struct sockaddr_storage address = { 0 };
+    socklen_t address_length;
+    int one = 1;
+
+    if(argc != 2){
+        fprintf(stderr, "usage: %s <port> | unix:<path>\n", argv[0]);
+        return 1;
+    }
+
+    memset(filler, 'x', sizeof(filler));
+    signal(SIGPIPE, SIG_IGN);
+
+    if(strncmp(argv[1], "unix:", 5) == 0){
+        struct sockaddr_un* un = (struct sockaddr_un*) &address;
+        un->sun_family = AF_UNIX;
+        snprintf(un->sun_path, sizeof(un->sun_path), "%s", argv[1] + 5);
+        unlink(un->sun_path);
+        address_length = sizeof(struct sockaddr_un);
+    }else{
+        struct sockaddr_in* in = (struct sockaddr_in*) &address;
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        in->sin_port = htons(atoi(argv[1]));
+        address_length = sizeof(struct sockaddr_in);
+    }
+
+    int listen_fd = socket(address.ss_family, SOCK_STREAM, 0);
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &address, address_length) < 0 || listen(listen_fd, 1024) < 0){
+        perror("upstream");
+        return 1;
+    }
+
+    while(true){
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0) continue;
+        if(address.ss_family == AF_INET) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_t thread;
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        if(pthread_create(&thread, &attributes, serve, (void*) (long) fd) != 0) close(fd);
+        pthread_attr_destroy(&attributes);
+    }
+
+}
@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include "h/access_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+_Static_assert(sizeof(access_log_header) == ACCESS_LOG_SLOT, "a header takes a slot");
+_Static_assert(sizeof(access_log_record) == ACCESS_LOG_SLOT, "a record takes a slot");
+_Static_assert(sizeof(access_log_path_record) == ACCESS_LOG_SLOT, "a path record takes a slot");
+_Static_assert(sizeof(access_log_dropped) == ACCESS_LOG_SLOT, "a dropped record takes a slot");
+
+static void* access_log_flush_loop(void* l);
+
+static long long access_log_clock_ns(clockid_t clock){
+
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+}
+
+static bool access_log_open(access_log* log){
+
+    /*
+        the file is appended to (a restart goes on with the same file), a new one starts with a header.
+        false if it can't be opened: records are thrown away, the flusher tries again with the next ones.
+    */
+
+    struct stat file_stat;
+
+    log->fd = open(log->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(log->fd < 0) return false;
+
+    log->file_size = fstat(log->fd, &file_stat) == 0 ? file_stat.st_size : 0;
+    if(log->file_size == 0){
+        access_log_header header = { 0 };
+        header.kind = ACCESS_LOG_HEADER;
+        header.version = ACCESS_LOG_VERSION;
+        memcpy(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic));
+        header.created_us = access_log_clock_ns(CLOCK_REALTIME) / 1000;
+        header.slot_size = ACCESS_LOG_SLOT;
+        if(write(log->fd, &header, sizeof(header)) == sizeof(header)) log->file_size = sizeof(header);
+    }
+
+    // the paths the rings defined are in the previous file: they'll be defined again in this one
+    atomic_fetch_add_explicit(&log->generation, 1, memory_order_release);
+    return true;
+
+}
+
+static void access_log_rotate(access_log* log){
+
+    // the full file gets the time it was closed in its name ("access.log.20261017-195801"), a new one takes its place
+    char rotated[PATH_MAX + 64];
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm utc;
+
+    gmtime_r(&now, &utc);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &utc);
+    snprintf(rotated, sizeof(rotated), "%s.%s", log->path, stamp);
+    for(int i = 1; access(rotated, F_OK) == 0; i++) snprintf(rotated, sizeof(rotated), "%s.%s-%d", log->path, stamp, i);
+
+    close(log->fd);
+    log->fd = -1;
+    if(rename(log->path, rotated) < 0) perror("cannot rotate the access log");
+    if(!access_log_open(log)) perror("cannot open the access log");
+
+}
+
+access_log* access_log_create(const server_config* config, int num_handlers){
+
+    access_log* log = calloc(1, sizeof(access_log));
+    unsigned long size = 1;
+
+    snprintf(log->path, sizeof(log->path), "%s", config->access_log);
+    log->rotate_size = config->access_log_rotate;
+    log->realtime_offset_ns = access_log_clock_ns(CLOCK_REALTIME) - access_log_clock_ns(CLOCK_MONOTONIC);
+    atomic_init(&log->generation, 0);
+    if(!access_log_open(log)){
+        // it's only fatal at startup: a bad path is a mistake in the config
+        perror("cannot open the access log");
+        exit(-1);
+    }
+
+    // the rings are indexed with a mask
+    while(size < (unsigned long) config->access_log_buffer) size <<= 1;
+
+    log->ring_count = num_handlers;
+    log->rings = aligned_alloc(LOAD_CACHE_LINE, sizeof(access_log_ring) * num_handlers);
+    for(int i = 0; i < num_handlers; i++){
+        access_log_ring* ring = &log->rings[i];
+        memset(ring, 0, sizeof(access_log_ring));
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->dropped, 0);
+        ring->log = log;
+        ring->handler = i;
+        ring->size = size;
+        ring->slots = aligned_alloc(ACCESS_LOG_SLOT, sizeof(access_log_slot) * size);
+        ring->generation = atomic_load(&log->generation);
+    }
+
+    if(pthread_create(&log->flusher, NULL, access_log_flush_loop, (void*) log) != 0){
+        perror("cannot start the access log flusher\n");
+        exit(-1);
+    }
+
+    return log;
+
+}
+
+access_log_ring* access_log_ring_get(access_log* log, int handler){
+
+    return &log->rings[handler];
+
+}
+
+uint64_t access_log_time_us(const access_log_ring* ring, unsigned long long monotonic_ns){
+
+    return (monotonic_ns + ring->log->realtime_offset_ns) / 1000;
+
+}
+
+static bool access_log_reserve(access_log_ring* ring, unsigned long slots){
+
+    // room for "slots" more slots? the flusher's tail is only read when the last one we saw says there isn't
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if(head + slots - ring->cached_tail <= ring->size) return true;
+    ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head + slots - ring->cached_tail <= ring->size;
+
+}
+
+static void access_log_publish(access_log_ring* ring, unsigned long slots){
+
+    // the slots are written: the flusher can have them
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + slots, memory_order_release);
+
+}
+
+uint64_t access_log_path(access_log_ring* ring, const char* path, size_t length){
+
+    /*
+        the id of a path, defined in the ring first if it's new to this file.
+        if the ring is full the definition is left out (it's tried again with the next request for the path):
+        the requests using its id are still logged, the converter prints the id instead of the path.
+    */
+
+    uint64_t id = 14695981039346656037ULL; // FNV-1a
+
+    if(length > ACCESS_LOG_PATH_MAX) length = ACCESS_LOG_PATH_MAX;
+    for(size_t i = 0; i < length; i++){
+        id ^= (unsigned char) path[i];
+        id *= 1099511628211ULL;
+    }
+    if(id == 0) id = 1; // 0 is "no path"
+
+    unsigned long generation = atomic_load_explicit(&ring->log->generation, memory_order_acquire);
+    if(generation != ring->generation){
+        memset(ring->seen, 0, sizeof(ring->seen));
+        ring->generation = generation;
+    }
+
+    uint64_t* seen = &ring->seen[id % ACCESS_LOG_SEEN];
+    if(*seen == id) return id;
+
+    // the first slot holds the first 48 bytes, every other slot 64 more
+    size_t first = sizeof(((access_log_path_record*) 0)->path);
+    unsigned long slots = 1 + (length > first ? (length - first + ACCESS_LOG_SLOT - 1) / ACCESS_LOG_SLOT : 0);
+    if(!access_log_reserve(ring, slots)) return id;
+
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    access_log_path_record* record = (access_log_path_record*) &ring->slots[head & (ring->size - 1)];
+    size_t copied = length < first ? length : first;
+
+    memset(record, 0, sizeof(access_log_path_record));
+    record->kind = ACCESS_LOG_PATH;
+    record->length = length;
+    record->path_id = id;
+    memcpy(record->path, path, copied);
+
+    for(unsigned long s = 1; s < slots; s++){
+        access_log_slot* slot = &ring->slots[(head + s) & (ring->size - 1)];
+        size_t piece = length - copied < ACCESS_LOG_SLOT ? length - copied : ACCESS_LOG_SLOT;
+        memcpy(slot->bytes, path + copied, piece);
+        memset(slot->bytes + piece, 0, ACCESS_LOG_SLOT - piece);
+        copied += piece;
+    }
+
+    access_log_publish(ring, slots);
+    *seen = id;
+    return id;
+
+}
+
+bool access_log_push(access_log_ring* ring, access_log_record* record){
+
+    // false if the ring is full (the record is dropped and counted)
+    if(!access_log_reserve(ring, 1)){
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1, memory_order_relaxed);
+        return false;
+    }
+
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    record->kind = ACCESS_LOG_REQUEST;
+    record->handler = ring->handler;
+    memcpy(&ring->slots[head & (ring->size - 1)], record, sizeof(access_log_record));
+    access_log_publish(ring, 1);
+    return true;
+
+}
+
+static bool access_log_write_all(int fd, struct iovec* iov, int count){
+
+    // a regular file takes it all at once, unless the disk is full or a signal got in the way
+    while(count > 0){
+
+        ssize_t written = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            return false;
+        }
+        while(count > 0 && (size_t) written >= iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (char*) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+
+    }
+    return true;
+
+}
+
+static void* access_log_flush_loop(void* l){
+
+    /*
+        the flusher: every ACCESS_LOG_FLUSH_MS, what every ring has (and how many records every handler dropped)
+        goes to the file with a single writev(). the slots are given back to the handlers only once they're written.
+        if the write fails (a full disk), the records are thrown away all the same: the handlers must never wait for the disk.
+    */
+
+    access_log* log = (access_log*) l;
+    struct timespec interval = { 0, ACCESS_LOG_FLUSH_MS * 1000000L };
+    struct iovec* iov = malloc(sizeof(struct iovec) * log->ring_count * 3);
+    access_log_dropped* dropped = malloc(sizeof(access_log_dropped) * log->ring_count);
+    unsigned long* heads = malloc(sizeof(unsigned long) * log->ring_count);
+    bool failing = false;
+
+    while(true){
+
+        int count = 0;
+        size_t bytes = 0;
+
+        nanosleep(&interval, NULL);
+
+        for(int i = 0; i < log->ring_count; i++){
+
+            access_log_ring* ring = &log->rings[i];
+            unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+            unsigned long start = tail & (ring->size - 1);
+            unsigned long pending = head - tail;
+            unsigned long until_end = ring->size - start;
+
+            heads[i] = head;
+            if(pending > 0){
+                unsigned long first = pending < until_end ? pending : until_end;
+                iov[count].iov_base = &ring->slots[start];
+                iov[count++].iov_len = first * ACCESS_LOG_SLOT;
+                if(pending > first){
+                    iov[count].iov_base = &ring->slots[0];
+                    iov[count++].iov_len = (pending - first) * ACCESS_LOG_SLOT;
+                }
+                bytes += pending * ACCESS_LOG_SLOT;
+            }
+
+            unsigned long lost = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+            if(lost != ring->dropped_reported){
+                memset(&dropped[i], 0, sizeof(access_log_dropped));
+                dropped[i].kind = ACCESS_LOG_DROPPED;
+                dropped[i].handler = i;
+                dropped[i].count = lost - ring->dropped_reported;
+                dropped[i].timestamp_us = access_log_clock_ns(CLOCK_REALTIME) / 1000;
+                ring->dropped_reported = lost;
+                iov[count].iov_base = &dropped[i];
+                iov[count++].iov_len = sizeof(access_log_dropped);
+                bytes += sizeof(access_log_dropped);
+            }
+
+        }
+
+        if(count == 0) continue;
+
+        if(log->fd < 0) access_log_open(log); // it couldn't be opened after the last rotation
+
+        bool written = log->fd >= 0 && access_log_write_all(log->fd, iov, count);
+        if(!written && !failing) perror("cannot write the access log");
+        failing = !written;
+        log->file_size += written ? bytes : 0;
+
+        for(int i = 0; i < log->ring_count; i++) atomic_store_explicit(&log->rings[i].tail, heads[i], memory_order_release);
+
+        if(log->fd >= 0 && log->rotate_size > 0 && log->file_size >= log->rotate_size) access_log_rotate(log);
+
+    }
+
+    return NULL;
+
+}
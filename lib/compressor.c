@@ -0,0 +1,207 @@
+#include "h/compressor.h"
+#include "h/file_cache.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+static void* compressor_loop(void* c);
+
+static const char* const sibling_suffixes[ENCODINGS] = {
+    [ENCODING_GZIP] = ".gz",
+    [ENCODING_BROTLI] = ".br",
+};
+
+compressor* compressor_create(struct file_cache* cache){
+
+    compressor* comp = malloc(sizeof(compressor));
+
+    comp->cache = cache;
+    comp->head = 0;
+    comp->count = 0;
+    pthread_mutex_init(&comp->lock, NULL);
+    pthread_cond_init(&comp->ready, NULL);
+
+    if(pthread_create(&comp->thread, NULL, compressor_loop, (void*) comp) != 0){
+        perror("cannot start the compressor\n");
+        exit(-1);
+    }
+
+    return comp;
+
+}
+
+bool compressor_submit(compressor* comp, struct file_cache_entry* entry, content_encoding encoding){
+
+    /*
+        called by the handlers: only a lock around a ring, never any compression.
+        the job holds its own reference to the entry, so an eviction can't pull the bytes away from it.
+        returns false if the queue is full.
+    */
+
+    pthread_mutex_lock(&comp->lock);
+
+    if(comp->count == COMPRESSOR_QUEUE){
+        pthread_mutex_unlock(&comp->lock);
+        return false;
+    }
+
+    atomic_fetch_add(&entry->refcount, 1);
+    compressor_job* job = &comp->jobs[(comp->head + comp->count) % COMPRESSOR_QUEUE];
+    job->entry = entry;
+    job->encoding = encoding;
+    comp->count++;
+
+    pthread_cond_signal(&comp->ready);
+    pthread_mutex_unlock(&comp->lock);
+
+    return true;
+
+}
+
+static char* read_sibling(file_cache* cache, file_cache_entry* entry, content_encoding encoding, off_t* size){
+
+    /*
+        "style.css.br" next to "style.css" is what the build already compressed (with the best settings, usually):
+        it's taken as it is if it's a regular file that isn't older than the original.
+        returns NULL if there's no usable sibling.
+    */
+
+    char sibling[PATH_MAX];
+    struct stat original_stat, sibling_stat;
+
+    if(snprintf(sibling, sizeof(sibling), "%s%s", entry->path, sibling_suffixes[encoding]) >= (int) sizeof(sibling)) return NULL;
+
+    int fd = open(sibling, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return NULL;
+
+    if(fstat(fd, &sibling_stat) < 0 || !S_ISREG(sibling_stat.st_mode) || sibling_stat.st_size > (off_t) cache->max_entry_size
+       || stat(entry->path, &original_stat) < 0 || sibling_stat.st_mtim.tv_sec < original_stat.st_mtim.tv_sec){
+        close(fd);
+        return NULL;
+    }
+
+    char* body = malloc(sibling_stat.st_size + 1);
+    off_t read_bytes = 0;
+    while(read_bytes < sibling_stat.st_size){
+        ssize_t result = pread(fd, body + read_bytes, sibling_stat.st_size - read_bytes, read_bytes);
+        if(result <= 0){
+            free(body);
+            close(fd);
+            return NULL;
+        }
+        read_bytes += result;
+    }
+
+    close(fd);
+    *size = read_bytes;
+    return body;
+
+}
+
+static char* compress_gzip(const char* data, off_t length, off_t* size){
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    // 15 + 16: the biggest window, with the gzip header and trailer instead of the zlib ones
+    if(deflateInit2(&stream, COMPRESSOR_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return NULL;
+
+    uLong bound = deflateBound(&stream, length);
+    char* out = malloc(bound);
+
+    stream.next_in = (Bytef*) data;
+    stream.avail_in = length;
+    stream.next_out = (Bytef*) out;
+    stream.avail_out = bound;
+
+    if(deflate(&stream, Z_FINISH) != Z_STREAM_END){
+        deflateEnd(&stream);
+        free(out);
+        return NULL;
+    }
+
+    *size = stream.total_out;
+    deflateEnd(&stream);
+    return out;
+
+}
+
+static char* compress_brotli(const char* data, off_t length, off_t* size){
+
+    size_t bound = BrotliEncoderMaxCompressedSize(length);
+    if(bound == 0) return NULL;
+
+    char* out = malloc(bound);
+    size_t out_length = bound;
+
+    if(!BrotliEncoderCompress(COMPRESSOR_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                              length, (const uint8_t*) data, &out_length, (uint8_t*) out)){
+        free(out);
+        return NULL;
+    }
+
+    *size = out_length;
+    return out;
+
+}
+
+static void compressor_run(compressor* comp, compressor_job* job){
+
+    file_cache* cache = comp->cache;
+    file_cache_entry* entry = job->entry;
+    off_t size = 0;
+    char* body = read_sibling(cache, entry, job->encoding, &size);
+
+    /*
+        no sibling: we compress the cached bytes, unless there's no room for them in the variants' budget
+        even after the unused variants are dropped (file_cache_publish would throw the result away,
+        better to know before spending the time). nothing is recorded then, a later request asks again.
+    */
+    if(!body){
+        if(!file_cache_variant_room(cache, entry, job->encoding, entry->body_length)) return;
+        if(job->encoding == ENCODING_GZIP) body = compress_gzip(entry->body, entry->body_length, &size);
+        else body = compress_brotli(entry->body, entry->body_length, &size);
+        if(!body){
+            // the encoder failed, that doesn't say anything about the file: it can be asked for again
+            atomic_fetch_and(&entry->requested, ~ENCODING_BIT(job->encoding));
+            return;
+        }
+    }
+
+    if(body && size * 100 > entry->body_length * (100 - COMPRESSOR_MIN_SAVING)){
+        // the bytes don't get much smaller (already compressed data, mostly)
+        free(body);
+        body = NULL;
+    }
+
+    file_cache_publish(cache, entry, job->encoding, body, size);
+
+}
+
+static void* compressor_loop(void* c){
+
+    compressor* comp = (compressor*) c;
+
+    while(true){
+
+        pthread_mutex_lock(&comp->lock);
+        while(comp->count == 0) pthread_cond_wait(&comp->ready, &comp->lock);
+        compressor_job job = comp->jobs[comp->head];
+        comp->head = (comp->head + 1) % COMPRESSOR_QUEUE;
+        comp->count--;
+        pthread_mutex_unlock(&comp->lock);
+
+        compressor_run(comp, &job);
+        file_cache_release(job.entry);
+
+    }
+
+    return NULL;
+
+}
@@ -0,0 +1,602 @@
+#define _GNU_SOURCE // sched_getaffinity, CPU_COUNT
+#include "h/config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <sched.h>
+#include <stdbool.h>
+
+#define DEFAULT_SOMAXCONN 4096 // when /proc/sys/net/core/somaxconn can't be read (it's the kernel's default since 5.4)
+#define BACKLOG_PER_HANDLER 1024
+
+typedef enum {
+    OPTION_INT, // numbers may have a k, m or g suffix (1k is 1024)
+    OPTION_SIZE, // the same, but it's a size_t
+    OPTION_STRING,
+    OPTION_ENUM, // one of "values", stored as its index
+    OPTION_CACHE_CONTROL, // ".css .js: max-age=600", every one adds a rule (check cache_control_rule in h/config.h)
+    OPTION_PROXY // "/api/ 127.0.0.1:9000", every one adds a route (check proxy_route_config in h/config.h)
+} option_type;
+
+typedef struct {
+    const char* name;
+    char short_name; // 0 if there's none
+    option_type type;
+    size_t offset;
+    const char* const* values; // OPTION_ENUM only, NULL-terminated and in the enum's order
+    const char* help;
+} config_option;
+
+static const char* const strategies[] = { "reuseport", "exclusive", "dispatch", NULL };
+static const char* const policies[] = { "round-robin", "least-loaded", "two-choices", NULL };
+static const char* const engines[] = { "epoll", "uring", NULL };
+static const char* const switches[] = { "off", "on", NULL };
+
+/*
+    every setting has a single entry here: it's both a flag (--name) and a config file key (name).
+*/
+static const config_option options[] = {
+    { "port", 'p', OPTION_INT, offsetof(server_config, port), NULL, "the port to listen on" },
+    { "handlers", 't', OPTION_INT, offsetof(server_config, num_handlers), NULL, "handler threads (0: one per available core)" },
+    { "root", 'r', OPTION_STRING, offsetof(server_config, www_path), NULL, "the directory served over HTTP" },
+    { "engine", 'e', OPTION_ENUM, offsetof(server_config, engine), engines, "epoll or uring" },
+    { "accept", 0, OPTION_ENUM, offsetof(server_config, strategy), strategies, "reuseport, exclusive or dispatch" },
+    { "dispatch", 0, OPTION_ENUM, offsetof(server_config, policy), policies, "round-robin, least-loaded or two-choices" },
+    { "backlog", 0, OPTION_INT, offsetof(server_config, listen_backlog), NULL, "pending connections per listening socket (0: auto)" },
+    { "max-events", 0, OPTION_INT, offsetof(server_config, max_events), NULL, "events the dispatcher handles per wakeup" },
+    { "handler-events", 0, OPTION_INT, offsetof(server_config, handler_queue_size), NULL, "events a handler handles per wakeup (0: auto)" },
+    { "request-buffer", 0, OPTION_INT, offsetof(server_config, request_buffer_size), NULL, "bytes read from a socket at once" },
+    { "max-request", 0, OPTION_INT, offsetof(server_config, max_request_size), NULL, "the biggest request accepted (its head, and the body of proxied ones)" },
+    { "header-timeout", 0, OPTION_INT, offsetof(server_config, header_timeout), NULL, "seconds to send a request's head" },
+    { "keep-alive-timeout", 0, OPTION_INT, offsetof(server_config, keep_alive_timeout), NULL, "seconds an idle connection is kept" },
+    { "write-timeout", 0, OPTION_INT, offsetof(server_config, write_timeout), NULL, "seconds a response can go without progress" },
+    { "keep-alive-requests", 0, OPTION_INT, offsetof(server_config, keep_alive_max_requests), NULL, "requests served on a connection" },
+    { "write-high-watermark", 0, OPTION_SIZE, offsetof(server_config, write_high_watermark), NULL, "bytes written to a connection before the others get a turn" },
+    { "write-low-watermark", 0, OPTION_SIZE, offsetof(server_config, write_low_watermark), NULL, "unsent bytes below which a socket is writable (0: kernel's)" },
+    { "ipv6", 0, OPTION_ENUM, offsetof(server_config, ipv6), switches, "listen on [::] for IPv6 and IPv4 clients (on/off)" },
+    { "tcp-nodelay", 0, OPTION_ENUM, offsetof(server_config, tcp_nodelay), switches, "disable Nagle's algorithm (on/off)" },
+    { "defer-accept", 0, OPTION_INT, offsetof(server_config, defer_accept), NULL, "seconds to wait for data before accept (0: off)" },
+    { "fast-open", 0, OPTION_INT, offsetof(server_config, fast_open), NULL, "TCP Fast Open queue length (0: off)" },
+    { "send-buffer", 0, OPTION_SIZE, offsetof(server_config, send_buffer), NULL, "SO_SNDBUF of every connection (0: kernel's)" },
+    { "receive-buffer", 0, OPTION_SIZE, offsetof(server_config, receive_buffer), NULL, "SO_RCVBUF of every connection (0: kernel's)" },
+    { "busy-poll", 0, OPTION_INT, offsetof(server_config, busy_poll), NULL, "microseconds of busy polling before sleeping (0: off)" },
+    { "prefer-busy-poll", 0, OPTION_ENUM, offsetof(server_config, prefer_busy_poll), switches, "SO_PREFER_BUSY_POLL, with busy-poll (on/off)" },
+    { "path-index", 0, OPTION_ENUM, offsetof(server_config, path_index), switches, "index the root's files at startup (on/off)" },
+    { "path-index-files", 0, OPTION_INT, offsetof(server_config, path_index_max_files), NULL, "a root with more files isn't indexed" },
+    { "http2", 0, OPTION_ENUM, offsetof(server_config, http2), switches, "HTTP/2 over cleartext, prior knowledge and Upgrade (on/off)" },
+    { "http2-streams", 0, OPTION_INT, offsetof(server_config, http2_max_streams), NULL, "streams a client can have open on a connection" },
+    { "access-log", 0, OPTION_STRING, offsetof(server_config, access_log), NULL, "where the binary access log goes (empty: off)" },
+    { "access-log-buffer", 0, OPTION_INT, offsetof(server_config, access_log_buffer), NULL, "records a handler can queue for the log" },
+    { "access-log-rotate", 0, OPTION_SIZE, offsetof(server_config, access_log_rotate), NULL, "bytes after which the log is rotated (0: never)" },
+    { "cache-size", 0, OPTION_SIZE, offsetof(server_config, file_cache_size), NULL, "bytes of files kept in memory" },
+    { "cache-entry-size", 0, OPTION_SIZE, offsetof(server_config, file_cache_max_entry_size), NULL, "bigger files are streamed from disk" },
+    { "compress-cache-size", 0, OPTION_SIZE, offsetof(server_config, compressed_cache_size), NULL, "bytes of gzip/brotli variants kept (0: off)" },
+    { "cache-control", 0, OPTION_CACHE_CONTROL, offsetof(server_config, cache_control), NULL, "\".css .js: max-age=600\", can be repeated" },
+    { "proxy", 0, OPTION_PROXY, offsetof(server_config, proxy_routes), NULL, "\"/api/ 127.0.0.1:9000 unix:/run/app.sock\", can be repeated" },
+    { "proxy-connect-timeout", 0, OPTION_INT, offsetof(server_config, proxy_connect_timeout), NULL, "seconds to connect to an upstream" },
+    { "proxy-read-timeout", 0, OPTION_INT, offsetof(server_config, proxy_read_timeout), NULL, "seconds an upstream can keep us waiting" },
+    { "proxy-pool", 0, OPTION_INT, offsetof(server_config, proxy_pool_size), NULL, "idle connections kept per upstream and handler" },
+    { "proxy-health-interval", 0, OPTION_INT, offsetof(server_config, proxy_health_interval), NULL, "seconds between health checks (0: off)" },
+    { "proxy-health-path", 0, OPTION_STRING, offsetof(server_config, proxy_health_path), NULL, "what the health checks ask the upstreams for" },
+};
+
+#define OPTIONS_COUNT (int) (sizeof(options) / sizeof(options[0]))
+#define OPTION_CONFIG 'c'
+#define OPTION_HELP 'h'
+
+static bool config_add_cache_control(server_config* config, const char* value){
+
+    // ".css .js: max-age=600": the extensions, a colon and the header's value
+    cache_control_rule* rule = &config->cache_control[config->cache_control_rules];
+    const char* colon = strchr(value, ':');
+    const char* policy = colon ? colon + 1 : NULL;
+
+    if(!colon || config->cache_control_rules == CONFIG_CACHE_CONTROL_RULES) return false;
+    while(*policy == ' ') policy++;
+    if(colon - value >= (long) sizeof(rule->extensions) || strlen(policy) >= sizeof(rule->value)) return false;
+
+    snprintf(rule->extensions, sizeof(rule->extensions), "%.*s", (int) (colon - value), value);
+    snprintf(rule->value, sizeof(rule->value), "%s", policy);
+    config->cache_control_rules++;
+    return true;
+
+}
+
+static bool config_add_proxy(server_config* config, const char* value){
+
+    // "/api/ 127.0.0.1:9000 unix:/run/app.sock": a path prefix, then its upstreams
+    proxy_route_config* route = &config->proxy_routes[config->proxy_route_count];
+    const char* token = value;
+    int tokens = 0;
+
+    if(config->proxy_route_count == CONFIG_PROXY_ROUTES) return false;
+    route->upstream_count = 0;
+
+    while(*token){
+        while(*token == ' ' || *token == '\t') token++;
+        size_t length = strcspn(token, " \t");
+        if(length == 0) break;
+
+        if(tokens == 0){
+            if(*token != '/' || length >= sizeof(route->prefix)) return false;
+            snprintf(route->prefix, sizeof(route->prefix), "%.*s", (int) length, token);
+        }else{
+            if(route->upstream_count == CONFIG_PROXY_UPSTREAMS || length >= sizeof(route->upstreams[0])) return false;
+            snprintf(route->upstreams[route->upstream_count++], sizeof(route->upstreams[0]), "%.*s", (int) length, token);
+        }
+
+        tokens++;
+        token += length;
+    }
+
+    if(route->upstream_count == 0) return false;
+    config->proxy_route_count++;
+    return true;
+
+}
+
+void config_defaults(server_config* config){
+
+    config->port = 8080;
+    config->num_handlers = 0;
+    config->max_events = 128;
+    config->handler_queue_size = 0;
+    config->listen_backlog = 0;
+    config->request_buffer_size = 2048;
+    config->max_request_size = 8092;
+    config->header_timeout = 10;
+    config->keep_alive_timeout = 5;
+    config->write_timeout = 30;
+    config->keep_alive_max_requests = 1000;
+    config->write_high_watermark = 256 * 1024;
+    config->write_low_watermark = 0;
+    config->ipv6 = 0;
+    config->tcp_nodelay = 1;
+    config->defer_accept = 0;
+    config->fast_open = 0;
+    config->send_buffer = 0;
+    config->receive_buffer = 0;
+    config->busy_poll = 0;
+    config->prefer_busy_poll = 0;
+    config->path_index = 1;
+    config->path_index_max_files = 100000;
+    config->http2 = 1;
+    config->http2_max_streams = 128;
+    config->access_log[0] = '\0';
+    config->access_log_buffer = 16384;
+    config->access_log_rotate = 64 * 1024 * 1024;
+    config->file_cache_size = 64 * 1024 * 1024;
+    config->file_cache_max_entry_size = 1024 * 1024;
+    config->compressed_cache_size = 16 * 1024 * 1024;
+    /*
+        pages must be checked every time (a 304 is cheap), everything else can be reused for an hour.
+        assets with a hash in their name should get "max-age=31536000, immutable".
+    */
+    config->cache_control_rules = 0;
+    config_add_cache_control(config, "*: public, max-age=3600");
+    config_add_cache_control(config, ".html .htm: no-cache");
+    config->proxy_route_count = 0;
+    config->proxy_connect_timeout = 2;
+    config->proxy_read_timeout = 30;
+    config->proxy_pool_size = 32;
+    config->proxy_health_interval = 5;
+    strcpy(config->proxy_health_path, "/");
+    config->strategy = ACCEPT_REUSEPORT;
+    config->policy = DISPATCH_TWO_CHOICES;
+    config->engine = IO_ENGINE_EPOLL;
+    config->www_path[0] = '\0';
+
+}
+
+static void config_usage(FILE* out, const char* program){
+
+    fprintf(out, "usage: %s [options]\n", program);
+    fprintf(out, "  -c, --config <path>                read the settings from a file first (\"name = value\" lines)\n");
+    for(int i = 0; i < OPTIONS_COUNT; i++){
+        const char* argument = options[i].type == OPTION_STRING ? "<path>" : options[i].type == OPTION_ENUM ? "<name>"
+                               : options[i].type == OPTION_CACHE_CONTROL || options[i].type == OPTION_PROXY ? "<rule>" : "<n>";
+        char flag[64];
+        if(options[i].short_name) snprintf(flag, sizeof(flag), "-%c, --%s %s", options[i].short_name, options[i].name, argument);
+        else snprintf(flag, sizeof(flag), "    --%s %s", options[i].name, argument);
+        fprintf(out, "  %-34s %s\n", flag, options[i].help);
+    }
+    fprintf(out, "  -h, --help                         print this message\n");
+
+}
+
+static bool config_parse_size(const char* value, size_t* out){
+
+    char* end;
+    unsigned long long number = strtoull(value, &end, 10);
+
+    if(end == value || value[0] == '-') return false;
+    switch(tolower((unsigned char) *end)){
+        case 'g': number *= 1024;
+        // fall through
+        case 'm': number *= 1024;
+        // fall through
+        case 'k': number *= 1024; end++;
+        break;
+    }
+
+    if(*end != '\0') return false;
+    *out = number;
+    return true;
+
+}
+
+static bool config_set(server_config* config, const config_option* option, const char* value){
+
+    // false if the value doesn't make sense for the option
+    void* field = (char*) config + option->offset;
+    size_t size;
+
+    switch(option->type){
+        case OPTION_INT:
+            if(!config_parse_size(value, &size) || size > INT_MAX) return false;
+            *(int*) field = (int) size;
+            return true;
+        case OPTION_SIZE:
+            if(!config_parse_size(value, &size)) return false;
+            *(size_t*) field = size;
+            return true;
+        case OPTION_STRING:
+            if(strlen(value) >= PATH_MAX) return false;
+            strcpy((char*) field, value);
+            return true;
+        case OPTION_ENUM:
+            for(int i = 0; option->values[i]; i++){
+                if(strcasecmp(option->values[i], value) == 0){
+                    *(int*) field = i;
+                    return true;
+                }
+            }
+            return false;
+        case OPTION_CACHE_CONTROL:
+            return config_add_cache_control(config, value);
+        case OPTION_PROXY:
+            return config_add_proxy(config, value);
+    }
+
+    return false;
+
+}
+
+static void config_set_or_die(server_config* config, const config_option* option, const char* value, const char* where){
+
+    if(!config_set(config, option, value)){
+        fprintf(stderr, "%s: invalid value \"%s\" for %s\n", where, value, option->name);
+        exit(-1);
+    }
+
+}
+
+static char* config_trim(char* text){
+
+    while(isspace((unsigned char) *text)) text++;
+    char* end = text + strlen(text);
+    while(end > text && isspace((unsigned char) end[-1])) end--;
+    *end = '\0';
+    return text;
+
+}
+
+static void config_load_file(server_config* config, const char* path){
+
+    FILE* file = fopen(path, "r");
+    char line[PATH_MAX + 128];
+    char where[PATH_MAX + 32];
+    int line_number = 0;
+
+    if(!file){
+        perror("cannot open the config file\n");
+        exit(-1);
+    }
+
+    while(fgets(line, sizeof(line), file)){
+
+        line_number += 1;
+        snprintf(where, sizeof(where), "%s:%d", path, line_number);
+
+        char* comment = strchr(line, '#');
+        if(comment) *comment = '\0';
+        char* name = config_trim(line);
+        if(*name == '\0') continue;
+
+        char* equals = strchr(name, '=');
+        if(!equals){
+            fprintf(stderr, "%s: expected \"name = value\"\n", where);
+            exit(-1);
+        }
+        *equals = '\0';
+        name = config_trim(name);
+        char* value = config_trim(equals + 1);
+
+        const config_option* option = NULL;
+        for(int i = 0; i < OPTIONS_COUNT && !option; i++){
+            if(strcmp(options[i].name, name) == 0) option = &options[i];
+        }
+        if(!option){
+            fprintf(stderr, "%s: unknown setting \"%s\"\n", where, name);
+            exit(-1);
+        }
+        config_set_or_die(config, option, value, where);
+
+    }
+
+    fclose(file);
+
+}
+
+static int config_cgroup_cpus(void){
+
+    /*
+        a container may be allowed every core but only a fraction of their time:
+        the CPU quota of the process's cgroup (and of its ancestors) is turned into cores, rounded up.
+        cgroup v2 has it in cpu.max ("<quota> <period>" or "max <period>"), v1 in cpu.cfs_quota_us and cpu.cfs_period_us.
+        returns 0 if there's no limit.
+    */
+
+    char path[PATH_MAX];
+    char cgroup[PATH_MAX] = "";
+    char line[PATH_MAX];
+    int cpus = 0;
+    FILE* file;
+
+    if((file = fopen("/proc/self/cgroup", "r"))){
+        while(fgets(line, sizeof(line), file)){
+            if(strncmp(line, "0::", 3) == 0){
+                snprintf(cgroup, sizeof(cgroup), "%s", config_trim(line + 3));
+                break;
+            }
+        }
+        fclose(file);
+    }
+
+    while(true){
+
+        long long quota, period;
+        char limit[32];
+
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", cgroup);
+        if((file = fopen(path, "r"))){
+            if(fscanf(file, "%31s %lld", limit, &period) == 2 && strcmp(limit, "max") != 0 && period > 0){
+                quota = atoll(limit);
+                int limited = (quota + period - 1) / period;
+                if(limited > 0 && (cpus == 0 || limited < cpus)) cpus = limited;
+            }
+            fclose(file);
+        }
+
+        // the parent's limit applies too
+        char* slash = strrchr(cgroup, '/');
+        if(!slash || cgroup[0] == '\0') break;
+        *slash = '\0';
+
+    }
+
+    if(cpus > 0) return cpus;
+
+    const char* v1_directories[] = { "/sys/fs/cgroup/cpu,cpuacct", "/sys/fs/cgroup/cpu" };
+    for(int i = 0; i < 2; i++){
+        long long quota = -1, period = 0;
+        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", v1_directories[i]);
+        if((file = fopen(path, "r"))){
+            if(fscanf(file, "%lld", &quota) != 1) quota = -1;
+            fclose(file);
+        }
+        snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", v1_directories[i]);
+        if((file = fopen(path, "r"))){
+            if(fscanf(file, "%lld", &period) != 1) period = 0;
+            fclose(file);
+        }
+        if(quota > 0 && period > 0) return (quota + period - 1) / period;
+    }
+
+    return 0;
+
+}
+
+int config_available_cpus(void){
+
+    // the cores we are allowed to run on (taskset, cpusets...), capped by the cgroup's quota
+    cpu_set_t set;
+    int cpus = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : 1;
+    int limit = config_cgroup_cpus();
+
+    if(limit > 0 && limit < cpus) cpus = limit;
+    return cpus > 0 ? cpus : 1;
+
+}
+
+static int config_somaxconn(void){
+
+    // listen() silently caps the backlog here anyway
+    FILE* file = fopen("/proc/sys/net/core/somaxconn", "r");
+    int somaxconn = DEFAULT_SOMAXCONN;
+
+    if(file){
+        if(fscanf(file, "%d", &somaxconn) != 1 || somaxconn <= 0) somaxconn = DEFAULT_SOMAXCONN;
+        fclose(file);
+    }
+    return somaxconn;
+
+}
+
+static void config_autotune(server_config* config){
+
+    /*
+        whatever was left to 0 is sized from the cores we can use:
+            - a handler per core (more would only take turns on the same cores).
+            - the events taken per wakeup shrink as handlers grow, so a handler doesn't hog
+              a big batch while the others wait (between 128 and 2048).
+            - every listening socket gets BACKLOG_PER_HANDLER pending connections for each handler accepting from it
+              (with ACCEPT_REUSEPORT that's only its owner), capped by somaxconn.
+    */
+
+    if(config->num_handlers <= 0) config->num_handlers = config_available_cpus();
+
+    if(config->handler_queue_size <= 0){
+        int events = 8192 / config->num_handlers;
+        config->handler_queue_size = events < 128 ? 128 : events > 2048 ? 2048 : events;
+    }
+
+    if(config->listen_backlog <= 0){
+        long backlog = config->strategy == ACCEPT_REUSEPORT ? BACKLOG_PER_HANDLER : (long) BACKLOG_PER_HANDLER * config->num_handlers;
+        int somaxconn = config_somaxconn();
+        config->listen_backlog = backlog > somaxconn ? somaxconn : backlog;
+    }
+
+}
+
+static void config_check(server_config* config){
+
+    const char* problem = NULL;
+
+    if(config->port <= 0 || config->port > 65535) problem = "port must be between 1 and 65535";
+    else if(config->max_events <= 0) problem = "max-events must be positive";
+    else if(config->request_buffer_size < 256) problem = "request-buffer must be at least 256 bytes";
+    else if(config->request_buffer_size > 1024 * 1024) problem = "request-buffer can't be more than 1m (every connection starts with one)";
+    else if(config->max_request_size < config->request_buffer_size) problem = "max-request can't be smaller than request-buffer";
+    else if(config->header_timeout <= 0 || config->keep_alive_timeout <= 0 || config->write_timeout <= 0) problem = "timeouts must be positive";
+    else if(config->keep_alive_max_requests <= 0) problem = "keep-alive-requests must be positive";
+    else if(config->write_high_watermark == 0) problem = "write-high-watermark must be positive";
+    else if(config->write_low_watermark > INT_MAX) problem = "write-low-watermark is too big";
+    else if(config->send_buffer > INT_MAX / 2 || config->receive_buffer > INT_MAX / 2) problem = "socket buffers are too big";
+    else if(config->path_index_max_files <= 0) problem = "path-index-files must be positive";
+    else if(config->http2_max_streams <= 0) problem = "http2-streams must be positive";
+    else if(config->access_log_buffer < 64) problem = "access-log-buffer must be at least 64 records";
+    else if(config->proxy_connect_timeout <= 0 || config->proxy_read_timeout <= 0) problem = "proxy timeouts must be positive";
+    else if(config->proxy_health_path[0] != '/') problem = "proxy-health-path must start with /";
+
+    if(problem){
+        fprintf(stderr, "invalid configuration: %s\n", problem);
+        exit(-1);
+    }
+
+}
+
+void config_load(server_config* config, int argc, char** argv){
+
+    /*
+        the config file is read first (wherever --config is on the command line),
+        so the other flags always win over it.
+    */
+
+    struct option long_options[OPTIONS_COUNT + 3];
+    char short_options[2 * OPTIONS_COUNT + 8] = "c:h";
+    int short_length = strlen(short_options);
+
+    for(int i = 0; i < OPTIONS_COUNT; i++){
+        long_options[i] = (struct option) { options[i].name, required_argument, NULL, options[i].short_name ? options[i].short_name : 256 + i };
+        if(options[i].short_name){
+            short_options[short_length++] = options[i].short_name;
+            short_options[short_length++] = ':';
+        }
+    }
+    short_options[short_length] = '\0';
+    long_options[OPTIONS_COUNT] = (struct option) { "config", required_argument, NULL, OPTION_CONFIG };
+    long_options[OPTIONS_COUNT + 1] = (struct option) { "help", no_argument, NULL, OPTION_HELP };
+    long_options[OPTIONS_COUNT + 2] = (struct option) { NULL, 0, NULL, 0 };
+
+    int flag;
+
+    // first pass: only the config file
+    opterr = 0;
+    while((flag = getopt_long(argc, argv, short_options, long_options, NULL)) != -1){
+        if(flag == OPTION_CONFIG) config_load_file(config, optarg);
+    }
+
+    // second pass: everything else
+    opterr = 1;
+    optind = 1;
+    while((flag = getopt_long(argc, argv, short_options, long_options, NULL)) != -1){
+
+        const config_option* option = NULL;
+
+        if(flag == OPTION_CONFIG) continue;
+        if(flag == OPTION_HELP){
+            config_usage(stdout, argv[0]);
+            exit(0);
+        }
+        if(flag >= 256){
+            option = &options[flag - 256];
+        }else{
+            for(int i = 0; i < OPTIONS_COUNT && !option; i++){
+                if(options[i].short_name == flag) option = &options[i];
+            }
+        }
+        if(!option){
+            config_usage(stderr, argv[0]);
+            exit(-1);
+        }
+        config_set_or_die(config, option, optarg, "command line");
+
+    }
+
+    if(optind < argc){
+        fprintf(stderr, "unexpected argument \"%s\"\n", argv[optind]);
+        config_usage(stderr, argv[0]);
+        exit(-1);
+    }
+
+    config_autotune(config);
+    config_check(config);
+
+}
+
+const char* config_cache_control(const server_config* config, const char* extension){
+
+    /*
+        the Cache-Control value for files with "extension" (dot included, NULL if they have none),
+        NULL if they shouldn't have the header.
+    */
+
+    for(int i = config->cache_control_rules - 1; i >= 0; i--){
+
+        const cache_control_rule* rule = &config->cache_control[i];
+        bool matches = false;
+
+        for(const char* token = rule->extensions; *token && !matches;){
+            while(*token == ' ' || *token == ',') token++;
+            size_t length = strcspn(token, " ,");
+            if(length == 0) break;
+            matches = (length == 1 && *token == '*')
+                      || (extension && strlen(extension) == length && strncasecmp(token, extension, length) == 0);
+            token += length;
+        }
+
+        if(matches) return rule->value[0] ? rule->value : NULL;
+
+    }
+
+    return NULL;
+
+}
+
+void config_print(const server_config* config, FILE* out){
+
+    fprintf(
+        out,
+        "handlers=%d engine=%s accept=%s backlog=%d handler-events=%d root=\"%s\" path-index=%s http2=%s\n",
+        config->num_handlers, engines[config->engine], strategies[config->strategy],
+        config->listen_backlog, config->handler_queue_size, config->www_path, switches[config->path_index], switches[config->http2]
+    );
+    fprintf(
+        out,
+        "sockets: ipv6=%s tcp-nodelay=%s defer-accept=%d fast-open=%d send-buffer=%zu receive-buffer=%zu busy-poll=%d\n",
+        switches[config->ipv6], switches[config->tcp_nodelay], config->defer_accept, config->fast_open,
+        config->send_buffer, config->receive_buffer, config->busy_poll
+    );
+    if(config->access_log[0]){
+        fprintf(out, "access log: %s buffer=%d rotate=%zu\n", config->access_log, config->access_log_buffer, config->access_log_rotate);
+    }
+    for(int i = 0; i < config->proxy_route_count; i++){
+        fprintf(out, "proxy: %s ->", config->proxy_routes[i].prefix);
+        for(int j = 0; j < config->proxy_routes[i].upstream_count; j++) fprintf(out, " %s", config->proxy_routes[i].upstreams[j]);
+        fprintf(out, "\n");
+    }
+
+}
@@ -3,34 +3,114 @@
 #include <string.h>
 #include "h/connection_context.h"
 
-void context_init(connection_context* context, unsigned int request_size){
+void context_init(connection_context* context, handler_memory* memory, const http_date* date, handler_load* load, unsigned int request_size){
 
-    context->data = malloc(sizeof(char) * request_size);
+    context->memory = memory;
+    context->date = date;
+    context->load = load;
+    context->data = slab_alloc(&memory->buffers); // the buffers slab hands out "request_size" bytes
     context->length = 0; // we didn't receive anything yet, so the size is 0
     context->buf_size = request_size; // defaults to this
     context->allocations = 1;
+    context->fd = -1;
+    context->requests_served = 0;
+    context->request_started_ns = 0;
+    context->write_armed = false;
+    context->response = NULL;
+    context->proxy = NULL;
+    context->http2 = NULL;
+    context->next_closed = NULL;
+    context->log_path_id = 0;
+    context->peer_family = 0;
+    http_request_init(&context->request);
+    timer_init(&context->deadline);
+    arena_init(&context->arena, &memory->arena_blocks, &memory->arenas);
 
-    bzero(context->data, request_size);
+    context->data[0] = '\0';
 
 }
+
+static void context_free_buffer(connection_context* context){
+
+    if(context->allocations == 1) slab_free(&context->memory->buffers, context->data);
+    else free(context->data);
+
+}
+
+void context_destroy(connection_context* context){
+
+    // everything goes back to the handler
+    load_add(&context->load->connections, -1);
+    context_release(context);
+
+}
+
+void context_release(connection_context* context){
+
+    // the memory only: HTTP/2 streams have contexts of their own, they don't count as connections
+    context_free_buffer(context);
+    arena_release(&context->arena);
+    slab_free(&context->memory->connections, context);
+
+}
+
 void write_to_context(connection_context* context, char* data, ssize_t received_bytes){
-    
-    void* next_ptr;
+
+    char* next_ptr;
     if(received_bytes > context->buf_size){
         perror("invalid buffer size!");
         exit(-1);
     }
 
-    memcpy(context->data + context->length, data, received_bytes);
-    context->length += received_bytes;
-    if(context->length >= context->allocations * context->buf_size){
-        next_ptr = (char*) realloc(context->data, context->length + context->buf_size);
+    /*
+        make room before copying: the buffer always keeps at least one spare byte
+        so the request is always null-terminated.
+        the first growth moves the request out of the slab buffer, the next ones are plain reallocs.
+    */
+    if(context->length + received_bytes >= context->allocations * context->buf_size){
+        if(context->allocations == 1){
+            next_ptr = malloc(2 * context->buf_size);
+            if(next_ptr) memcpy(next_ptr, context->data, context->length);
+        }else{
+            next_ptr = (char*) realloc(context->data, (context->allocations + 1) * context->buf_size);
+        }
         if(!next_ptr){
             perror("system is out of memory!\n");
             exit(-1);
         }
+        if(context->allocations == 1) slab_free(&context->memory->buffers, context->data);
         context->data = next_ptr;
         context->allocations += 1;
     }
 
-}
\ No newline at end of file
+    memcpy(context->data + context->length, data, received_bytes);
+    context->length += received_bytes;
+    context->data[context->length] = '\0';
+
+}
+
+void context_consume(connection_context* context, int bytes){
+
+    /*
+        the first request has been answered: shift the pipelined bytes (if any)
+        to the beginning of the buffer, so the next request starts at offset 0.
+        if the buffer had grown and what's left fits in a slab buffer again, we go back to it,
+        so a single big request doesn't keep a big buffer for the whole life of the connection.
+    */
+
+    int remaining = bytes >= context->length ? 0 : context->length - bytes;
+
+    if(context->allocations > 1 && remaining < context->buf_size){
+        char* buffer = slab_alloc(&context->memory->buffers);
+        memcpy(buffer, context->data + bytes, remaining);
+        free(context->data);
+        context->data = buffer;
+        context->allocations = 1;
+    }else if(remaining > 0){
+        memmove(context->data, context->data + bytes, remaining);
+    }
+
+    context->length = remaining;
+    context->data[context->length] = '\0';
+
+}
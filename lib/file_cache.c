@@ -0,0 +1,670 @@
+#include "h/file_cache.h"
+#include "h/compressor.h"
+#include "h/http_response.h"
+#include "h/http_date.h"
+#include "h/utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/inotify.h>
+
+#define FILE_CACHE_SHARDS 16
+#define FILE_CACHE_BUCKETS 256 // per shard, must be a power of two
+#define VARY_HEADER "Vary: Accept-Encoding\r\n"
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static void* file_cache_watch_loop(void* c);
+
+static const char* const encoding_headers[ENCODINGS] = {
+    [ENCODING_GZIP] = "Content-Encoding: gzip\r\n",
+    [ENCODING_BROTLI] = "Content-Encoding: br\r\n",
+};
+
+static const char* const etag_suffixes[ENCODINGS] = {
+    [ENCODING_IDENTITY] = "",
+    [ENCODING_GZIP] = "-gz",
+    [ENCODING_BROTLI] = "-br",
+};
+
+static uint64_t hash_path(char* path){
+
+    // FNV-1a, good enough for short strings like paths
+    uint64_t hash = 14695981039346656037ULL;
+    for(unsigned char* p = (unsigned char*) path; *p; p++){
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+
+}
+
+static file_cache_shard* shard_of(file_cache* cache, uint64_t hash){
+
+    // the low bits pick the bucket, the high ones pick the shard
+    return &cache->shards[(hash >> 56) % FILE_CACHE_SHARDS];
+
+}
+
+static size_t entry_size(file_cache_entry* entry){
+
+    return entry->body_length + entry->head_length + entry->not_modified_length + strlen(entry->path);
+
+}
+
+static size_t variant_size(const file_cache_variant* variant){
+
+    return variant->body_length + variant->head_length + variant->not_modified_length;
+
+}
+
+static void entry_free(file_cache_entry* entry){
+
+    for(int encoding = 0; encoding < ENCODINGS; encoding++){
+        file_cache_variant* variant = atomic_load(&entry->variants[encoding]);
+        if(!variant) continue;
+        if(variant->body) atomic_fetch_sub(&entry->cache->variant_bytes, variant_size(variant));
+        free(variant->head);
+        free(variant->body);
+        free(variant->not_modified);
+        free(variant);
+    }
+
+    free(entry->path);
+    free(entry->head);
+    free(entry->not_modified);
+    free(entry->body);
+    free(entry);
+
+}
+
+static bool mime_type_compressible(const char* mime_type){
+
+    // images, videos, archives and fonts (woff2 is brotli already) are compressed as they are
+    return strstr(mime_type, "text/") || strstr(mime_type, "javascript") || strstr(mime_type, "json")
+           || strstr(mime_type, "xml") || strstr(mime_type, "wasm");
+
+}
+
+file_cache* file_cache_create(const server_config* config){
+
+    /*
+        the sizes come from the config, which must outlive the cache (its Cache-Control rules are read on every miss):
+            - file_cache_size: bytes of files kept in memory.
+            - file_cache_max_entry_size: bigger files are never cached.
+            - compressed_cache_size: bytes of compressed variants kept alive at once, 0 disables them
+              (responses are then never compressed and carry no Vary header).
+    */
+
+    file_cache* cache = malloc(sizeof(file_cache));
+    size_t budget = config->file_cache_size;
+
+    cache->config = config;
+    cache->shards = malloc(sizeof(file_cache_shard) * FILE_CACHE_SHARDS);
+    cache->max_entry_size = config->file_cache_max_entry_size;
+    cache->variant_budget = config->compressed_cache_size;
+    atomic_init(&cache->variant_bytes, 0);
+    cache->watched_dirs = NULL;
+    cache->watched_dirs_size = 0;
+    atomic_init(&cache->generation, 0);
+    pthread_mutex_init(&cache->watches_lock, NULL);
+
+    for(int i = 0; i < FILE_CACHE_SHARDS; i++){
+        pthread_rwlock_init(&cache->shards[i].lock, NULL);
+        cache->shards[i].buckets = calloc(FILE_CACHE_BUCKETS, sizeof(file_cache_entry*));
+        cache->shards[i].clock_hand = NULL;
+        cache->shards[i].variant_hand = NULL;
+        cache->shards[i].bytes = 0;
+        cache->shards[i].budget = budget / FILE_CACHE_SHARDS;
+    }
+
+    cache->inotify_fd = inotify_init1(IN_CLOEXEC);
+    if(cache->inotify_fd < 0){
+        perror("cannot initialize inotify\n");
+        exit(-1);
+    }
+
+    cache->watcher = malloc(sizeof(pthread_t));
+    pthread_create(cache->watcher, NULL, file_cache_watch_loop, (void*) cache);
+
+    cache->compressor = cache->variant_budget > 0 ? compressor_create(cache) : NULL;
+
+    return cache;
+
+}
+
+static file_cache_entry* shard_find(file_cache_shard* shard, char* path, uint64_t hash){
+
+    file_cache_entry* entry = shard->buckets[hash & (FILE_CACHE_BUCKETS - 1)];
+    while(entry && (entry->hash != hash || strcmp(entry->path, path) != 0)){
+        entry = entry->chain_next;
+    }
+    return entry;
+
+}
+
+static void shard_remove(file_cache_shard* shard, file_cache_entry* entry){
+
+    /*
+        takes the entry out of the bucket and of the clock ring (the write lock must be held),
+        the cache's reference is dropped: the entry dies as soon as nobody is streaming it anymore.
+    */
+
+    file_cache_entry** link = &shard->buckets[entry->hash & (FILE_CACHE_BUCKETS - 1)];
+    while(*link != entry) link = &(*link)->chain_next;
+    *link = entry->chain_next;
+
+    if(entry->clock_next == entry){
+        shard->clock_hand = NULL;
+        shard->variant_hand = NULL;
+    }else{
+        entry->clock_prev->clock_next = entry->clock_next;
+        entry->clock_next->clock_prev = entry->clock_prev;
+        if(shard->clock_hand == entry) shard->clock_hand = entry->clock_next;
+        if(shard->variant_hand == entry) shard->variant_hand = entry->clock_next;
+    }
+
+    shard->bytes -= entry_size(entry);
+    file_cache_release(entry);
+
+}
+
+static void shard_make_room(file_cache_shard* shard, size_t needed){
+
+    /*
+        CLOCK eviction: the hand goes around the ring, entries that have been used since the
+        last pass get a second chance (their bit is cleared), the others are evicted.
+    */
+
+    while(shard->clock_hand && shard->bytes + needed > shard->budget){
+        file_cache_entry* candidate = shard->clock_hand;
+        if(atomic_exchange(&candidate->referenced, false)){
+            shard->clock_hand = candidate->clock_next;
+            continue;
+        }
+        shard_remove(shard, candidate);
+    }
+
+}
+
+file_cache_entry* file_cache_acquire(file_cache* cache, char* path){
+
+    /*
+        the hot path: a read lock, a bucket walk and an atomic increment.
+        the caller must give the entry back with file_cache_release().
+    */
+
+    uint64_t hash = hash_path(path);
+    file_cache_shard* shard = shard_of(cache, hash);
+
+    pthread_rwlock_rdlock(&shard->lock);
+    file_cache_entry* entry = shard_find(shard, path, hash);
+    if(entry){
+        atomic_fetch_add(&entry->refcount, 1);
+        atomic_store_explicit(&entry->referenced, true, memory_order_relaxed);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    return entry;
+
+}
+
+static void file_cache_watch(file_cache* cache, char* path){
+
+    /*
+        we watch the directory of every file we cache (watching an already watched directory
+        just gives us back the same watch descriptor).
+    */
+
+    char dir[PATH_MAX];
+    char* last_slash = strrchr(path, '/');
+    int dir_length = last_slash ? last_slash - path : 0;
+
+    if(dir_length >= PATH_MAX) return;
+    if(!last_slash){
+        strcpy(dir, ".");
+    }else if(dir_length == 0){
+        strcpy(dir, "/");
+    }else{
+        memcpy(dir, path, dir_length);
+        dir[dir_length] = '\0';
+    }
+
+    pthread_mutex_lock(&cache->watches_lock);
+
+    int wd = inotify_add_watch(cache->inotify_fd, dir, WATCH_MASK);
+    if(wd >= 0){
+        if(wd >= cache->watched_dirs_size){
+            int new_size = wd * 2 + 16;
+            cache->watched_dirs = realloc(cache->watched_dirs, sizeof(char*) * new_size);
+            memset(cache->watched_dirs + cache->watched_dirs_size, 0, sizeof(char*) * (new_size - cache->watched_dirs_size));
+            cache->watched_dirs_size = new_size;
+        }
+        if(!cache->watched_dirs[wd]) cache->watched_dirs[wd] = strdup(dir);
+    }
+
+    pthread_mutex_unlock(&cache->watches_lock);
+
+}
+
+unsigned long file_cache_prepare(file_cache* cache, char* path){
+
+    /*
+        must be called before the file is read: the watch comes first, so from now on
+        every change to the file will reach us.
+        the returned generation must be handed to file_cache_insert.
+    */
+    unsigned long generation = atomic_load(&cache->generation);
+    file_cache_watch(cache, path);
+
+    return generation;
+
+}
+
+file_cache_entry* file_cache_load(file_cache* cache, char* path, int fd, const struct stat* file_stat){
+
+    /*
+        called on a miss, with the file already opened (and fstat'ed) by the handler.
+        the file is read and inserted in the cache, the returned entry is already acquired.
+        returns NULL if the file can't be cached (too big or unreadable): the caller keeps the descriptor and
+        will stream the file from it.
+    */
+
+    off_t size = file_stat->st_size;
+
+    if(size > (off_t) cache->max_entry_size) return NULL;
+
+    unsigned long generation = file_cache_prepare(cache, path);
+
+    char* body = malloc(size + 1);
+    off_t read_bytes = 0;
+    while(read_bytes < size){
+        ssize_t result = pread(fd, body + read_bytes, size - read_bytes, read_bytes);
+        if(result <= 0){
+            free(body);
+            return NULL;
+        }
+        read_bytes += result;
+    }
+
+    return file_cache_insert(cache, path, body, size, file_stat->st_ino, file_stat->st_mtime, generation);
+
+}
+
+int file_cache_etag(char* out, ino_t inode, off_t size, time_t mtime, content_encoding encoding){
+
+    /*
+        a strong tag: a file that is rewritten gets a new mtime (or a new inode, if it's replaced with a rename),
+        and the compressed representations get one of their own.
+        writes at most FILE_CACHE_ETAG_SIZE characters (null-terminated), returns the tag's length.
+    */
+
+    return snprintf(out, FILE_CACHE_ETAG_SIZE, "\"%llx-%llx-%llx%s\"",
+                    (unsigned long long) inode, (unsigned long long) size, (unsigned long long) mtime, etag_suffixes[encoding]);
+
+}
+
+int file_cache_validators(file_cache* cache, char* path, const char* etag, time_t last_modified, bool vary, char* out, size_t size){
+
+    /*
+        the headers that tell a client how to keep the file and how to ask if it changed:
+        ETag, Last-Modified, Cache-Control (from the config's rules for the file's extension) and,
+        if the body depends on Accept-Encoding, Vary. "size" should be FILE_CACHE_VALIDATORS_SIZE.
+        they are shared by the 200 and the 304, a 304 must carry the same ones.
+    */
+
+    char date[HTTP_DATE_VALUE_LENGTH];
+    const char* cache_control = config_cache_control(cache->config, filename_to_extension(path));
+
+    http_date_write(date, last_modified);
+
+    return snprintf(out, size, "ETag: %s\r\nLast-Modified: %.*s\r\n%s%s%s%s", etag, HTTP_DATE_VALUE_LENGTH, date,
+                    cache_control ? "Cache-Control: " : "", cache_control ? cache_control : "", cache_control ? "\r\n" : "",
+                    vary ? VARY_HEADER : "");
+
+}
+
+file_cache_entry* file_cache_insert(file_cache* cache, char* path, char* body, off_t size, ino_t inode, time_t mtime, unsigned long generation){
+
+    /*
+        "body" (malloc'ed, "size" bytes) has been read after file_cache_prepare returned "generation",
+        the entry takes ownership of it. the returned entry is already acquired.
+        "inode" and "mtime" are the file's, they make its validators.
+    */
+
+    char validators[FILE_CACHE_VALIDATORS_SIZE];
+    char headers[FILE_CACHE_VALIDATORS_SIZE + 128];
+
+    file_cache_entry* entry = malloc(sizeof(file_cache_entry));
+    entry->path = strdup(path);
+    entry->hash = hash_path(path);
+    entry->mime_type = filename_to_mimetype_header(path);
+    entry->body = body;
+    entry->body_length = size;
+    entry->compressible = cache->compressor && size >= COMPRESSOR_MIN_SIZE && mime_type_compressible(entry->mime_type);
+    entry->cache = cache;
+    atomic_init(&entry->requested, 0);
+    for(int encoding = 0; encoding < ENCODINGS; encoding++) atomic_init(&entry->variants[encoding], NULL);
+
+    entry->last_modified = mtime;
+    entry->etag_length = file_cache_etag(entry->etag, inode, size, mtime, ENCODING_IDENTITY);
+
+    // the identity body of a file that may be sent compressed depends on Accept-Encoding too, caches must know
+    file_cache_validators(cache, path, entry->etag, mtime, entry->compressible, validators, sizeof(validators));
+    snprintf(headers, sizeof(headers), "%s%s", entry->mime_type, validators);
+    entry->head = http_response_serialize_head(200, headers, size, &entry->head_length);
+    entry->not_modified = http_response_serialize_head(304, validators, -1, &entry->not_modified_length);
+    entry->chain_next = NULL;
+    atomic_init(&entry->refcount, 1); // the caller's reference
+    atomic_init(&entry->referenced, true);
+    atomic_init(&entry->variant_referenced, false);
+
+    size_t needed = entry_size(entry);
+    file_cache_shard* shard = shard_of(cache, entry->hash);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    if(atomic_load(&cache->generation) != generation || needed > shard->budget){
+        /*
+            something changed while we were reading (or the file can't fit at all):
+            we still serve what we read, but it doesn't go in the cache.
+        */
+        pthread_rwlock_unlock(&shard->lock);
+        return entry;
+    }
+
+    file_cache_entry* existing = shard_find(shard, path, entry->hash);
+    if(existing){
+        // another handler loaded the same file in the meantime
+        atomic_fetch_add(&existing->refcount, 1);
+        pthread_rwlock_unlock(&shard->lock);
+        entry_free(entry);
+        return existing;
+    }
+
+    shard_make_room(shard, needed);
+
+    file_cache_entry** bucket = &shard->buckets[entry->hash & (FILE_CACHE_BUCKETS - 1)];
+    entry->chain_next = *bucket;
+    *bucket = entry;
+
+    // new entries go right behind the hand, so they are the last ones to be looked at
+    if(!shard->clock_hand){
+        entry->clock_next = entry;
+        entry->clock_prev = entry;
+        shard->clock_hand = entry;
+    }else{
+        entry->clock_next = shard->clock_hand;
+        entry->clock_prev = shard->clock_hand->clock_prev;
+        shard->clock_hand->clock_prev->clock_next = entry;
+        shard->clock_hand->clock_prev = entry;
+    }
+
+    shard->bytes += needed;
+    atomic_fetch_add(&entry->refcount, 1); // the cache's reference
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    return entry;
+
+}
+
+void file_cache_release(file_cache_entry* entry){
+
+    if(atomic_fetch_sub(&entry->refcount, 1) == 1){
+        entry_free(entry);
+    }
+
+}
+
+const file_cache_variant* file_cache_negotiate(file_cache* cache, file_cache_entry* entry, unsigned int accepted){
+
+    /*
+        the body a client that accepts "accepted" (check http_request_accepted_encodings) should get:
+        the best published variant it accepts, or NULL for the identity body.
+        if the variant it would like the most isn't there yet, the compressor is asked for it
+        (once per entry) and a lesser variant, if there's one already, is served in the meantime.
+        the variant lives as long as the entry, so the caller must hold it.
+    */
+
+    bool asked = false;
+
+    if(!entry->compressible) return NULL;
+
+    for(int encoding = ENCODINGS - 1; encoding > ENCODING_IDENTITY; encoding--){
+
+        if(!(accepted & ENCODING_BIT(encoding))) continue;
+
+        file_cache_variant* variant = atomic_load_explicit(&entry->variants[encoding], memory_order_acquire);
+        if(variant){
+            if(!variant->body) continue; // not worth it, maybe the next one is
+            atomic_store_explicit(&entry->variant_referenced, true, memory_order_relaxed);
+            return variant;
+        }
+        if(asked) continue;
+
+        asked = true;
+        unsigned int bit = ENCODING_BIT(encoding);
+        if(!(atomic_fetch_or(&entry->requested, bit) & bit) && !compressor_submit(cache->compressor, entry, encoding)){
+            atomic_fetch_and(&entry->requested, ~bit); // the queue is full, the next request will try again
+        }
+
+    }
+
+    return NULL;
+
+}
+
+static void entry_drop_variants(file_cache_entry* entry){
+
+    /*
+        the compressed bodies go (the "don't bother" ones stay, they cost nothing and they're still true),
+        and the compressor can be asked for them again.
+    */
+    for(int encoding = ENCODING_IDENTITY + 1; encoding < ENCODINGS; encoding++){
+        file_cache_variant* variant = atomic_load(&entry->variants[encoding]);
+        if(!variant || !variant->body) continue;
+        atomic_store(&entry->variants[encoding], NULL);
+        atomic_fetch_and(&entry->requested, ~ENCODING_BIT(encoding));
+        atomic_fetch_sub(&entry->cache->variant_bytes, variant_size(variant));
+        free(variant->head);
+        free(variant->body);
+        free(variant->not_modified);
+        free(variant);
+    }
+
+}
+
+static void shard_reclaim_variants(file_cache* cache, file_cache_shard* shard, size_t needed){
+
+    /*
+        CLOCK over the variants of the shard's entries (the write lock must be held): the ones served since
+        the last pass get a second chance, the others are dropped. an entry that somebody holds (a response,
+        a handler that's negotiating, the compressor) is skipped: its variants may be in use. with the write lock
+        nobody can acquire an entry, so one that only the cache holds is safe.
+        two turns at most, the first one may only clear bits.
+    */
+
+    if(!shard->variant_hand) shard->variant_hand = shard->clock_hand;
+
+    file_cache_entry* start = shard->variant_hand;
+    int turns = 0;
+
+    while(shard->variant_hand && turns < 2 && atomic_load(&cache->variant_bytes) + needed > cache->variant_budget){
+        file_cache_entry* candidate = shard->variant_hand;
+        shard->variant_hand = candidate->clock_next;
+        if(shard->variant_hand == start) turns++;
+        if(atomic_load(&candidate->refcount) > 1) continue;
+        if(atomic_exchange(&candidate->variant_referenced, false)) continue;
+        entry_drop_variants(candidate);
+    }
+
+}
+
+bool file_cache_variant_room(file_cache* cache, file_cache_entry* entry, content_encoding encoding, size_t size){
+
+    /*
+        whether a variant of "size" bytes fits in the variants' budget, after the unused ones made room for it
+        (starting from the entry's shard). if it doesn't, nothing is recorded: the encoding can be asked for again
+        by a later request, when the variants in use now may be gone.
+    */
+
+    file_cache_shard* first = shard_of(cache, entry->hash);
+    int first_index = first - cache->shards;
+
+    for(int i = 0; i < FILE_CACHE_SHARDS && atomic_load(&cache->variant_bytes) + size > cache->variant_budget; i++){
+        file_cache_shard* shard = &cache->shards[(first_index + i) % FILE_CACHE_SHARDS];
+        pthread_rwlock_wrlock(&shard->lock);
+        shard_reclaim_variants(cache, shard, size);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    if(atomic_load(&cache->variant_bytes) + size <= cache->variant_budget) return true;
+
+    atomic_fetch_and(&entry->requested, ~ENCODING_BIT(encoding));
+    return false;
+
+}
+
+bool file_cache_publish(file_cache* cache, file_cache_entry* entry, content_encoding encoding, char* body, off_t size){
+
+    /*
+        called by the compressor (which holds the entry): "body" (malloc'ed, "size" bytes, or NULL) becomes
+        the entry's variant for "encoding". a NULL body means compressing isn't worth it for this file,
+        the entry remembers it. a body that doesn't fit in the variants' budget, even after making room
+        (check file_cache_variant_room), is dropped without leaving a trace.
+        returns whether the body was published.
+    */
+
+    file_cache_variant* variant = calloc(1, sizeof(file_cache_variant));
+
+    if(body){
+        char validators[FILE_CACHE_VALIDATORS_SIZE];
+        char headers[FILE_CACHE_VALIDATORS_SIZE + 192];
+
+        // the tag only changes with the encoding, the rest is the entry's
+        variant->etag_length = snprintf(variant->etag, sizeof(variant->etag), "%.*s%s\"", entry->etag_length - 1, entry->etag, etag_suffixes[encoding]);
+        file_cache_validators(cache, entry->path, variant->etag, entry->last_modified, true, validators, sizeof(validators));
+        snprintf(headers, sizeof(headers), "%s%s%s", entry->mime_type, encoding_headers[encoding], validators);
+        variant->head = http_response_serialize_head(200, headers, size, &variant->head_length);
+        variant->not_modified = http_response_serialize_head(304, validators, -1, &variant->not_modified_length);
+        variant->body = body;
+        variant->body_length = size;
+
+        size_t needed = variant_size(variant);
+        if(!file_cache_variant_room(cache, entry, encoding, needed)){
+            free(variant->head);
+            free(variant->not_modified);
+            free(body);
+            free(variant);
+            return false;
+        }
+        // the compressor is the only one adding variants: the room it found is still there
+        atomic_fetch_add(&cache->variant_bytes, needed);
+        atomic_store_explicit(&entry->variant_referenced, true, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&entry->variants[encoding], variant, memory_order_release);
+
+    return body != NULL;
+
+}
+
+void file_cache_invalidate(file_cache* cache, char* path){
+
+    uint64_t hash = hash_path(path);
+    file_cache_shard* shard = shard_of(cache, hash);
+
+    atomic_fetch_add(&cache->generation, 1);
+
+    pthread_rwlock_wrlock(&shard->lock);
+    file_cache_entry* entry = shard_find(shard, path, hash);
+    if(entry) shard_remove(shard, entry);
+    pthread_rwlock_unlock(&shard->lock);
+
+}
+
+void file_cache_flush(file_cache* cache){
+
+    atomic_fetch_add(&cache->generation, 1);
+
+    for(int i = 0; i < FILE_CACHE_SHARDS; i++){
+        file_cache_shard* shard = &cache->shards[i];
+        pthread_rwlock_wrlock(&shard->lock);
+        while(shard->clock_hand){
+            shard_remove(shard, shard->clock_hand);
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+}
+
+static void* file_cache_watch_loop(void* c){
+
+    /*
+        the watcher thread: every change in a watched directory invalidates the file it refers to.
+        if the kernel dropped some events (or a watched directory went away) we can't know what changed,
+        so everything is flushed.
+    */
+
+    file_cache* cache = (file_cache*) c;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[PATH_MAX];
+
+    while(true){
+
+        ssize_t length = read(cache->inotify_fd, buf, sizeof(buf));
+        if(length <= 0){
+            if(length < 0 && errno == EINTR) continue;
+            perror("cannot read inotify events\n");
+            return NULL;
+        }
+
+        for(char* ptr = buf; ptr < buf + length; ptr += sizeof(struct inotify_event) + ((struct inotify_event*) ptr)->len){
+
+            struct inotify_event* event = (struct inotify_event*) ptr;
+
+            if(event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)){
+                file_cache_flush(cache);
+                continue;
+            }
+
+            if(event->mask & IN_IGNORED){
+                // the watch is gone (the directory was removed), forget about it
+                pthread_mutex_lock(&cache->watches_lock);
+                if(event->wd < cache->watched_dirs_size){
+                    free(cache->watched_dirs[event->wd]);
+                    cache->watched_dirs[event->wd] = NULL;
+                }
+                pthread_mutex_unlock(&cache->watches_lock);
+                continue;
+            }
+
+            if(event->len == 0) continue;
+
+            pthread_mutex_lock(&cache->watches_lock);
+            char* dir = event->wd < cache->watched_dirs_size ? cache->watched_dirs[event->wd] : NULL;
+            if(dir){
+                if(strcmp(dir, "/") == 0) snprintf(path, PATH_MAX, "/%s", event->name);
+                else if(strcmp(dir, ".") == 0) snprintf(path, PATH_MAX, "%s", event->name);
+                else snprintf(path, PATH_MAX, "%s/%s", dir, event->name);
+            }
+            pthread_mutex_unlock(&cache->watches_lock);
+
+            if(dir){
+                file_cache_invalidate(cache, path);
+                // a precompressed sibling changed: the file's variants must be built again
+                char* extension = filename_to_extension(path);
+                if(extension && (strcmp(extension, ".gz") == 0 || strcmp(extension, ".br") == 0)){
+                    *extension = '\0';
+                    file_cache_invalidate(cache, path);
+                }
+            }
+
+        }
+
+    }
+
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "config.h"
+#include "load.h"
+
+/*
+    the access log: a fixed-size binary record for every response, written to disk by a thread of its own.
+
+    every handler has a ring of records and it's the only one writing it (it only moves "head"), the flusher
+    is the only one reading it (it only moves "tail"): no locks, no read-modify-write, and the handler never waits.
+    if the flusher falls behind and a ring is full, the record is dropped and counted (the flusher writes how many
+    in the log, the stats page has them too).
+    every ACCESS_LOG_FLUSH_MS the flusher takes whatever the rings have (two pieces at most each, where they wrap)
+    and writes them all with a single writev(), then it rotates the file once it's bigger than "access-log-rotate".
+
+    paths are variable-sized, so a record only has the path's id (a hash of it): the first time a ring uses an id
+    in a file, an ACCESS_LOG_PATH record (followed by as many slots as the path needs) tells what it stands for.
+    bin/access-log-convert turns the files back into text or JSON (check tools/access_log_convert.c).
+*/
+
+#define ACCESS_LOG_SLOT 64 // every record takes a slot, the rings and the files are arrays of slots
+#define ACCESS_LOG_MAGIC "EPOLLYAL"
+#define ACCESS_LOG_VERSION 1
+#define ACCESS_LOG_FLUSH_MS 50
+#define ACCESS_LOG_SEEN 1024 // path ids a ring remembers (direct-mapped: a forgotten one is just defined again)
+#define ACCESS_LOG_PATH_MAX 1024 // longer paths are cut
+
+typedef enum {
+    ACCESS_LOG_HEADER = 1, // the first slot of every file
+    ACCESS_LOG_REQUEST,
+    ACCESS_LOG_PATH,
+    ACCESS_LOG_DROPPED
+} access_log_kind;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t reserved[3];
+    uint32_t version;
+    char magic[8];
+    uint64_t created_us; // microseconds since the epoch
+    uint32_t slot_size;
+    uint8_t padding[36];
+} access_log_header;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t family; // AF_INET or AF_INET6 (0 if the client's address couldn't be read)
+    uint16_t status;
+    uint16_t handler;
+    uint16_t port;
+    uint32_t duration_us; // from the round the request was complete in to its last byte
+    uint32_t reserved;
+    uint64_t timestamp_us; // when the request was complete, since the epoch
+    uint64_t path_id; // 0: there's no path (the request couldn't be parsed)
+    uint64_t bytes; // of the response's body
+    uint8_t address[16]; // IPv4 addresses take the first 4 bytes
+    char method[8]; // not null-terminated if it takes all 8
+} access_log_record;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t reserved;
+    uint16_t length; // the path starts here and goes on in the next slots (whole ones, the last one is padded)
+    uint32_t reserved2;
+    uint64_t path_id;
+    char path[48];
+} access_log_path_record;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t reserved;
+    uint16_t handler;
+    uint32_t reserved2;
+    uint64_t count; // records the handler dropped since the previous ACCESS_LOG_DROPPED of its own
+    uint64_t timestamp_us; // when the flusher noticed
+    uint8_t padding[40];
+} access_log_dropped;
+
+typedef struct {
+    unsigned char bytes[ACCESS_LOG_SLOT];
+} access_log_slot;
+
+struct access_log;
+
+typedef struct {
+    /*
+        the handler's side
+    */
+    atomic_ulong head; // slots ever pushed
+    unsigned long cached_tail; // the last tail the handler saw, it's read again only when the ring looks full
+    unsigned long generation; // the file "seen" is about
+    uint64_t seen[ACCESS_LOG_SEEN];
+    const struct access_log* log;
+    access_log_slot* slots;
+    unsigned long size; // slots, a power of 2
+    int handler;
+    /*
+        the flusher's side, in a cache line of its own
+    */
+    atomic_ulong tail __attribute__((aligned(LOAD_CACHE_LINE))); // slots ever written to disk
+    atomic_ulong dropped; // requests the handler couldn't log (written by the handler, but only when it's dropping anyway)
+    unsigned long dropped_reported; // the flusher's
+} __attribute__((aligned(LOAD_CACHE_LINE))) access_log_ring;
+
+typedef struct access_log {
+    char path[PATH_MAX];
+    int fd;
+    size_t file_size;
+    size_t rotate_size; // 0: never
+    atomic_ulong generation; // bumped with every new file, the rings' "seen" ids are forgotten
+    long long realtime_offset_ns; // CLOCK_REALTIME - CLOCK_MONOTONIC, records are timed with the monotonic clock
+    access_log_ring* rings;
+    int ring_count;
+    pthread_t flusher;
+} access_log;
+
+extern access_log* access_log_create(const server_config* config, int num_handlers);
+extern access_log_ring* access_log_ring_get(access_log* log, int handler);
+extern uint64_t access_log_path(access_log_ring* ring, const char* path, size_t length);
+extern bool access_log_push(access_log_ring* ring, access_log_record* record);
+extern uint64_t access_log_time_us(const access_log_ring* ring, unsigned long long monotonic_ns);
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdbool.h>
+#include <pthread.h>
+#include "http_request.h"
+
+struct file_cache;
+struct file_cache_entry;
+
+/*
+    the compressor builds the gzip and brotli variants of cached files, on a thread of its own:
+    compressing a file takes milliseconds, a handler never waits for it.
+
+    a handler that finds a compressible entry without the variant the client prefers queues a job
+    and answers with what the entry already has (identity, or gzip while brotli is on its way),
+    the next requests get the variant as soon as it's published in the entry (check file_cache_negotiate).
+    a precompressed sibling ("style.css.br" next to "style.css", not older than it) is taken as it is,
+    otherwise the cached bytes are compressed. variants count in their own budget ("compress-cache-size"):
+    when it's full, or when compressing doesn't save enough, the entry remembers it and keeps serving identity.
+*/
+
+#define COMPRESSOR_QUEUE 256 // jobs waiting for the thread, a full queue drops new ones (they'll be asked again)
+#define COMPRESSOR_MIN_SIZE 256 // smaller files aren't worth a Content-Encoding header
+#define COMPRESSOR_MIN_SAVING 10 // percent: a variant must be at least this much smaller than the file
+#define COMPRESSOR_GZIP_LEVEL 9
+#define COMPRESSOR_BROTLI_QUALITY 9 // 11 is the best, but it takes seconds on a big file
+
+typedef struct {
+    struct file_cache_entry* entry; // acquired for the job
+    content_encoding encoding;
+} compressor_job;
+
+typedef struct compressor {
+    struct file_cache* cache;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    compressor_job jobs[COMPRESSOR_QUEUE]; // a ring
+    int head;
+    int count;
+} compressor;
+
+extern compressor* compressor_create(struct file_cache* cache);
+extern bool compressor_submit(compressor* comp, struct file_cache_entry* entry, content_encoding encoding);
@@ -0,0 +1,136 @@
+#pragma once
+#include <stddef.h>
+#include <stdio.h>
+#include <limits.h>
+
+/*
+    everything that can be tuned without rebuilding epolly.
+    values come from (in this order, the last one wins) the defaults, the config file (--config)
+    and the command line flags; the ones left to 0 are sized from the cores the process can actually
+    use (its CPU affinity, capped by its cgroup's CPU quota), check config_load.
+
+    the config file has a "name = value" pair per line (names are the long flags' ones, without "--"),
+    "#" starts a comment.
+*/
+
+/*
+    how new connections reach the handlers:
+        - ACCEPT_REUSEPORT: every handler owns a listening socket bound to the same port (SO_REUSEPORT),
+          the kernel spreads incoming connections among them.
+        - ACCEPT_EXCLUSIVE: handlers share a single listening socket, registered with EPOLLEXCLUSIVE so that
+          only one of them is woken up for each burst of connections.
+        - ACCEPT_DISPATCH: the main thread accepts connections and passes them to the handlers (the least loaded
+          one, check dispatch_policy below) through a pipe, the handler then adds them to its own epoll.
+*/
+typedef enum {
+    ACCEPT_REUSEPORT,
+    ACCEPT_EXCLUSIVE,
+    ACCEPT_DISPATCH
+} accept_strategy;
+
+/*
+    how a handler does its I/O:
+        - IO_ENGINE_EPOLL: readiness events from an epoll, then recv/send/sendfile/open/read are called one by one.
+        - IO_ENGINE_URING: operations are queued on an io_uring and submitted in batches with a single syscall,
+          which also reaps their completions (check uring_engine.c). the server falls back to epoll
+          if the kernel doesn't support it.
+*/
+typedef enum {
+    IO_ENGINE_EPOLL,
+    IO_ENGINE_URING
+} io_engine;
+
+/*
+    which handler gets a connection accepted by the dispatcher (ACCEPT_DISPATCH only):
+        - DISPATCH_ROUND_ROBIN: every handler in turn, no matter how busy it is.
+        - DISPATCH_LEAST_LOADED: the handler with the lowest load score (check h/load.h), every handler is looked at.
+        - DISPATCH_TWO_CHOICES: the less loaded of two handlers picked at random. it's almost as good as
+          the least loaded one and it doesn't send a whole burst to the same handler when the scores are a bit stale.
+*/
+typedef enum {
+    DISPATCH_ROUND_ROBIN,
+    DISPATCH_LEAST_LOADED,
+    DISPATCH_TWO_CHOICES
+} dispatch_policy;
+
+/*
+    a Cache-Control policy for some kinds of files: "extensions" lists them (".css .js", dots included)
+    or it's "*" for every file. rules are looked at from the last one, so the ones given later
+    (in the config file, then on the command line) win over the defaults.
+*/
+#define CONFIG_CACHE_CONTROL_RULES 32
+
+typedef struct {
+    char extensions[64];
+    char value[128]; // what goes after "Cache-Control: ", empty for no header at all
+} cache_control_rule;
+
+/*
+    a proxy route: requests whose path starts with "prefix" are forwarded (path and all) to one of "upstreams",
+    "host:port" (an IPv4 address or a name) or "unix:/path/to/socket" (check h/proxy.h).
+*/
+#define CONFIG_PROXY_ROUTES 16
+#define CONFIG_PROXY_UPSTREAMS 8
+
+typedef struct {
+    char prefix[128];
+    char upstreams[CONFIG_PROXY_UPSTREAMS][128];
+    int upstream_count;
+} proxy_route_config;
+
+typedef struct {
+    int port;
+    int num_handlers; // 0: one per available core
+    int max_events; // events the dispatcher takes from its epoll at once (ACCEPT_DISPATCH only)
+    int handler_queue_size; // events a handler takes from its epoll at once (0: sized from the handlers' count)
+    int listen_backlog; // pending connections per listening socket (0: sized from the handlers' count, capped by somaxconn)
+    int request_buffer_size; // bytes read from a socket at once (and the size of a connection's first buffer)
+    int max_request_size;
+    int header_timeout; // seconds (check handler_deadline in h/handler.h)
+    int keep_alive_timeout;
+    int write_timeout;
+    int keep_alive_max_requests;
+    size_t write_high_watermark; // bytes written to a connection per event loop round (epoll engine only)
+    size_t write_low_watermark; // TCP_NOTSENT_LOWAT: the socket is writable again once fewer unsent bytes are queued (0: the kernel's default)
+    /*
+        the listening sockets' TCP tuning, accepted sockets inherit it (check h/socket_options.h).
+        0 always means "leave it to the kernel".
+    */
+    int ipv6; // listen on [::], for IPv6 and IPv4 clients, instead of 0.0.0.0
+    int tcp_nodelay;
+    int defer_accept; // seconds the kernel waits for a connection's first bytes before it can be accepted
+    int fast_open; // TCP Fast Open: connections waiting for their handshake
+    size_t send_buffer; // SO_SNDBUF
+    size_t receive_buffer; // SO_RCVBUF
+    int busy_poll; // microseconds spent polling the device queues before sleeping
+    int prefer_busy_poll; // SO_PREFER_BUSY_POLL (only with busy_poll)
+    int path_index; // index the files under www_path at startup (check h/path_index.h)
+    int path_index_max_files;
+    int http2; // h2c, by prior knowledge or Upgrade (epoll engine only, check h/http2.h)
+    int http2_max_streams; // SETTINGS_MAX_CONCURRENT_STREAMS
+    char access_log[PATH_MAX]; // the binary access log's file (empty: no access log, check h/access_log.h)
+    int access_log_buffer; // records every handler can queue for the flusher
+    size_t access_log_rotate;
+    size_t file_cache_size;
+    size_t file_cache_max_entry_size;
+    size_t compressed_cache_size; // gzip and brotli variants of the cached files (0: never compress)
+    cache_control_rule cache_control[CONFIG_CACHE_CONTROL_RULES];
+    int cache_control_rules;
+    proxy_route_config proxy_routes[CONFIG_PROXY_ROUTES];
+    int proxy_route_count;
+    int proxy_connect_timeout; // seconds to connect to an upstream
+    int proxy_read_timeout; // seconds an upstream can go without sending anything while it's answering
+    int proxy_pool_size; // idle connections a handler keeps to every upstream
+    int proxy_health_interval; // seconds between two health checks of every upstream (0: no checks)
+    char proxy_health_path[PATH_MAX]; // what the health checks ask for, any 2xx or 3xx is healthy
+    accept_strategy strategy;
+    dispatch_policy policy;
+    io_engine engine;
+    char www_path[PATH_MAX]; // prepended to every requested path (empty: paths are taken from /)
+} server_config;
+
+extern void config_defaults(server_config* config);
+extern void config_load(server_config* config, int argc, char** argv);
+extern int config_available_cpus(void);
+extern void config_print(const server_config* config, FILE* out);
+extern const char* config_cache_control(const server_config* config, const char* extension);
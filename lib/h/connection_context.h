@@ -1,14 +1,61 @@
 #pragma once
 #include <stdlib.h>
 #include <strings.h>
+#include <stdbool.h>
+#include <time.h>
+#include "http_request.h"
+#include "memory.h"
+#include "http_date.h"
+#include "load.h"
+#include "timer_wheel.h"
+#include "access_log.h"
 
-typedef struct {
+struct http_response;
+struct proxy_connection;
+struct http2_session;
+
+/*
+    a connection context lives as long as the client's socket does.
+    since connections are persistent (keep-alive), the same context will
+    receive many requests: bytes are accumulated in "data" until a full request
+    is there, then the request is consumed and the remaining bytes (pipelined requests)
+    are kept for the next round.
+
+    contexts, their receive buffers and everything their responses allocate come from
+    the memory of the handler that owns the connection (check h/memory.h).
+*/
+
+typedef struct connection_context {
     int length; // as an example, max message size is 4GB (i won't check for overflows because i'm lazy and this is an example)
-    char* data;
+    char* data; // a buffer from the handler's slab, unless the request outgrew it (then it's malloc'ed)
     int allocations;
     int buf_size; // defaults to this
     int fd;
+    int requests_served; // how many responses were fully written on this connection
+    unsigned long long request_started_ns; // the round the request being answered was complete in (check h/metrics.h)
+    http_request request; // the request being parsed (the parser resumes from here when more bytes arrive)
+    struct http_response* response; // the response being streamed right now (NULL if we are reading)
+    bool write_armed; // the socket is registered for EPOLLOUT instead of EPOLLIN (epoll engine only, check handler_write)
+    struct proxy_connection* proxy; // the upstream answering the request, instead of a response (check h/proxy.h)
+    struct http2_session* http2; // the connection speaks HTTP/2: the session writes instead of "response" (check h/http2.h)
+    struct connection_context* next_closed; // closed in this round of the event loop, destroyed at its end (epoll engine only)
+    /*
+        what the access log needs once the response is out, the request's bytes are gone by then (check handler_log_response)
+    */
+    uint64_t log_path_id;
+    char log_method[8];
+    uint8_t peer_family; // the client's address is read with the first record (0: not yet)
+    uint8_t peer_address[16];
+    uint16_t peer_port;
+    timer deadline; // in the handler's timer wheel, its kind tells which deadline it is (check handler_deadline)
+    handler_memory* memory; // the handler's allocators
+    const http_date* date; // the handler's Date header
+    handler_load* load; // the handler's load counters (the connection counts until it's destroyed)
+    arena arena; // temporary data of the response being built/written, reset once it's done
 } connection_context;
 
-extern void context_init(connection_context* context, unsigned int request_size);
-void write_to_context(connection_context* context, char* data, ssize_t received_bytes);
\ No newline at end of file
+extern void context_init(connection_context* context, handler_memory* memory, const http_date* date, handler_load* load, unsigned int request_size);
+extern void context_destroy(connection_context* context);
+extern void context_release(connection_context* context);
+void write_to_context(connection_context* context, char* data, ssize_t received_bytes);
+extern void context_consume(connection_context* context, int bytes);
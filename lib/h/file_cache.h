@@ -0,0 +1,127 @@
+#pragma once
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "http_request.h"
+#include "config.h"
+
+/*
+    the file cache keeps small, hot files in memory, shared by every handler.
+    an entry holds the file's bytes together with the pre-serialized status line and headers,
+    so a hit can be answered without touching the filesystem at all.
+
+    the table is split in shards, every shard has its own read-write lock and its own slice
+    of the byte budget: lookups only take the read lock, so handlers don't serialize on each other.
+    when a shard is full, entries are evicted with the CLOCK algorithm (the "referenced" bit
+    is set by lookups and cleared by the clock hand, entries that weren't used since the last sweep go away).
+
+    entries are reference counted: an evicted (or invalidated) entry stays alive until the last
+    response that is streaming it is done.
+
+    a background thread listens to inotify events on the directories of the cached files
+    and drops the entries whose file changed.
+
+    compressible entries (text, scripts, json, svg...) can also carry a gzip and a brotli variant,
+    built off the event loop by the compressor (check h/compressor.h) and picked by file_cache_negotiate.
+    variants have a budget of their own: when it's full, a second CLOCK (a hand and a bit of its own, on the same rings)
+    drops the variants that weren't served since its last pass, so the file is compressed again if it gets hot again.
+
+    the validators (ETag and Last-Modified, from the file's inode, size and mtime) are computed once, when the file
+    is loaded, and they are part of the serialized heads. so is a whole 304 response: a client that
+    already has the file gets an answer without a single header being formatted.
+*/
+
+#define FILE_CACHE_ETAG_SIZE 64 // "\"<inode>-<size>-<mtime>[-br]\"" in hex, quotes included
+#define FILE_CACHE_VALIDATORS_SIZE 320 // ETag, Last-Modified, Cache-Control and Vary (check file_cache_validators)
+
+/*
+    a compressed copy of an entry's body, with its own head (Content-Encoding, Vary and its own Content-Length).
+    it's published once and never changes, it dies with its entry or when the variants' CLOCK drops it
+    (only while nobody holds the entry, check shard_reclaim_variants).
+    a variant without a body means "don't bother": compressing the file doesn't make it smaller, the client gets the identity body.
+*/
+typedef struct {
+    char* head;
+    int head_length;
+    char* body;
+    off_t body_length;
+    char etag[FILE_CACHE_ETAG_SIZE]; // a compressed body is another representation, with its own tag
+    int etag_length;
+    char* not_modified; // the 304 for this variant (status line and headers, without the final empty line)
+    int not_modified_length;
+} file_cache_variant;
+
+typedef struct file_cache_entry {
+    char* path; // the key: the normalized path of the file
+    uint64_t hash;
+    char* head; // status line + headers (without the final empty line)
+    int head_length;
+    char* body;
+    off_t body_length;
+    char* mime_type;
+    time_t last_modified;
+    char etag[FILE_CACHE_ETAG_SIZE];
+    int etag_length;
+    char* not_modified; // the 304 for the identity body (status line and headers, without the final empty line)
+    int not_modified_length;
+    bool compressible;
+    _Atomic(file_cache_variant*) variants[ENCODINGS]; // NULL until the compressor publishes one (identity is never used)
+    atomic_uint requested; // the encodings the compressor has been asked for (a bit per encoding, check ENCODING_BIT)
+    struct file_cache* cache;
+    atomic_int refcount; // the cache holds one reference as long as the entry is in the table
+    atomic_bool referenced; // CLOCK bit
+    atomic_bool variant_referenced; // the variants' CLOCK bit, set when one of them is served
+    struct file_cache_entry* chain_next; // next entry in the same bucket
+    struct file_cache_entry* clock_prev; // the shard's clock ring
+    struct file_cache_entry* clock_next;
+} file_cache_entry;
+
+typedef struct {
+    pthread_rwlock_t lock;
+    file_cache_entry** buckets;
+    file_cache_entry* clock_hand;
+    file_cache_entry* variant_hand; // the variants' CLOCK goes around the same ring
+    size_t bytes; // bytes of the entries currently in the shard
+    size_t budget;
+} file_cache_shard;
+
+typedef struct file_cache {
+    const server_config* config; // the Cache-Control rules
+    file_cache_shard* shards;
+    size_t max_entry_size; // bigger files are not cached, they are streamed with sendfile()
+    int inotify_fd;
+    pthread_t* watcher;
+    /*
+        bumped for every invalidation: a handler that loaded a file while an invalidation
+        was happening won't insert it (the bytes it read may be stale already).
+    */
+    atomic_ulong generation;
+    /*
+        watch descriptor -> watched directory, needed to rebuild paths from inotify events.
+        only touched on misses and by the watcher thread.
+    */
+    pthread_mutex_t watches_lock;
+    char** watched_dirs;
+    int watched_dirs_size;
+    struct compressor* compressor; // NULL if compressed variants are disabled
+    size_t variant_budget;
+    atomic_size_t variant_bytes; // bytes of every variant still alive (evicted entries included, until they die)
+} file_cache;
+
+extern file_cache* file_cache_create(const server_config* config);
+extern file_cache_entry* file_cache_acquire(file_cache* cache, char* path);
+extern file_cache_entry* file_cache_load(file_cache* cache, char* path, int fd, const struct stat* file_stat);
+extern unsigned long file_cache_prepare(file_cache* cache, char* path);
+extern file_cache_entry* file_cache_insert(file_cache* cache, char* path, char* body, off_t size, ino_t inode, time_t mtime, unsigned long generation);
+extern void file_cache_release(file_cache_entry* entry);
+extern const file_cache_variant* file_cache_negotiate(file_cache* cache, file_cache_entry* entry, unsigned int accepted);
+extern bool file_cache_variant_room(file_cache* cache, file_cache_entry* entry, content_encoding encoding, size_t size);
+extern bool file_cache_publish(file_cache* cache, file_cache_entry* entry, content_encoding encoding, char* body, off_t size);
+extern int file_cache_etag(char* out, ino_t inode, off_t size, time_t mtime, content_encoding encoding);
+extern int file_cache_validators(file_cache* cache, char* path, const char* etag, time_t last_modified, bool vary, char* out, size_t size);
+extern void file_cache_invalidate(file_cache* cache, char* path);
+extern void file_cache_flush(file_cache* cache);
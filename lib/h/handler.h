@@ -1,24 +1,64 @@
 #pragma once
 #include <stdbool.h>
 #include <pthread.h>
+#include <stdio.h>
+#include "connection_context.h"
+#include "file_cache.h"
+#include "memory.h"
+#include "http_date.h"
+#include "load.h"
+#include "timer_wheel.h"
+#include "config.h"
+#include "metrics.h"
+#include "proxy.h"
+#include "path_index.h"
+#include "access_log.h"
 
 /*
     the handler will process every request it gets from the main thread (i.e the server).
-    every handler is thread that has a fixed-size epoll queue where connection events will occur; 
+    every handler is thread that has a fixed-size epoll queue where connection events will occur;
     for every event, the handler will parse the request and do something with it.
 
 */
 
+/*
+    every connection is always racing against one deadline, depending on what it's doing:
+        - DEADLINE_HEADER: the head of a request must arrive within "header_timeout" seconds from its first byte
+          (or from the accept, for a new connection). it's not pushed back when more bytes arrive,
+          so a client can't keep a connection by trickling a byte at a time.
+        - DEADLINE_IDLE: a keep-alive connection waiting for its next request is closed after "keep_alive_timeout" seconds.
+        - DEADLINE_WRITE: a response that doesn't make progress for "write_timeout" seconds is given up.
+          every time the socket takes some bytes the deadline is pushed back, so slow (but alive) readers are fine.
+*/
+typedef enum {
+    DEADLINE_HEADER,
+    DEADLINE_IDLE,
+    DEADLINE_WRITE,
+    DEADLINE_KINDS
+} handler_deadline;
+
+/*
+    a request for a file that isn't in the cache: engines that open files asynchronously get this
+    back instead of a response (check handler_next_response).
+*/
 typedef struct {
-    
+    char* filename; // NULL if a response was built right away (it lives in the connection's arena)
+    bool keep_alive;
+    unsigned int accepted_encodings; // the request's Accept-Encoding, to pick the body once the file is loaded
+    http_conditions conditions; // and its validators and ranges (copied in the arena too)
+} file_miss;
+
+typedef struct handler {
+
     /*
         every handler has a fixed-size epoll queue.
         if more than "max_events" file descriptors are ready when
         epoll_wait() is called, then successive epoll_wait() calls will
         round robin through the set of ready file descriptors. (https://man7.org/linux/man-pages/man2/epoll_wait.2.html)
     */
+    int id;
     int max_request_size;
-    int max_events; 
+    int max_events;
     int epoll_fd;
     int request_buffer_size;
     char* request_buffer; // where the request will be written
@@ -26,6 +66,78 @@ typedef struct {
     pthread_t* thread;
     bool active;
 
+    /*
+        connections are persistent: after a response is written the connection goes back to reading.
+        their deadlines (check handler_deadline) are kept in a timer wheel: the event loop sleeps
+        until the next one is due, and the expired ones are closed as soon as it wakes up.
+    */
+    int header_timeout; // seconds a request's head can take to arrive
+    int keep_alive_timeout; // seconds an idle connection is kept open
+    int write_timeout; // seconds a response can go without writing anything
+    int keep_alive_max_requests; // how many requests a single connection can send before being closed
+    timer_wheel timers;
+    size_t write_high_watermark; // bytes a connection can write in a round of the event loop before the others get their turn
+
+    accept_strategy strategy;
+    int listen_fd; // the listening socket this handler accepts from (-1 when connections are dispatched)
+    /*
+        the pipe where the dispatcher writes accepted descriptors (ACCEPT_DISPATCH only).
+        every handler has one anyway, because it's also how the handler is asked to print its
+        allocator stats (HANDLER_INBOX_STATS is written instead of a descriptor).
+    */
+    int inbox[2];
+
+    io_engine engine;
+    struct uring_engine* uring; // the engine's state (IO_ENGINE_URING only, it's created by the handler's thread)
+
+    const char* www_path; // prepended to every requested path
+    size_t www_path_length;
+    file_cache* cache; // shared by every handler
+    path_index* index; // the files under www_path, shared by every handler (NULL if they aren't indexed)
+    handler_memory memory; // owned by the handler's thread: connections, responses and their buffers come from here
+    http_date date; // refreshed by the event loop, shared by all the handler's responses
+    handler_load load; // published for the dispatcher, in a cache line of its own (check h/load.h)
+    handler_metrics metrics; // only the handler writes them, METRICS_PATH reads them (check h/metrics.h)
+    metrics_registry* registry; // every handler's metrics, for the stats page
+
+    /*
+        the reverse proxy (NULL if there are no routes): the routes are shared, the upstream connections are the handler's.
+        contexts closed in a round are only destroyed at its end, when nothing in the batch can point to them anymore
+        (a single round may have events for both a client and the upstream answering it).
+    */
+    const proxy* proxy;
+    proxy_pool proxy_pool;
+    connection_context* closed;
+
+    access_log_ring* log; // the handler's ring in the access log (NULL if there's no access log)
+
+    bool http2; // connections can switch to HTTP/2 (epoll engine only, check h/http2.h)
+    int http2_max_streams; // streams a client can have open at once on a connection
+
 } handler;
 
-void handler_init(handler* handler, int max_events, int buf_size, int max_request_size);
\ No newline at end of file
+#define HANDLER_INBOX_STATS -1
+
+void handler_init(handler* handler, int id, const server_config* config, int listen_fd, file_cache* cache, metrics_registry* registry, const proxy* proxy, path_index* index, access_log* log);
+extern bool handler_dispatch(handler* handler, int client_fd);
+extern void handler_assign(handler* handler);
+extern void handler_request_stats(handler* handler);
+
+/*
+    shared by the I/O engines
+*/
+extern void handler_set_deadline(handler* current_handler, connection_context* ctx, handler_deadline kind);
+extern void handler_clear_deadline(handler* current_handler, connection_context* ctx);
+extern void handler_await_request(handler* current_handler, connection_context* ctx);
+extern int handler_wait_timeout(handler* current_handler);
+extern void handler_expire_deadlines(handler* current_handler, void (*close_connection)(handler*, connection_context*));
+extern void handler_print_deadline_stats(handler* current_handler, FILE* out);
+extern void handler_request_started(handler* current_handler, connection_context* ctx);
+extern void handler_log_request(handler* current_handler, connection_context* ctx);
+extern void handler_log_response(handler* current_handler, connection_context* ctx, int status, off_t bytes);
+extern struct http_response* build_response(handler* current_handler, connection_context* context, http_request* req, file_miss* miss);
+extern bool handler_next_response(handler* current_handler, connection_context* ctx, file_miss* miss);
+extern struct http_response* handler_cached_response(handler* current_handler, connection_context* ctx, file_cache_entry* entry,
+                                                     unsigned int accepted_encodings, const http_conditions* conditions, bool keep_alive);
+extern struct http_response* handler_file_response(handler* current_handler, connection_context* ctx, char* filename, int fd, ino_t inode,
+                                                   off_t size, time_t mtime, const http_conditions* conditions, bool keep_alive);
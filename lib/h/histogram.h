@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    a log-linear histogram, the same idea as HdrHistogram: values below 2^HISTOGRAM_SUB_BITS have a bucket each,
+    bigger ones share a power of two with 2^(HISTOGRAM_SUB_BITS - 1) linear buckets, so every value is
+    known within 1/64 of itself (about 1.6%) from 0 up to 2^64, with a fixed number of counters.
+    recording is an index computation and an increment: no allocation, no search.
+*/
+
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_HALF (1 << (HISTOGRAM_SUB_BITS - 1))
+#define HISTOGRAM_BUCKETS (HISTOGRAM_HALF * (64 - HISTOGRAM_SUB_BITS + 2))
+
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum; // for the mean and the standard deviation
+    double sum_squares;
+} histogram;
+
+extern void histogram_init(histogram* h);
+extern void histogram_record(histogram* h, uint64_t value);
+extern void histogram_merge(histogram* into, const histogram* from);
+extern uint64_t histogram_percentile(const histogram* h, double percentile);
+extern uint64_t histogram_count_at_most(const histogram* h, uint64_t value);
+extern double histogram_mean(const histogram* h);
+extern double histogram_stddev(const histogram* h);
+extern void histogram_print_distribution(const histogram* h, FILE* out, double unit);
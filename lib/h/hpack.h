@@ -0,0 +1,63 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    HPACK (RFC 7541), the header compression of HTTP/2 (check h/http2.h).
+
+    decoding is the whole thing, clients use every part of it: the static table, a dynamic table per connection
+    (fields the client told us to remember) and Huffman-coded strings.
+        - static fields (":method GET", ":path /" ...) come straight from the table, nothing is copied.
+        - the dynamic table keeps its fields in a ring of bytes of its own, twice as big as the table can get:
+          a field always fits in one piece (check hpack_insert), so it's handed out as it is.
+        - Huffman strings are decoded four bits at a time with a state machine built before main() runs.
+    a decoded field is valid until the next one is decoded.
+
+    encoding (responses) only uses the static table: a name it has costs a byte or two, ":status" with the
+    usual codes is a single byte, values go as they are. the dynamic table isn't used, so there's nothing
+    to keep in sync with the client, whatever table size it asks for.
+*/
+
+#define HPACK_TABLE_SIZE 4096 // the dynamic table we allow (SETTINGS_HEADER_TABLE_SIZE's default, we don't change it)
+#define HPACK_TABLE_ENTRIES (HPACK_TABLE_SIZE / 32) // every field costs 32 bytes more than its name and value
+#define HPACK_STATIC_ENTRIES 61
+
+typedef struct {
+    const char* name;
+    size_t name_length;
+    const char* value;
+    size_t value_length;
+} hpack_field;
+
+typedef struct {
+    uint32_t offset; // in "bytes", the name is followed by the value
+    uint32_t name_length;
+    uint32_t value_length;
+} hpack_entry;
+
+typedef struct {
+    char bytes[2 * HPACK_TABLE_SIZE];
+    hpack_entry entries[HPACK_TABLE_ENTRIES]; // a ring: "first" is the oldest entry, the newest is index 62
+    int first;
+    int count;
+    size_t size; // as HPACK counts it: name + value + 32 for every entry
+    size_t max_size; // what the client's last size update asked for (never more than HPACK_TABLE_SIZE)
+    char* scratch; // Huffman-decoded names and values
+    size_t scratch_size;
+} hpack_decoder;
+
+typedef enum {
+    HPACK_FIELD = 1,
+    HPACK_SIZE_UPDATE = 0, // nothing to look at, go on with the next one
+    HPACK_ERROR = -1 // the block is broken: the connection's table can't be trusted anymore
+} hpack_result;
+
+extern void hpack_decoder_init(hpack_decoder* decoder);
+extern void hpack_decoder_free(hpack_decoder* decoder);
+extern hpack_result hpack_decode(hpack_decoder* decoder, const uint8_t** in, const uint8_t* end, hpack_field* field);
+
+#define HPACK_FIELD_MAX(name_length, value_length) ((name_length) + (value_length) + 12) // the most hpack_encode_field can write
+
+extern size_t hpack_encode_status(char* out, int status);
+extern size_t hpack_encode_field(char* out, const char* name, size_t name_length, const char* value, size_t value_length);
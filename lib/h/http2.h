@@ -0,0 +1,126 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "hpack.h"
+#include "http_request.h"
+
+struct handler;
+struct connection_context;
+struct http_response;
+
+/*
+    HTTP/2 over cleartext TCP (h2c, RFC 9113), next to HTTP/1.1 on the same port (epoll engine only).
+    a connection becomes an HTTP/2 session in one of two ways:
+        - prior knowledge: its first bytes are the client's preface ("PRI * HTTP/2.0...").
+        - Upgrade: a GET without a body asks for "Upgrade: h2c" with its settings in HTTP2-Settings, it's answered
+          with a 101 and its response goes out as stream 1.
+    from there on, ctx->http2 takes the place of ctx->response: the connection's buffer holds frames instead of a request.
+
+        - every stream borrows a connection context from the handler's slab (context_release gives it back):
+          its request is rebuilt as an HTTP/1.1 head in the context's buffer, so the parser, build_response,
+          the file cache, the path index, the stats page and the access log work on it as they do on any other request.
+        - the response's head (already serialized for HTTP/1.1) is turned into a HEADERS frame (check h/hpack.h),
+          what's left of the chain is the body: cached and in-memory bodies go out of the chain with sendmsg(),
+          file bodies with sendfile() right after their frame's head, so bodies are never copied.
+        - streams take turns: the ready ones are in a ring and each one writes a frame (up to the client's
+          SETTINGS_MAX_FRAME_SIZE) before going back at its end. DATA frames of several streams go out with a
+          single sendmsg() (a frame whose body is in a file ends the batch, sendfile() sends it right after).
+        - flow control: a stream writes as long as its window and the connection's let it, WINDOW_UPDATE wakes it up.
+          we don't take request bodies (only GET is served), so DATA from the client is thrown away
+          and its bytes are given back to its windows right away.
+        - a request only needs a response that can be built right away, so streams never wait for anything but the socket
+          and the client's windows. proxied routes can't be served on a stream (the proxy writes HTTP/1.1 straight
+          to the socket): they are answered with a 421, the client can ask again on an HTTP/1.1 connection.
+        - errors that break the connection (a bad frame, a broken header block...) send a GOAWAY and close it
+          once it's out. after "keep-alive-requests" streams the session says GOAWAY too, finishing the ones it has.
+*/
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LENGTH 24
+#define HTTP2_FRAME_HEAD 9
+#define HTTP2_MAX_FRAME 16384 // the biggest frame we take (SETTINGS_MAX_FRAME_SIZE's default, we don't change it)
+#define HTTP2_WINDOW 65535 // the windows every stream and the connection start with (both ways)
+#define HTTP2_BATCH 16 // frames written with a single sendmsg()
+#define HTTP2_HEAD_MAX 8192 // the biggest response head we translate
+#define HTTP2_OUTPUT_MAX (1024 * 1024) // control frames and heads a client can leave unread before it's dropped
+
+typedef struct http2_stream {
+    uint32_t id;
+    struct connection_context* ctx; // the request, the response's arena and its memory
+    struct http_response* response; // its body is what's left of the chain (and of the file)
+    long window; // bytes we can send on it (it can go below 0 when the client shrinks SETTINGS_INITIAL_WINDOW_SIZE)
+    off_t body_left; // bytes of the body not in a frame yet
+    int batched; // frames of this stream in the batch being written
+    size_t batched_chain; // bytes of the chain in those frames
+    off_t batched_file; // and bytes of the file
+    bool request_ended; // the client is done with the stream (END_STREAM)
+    bool head_only; // a HEAD: whatever the response's body is, it's left out
+    bool ready; // in the session's ring of streams with something to write
+    bool reset; // the client reset it while it had frames in the batch: it goes once they are out
+    struct http2_stream* next_ready;
+} http2_stream;
+
+typedef struct {
+    http2_stream* stream;
+    unsigned char head[HTTP2_FRAME_HEAD];
+    size_t head_sent;
+    size_t length; // of the payload
+    size_t sent;
+    bool file; // the payload comes from the response's file (it's the last frame of the batch)
+    bool last; // END_STREAM
+} http2_frame;
+
+typedef enum {
+    HTTP2_DONE, // everything that could be written was written
+    HTTP2_BLOCKED, // the socket is full
+    HTTP2_YIELD, // the connection wrote its share for this round
+    HTTP2_CLOSE, // the session is over (its GOAWAY is out, or the client's came and every stream is done)
+    HTTP2_ERROR
+} http2_result;
+
+typedef struct http2_session {
+    struct connection_context* ctx;
+    bool preface; // the client's preface is in
+    bool settings; // and its first SETTINGS
+    bool going_away; // we sent a GOAWAY (or the client did): no new streams
+    bool broken; // we sent it because of an error: nothing the client sends matters anymore
+    uint32_t last_stream_id; // the highest stream the client opened
+    uint32_t max_frame; // the client's SETTINGS_MAX_FRAME_SIZE
+    long initial_window; // the client's SETTINGS_INITIAL_WINDOW_SIZE
+    long window; // the connection's send window
+    long received; // DATA bytes not given back with a WINDOW_UPDATE yet
+    int max_streams; // SETTINGS_MAX_CONCURRENT_STREAMS
+    http2_stream** streams;
+    int stream_count;
+    http2_stream* ready_first; // the ring of streams with something to write
+    http2_stream* ready_last;
+    /*
+        a header block, from its HEADERS frame and any CONTINUATION after it
+    */
+    uint32_t block_stream; // 0 when there's none
+    bool block_end_stream;
+    unsigned char* block;
+    size_t block_length;
+    size_t block_size;
+    hpack_decoder decoder;
+    /*
+        what goes out: control frames and heads in "output", then the batch of DATA frames.
+        a frame of the batch can't be cut by anything else, so once the batch has started the output waits for it.
+    */
+    char* output;
+    size_t output_length;
+    size_t output_sent;
+    size_t output_size;
+    http2_frame frames[HTTP2_BATCH];
+    int frame_count;
+} http2_session;
+
+extern bool http2_is_preface(const char* data, size_t length);
+extern bool http2_upgrade_requested(http_request* req);
+extern void http2_start(struct handler* current_handler, struct connection_context* ctx);
+extern bool http2_upgrade(struct handler* current_handler, struct connection_context* ctx, int head_length);
+extern void http2_receive(struct handler* current_handler, struct connection_context* ctx);
+extern http2_result http2_send(struct handler* current_handler, http2_session* session);
+extern bool http2_waiting(const http2_session* session);
+extern void http2_session_destroy(struct handler* current_handler, http2_session* session);
@@ -0,0 +1,20 @@
+#pragma once
+#include <time.h>
+
+/*
+    the Date header is the same for every response sent in the same second, so every handler
+    keeps it formatted and its event loop refreshes it (at most once per second) when it wakes up.
+*/
+
+#define HTTP_DATE_LENGTH 37 // "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n", always the same length
+#define HTTP_DATE_VALUE_LENGTH 29 // the date alone
+
+typedef struct {
+    time_t second; // when "header" was formatted
+    char header[HTTP_DATE_LENGTH + 1];
+} http_date;
+
+extern void http_date_init(http_date* date);
+extern void http_date_update(http_date* date);
+extern int http_date_write(char* out, time_t second);
+extern time_t http_date_parse(const char* text, size_t length);
@@ -1,23 +1,134 @@
 #pragma once
 /*
     we'll only handle GET requests for simplicity.
-    what we need is a way to parse simple requests (we will only parse the filename and the method)
+
+    the parser works in place on the connection's receive buffer: nothing is copied and nothing is allocated,
+    every piece of the request (method, path, version, headers) is a view (pointer + length) into that buffer.
+    it is incremental too: it can be called again every time new bytes are received, and it will resume from the
+    line it stopped at, so every byte is looked at once, no matter how many recv() it takes to get the whole request.
 */
 #include <stdio.h>
-#include "connection_context.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define HTTP_MAX_HEADERS 64
+#define HTTP_MAX_CONTENT_LENGTH (LONG_MAX / 2) // bigger lengths are refused, so a head's length can always be added to one
+
 typedef enum {
-    GET
+    GET,
+    UNIMPLEMENTED_METHOD
 } http_method;
 
 typedef struct {
-    char* bytes;
+    const char* ptr;
     size_t length;
-    int lines_num;
-    char** lines;
+} http_view;
+
+/*
+    the content codings epolly can answer with, from the least to the most preferred
+    (check http_request_accepted_encodings).
+*/
+typedef enum {
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_BROTLI,
+    ENCODINGS
+} content_encoding;
+
+#define ENCODING_BIT(encoding) (1u << (encoding))
+
+/*
+    the validators a client sent back (If-None-Match and If-Modified-Since, check http_conditions_not_modified)
+    and the part of the file it wants (Range, and If-Range to make sure it's still the same file, check http_conditions_ranges).
+*/
+typedef struct {
+    const char* if_none_match; // NULL if there's none
+    size_t if_none_match_length;
+    time_t if_modified_since; // -1 if there's none (or it isn't a date we understand)
+    const char* range; // NULL if there's none
+    size_t range_length;
+    const char* if_range; // NULL if there's none
+    size_t if_range_length;
+} http_conditions;
+
+#define HTTP_RANGES_MAX 8 // a Range with more parts than this is ignored (the whole file is sent)
+#define HTTP_RANGES_UNSATISFIABLE -1
+
+typedef struct {
+    off_t start;
+    off_t end; // excluded
+} http_range;
+
+typedef struct {
+    http_view name;
+    http_view value;
+} http_header;
+
+/*
+    what http_request_parse returns: a positive value is the length of the request head
+    (request line + headers + empty line), the request is complete and every view is valid.
+*/
+typedef enum {
+    HTTP_PARSE_ERROR = -1, // malformed request
+    HTTP_PARSE_INCOMPLETE = 0 // we need more bytes
+} http_parse_result;
+
+/*
+    what http_request_filename returns when there's no file name (otherwise it's the name's length)
+*/
+typedef enum {
+    HTTP_FILENAME_TOO_LONG = -1,
+    HTTP_FILENAME_INVALID = -2 // a path that climbs above the root, or that can't be decoded
+} http_filename_result;
+
+typedef enum {
+    PARSING_REQUEST_LINE,
+    PARSING_HEADERS
+} http_parse_state;
+
+/*
+    the SIMD flavour used to look for line endings and delimiters,
+    the best one supported by the CPU is picked at startup.
+*/
+typedef enum {
+    HTTP_SIMD_SCALAR,
+    HTTP_SIMD_SSE42,
+    HTTP_SIMD_AVX2
+} http_simd_level;
+
+typedef struct {
     http_method method;
-    char* filename;
-    int filename_max_length;
-    int filename_actual_length;
+    http_view method_name;
+    http_view path; // the request target, exactly as the client sent it
+    http_view version;
+    int minor_version; // HTTP/1.x
+    http_header headers[HTTP_MAX_HEADERS];
+    int headers_num;
+    bool keep_alive; // whether the client wants the connection to stay open after the response
+    off_t content_length; // the body's length, -1 if there's no Content-Length
+    bool transfer_encoding; // the body is encoded (chunked): we can't tell where it ends without reading it
+
+    /*
+        parser state, so the parsing can be resumed when more bytes arrive.
+        the buffer may be moved (realloc) between two calls: "base" tells us where the views were pointing to.
+    */
+    const char* base;
+    size_t line_start; // where the line we are waiting for starts
+    size_t scanned; // bytes (from line_start on) that we already know don't contain a newline
+    http_parse_state state;
 } http_request;
 
-extern int http_request_create(http_request* req, connection_context* ctx);
\ No newline at end of file
+extern void http_request_init(http_request* req);
+extern int http_request_parse(http_request* req, const char* data, size_t length);
+extern http_view* http_request_header(http_request* req, const char* name);
+extern bool http_request_has_token(http_request* req, const char* name, const char* token);
+extern unsigned int http_request_accepted_encodings(http_request* req);
+extern void http_request_conditions(http_request* req, http_conditions* conditions);
+extern bool http_conditions_not_modified(const http_conditions* conditions, const char* etag, size_t etag_length, time_t last_modified);
+extern int http_conditions_ranges(const http_conditions* conditions, off_t size, const char* etag, size_t etag_length, time_t last_modified, http_range* ranges);
+extern int http_request_filename(http_request* req, const char* www_path, size_t www_path_len, char* filename, size_t size);
+extern bool http_request_use_simd(http_simd_level level);
+extern http_simd_level http_request_simd_level(void);
@@ -1,36 +1,97 @@
 #pragma once
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "file_cache.h"
+#include "memory.h"
+#include "http_date.h"
+#include "load.h"
 
+struct connection_context;
+
+#define HTTP_RESPONSE_IOVECS 7 // status line, Server, Connection, Date + Content-Length, extra headers, empty line, body
+#define HTTP_RESPONSE_DYNAMIC_HEADERS (HTTP_DATE_LENGTH + 16 + 20 + 2) // Date + "Content-Length: " + 20 digits + CRLF
+
+/*
+    a piece of a multipart/byteranges body (check (5. ) below): its delimiter and headers, then the bytes of the file
+    from "start" to "end" (excluded). the closing delimiter is a last part without bytes.
+*/
 typedef struct {
+    char* head;
+    int head_length;
+    off_t start;
+    off_t end;
+} http_response_part;
+
+typedef struct http_response {
     int status;
-    int content_length;
-    int headers_length;
-    int response_length;
-    int date_header_length;
-    char* date_header;
-    int full_length;
+    off_t content_length;
     /*
         (1. )
         we need to save the socket inside this struct, because otherwise we will
         lose the file descriptor once we attach a response to an epoll
     */
     int socket;
-    char* body;
-    char* headers;
-    char* stringified;
     /*
         (2. )
-        the stream_ptr variable will be useful when the request will be streamed to the client.
-        with this variable will act as a "file pointer" to our stream, because
-        it will be incremented for each byte written to the client, so we know
-        where we left off!
+        the response is never concatenated in a single buffer: it's a chain of pieces (iovecs)
+        that goes to the socket with a single sendmsg().
+        static pieces (status lines, constant headers, the empty line, canned error pages) point straight
+        to read-only data, dynamic headers live in the response itself and bodies are borrowed
+        (from the caller or the cache entry), so building a response never copies the body.
+        a write may stop anywhere in the chain: "iov_next" is the first piece that hasn't been fully written,
+        and the written part of that piece is cut away (check http_response_advance), so we know where we left off!
+    */
+    struct iovec iov[HTTP_RESPONSE_IOVECS];
+    int iov_count;
+    int iov_next;
+    bool keep_alive; // if false, the connection is closed as soon as the response has been written
+    /*
+        (3. )
+        file-backed responses: the chain only holds the status line and the headers.
+        once the headers are out, the body is sent straight from the file descriptor with sendfile(), from "body_offset"
+        to "body_end" (the file's size, or the end of the range that was asked for).
+        the body offset is kept by us (not by the kernel) so partial writes can resume where they stopped.
+    */
+    int file_fd; // -1 if the body doesn't come from a file
+    file_cache_entry* cache_entry; // NULL if the body doesn't come from the file cache (if it does, it's the last piece of the chain)
+    off_t body_offset;
+    off_t body_end;
+    /*
+        (5. )
+        a multipart/byteranges body is sent a part at a time: once the chain and the file's bytes are out,
+        http_response_next_part refills the chain with the next part's headers (and its bytes, for cached files)
+        or points body_offset and body_end at them. the parts live in the connection's arena.
+    */
+    http_response_part* parts;
+    int part_count;
+    int part_next;
+    /*
+        (4. )
+        the response itself comes from the handler's responses slab, with room for its dynamic headers:
+        building one never allocates. what the request left in the connection's arena is reset with it.
     */
-    int stream_ptr;
+    handler_memory* memory;
+    arena* arena;
+    handler_load* load; // the body counts in the handler's pending bytes until the response is destroyed
+    char dynamic_headers[HTTP_RESPONSE_DYNAMIC_HEADERS];
 } http_response;
 
-extern http_response* http_response_create(int status, char* headers, char* body, int socket_fd);
-extern http_response* http_response_bad_request(int socket_fd);
-extern http_response* http_response_uninmplemented_method(int socket_fd);
-extern http_response* http_response_filename_too_long(int socket_fd);
-extern http_response* http_response_internal_server_error(int socket_fd);
-extern http_response* http_response_not_found(int socket_fd);
-extern char* http_response_stringify(http_response* res);
\ No newline at end of file
+extern http_response* http_response_create(int status, char* headers, const char* body, size_t body_length, struct connection_context* ctx, bool keep_alive);
+extern http_response* http_response_create_file(int status, char* headers, int file_fd, off_t file_size, struct connection_context* ctx, bool keep_alive);
+extern http_response* http_response_create_cached(file_cache_entry* entry, const file_cache_variant* variant, struct connection_context* ctx, bool keep_alive);
+extern http_response* http_response_create_not_modified(file_cache_entry* entry, const file_cache_variant* variant, struct connection_context* ctx, bool keep_alive);
+extern http_response* http_response_canned(int status, struct connection_context* ctx, bool keep_alive);
+extern char* http_response_serialize_head(int status, char* headers, off_t content_length, int* head_length);
+extern http_response* http_response_bad_request(struct connection_context* ctx);
+extern http_response* http_response_uninmplemented_method(struct connection_context* ctx);
+extern http_response* http_response_filename_too_long(struct connection_context* ctx);
+extern http_response* http_response_internal_server_error(struct connection_context* ctx);
+extern http_response* http_response_not_found(struct connection_context* ctx, bool keep_alive);
+extern http_response* http_response_create_ranges(file_cache_entry* entry, int file_fd, char* headers, char* mime_type, off_t size,
+                                                  const http_range* ranges, int range_count, struct connection_context* ctx, bool keep_alive);
+extern http_response* http_response_range_not_satisfiable(off_t size, struct connection_context* ctx, bool keep_alive);
+extern bool http_response_chain_written(http_response* res);
+extern bool http_response_next_part(http_response* res);
+extern void http_response_advance(http_response* res, size_t written_bytes);
+extern void http_response_destroy(http_response* res);
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+    how busy a handler is right now. the handler's thread keeps these counters up to date and
+    whoever hands out connections (the dispatcher) reads them, so they are atomics (relaxed: they are
+    only hints, nobody synchronizes on them).
+    every handler's counters live in a cache line of their own, so publishing them doesn't
+    bounce the lines the handlers (or the dispatcher) are working on.
+*/
+
+#define LOAD_CACHE_LINE 64
+
+/*
+    the score of a handler is measured in "connections":
+    LOAD_BYTES_PER_CONNECTION bytes waiting to be written and LOAD_LATENCY_PER_CONNECTION_US
+    microseconds of event loop latency weigh as much as an open connection.
+*/
+#define LOAD_BYTES_PER_CONNECTION (64 * 1024)
+#define LOAD_LATENCY_PER_CONNECTION_US 100
+
+typedef struct {
+    atomic_long connections; // open connections (dispatched ones count as soon as they are written in the inbox)
+    atomic_long pending_bytes; // bodies of the responses that are being written
+    atomic_long loop_latency_us; // how long a round of the event loop takes (moving average)
+    atomic_long assigned; // connections ever assigned to the handler
+} __attribute__((aligned(LOAD_CACHE_LINE))) handler_load;
+
+extern void load_init(handler_load* load);
+extern void load_add(atomic_long* counter, long delta);
+extern long load_get(atomic_long* counter);
+extern void load_loop_start(struct timespec* start);
+extern long load_loop_done(handler_load* load, const struct timespec* start);
+extern long load_score(handler_load* load);
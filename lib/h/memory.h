@@ -0,0 +1,78 @@
+#pragma once
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+    every handler owns its memory: nothing here is shared between threads, so there are no locks at all.
+
+    - slabs hand out fixed-size objects (connections, responses, receive buffers, arena blocks).
+      freed objects go back to a free list and are reused, so under a steady load the handler
+      stops calling malloc() at all and its memory stays flat.
+    - arenas are bump allocators used for everything that lives as long as a single response
+      (headers, bodies of error pages...). nothing is freed one by one: when the response has been
+      written the arena is reset in O(1) (its blocks are kept for the next response on the same connection)
+      and its blocks go back to the slab only when the connection is closed.
+*/
+
+typedef struct {
+    size_t allocations; // slab_alloc() calls
+    size_t in_use; // objects currently handed out
+    size_t peak; // the highest "in_use" ever seen
+    size_t chunks; // chunks malloc'ed so far (every chunk holds "objects_per_chunk" objects)
+} slab_stats;
+
+typedef struct {
+    size_t object_size;
+    int objects_per_chunk;
+    void* free_list; // freed objects are linked through their first bytes
+    void* chunks; // every chunk starts with a pointer to the previous one
+    slab_stats stats;
+} slab;
+
+typedef struct arena_block {
+    struct arena_block* next;
+    size_t used;
+    char data[];
+} arena_block;
+
+typedef struct {
+    size_t allocations; // arena_alloc() calls
+    size_t bytes; // bytes handed out by arena_alloc()
+    size_t resets;
+    size_t oversized; // allocations too big for a block, they fall back to malloc()
+} arena_stats;
+
+typedef struct arena_large {
+    struct arena_large* next;
+} arena_large;
+
+typedef struct {
+    slab* blocks; // where the blocks come from (the block size is the slab's object size)
+    arena_stats* stats; // shared by all the arenas of a handler
+    arena_block* first;
+    arena_block* current;
+    arena_large* large; // oversized allocations, freed on reset
+} arena;
+
+/*
+    all the allocators of a handler
+*/
+typedef struct {
+    slab connections;
+    slab responses;
+    slab buffers; // receive buffers ("request_buffer_size" bytes each)
+    slab arena_blocks;
+    arena_stats arenas;
+} handler_memory;
+
+extern void slab_init(slab* slab, size_t object_size, int objects_per_chunk);
+extern void* slab_alloc(slab* slab);
+extern void slab_free(slab* slab, void* object);
+
+extern void arena_init(arena* arena, slab* blocks, arena_stats* stats);
+extern void* arena_alloc(arena* arena, size_t size);
+extern void arena_reset(arena* arena);
+extern void arena_release(arena* arena);
+
+extern void handler_memory_init(handler_memory* memory, size_t connection_size, size_t response_size, size_t buffer_size);
+extern void handler_memory_print_stats(handler_memory* memory, int handler_id, FILE* out);
@@ -0,0 +1,96 @@
+#pragma once
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+#include "histogram.h"
+#include "load.h"
+
+/*
+    what the handlers have been doing, for whoever scrapes METRICS_PATH.
+
+    every handler owns a block of counters and histograms and it's the only one writing it, so nothing is ever
+    locked and no read-modify-write is needed: a counter is bumped with a relaxed load and a relaxed store
+    (plain moves on x86 and arm), the histograms are plain arrays. the block starts on a cache line of its own,
+    so a handler never shares a line with another handler's counters.
+    the page is built by whichever handler gets the request, adding up every block as it reads it:
+    a counter may be a few requests behind the others, which is fine for something scraped every few seconds.
+
+    building with -DMETRICS_DISABLED turns the recording functions into no-ops (check make metrics-bench),
+    the page is still there but it reads all zeros.
+*/
+
+#define METRICS_PATH "/__stats" // "?format=json" (or "Accept: application/json") for JSON, Prometheus text otherwise
+#define METRICS_STATUS_CLASSES 6 // 1xx...5xx, 0 is for anything else
+#define METRICS_PENDING 256 // responses completed in a round, waiting for the round's end to be timed
+
+typedef enum {
+    METRIC_REQUESTS, // responses fully written
+    METRIC_BYTES_RECEIVED,
+    METRIC_BYTES_SENT,
+    METRIC_CONNECTIONS_ACCEPTED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_ACCEPT_ERRORS,
+    METRIC_SEND_BLOCKED, // writes that found the socket full (EAGAIN, or a short write with io_uring)
+    METRIC_TIMEOUTS_HEADER, // in the same order as handler_deadline
+    METRIC_TIMEOUTS_IDLE,
+    METRIC_TIMEOUTS_WRITE,
+    METRIC_LOOP_ROUNDS,
+    METRIC_ACCESS_LOG_DROPPED, // records the access log's flusher had no room for
+    METRIC_HTTP2_SESSIONS, // connections that became HTTP/2 (check h/http2.h)
+    METRIC_HTTP2_STREAMS,
+    METRIC_COUNTERS
+} metric_counter;
+
+typedef struct {
+    atomic_ulong counters[METRIC_COUNTERS];
+    atomic_ulong statuses[METRICS_STATUS_CLASSES];
+    histogram request_latency; // nanoseconds from the round a request was complete in to the round its last byte was written in
+    histogram loop_time; // nanoseconds a round of the event loop takes (from the wakeup to the next wait)
+    /*
+        the clock is only read once at the start and once at the end of a round (the handler does it anyway, check h/load.h),
+        a request starts when the round it was complete in started and ends when the round its response was written in ends,
+        so its latency is off by less than a round (the loop_time histogram tells how long that is).
+        only the handler touches these.
+    */
+    unsigned long long round_ns; // when the current round started
+    unsigned long long pending[METRICS_PENDING]; // when the responses written in this round were started
+    int pending_count;
+} __attribute__((aligned(LOAD_CACHE_LINE))) handler_metrics;
+
+/*
+    where the page finds every handler's block (and its load, for the gauges).
+    the server fills it before the handlers start, then it's only read.
+*/
+typedef struct {
+    handler_metrics* metrics;
+    handler_load* load;
+} metrics_source;
+
+typedef struct {
+    int num_handlers;
+    metrics_source* handlers;
+    atomic_ulong dispatcher_accept_errors; // accepts that failed in the dispatcher (ACCEPT_DISPATCH), only its thread writes it
+} metrics_registry;
+
+typedef enum {
+    METRICS_PROMETHEUS,
+    METRICS_JSON
+} metrics_format;
+
+extern void metrics_init(handler_metrics* metrics);
+extern metrics_registry* metrics_registry_create(int num_handlers);
+extern void metrics_register(metrics_registry* registry, int id, handler_metrics* metrics, handler_load* load);
+extern size_t metrics_page_size(const metrics_registry* registry);
+extern size_t metrics_render(const metrics_registry* registry, metrics_format format, char* out, size_t size);
+
+#ifdef METRICS_DISABLED
+#define metrics_add(metrics, counter, value) ((void) 0)
+#define metrics_round_start(metrics, start) ((void) 0)
+#define metrics_round_done(metrics, elapsed_ns) ((void) (elapsed_ns))
+#define metrics_response_done(metrics, status, started_ns) ((void) 0)
+#else
+extern void metrics_add(handler_metrics* metrics, metric_counter counter, unsigned long value);
+extern void metrics_round_start(handler_metrics* metrics, const struct timespec* start);
+extern void metrics_round_done(handler_metrics* metrics, long elapsed_ns);
+extern void metrics_response_done(handler_metrics* metrics, int status, unsigned long long started_ns);
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "config.h"
+
+struct file_cache;
+
+/*
+    the path index: every regular file under the root, found once at startup (and again whenever the tree changes),
+    keyed by its normalized url path ("/css/site.css"). it tells a handler whether a file exists without
+    a single syscall, so requests for files that don't exist get their 404 straight away,
+    and the ones that do skip the open() path walk and the fstat(): the index keeps every file open (as long as
+    there are descriptors to spare) together with its metadata. a descriptor is checked (fstat) before it's handed out:
+    the file may have been rewritten or replaced since the tree was indexed, and the snapshot only catches up
+    once the changes stop coming.
+
+    a snapshot is immutable: lookups go through a minimal perfect hash (hash and displace, check path_index_place),
+    a bucket's seed and a single probe of a table with exactly one slot per file.
+    a watcher thread rebuilds the snapshot from scratch when anything changes under the root (inotify on every directory)
+    and swaps it in: handlers only hold the read lock for the length of a lookup.
+    the files that changed from one snapshot to the next are dropped from the file cache, in case it loaded
+    one of them while the old snapshot was still there.
+*/
+
+typedef struct {
+    char* path; // the url path, normalized (what http_request_filename writes after the root)
+    size_t path_length;
+    uint64_t hash;
+    int fd; // -1 if we ran out of descriptors while building (the file is opened when it's asked for)
+    struct stat file_stat;
+} path_index_entry;
+
+typedef struct {
+    path_index_entry* entries; // entries[slot], one per file
+    uint32_t count;
+    uint32_t* seeds; // a seed per bucket: a key's slot is hash(key, seeds[bucket(key)]) % count
+    uint32_t bucket_count;
+    uint64_t salt; // picked again if no seeds can be found for it
+    char* paths; // every entry's path, back to back
+} path_index_snapshot;
+
+typedef struct {
+    char root[PATH_MAX];
+    size_t root_length;
+    int max_files; // a tree with more files than this isn't indexed
+    pthread_rwlock_t lock; // held for reading by lookups, for writing by the swap
+    path_index_snapshot* snapshot;
+    int inotify_fd;
+    pthread_t watcher;
+    struct file_cache* cache; // its keys are the configured root followed by the url path
+    const char* www_path;
+} path_index;
+
+extern path_index* path_index_create(const server_config* config, struct file_cache* cache);
+extern bool path_index_contains(path_index* index, const char* path, size_t length);
+extern int path_index_open(path_index* index, const char* path, size_t length, struct stat* file_stat);
@@ -0,0 +1,162 @@
+#pragma once
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "config.h"
+#include "http_request.h"
+#include "timer_wheel.h"
+
+struct connection_context;
+struct handler;
+
+/*
+    the reverse proxy: requests whose path starts with a route's prefix are forwarded to one of its upstreams
+    (local app servers, over TCP or Unix sockets) by the same event loop that serves the files (epoll engine only).
+
+        - every handler keeps a pool of idle keep-alive connections to every upstream: a request takes one
+          (or connects a new one, without blocking), the connection goes back to the pool once the response is over.
+          a pooled connection the upstream closed in the meantime is retried once with a new one.
+        - the request (head and Content-Length body, which must fit in "max-request") is copied once,
+          the response's head is read and rewritten for the client (hop-by-hop headers, Connection),
+          then its body goes upstream -> pipe -> client with splice(): it never reaches userspace.
+          chunked bodies are spliced as they are, the chunk sizes are only peeked at to know where the body ends.
+        - the connect timeout bounds the connect, the read timeout the wait for every byte of the response.
+          a failure before anything was written to the client becomes a 502 (a 504 on timeouts), after that
+          the client's connection is closed.
+        - a thread checks every upstream's health (a GET of "proxy-health-path") every few seconds: requests
+          skip the upstreams that fail it, or that refused a connection since the last check, a route with
+          no healthy upstream answers 503.
+*/
+
+#define PROXY_HEAD_MAX 8192 // the biggest response head accepted from an upstream
+#define PROXY_PIPE_SIZE (256 * 1024) // bytes moved through the pipe with a single splice
+#define PROXY_UPSTREAMS (CONFIG_PROXY_ROUTES * CONFIG_PROXY_UPSTREAMS)
+/*
+    upstream sockets are in the handler's epoll next to the clients: their event data is the connection's
+    address with this bit set (connections are aligned, so it's always clear otherwise).
+*/
+#define PROXY_EVENT_TAG 1
+
+typedef struct {
+    char name[128]; // as it was configured
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    int id; // where its idle connections are in every handler's pool
+    atomic_bool healthy; // written by the health checker (and by handlers that couldn't connect), read by every handler
+} proxy_upstream;
+
+typedef struct {
+    char prefix[128];
+    size_t prefix_length;
+    proxy_upstream* upstreams[CONFIG_PROXY_UPSTREAMS];
+    int upstream_count;
+} proxy_route;
+
+/*
+    the routes and the upstreams, shared by every handler: only the health flags change once it's created.
+*/
+typedef struct {
+    proxy_route routes[CONFIG_PROXY_ROUTES];
+    int route_count;
+    proxy_upstream upstreams[PROXY_UPSTREAMS];
+    int upstream_count;
+    int connect_timeout;
+    int read_timeout;
+    int idle_timeout;
+    int health_interval;
+    char health_path[PATH_MAX];
+    pthread_t health_thread;
+} proxy;
+
+typedef enum {
+    PROXY_CONNECTING,
+    PROXY_SENDING, // the request
+    PROXY_READING_HEAD,
+    PROXY_WRITING_HEAD, // the rewritten head, to the client
+    PROXY_BODY,
+    PROXY_IDLE // in the pool
+} proxy_state;
+
+typedef enum {
+    PROXY_BODY_NONE, // HEAD requests, 204 and 304
+    PROXY_BODY_LENGTH,
+    PROXY_BODY_CHUNKED,
+    PROXY_BODY_CLOSE // ends when the upstream closes the connection
+} proxy_framing;
+
+typedef struct proxy_connection {
+    int fd;
+    proxy_upstream* upstream;
+    proxy_state state;
+    struct connection_context* client; // NULL while it's idle in the pool
+    struct proxy_connection* next; // in the pool
+    bool reused; // it came from the pool: if it fails before the response starts, the request is sent again on a new one
+    bool failed; // the connect failed, or a deadline passed (check proxy_expire)
+    bool timed_out;
+    timer deadline; // in the pool's timer wheel (connect, read or idle)
+    /*
+        the request, copied from the client's buffer (the client may pipeline more bytes behind it)
+    */
+    char* request;
+    size_t request_length;
+    size_t request_sent;
+    /*
+        the response: its head is read and rewritten in the client's arena, then the body is spliced
+    */
+    char* head; // where the upstream's head (then the chunk size lines) is peeked at
+    bool head_request;
+    int status;
+    bool keep_alive; // the client's connection, once this response is over
+    bool upstream_keep_alive; // the upstream's connection
+    char* client_head;
+    size_t client_head_length;
+    size_t client_head_sent;
+    proxy_framing framing;
+    off_t remaining; // bytes of the body (or of the current chunk, with its framing) still to be spliced from the upstream
+    bool last_chunk; // "remaining" is the end of a chunked body
+    int pipe[2];
+    size_t pipe_fill; // bytes in the pipe that the client didn't take yet
+    off_t body_sent; // bytes of the body the client got (for the access log)
+} proxy_connection;
+
+/*
+    a handler's connections: its own, so nothing is shared or locked.
+*/
+typedef struct {
+    const proxy* proxy;
+    proxy_connection* idle[PROXY_UPSTREAMS];
+    int idle_count[PROXY_UPSTREAMS];
+    int size; // idle connections kept per upstream
+    unsigned int next_upstream; // round-robin among a route's healthy upstreams
+    timer_wheel timers;
+    int epoll_fd;
+    proxy_connection* closed; // freed at the end of the event loop's round (check proxy_collect)
+} proxy_pool;
+
+typedef enum {
+    PROXY_DONE, // the response is over
+    PROXY_WAIT_UPSTREAM,
+    PROXY_WAIT_CLIENT, // the client's socket is full
+    PROXY_YIELD, // the client got write_high_watermark bytes in this round
+    PROXY_FAILED
+} proxy_result;
+
+extern proxy* proxy_create(const server_config* config);
+extern void proxy_pool_init(proxy_pool* pool, const proxy* proxy, int pool_size, int epoll_fd);
+extern const proxy_route* proxy_match(const proxy* proxy, const http_request* req);
+extern long proxy_request_length(const http_request* req, int head_length);
+extern proxy_connection* proxy_start(proxy_pool* pool, const proxy_route* route, struct connection_context* client,
+                                     const http_request* req, const char* request, int head_length, size_t length, bool keep_alive);
+extern proxy_result proxy_advance(struct handler* current_handler, proxy_connection* conn);
+extern int proxy_failure_status(const proxy_connection* conn);
+extern bool proxy_response_started(const proxy_connection* conn);
+extern void proxy_finish(proxy_pool* pool, proxy_connection* conn);
+extern void proxy_abort(proxy_pool* pool, proxy_connection* conn);
+extern bool proxy_is_upstream(const void* source);
+extern struct connection_context* proxy_on_event(proxy_pool* pool, const void* source, uint32_t events);
+extern int proxy_wait_timeout(proxy_pool* pool);
+extern void proxy_expire(proxy_pool* pool, struct handler* current_handler, void (*resume)(struct handler*, struct connection_context*));
+extern void proxy_collect(proxy_pool* pool);
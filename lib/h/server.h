@@ -1,16 +1,18 @@
 #pragma once
 #include "handler.h"
 #include <stdbool.h>
+#include <stdio.h>
 
 /*
     the server is the core of the program.
-    this module will accept requests from connecting clients and will dispatch
+    this module creates the listening socket(s) and, depending on the accept strategy,
+    either lets the handlers accept connections by themselves or accepts them and dispatches
     them to certain handlers.
 */
 
 typedef struct {
-    int socket_fd;
-    int epoll_fd;
+    int socket_fd; // the shared listening socket (-1 with ACCEPT_REUSEPORT, every handler has its own)
+    int epoll_fd; // only used by the dispatcher (ACCEPT_DISPATCH)
     short port;
     /*
         how many "parallel" file descriptors (i.e connections) the server will monitor.
@@ -21,19 +23,22 @@ typedef struct {
     int max_connection_events;
     int max_request_size;
     int num_handlers;
-    int selector; // this will be the index of the last accessed handler
+    int selector; // this will be the index of the last accessed handler (DISPATCH_ROUND_ROBIN)
+    unsigned int random_state; // xorshift state for DISPATCH_TWO_CHOICES
+    accept_strategy strategy;
+    dispatch_policy policy;
+    server_config config; // a copy of what the server was started with (the handlers read theirs from here)
+    file_cache* cache;
+    path_index* index; // the files under the root (NULL if they aren't indexed, check h/path_index.h)
+    metrics_registry* registry; // every handler's metrics (the stats page reads them from here)
+    proxy* proxy; // the proxy's routes and upstreams (NULL if there are none)
+    access_log* log; // NULL if there's no access log
     struct epoll_event* connection_events;
     handler* handlers;
     bool active;
 } server;
 
-extern server* server_init(
-    short port, 
-    int max_events, 
-    int num_handlers,
-    int max_epoll_handler_queue_size,
-    int request_buffer_size,
-    int max_request_size
-);
+extern server* server_init(const server_config* config);
 extern void server_loop(server* server);
 extern void server_on_connection(server* server);
+extern void server_print_load(server* server, FILE* out);
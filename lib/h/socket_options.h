@@ -0,0 +1,23 @@
+#pragma once
+#include "config.h"
+
+/*
+    the TCP tuning of the listening sockets, every option comes from the config (check server_config):
+        - TCP_DEFER_ACCEPT: a connection is only handed to accept() once its first bytes arrived,
+          so a handler is never woken up for a connection it can't do anything with yet.
+        - TCP_FASTOPEN: clients that already talked to us send the request with the SYN (it needs the server bit,
+          2, in net.ipv4.tcp_fastopen).
+        - TCP_NODELAY: a response is written with a single sendmsg (or MSG_MORE, check handler_stream_response),
+          Nagle would only hold the last segment back waiting for an ACK.
+        - SO_SNDBUF/SO_RCVBUF: fixed buffer sizes instead of the kernel's autotuning.
+        - SO_BUSY_POLL/SO_PREFER_BUSY_POLL: the device queue is polled for a while before sleeping,
+          trading CPU for latency (check socket_options_epoll too).
+        - TCP_NOTSENT_LOWAT: check write_low_watermark.
+
+    everything is set on the listening socket (before bind, for the buffers' window scaling to see them)
+    and Linux copies it to every socket it accepts, so an accepted connection costs nothing more
+    than the accept4() call (that makes it non-blocking too).
+*/
+
+extern void socket_options_listener(int socket_fd, const server_config* config);
+extern void socket_options_epoll(int epoll_fd, const server_config* config);
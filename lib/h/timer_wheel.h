@@ -0,0 +1,49 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    a hierarchical timer wheel: every handler keeps one for the deadlines of its connections.
+
+    time goes on in ticks of TIMER_WHEEL_TICK_MS. a timer due within 64 ticks sits in the slot of the
+    first level that matches its tick, later ones sit in coarser levels (every slot of level n spans 64^n ticks)
+    and move down a level each time the level below completes a round (the "cascade"), until they fire.
+    slots are circular lists with a sentinel, so scheduling and cancelling are O(1) no matter how many
+    timers there are, and each level has a bitmap of its non-empty slots, so the next wakeup is found with a ctz.
+    four levels reach 64^4 ticks (about 19 days), later deadlines are clamped there.
+
+    timers are embedded in the objects they belong to (connections): the wheel never allocates.
+*/
+
+#define TIMER_WHEEL_TICK_MS 100
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+typedef struct timer {
+    struct timer* prev;
+    struct timer* next; // NULL when the timer isn't scheduled
+    struct timer* list; // the sentinel of the list the timer is in
+    unsigned long expires; // in ticks
+    int kind; // whatever the owner wants to remember about it
+} timer;
+
+typedef struct {
+    unsigned long start_ms; // the clock when the wheel was created, ticks are counted from there
+    unsigned long now; // the last tick that has been processed
+    size_t count; // scheduled timers, expired ones included until they are taken
+    uint64_t occupied[TIMER_WHEEL_LEVELS]; // a bit for every non-empty slot
+    timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    timer expired; // timers that are due, waiting for timer_wheel_next_expired()
+} timer_wheel;
+
+extern unsigned long timer_wheel_clock_ms(void);
+extern void timer_wheel_init(timer_wheel* wheel, unsigned long now_ms);
+extern void timer_init(timer* t);
+extern bool timer_scheduled(timer* t);
+extern void timer_schedule(timer_wheel* wheel, timer* t, unsigned long now_ms, unsigned long delay_ms, int kind);
+extern void timer_cancel(timer_wheel* wheel, timer* t);
+extern void timer_wheel_advance(timer_wheel* wheel, unsigned long now_ms);
+extern timer* timer_wheel_next_expired(timer_wheel* wheel);
+extern int timer_wheel_timeout(timer_wheel* wheel, unsigned long now_ms);
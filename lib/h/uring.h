@@ -0,0 +1,69 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/*
+    a tiny io_uring wrapper built straight on the syscalls (no liburing around here).
+    a ring is made of two queues shared with the kernel:
+        - the submission queue (SQ), where we write the operations we want (SQEs)
+        - the completion queue (CQ), where the kernel writes their results (CQEs)
+    many SQEs are submitted with a single io_uring_enter(), which can also wait for completions:
+    that's where the syscalls are saved.
+
+    a ring is not thread-safe, every handler has its own.
+*/
+
+typedef struct {
+    int fd;
+    unsigned features;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail; // SQEs handed out by uring_get_sqe() but not submitted yet
+    struct io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    unsigned long enters; // io_uring_enter() calls, i.e. the syscalls the ring costs us
+} uring;
+
+/*
+    provided buffers: a pool of equally sized buffers registered with the kernel.
+    operations flagged with IOSQE_BUFFER_SELECT (like multishot recv) pick a buffer from the pool
+    only when data actually arrives, so idle connections don't pin any memory.
+    the buffer's id comes back in the CQE flags and the buffer must be recycled once consumed.
+*/
+typedef struct {
+    struct io_uring_buf_ring* ring;
+    char* buffers;
+    unsigned count; // must be a power of 2
+    unsigned buffer_size;
+    unsigned short tail;
+    unsigned short group;
+    size_t ring_size;
+} uring_buffer_ring;
+
+extern bool uring_supported(void);
+extern int uring_init(uring* ring, unsigned entries);
+extern void uring_destroy(uring* ring);
+extern struct io_uring_sqe* uring_get_sqe(uring* ring);
+extern int uring_submit_and_wait(uring* ring, unsigned wait_nr, int timeout_ms);
+extern struct io_uring_cqe* uring_peek_cqe(uring* ring);
+extern void uring_cqe_seen(uring* ring);
+
+extern int uring_buffer_ring_init(uring* ring, uring_buffer_ring* buffers, unsigned short group, unsigned count, unsigned buffer_size);
+extern char* uring_buffer(uring_buffer_ring* buffers, unsigned short id);
+extern void uring_buffer_recycle(uring_buffer_ring* buffers, unsigned short id);
@@ -0,0 +1,9 @@
+#pragma once
+#include <stddef.h>
+
+/*
+    the io_uring I/O engine: a handler's thread runs uring_engine_run instead of the epoll loop.
+*/
+
+extern size_t uring_engine_connection_size(void);
+extern void* uring_engine_run(void* h);
@@ -1,8 +1,13 @@
+#define _GNU_SOURCE // accept4, pipe2
 #include "h/handler.h"
 #include "h/connection_context.h"
 #include "h/http_request.h"
 #include "h/http_response.h"
 #include "h/utils.h"
+#include "h/file_cache.h"
+#include "h/uring_engine.h"
+#include "h/socket_options.h"
+#include "h/http2.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
@@ -13,232 +18,1175 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <limits.h>
+#include <stddef.h>
 
-http_response* build_response(connection_context* context){
+#define INBOX_BATCH 64 // how many dispatched descriptors are read from the inbox at once
 
-    http_request* req = malloc(sizeof(http_request));
-    http_response* res;
+void handler_set_deadline(handler* current_handler, connection_context* ctx, handler_deadline kind){
+
+    // (re)starts the connection's deadline: whatever it was racing against before is forgotten
+    int seconds;
+    switch(kind){
+        case DEADLINE_HEADER: seconds = current_handler->header_timeout; break;
+        case DEADLINE_IDLE: seconds = current_handler->keep_alive_timeout; break;
+        default: seconds = current_handler->write_timeout;
+    }
 
-    int req_err = http_request_create(req, context);
+    timer_schedule(&current_handler->timers, &ctx->deadline, timer_wheel_clock_ms(), seconds * 1000UL, kind);
 
-    if(context->length != 0){
-        /* 
-            length represents the length of the contents on the heap.
-            if there is nothing allocated on the heap (dummy context passed if the request is shorter than the buffer size)
-            then we won't be able to free it!
-        */
-        free(context->data);
-        context->length = 0; 
+}
+
+void handler_clear_deadline(handler* current_handler, connection_context* ctx){
+
+    timer_cancel(&current_handler->timers, &ctx->deadline);
+
+}
+
+void handler_await_request(handler* current_handler, connection_context* ctx){
+
+    /*
+        the connection is waiting for (the rest of) a request.
+        a keep-alive connection with nothing buffered is idle, anything else is reading a head:
+        the header deadline starts with the first byte and it's never pushed back by the next ones.
+    */
+    handler_deadline kind = ctx->length > 0 || ctx->requests_served == 0 ? DEADLINE_HEADER : DEADLINE_IDLE;
+
+    if(timer_scheduled(&ctx->deadline) && ctx->deadline.kind == kind) return;
+    handler_set_deadline(current_handler, ctx, kind);
+
+}
+
+int handler_wait_timeout(handler* current_handler){
+
+    // how long the event loop can sleep before a deadline is due (-1 if there are none)
+    return timer_wheel_timeout(&current_handler->timers, timer_wheel_clock_ms());
+
+}
+
+void handler_expire_deadlines(handler* current_handler, void (*close_connection)(handler*, connection_context*)){
+
+    // every engine closes connections its own way, this only tells which ones
+    timer* expired;
+
+    timer_wheel_advance(&current_handler->timers, timer_wheel_clock_ms());
+    while((expired = timer_wheel_next_expired(&current_handler->timers))){
+        connection_context* ctx = (connection_context*) ((char*) expired - offsetof(connection_context, deadline));
+        metrics_add(&current_handler->metrics, METRIC_TIMEOUTS_HEADER + expired->kind, 1);
+        close_connection(current_handler, ctx);
     }
 
-    if(req_err != 0){
-        switch(errno){
-            case -1:
-                res = http_response_bad_request(context->fd);
-            break;
-            case 1:
-                // method is unimplemented (we only have GET)
-                res = http_response_uninmplemented_method(context->fd);
-            break;
-            case 2: 
-                // filename too long
-                res = http_response_filename_too_long(context->fd);
-            break;
-            default: res = http_response_internal_server_error(context->fd);
+}
+
+void handler_print_deadline_stats(handler* current_handler, FILE* out){
+
+    atomic_ulong* counters = current_handler->metrics.counters;
+
+    fprintf(
+        out,
+        "handler %d: %-12s header=%lu idle=%lu write=%lu\n",
+        current_handler->id, "timeouts",
+        atomic_load(&counters[METRIC_TIMEOUTS_HEADER]), atomic_load(&counters[METRIC_TIMEOUTS_IDLE]), atomic_load(&counters[METRIC_TIMEOUTS_WRITE])
+    );
+
+}
+
+void handler_request_started(handler* current_handler, connection_context* ctx){
+
+    // a whole request is there: its latency starts with the round it arrived in
+    ctx->request_started_ns = current_handler->metrics.round_ns;
+    ctx->log_path_id = 0;
+    ctx->log_method[0] = '\0';
+
+}
+
+void handler_log_request(handler* current_handler, connection_context* ctx){
+
+    // the request's bytes won't be there when the response is logged: we keep its path's id and its method
+    http_request* req = &ctx->request;
+    size_t method_length = req->method_name.length < sizeof(ctx->log_method) ? req->method_name.length : sizeof(ctx->log_method);
+
+    ctx->log_path_id = access_log_path(current_handler->log, req->path.ptr, req->path.length);
+    memset(ctx->log_method, 0, sizeof(ctx->log_method));
+    memcpy(ctx->log_method, req->method_name.ptr, method_length);
+
+}
+
+void handler_log_response(handler* current_handler, connection_context* ctx, int status, off_t bytes){
+
+    /*
+        a response is out: its record goes to the handler's ring (check h/access_log.h). nothing here can block,
+        the record is dropped if the ring is full. the client's address is read once per connection.
+    */
+
+    if(!current_handler->log) return;
+
+    access_log_record record = { 0 };
+    struct timespec now;
+    unsigned long long now_ns, started_ns;
+
+    if(ctx->peer_family == 0){
+        struct sockaddr_storage peer;
+        socklen_t peer_length = sizeof(peer);
+        ctx->peer_family = UINT8_MAX; // unknown, unless getpeername() tells us
+        if(getpeername(ctx->fd, (struct sockaddr*) &peer, &peer_length) == 0){
+            if(peer.ss_family == AF_INET){
+                struct sockaddr_in* in = (struct sockaddr_in*) &peer;
+                memcpy(ctx->peer_address, &in->sin_addr, 4);
+                ctx->peer_port = ntohs(in->sin_port);
+                ctx->peer_family = AF_INET;
+            }else if(peer.ss_family == AF_INET6){
+                struct sockaddr_in6* in6 = (struct sockaddr_in6*) &peer;
+                memcpy(ctx->peer_address, &in6->sin6_addr, 16);
+                ctx->peer_port = ntohs(in6->sin6_port);
+                ctx->peer_family = AF_INET6;
+            }
         }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    started_ns = ctx->request_started_ns && ctx->request_started_ns <= now_ns ? ctx->request_started_ns : now_ns; // 0 without metrics
+
+    record.family = ctx->peer_family == UINT8_MAX ? 0 : ctx->peer_family;
+    record.status = status;
+    record.port = ctx->peer_port;
+    record.duration_us = (now_ns - started_ns) / 1000;
+    record.timestamp_us = access_log_time_us(current_handler->log, started_ns);
+    record.path_id = ctx->log_path_id;
+    record.bytes = bytes;
+    memcpy(record.address, ctx->peer_address, sizeof(record.address));
+    memcpy(record.method, ctx->log_method, sizeof(record.method));
+
+    if(!access_log_push(current_handler->log, &record)) metrics_add(&current_handler->metrics, METRIC_ACCESS_LOG_DROPPED, 1);
+
+}
+
+static void handler_close_connection(handler* current_handler, connection_context* ctx){
+
+    if(ctx->fd < 0) return; // closed already, earlier in this round
+
+    if(epoll_ctl(current_handler->epoll_fd, EPOLL_CTL_DEL, ctx->fd, NULL) < 0){
+        perror("cannot close epoll fd\n");
+    }
+    close(ctx->fd);
+    metrics_add(&current_handler->metrics, METRIC_CONNECTIONS_CLOSED, 1);
+
+    handler_clear_deadline(current_handler, ctx);
+    if(ctx->response) http_response_destroy(ctx->response);
+    if(ctx->proxy) proxy_abort(&current_handler->proxy_pool, ctx->proxy);
+    if(ctx->http2) http2_session_destroy(current_handler, ctx->http2);
+    ctx->response = NULL;
+    ctx->proxy = NULL;
+
+    // the context itself goes at the end of the round (check handler_collect): its events may still be in the batch
+    ctx->fd = -1;
+    ctx->next_closed = current_handler->closed;
+    current_handler->closed = ctx;
+
+}
+
+static void handler_collect(handler* current_handler){
+
+    while(current_handler->closed){
+        connection_context* ctx = current_handler->closed;
+        current_handler->closed = ctx->next_closed;
+        context_destroy(ctx);
+    }
+    if(current_handler->proxy) proxy_collect(&current_handler->proxy_pool);
+
+}
+
+static http_response* handler_stats_response(handler* current_handler, connection_context* context, http_request* req, bool keep_alive){
+
+    /*
+        the stats page (METRICS_PATH): Prometheus text, or JSON if it's asked for with "?format=json"
+        or with an Accept header. it's written in the connection's arena, so it's gone with the response.
+    */
+    http_view* accept = http_request_header(req, "Accept");
+    bool json = (req->path.length > sizeof(METRICS_PATH) && memmem(req->path.ptr, req->path.length, "format=json", 11))
+                || (accept && memmem(accept->ptr, accept->length, "application/json", 16));
+
+    size_t size = metrics_page_size(current_handler->registry);
+    char* page = arena_alloc(&context->arena, size);
+    size_t length = metrics_render(current_handler->registry, json ? METRICS_JSON : METRICS_PROMETHEUS, page, size);
+
+    return http_response_create(
+        200,
+        json ? "Content-Type: application/json\r\nCache-Control: no-store\r\n" : "Content-Type: text/plain; version=0.0.4\r\nCache-Control: no-store\r\n",
+        page, length, context, keep_alive
+    );
+
+}
+
+static bool handler_is_stats_request(http_request* req){
+
+    size_t length = sizeof(METRICS_PATH) - 1;
+    return req->path.length >= length && memcmp(req->path.ptr, METRICS_PATH, length) == 0
+           && (req->path.length == length || req->path.ptr[length] == '?');
+
+}
+
+static const char* handler_keep(connection_context* ctx, const char* value, size_t length){
+
+    // a copy of a header's value (NULL stays NULL) that outlives the request's bytes
+    if(!value) return NULL;
+
+    char* copy = arena_alloc(&ctx->arena, length);
+    memcpy(copy, value, length);
+    return copy;
+
+}
+
+http_response* handler_cached_response(handler* current_handler, connection_context* ctx, file_cache_entry* entry,
+                                       unsigned int accepted_encodings, const http_conditions* conditions, bool keep_alive){
+
+    /*
+        the response for a cached file (the entry's reference goes to the response): the variant the client accepts,
+        a 304 if the tag (or the date) it sent back says it already has it, or the parts it asked for.
+        only compressible entries look at Accept-Encoding, the others go out as they are.
+        ranges are always ranges of the identity body, so a request with a Range isn't negotiated.
+    */
+
+    const file_cache_variant* variant = entry->compressible && !conditions->range
+        ? file_cache_negotiate(current_handler->cache, entry, accepted_encodings) : NULL;
+    const char* etag = variant ? variant->etag : entry->etag;
+    int etag_length = variant ? variant->etag_length : entry->etag_length;
+    http_range ranges[HTTP_RANGES_MAX];
+    int range_count;
+
+    if(http_conditions_not_modified(conditions, etag, etag_length, entry->last_modified)){
+        return http_response_create_not_modified(entry, variant, ctx, keep_alive);
+    }
+
+    range_count = http_conditions_ranges(conditions, entry->body_length, etag, etag_length, entry->last_modified, ranges);
+    if(range_count == HTTP_RANGES_UNSATISFIABLE){
+        off_t size = entry->body_length;
+        file_cache_release(entry);
+        return http_response_range_not_satisfiable(size, ctx, keep_alive);
+    }
+    if(range_count > 0){
+        // the validators are in the entry's serialized head, a 206 needs them on their own
+        char* validators = arena_alloc(&ctx->arena, FILE_CACHE_VALIDATORS_SIZE);
+        file_cache_validators(current_handler->cache, entry->path, entry->etag, entry->last_modified, entry->compressible, validators, FILE_CACHE_VALIDATORS_SIZE);
+        return http_response_create_ranges(entry, -1, validators, entry->mime_type, entry->body_length, ranges, range_count, ctx, keep_alive);
+    }
+
+    return http_response_create_cached(entry, variant, ctx, keep_alive);
+
+}
+
+http_response* handler_file_response(handler* current_handler, connection_context* ctx, char* filename, int fd, ino_t inode,
+                                     off_t size, time_t mtime, const http_conditions* conditions, bool keep_alive){
+
+    /*
+        the response for a file too big for the cache (the response owns "fd"): it's streamed with sendfile()
+        (the whole file or the ranges that were asked for), unless the client already has it.
+        its validators are formatted in the connection's arena, they can't be serialized ahead of time like the cached ones.
+    */
+
+    http_range ranges[HTTP_RANGES_MAX];
+    int range_count;
+    char etag[FILE_CACHE_ETAG_SIZE];
+    int etag_length = file_cache_etag(etag, inode, size, mtime, ENCODING_IDENTITY);
+    char* mime_type = filename_to_mimetype_header(filename);
+    size_t mime_type_length = strlen(mime_type);
+    char* headers = arena_alloc(&ctx->arena, mime_type_length + FILE_CACHE_VALIDATORS_SIZE);
+
+    memcpy(headers, mime_type, mime_type_length);
+    file_cache_validators(current_handler->cache, filename, etag, mtime, false, headers + mime_type_length, FILE_CACHE_VALIDATORS_SIZE);
+
+    if(http_conditions_not_modified(conditions, etag, etag_length, mtime)){
+        // nothing will be sent from the file, it's closed with the response
+        return http_response_create_file(304, headers + mime_type_length, fd, 0, ctx, keep_alive);
+    }
+
+    range_count = http_conditions_ranges(conditions, size, etag, etag_length, mtime, ranges);
+    if(range_count == HTTP_RANGES_UNSATISFIABLE){
+        close(fd);
+        return http_response_range_not_satisfiable(size, ctx, keep_alive);
+    }
+    if(range_count > 0){
+        return http_response_create_ranges(NULL, fd, headers + mime_type_length, mime_type, size, ranges, range_count, ctx, keep_alive);
+    }
+
+    return http_response_create_file(200, headers, fd, size, ctx, keep_alive);
+
+}
+
+static bool handler_keep_alive(handler* current_handler, connection_context* ctx, http_request* req){
+
+    // the connection stays open only if the client wants it and it didn't hit the request limit
+    return req->keep_alive && ctx->requests_served + 1 < current_handler->keep_alive_max_requests;
+
+}
+
+http_response* build_response(handler* current_handler, connection_context* context, http_request* req, file_miss* miss){
+
+    http_response* res;
+    char filename[PATH_MAX];
+    int filename_length;
+    bool keep_alive = handler_keep_alive(current_handler, context, req);
+
+    if(req->method != GET){
+        // method is unimplemented (we only have GET)
+        res = http_response_uninmplemented_method(context);
+    }else if(handler_is_stats_request(req)){
+        res = handler_stats_response(current_handler, context, req, keep_alive);
+    }else if((filename_length = http_request_filename(req, current_handler->www_path, current_handler->www_path_length, filename, sizeof(filename))) == HTTP_FILENAME_TOO_LONG){
+        res = http_response_filename_too_long(context);
+    }else if(filename_length == HTTP_FILENAME_INVALID){
+        // a bad escape, or a path that climbs out of the root
+        res = http_response_bad_request(context);
+    }else if(current_handler->index && !path_index_contains(current_handler->index, filename + current_handler->www_path_length, filename_length - current_handler->www_path_length)){
+        // the file isn't there: no need to ask the filesystem
+        res = http_response_not_found(context, keep_alive);
     }else{
-        
-        int fd = open(req->filename, O_RDONLY);
-        if(fd < 0){
-            res = http_response_not_found(context->fd);
+
+        /*
+            hot files are served from the shared cache, without touching the filesystem.
+            on a miss, small files are loaded in the cache while big ones are not read at all:
+            the response keeps the descriptor and the body will be streamed from it with sendfile()
+        */
+        struct stat file_stat;
+        int fd = -1;
+        http_conditions conditions;
+        file_cache_entry* entry = file_cache_acquire(current_handler->cache, filename);
+
+        http_request_conditions(req, &conditions);
+
+        if(!entry && miss){
+            // the engine will open the file by itself, the request's bytes will be gone by then
+            miss->filename = arena_alloc(&context->arena, filename_length + 1);
+            memcpy(miss->filename, filename, filename_length + 1);
+            miss->keep_alive = keep_alive;
+            miss->accepted_encodings = http_request_accepted_encodings(req);
+            miss->conditions = conditions;
+            miss->conditions.if_none_match = handler_keep(context, conditions.if_none_match, conditions.if_none_match_length);
+            miss->conditions.range = handler_keep(context, conditions.range, conditions.range_length);
+            miss->conditions.if_range = handler_keep(context, conditions.if_range, conditions.if_range_length);
+            return NULL;
+        }
+
+        if(!entry){
+            // the index hands us the file already open (and stat-ed) when it can
+            if(current_handler->index){
+                const char* path = filename + current_handler->www_path_length;
+                fd = path_index_open(current_handler->index, path, filename_length - current_handler->www_path_length, &file_stat);
+            }
+            if(fd < 0){
+                fd = open(filename, O_RDONLY | O_CLOEXEC);
+                if(fd >= 0 && (fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode))){
+                    // directories (and other funny things) can be opened, but they can't be served
+                    close(fd);
+                    fd = -1;
+                }
+            }
+            if(fd >= 0 && (entry = file_cache_load(current_handler->cache, filename, fd, &file_stat))){
+                close(fd);
+            }
+        }
+
+        if(entry){
+            unsigned int accepted_encodings = entry->compressible ? http_request_accepted_encodings(req) : 0;
+            res = handler_cached_response(current_handler, context, entry, accepted_encodings, &conditions, keep_alive);
+        }else if(fd < 0){
+            res = http_response_not_found(context, keep_alive);
         }else{
-            char* mime_type = filename_to_mimetype_header(req->filename);
-            char* stringified_file = read_whole_file(fd);
-            res = http_response_create(200, mime_type, stringified_file, context->fd);
+            res = handler_file_response(current_handler, context, filename, fd, file_stat.st_ino, file_stat.st_size, file_stat.st_mtime, &conditions, keep_alive);
         }
 
     }
 
     /*
-        we are ready to stream the response to the socket! 
-        to actually stream something we need to save the socket's fd (check comment 1 in h/http_response.h)
-        so that when we are back in the epoll loop we have a valid file descriptor to stream to 
-        (we can't use both the "fd" and the "ptr" attributes when using epolls)
+        we are ready to stream the response to the socket!
+        the response is attached to the connection context, which is what the epoll hands us back
+        when the socket is ready for writing.
     */
 
     return res;
 
 }
 
+static bool handler_proxy_request(handler* current_handler, connection_context* ctx, const proxy_route* route, int head_length){
+
+    /*
+        the request goes to one of the route's upstreams, with its body (check h/proxy.h): ctx->proxy takes the response's place.
+        requests we can't forward get an answer of our own instead (the connection is closed if the body can't be skipped).
+        returns false if the body isn't all there yet.
+    */
+
+    http_request* req = &ctx->request;
+    bool keep_alive = handler_keep_alive(current_handler, ctx, req);
+    long length = proxy_request_length(req, head_length);
+
+    if(length < 0){
+        // a chunked body (or a length we can't read): we only forward bodies we know the length of
+        ctx->response = http_response_canned(411, ctx, false);
+        context_consume(ctx, ctx->length);
+        return true;
+    }
+    if(length > current_handler->max_request_size){
+        ctx->response = http_response_canned(413, ctx, false);
+        context_consume(ctx, ctx->length);
+        return true;
+    }
+    if(ctx->length < length) return false;
+
+    ctx->proxy = proxy_start(&current_handler->proxy_pool, route, ctx, req, ctx->data, head_length, length, keep_alive);
+    if(!ctx->proxy){
+        // every upstream of the route is down
+        ctx->response = http_response_canned(503, ctx, keep_alive);
+    }
+    context_consume(ctx, length);
+    return true;
+
+}
+
+bool handler_next_response(handler* current_handler, connection_context* ctx, file_miss* miss){
+
+    /*
+        if a whole request is sitting in the context (it may have been pipelined behind the one we just answered)
+        a response is built for it and attached to the context.
+        if "miss" is not NULL, files that aren't cached are not opened: the response is left NULL and
+        "miss" tells the caller which file is needed.
+        returns false if we need more bytes from the client.
+    */
+
+    const proxy_route* route;
+
+    if(miss) miss->filename = NULL;
+
+    // the beginning of an HTTP/2 preface: the session starts once it's all there (check handler_http2_preface)
+    if(current_handler->http2 && ctx->requests_served == 0 && http2_is_preface(ctx->data, ctx->length)) return false;
+
+    int head_length = http_request_parse(&ctx->request, ctx->data, ctx->length);
+    if(head_length == HTTP_PARSE_INCOMPLETE) return false;
+
+    handler_request_started(current_handler, ctx);
+    if(current_handler->log && head_length != HTTP_PARSE_ERROR) handler_log_request(current_handler, ctx);
+
+    if(head_length == HTTP_PARSE_ERROR){
+        // we can't even tell where this request ends, so nothing after it can be answered
+        ctx->response = http_response_bad_request(ctx);
+        context_consume(ctx, ctx->length);
+    }else if(current_handler->proxy && (route = proxy_match(current_handler->proxy, &ctx->request))){
+        if(!handler_proxy_request(current_handler, ctx, route, head_length)){
+            http_request_init(&ctx->request); // parsed again once the whole body is there
+            return false;
+        }
+    }else if(current_handler->http2 && http2_upgrade_requested(&ctx->request) && http2_upgrade(current_handler, ctx, head_length)){
+        // the request is stream 1 now: what follows it is the client's preface (check http2_receive)
+        context_consume(ctx, head_length);
+        http2_receive(current_handler, ctx);
+    }else{
+        /*
+            the request's views point into the context, so it's consumed only when the response is ready:
+            the bytes that are left (if any) belong to the next pipelined request.
+            we don't take bodies, a Content-Length one is skipped if it's all there already. one that isn't
+            (or a chunked one, or the body of a method we don't implement) would be read as the next request,
+            so the connection is closed after the response instead, whatever comes after it is dropped.
+        */
+        http_request* req = &ctx->request;
+        off_t body_length = req->content_length > 0 ? req->content_length : 0;
+        // compared with what's in the buffer after the head, never added to it: a huge length can't wrap around
+        bool drop_rest = req->transfer_encoding || req->method != GET || body_length > ctx->length - head_length;
+
+        if(drop_rest) req->keep_alive = false;
+        ctx->response = build_response(current_handler, ctx, req, miss);
+        context_consume(ctx, drop_rest ? ctx->length : head_length + (int) body_length);
+    }
+
+    http_request_init(&ctx->request); // the next request will be parsed from scratch
+    return true;
+
+}
+
+static void handler_set_events(handler* current_handler, connection_context* ctx, uint32_t events){
+
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = ctx;
+
+    if(epoll_ctl(current_handler->epoll_fd, EPOLL_CTL_MOD, ctx->fd, &event) < 0){
+        perror("cannot modify epoll descriptor\n");
+        handler_close_connection(current_handler, ctx);
+    }
+
+}
+
+static void handler_add_connection(handler* current_handler, int client_fd){
+
+    /*
+        the context will follow the connection for its whole life (many requests can be sent on the same connection),
+        so it's attached to the epoll event: the handler gets it back with every event.
+    */
+    connection_context* ctx = slab_alloc(&current_handler->memory.connections);
+    context_init(ctx, &current_handler->memory, &current_handler->date, &current_handler->load, current_handler->request_buffer_size);
+    ctx->fd = client_fd;
+    metrics_add(&current_handler->metrics, METRIC_CONNECTIONS_ACCEPTED, 1);
+    handler_await_request(current_handler, ctx);
+
+    struct epoll_event client_event;
+
+    client_event.events = EPOLLIN | EPOLLET; // edge-triggered mode for the current descriptor (EAGAIN)
+    client_event.data.ptr = ctx;
+
+    if(epoll_ctl(current_handler->epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event) < 0){ // adding a new epoll (EPOLL_CTL_ADD)
+        perror("cannot add client descriptor to epoll");
+        close(client_fd);
+        handler_clear_deadline(current_handler, ctx);
+        context_destroy(ctx);
+    }
+
+}
+
+static void handler_accept(handler* current_handler){
+
+    /*
+        a burst of connections may be waiting on the listening socket: we accept them all
+        (until EAGAIN) so we pay a single wakeup for the whole burst.
+        accept4 hands us descriptors that are already non-blocking, so there is no need for extra fcntl calls.
+    */
+
+    while(true){
+
+        int client_fd = accept4(current_handler->listen_fd, NULL, NULL, SOCK_NONBLOCK);
+
+        if(client_fd < 0){
+            switch(errno){
+                case EAGAIN:
+                    // the queue has been drained (or another handler got there first)
+                    return;
+                case EINTR:
+                case ECONNABORTED:
+                case EPROTO:
+                    // the client went away before we could accept it, try the next one
+                    continue;
+                default:
+                    /*
+                        EMFILE, ENFILE, ENOBUFS... we are out of resources: the pending connections
+                        will be accepted the next time around, once some descriptors have been closed.
+                    */
+                    metrics_add(&current_handler->metrics, METRIC_ACCEPT_ERRORS, 1);
+                    perror("error while accepting\n");
+                    return;
+            }
+        }
+
+        handler_assign(current_handler);
+        handler_add_connection(current_handler, client_fd);
+
+    }
+
+}
+
+static void handler_drain_inbox(handler* current_handler){
+
+    // the dispatcher wrote some descriptors in our pipe, let's take them all
+    int fds[INBOX_BATCH];
+    ssize_t read_bytes;
+
+    while((read_bytes = read(current_handler->inbox[0], fds, sizeof(fds))) > 0){
+        for(int i = 0; i < read_bytes / (ssize_t) sizeof(int); i++){
+            if(fds[i] == HANDLER_INBOX_STATS){
+                handler_memory_print_stats(&current_handler->memory, current_handler->id, stderr);
+                handler_print_deadline_stats(current_handler, stderr);
+            }else{
+                handler_add_connection(current_handler, fds[i]);
+            }
+        }
+    }
+
+}
+
+void handler_assign(handler* handler){
+
+    /*
+        a connection is now the handler's business: it counts right away, even if it's still waiting in the inbox,
+        so a burst of connections doesn't all go to the handler that looked idle before it.
+        the count goes down when the connection's context is destroyed.
+    */
+    load_add(&handler->load.connections, 1);
+    load_add(&handler->load.assigned, 1);
+
+}
+
+bool handler_dispatch(handler* handler, int client_fd){
+
+    /*
+        called by the dispatcher (i.e. not by the handler's thread): a pipe write of a single int is atomic,
+        so the descriptor reaches the handler without any lock.
+        returns false if the handler's inbox is full.
+    */
+    handler_assign(handler);
+    if(write(handler->inbox[1], &client_fd, sizeof(client_fd)) == sizeof(client_fd)) return true;
+
+    load_add(&handler->load.connections, -1);
+    load_add(&handler->load.assigned, -1);
+    return false;
+
+}
+
+void handler_request_stats(handler* handler){
+
+    /*
+        asks the handler to print its allocator stats: the counters are only touched by the handler's thread,
+        so it's the handler that prints them, as soon as it reads the request from its inbox.
+        a single write() is all it takes, so this can be called from a signal handler.
+    */
+    int request = HANDLER_INBOX_STATS;
+    if(write(handler->inbox[1], &request, sizeof(request)) < 0){
+        // the inbox is full, the handler is busy enough: no stats this time
+    }
+
+}
+
+typedef enum {
+    STREAM_DONE, // the whole response has been written
+    STREAM_BLOCKED, // the socket is full
+    STREAM_YIELD, // the connection wrote its share for this round (check write_high_watermark in h/handler.h)
+    STREAM_ERROR
+} stream_result;
+
+static stream_result handler_stream_response(handler* current_handler, http_response* res){
+
+    /*
+        writes as much of the response as the socket accepts, up to write_high_watermark bytes.
+        the chain (head and, for in-memory and cached responses, the body) goes out with a single sendmsg(),
+        then file-backed bodies are sent straight from the file with sendfile().
+        when the file (or another part of the body) follows the chain, the chain is sent with MSG_MORE: the kernel holds
+        a partial segment back instead of sending the head on its own, the body's first bytes fill it up (no TCP_CORK
+        round trips, sendfile() pushes whatever is left with its last chunk).
+        the chain and body_offset tell us where we stopped: if the socket fills up we'll resume from there on the next EPOLLOUT.
+    */
+
+    size_t budget = current_handler->write_high_watermark;
+
+    do{
+
+        while(!http_response_chain_written(res)){
+            if(budget == 0) return STREAM_YIELD;
+
+            struct msghdr message = { 0 };
+            message.msg_iov = res->iov + res->iov_next;
+            message.msg_iovlen = res->iov_count - res->iov_next;
+            bool more = (res->file_fd >= 0 && res->body_offset < res->body_end) || res->part_next < res->part_count;
+
+            ssize_t written_bytes = sendmsg(res->socket, &message, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+            if(written_bytes < 0){
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? STREAM_BLOCKED : STREAM_ERROR;
+            }
+            metrics_add(&current_handler->metrics, METRIC_BYTES_SENT, written_bytes);
+            http_response_advance(res, written_bytes); // here we update our position in the chain!
+            budget = (size_t) written_bytes < budget ? budget - written_bytes : 0;
+        }
+
+        while(res->file_fd >= 0 && res->body_offset < res->body_end){
+            if(budget == 0) return STREAM_YIELD;
+
+            off_t remaining = res->body_end - res->body_offset;
+            ssize_t sent_bytes = sendfile(res->socket, res->file_fd, &res->body_offset, remaining < (off_t) budget ? (size_t) remaining : budget);
+            if(sent_bytes < 0){
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? STREAM_BLOCKED : STREAM_ERROR;
+            }
+            if(sent_bytes == 0){
+                // the file has been truncated under our feet, we can't honor Content-Length anymore
+                return STREAM_ERROR;
+            }
+            metrics_add(&current_handler->metrics, METRIC_BYTES_SENT, sent_bytes);
+            budget -= sent_bytes;
+        }
+
+    }while(http_response_next_part(res)); // multipart bodies go a part at a time
+
+    return STREAM_DONE;
+
+}
+
+static void handler_write_later(handler* current_handler, connection_context* ctx, bool yield){
+
+    // the client is reading (or will be soon), the deadline is pushed back. an HTTP/2 session keeps reading while it writes
+    handler_set_deadline(current_handler, ctx, DEADLINE_WRITE);
+    if(yield || !ctx->write_armed){
+        ctx->write_armed = true;
+        handler_set_events(current_handler, ctx, ctx->http2 ? EPOLLIN | EPOLLOUT | EPOLLET : EPOLLOUT | EPOLLET);
+    }
+
+}
+
+static bool handler_response_done(handler* current_handler, connection_context* ctx, int status, off_t bytes, bool keep_alive){
+
+    /*
+        a response ("bytes" of body) is out: the connection is closed, or the next request (a pipelined one may be waiting already) is answered.
+        returns false if the connection was closed.
+    */
+
+    metrics_response_done(&current_handler->metrics, status, ctx->request_started_ns);
+    handler_log_response(current_handler, ctx, status, bytes);
+    ctx->requests_served += 1;
+    handler_clear_deadline(current_handler, ctx); // the idle time starts over from this response
+
+    if(!keep_alive){
+        // the client (or the request limit) asked us to close the connection
+        handler_close_connection(current_handler, ctx);
+        return false;
+    }
+
+    handler_next_response(current_handler, ctx, NULL);
+    return true;
+
+}
+
+static bool handler_write_proxy(handler* current_handler, connection_context* ctx){
+
+    /*
+        takes a proxied exchange as far as it goes (check proxy_advance), returns true if it's over and the connection can go on.
+        while the upstream is thinking, the client has no deadline of its own: the proxy's connect and read timeouts run instead,
+        and they come back here when they expire (check proxy_expire).
+    */
+
+    proxy_connection* conn = ctx->proxy;
+    proxy_result result = proxy_advance(current_handler, conn);
+    int status = conn->status;
+    bool keep_alive = conn->keep_alive;
+
+    switch(result){
+
+        case PROXY_WAIT_UPSTREAM:
+            handler_clear_deadline(current_handler, ctx);
+            return false;
+
+        case PROXY_WAIT_CLIENT:
+        case PROXY_YIELD:
+            if(result == PROXY_WAIT_CLIENT) metrics_add(&current_handler->metrics, METRIC_SEND_BLOCKED, 1);
+            handler_write_later(current_handler, ctx, result == PROXY_YIELD);
+            return false;
+
+        case PROXY_FAILED:
+            ctx->proxy = NULL;
+            if(proxy_response_started(conn)){
+                // the client has part of a response already, all we can do is close
+                proxy_abort(&current_handler->proxy_pool, conn);
+                handler_close_connection(current_handler, ctx);
+                return false;
+            }
+            status = proxy_failure_status(conn);
+            proxy_abort(&current_handler->proxy_pool, conn);
+            arena_reset(&ctx->arena);
+            ctx->response = http_response_canned(status, ctx, keep_alive);
+            return true;
+
+        default:
+            ctx->proxy = NULL;
+            off_t body_sent = conn->body_sent;
+            proxy_finish(&current_handler->proxy_pool, conn);
+            arena_reset(&ctx->arena); // the rewritten head
+            return handler_response_done(current_handler, ctx, status, body_sent, keep_alive);
+
+    }
+
+}
+
+static void handler_write_http2(handler* current_handler, connection_context* ctx){
+
+    /*
+        an HTTP/2 session writes whatever its streams have, as far as the socket and the client's windows let it (check http2_send).
+        EPOLLIN stays armed next to EPOLLOUT: WINDOW_UPDATEs and new streams can come in while the session is writing.
+    */
+
+    http2_result result = http2_send(current_handler, ctx->http2);
+
+    switch(result){
+
+        case HTTP2_ERROR:
+            perror("send failed");
+            handler_close_connection(current_handler, ctx);
+            return;
+
+        case HTTP2_CLOSE:
+            handler_close_connection(current_handler, ctx);
+            return;
+
+        case HTTP2_BLOCKED:
+        case HTTP2_YIELD:
+            if(result == HTTP2_BLOCKED) metrics_add(&current_handler->metrics, METRIC_SEND_BLOCKED, 1);
+            handler_write_later(current_handler, ctx, result == HTTP2_YIELD);
+            return;
+
+        default:
+            break;
+
+    }
+
+    // everything that could go out is out: streams waiting for a WINDOW_UPDATE race against the write deadline
+    if(http2_waiting(ctx->http2)) handler_set_deadline(current_handler, ctx, DEADLINE_WRITE);
+    else handler_await_request(current_handler, ctx);
+    if(ctx->write_armed){
+        ctx->write_armed = false;
+        handler_set_events(current_handler, ctx, EPOLLIN | EPOLLET);
+    }
+
+}
+
+static bool handler_http2_preface(handler* current_handler, connection_context* ctx){
+
+    // prior knowledge: a new connection that starts with the HTTP/2 preface is a session from its first byte
+    if(!current_handler->http2 || ctx->http2 || ctx->requests_served > 0 || ctx->length < HTTP2_PREFACE_LENGTH) return false;
+    if(!http2_is_preface(ctx->data, ctx->length)) return false;
+
+    http2_start(current_handler, ctx);
+    return true;
+
+}
+
+static void handler_write(handler* current_handler, connection_context* ctx){
+
+    /*
+        the output pipeline: the response attached to the context is written right away, from the read path,
+        without asking the epoll first (a socket that just received a request almost always has room for the answer).
+        pipelined requests are answered one after the other, as long as the socket takes them.
+        proxied requests work the same way, with proxy_advance() instead of handler_stream_response() (check handler_write_proxy).
+        EPOLLOUT (edge-triggered, so a writable socket doesn't wake us up over and over) is only armed when:
+            - the socket is full: the next edge comes when the client has read enough (TCP_NOTSENT_LOWAT, if it's set
+              with "write-low-watermark", decides how much is enough).
+            - the connection wrote write_high_watermark bytes in this round: it yields, so a fast client downloading a big file
+              doesn't starve the others. re-arming a writable socket makes the epoll report it again right away.
+        while EPOLLOUT is armed the connection isn't read (there's only one response at a time), once the response is out
+        the socket goes back to EPOLLIN, and the epoll reports whatever arrived in the meantime.
+        small responses never touch the epoll at all.
+        an HTTP/2 session (check h/http2.h) has no response of its own: its streams are written by handler_write_http2.
+    */
+
+    while(ctx->response || ctx->proxy){
+
+        if(ctx->proxy){
+            if(!handler_write_proxy(current_handler, ctx)) return;
+            continue;
+        }
+
+        http_response* res = ctx->response;
+        stream_result result = handler_stream_response(current_handler, res);
+
+        if(result == STREAM_ERROR){
+            perror("send failed");
+            handler_close_connection(current_handler, ctx);
+            return;
+        }
+
+        if(result != STREAM_DONE){
+            if(result == STREAM_BLOCKED) metrics_add(&current_handler->metrics, METRIC_SEND_BLOCKED, 1);
+            handler_write_later(current_handler, ctx, result == STREAM_YIELD);
+            return;
+        }
+
+        int status = res->status;
+        off_t bytes = res->content_length;
+        bool keep_alive = res->keep_alive;
+
+        http_response_destroy(res);
+        ctx->response = NULL;
+        if(!handler_response_done(current_handler, ctx, status, bytes, keep_alive)) return;
+
+    }
+
+    if(ctx->http2){
+        handler_write_http2(current_handler, ctx);
+        return;
+    }
+
+    /*
+        we wrote everything and no other request has been pipelined:
+        the connection goes back to reading and waits for the next request.
+    */
+    handler_await_request(current_handler, ctx);
+    if(ctx->write_armed){
+        ctx->write_armed = false;
+        handler_set_events(current_handler, ctx, EPOLLIN | EPOLLET);
+    }
+
+}
+
 void *handler_process_request(void* h){
 
     handler* current_handler = (handler *) h;
-    char buf[current_handler->request_buffer_size];
 
-    bzero(buf, current_handler->request_buffer_size);
-    current_handler->request_buffer = buf; // let's keep the request buffer on the stack so it's faster to be read from
+    struct timespec round_start;
+
+    // the request buffer is allocated once per handler: its size is configurable, the thread's stack isn't
+    current_handler->request_buffer = calloc(1, current_handler->request_buffer_size);
+    if(!current_handler->request_buffer){
+        perror("cannot allocate the request buffer\n");
+        exit(-1);
+    }
 
     while(current_handler->active){
 
-        int ready_events = epoll_wait(current_handler->epoll_fd, current_handler->events, current_handler->max_events, -1);
+        // we sleep until the next deadline is due (or forever, if there are none)
+        int timeout = handler_wait_timeout(current_handler);
+        if(current_handler->proxy){
+            int proxy_timeout = proxy_wait_timeout(&current_handler->proxy_pool);
+            if(timeout < 0 || (proxy_timeout >= 0 && proxy_timeout < timeout)) timeout = proxy_timeout;
+        }
+        int ready_events = epoll_wait(current_handler->epoll_fd, current_handler->events, current_handler->max_events, timeout);
+        http_date_update(&current_handler->date); // a no-op unless a new second has started
+        load_loop_start(&round_start);
+        metrics_round_start(&current_handler->metrics, &round_start);
         for(int i = 0; i < ready_events; i++){
 
             uint32_t events = current_handler->events[i].events;
+            void* source = current_handler->events[i].data.ptr;
+            connection_context* ctx = (connection_context*) source;
 
-            if(events == EPOLLIN){
-                ssize_t received_bytes = recv(current_handler->events[i].data.fd, current_handler->request_buffer, current_handler->request_buffer_size, O_NONBLOCK);
-                int request_size = 0;
+            /*
+                the listening socket and the inbox are registered with a pointer to the handler's own
+                field, so they can't be mistaken for a connection context.
+            */
+            if(source == &current_handler->listen_fd){
 
-                if(received_bytes > 0){
+                handler_accept(current_handler);
 
-                    connection_context* ctx = malloc(sizeof(connection_context));
-                    context_init(ctx, current_handler->request_buffer_size);
+            }else if(source == &current_handler->inbox){
 
-                    ctx->fd = current_handler->events[i].data.fd;
-                    write_to_context(ctx, current_handler->request_buffer, received_bytes);
+                handler_drain_inbox(current_handler);
 
-                    /*
-                        since we are in edge-triggered mode, we must consume the request at its 
-                        fullest before exiting this loop.
-                        to do so, we must read bytes until EAGAIN (or EWOULDBLOCK) isn't returned
-                    */
-                    while((received_bytes = recv(ctx->fd, current_handler->request_buffer, current_handler->request_buffer_size, O_NONBLOCK)) > 0){
+            }else if(proxy_is_upstream(source)){
 
-                        write_to_context(ctx, current_handler->request_buffer, received_bytes);
-                        bzero(current_handler->request_buffer, current_handler->request_buffer_size);
+                // an upstream's socket: its client's response can go on
+                connection_context* client = proxy_on_event(&current_handler->proxy_pool, source, events);
+                if(client) handler_write(current_handler, client);
 
-                        request_size += received_bytes;
-                        if(request_size > current_handler->max_request_size){
-                            // do something to tell the client that the request is too big 
-                            continue;
-                        }
+            }else if(ctx->fd < 0){
 
-                    }
+                // the connection was closed earlier in this round
 
-                    /*
-                        the while has ended so we stopped reading.
-                        we could've encountered an error, so we must check for it!
-                    */
+            }else if(events & (EPOLLERR | EPOLLHUP)){
 
-                    if(errno == EAGAIN || errno == EWOULDBLOCK){
-                        /*
-                            we drained the descriptor (basically, we've read the whole request)
-                            now we have to actually reply to the request, so we set the event descriptor
-                            ready for writing (we attach the EPOLLOUT bit).
-
-                            note that we removed the EPOLLET flag, because we don't want to
-                            write the whole response for each request. 
-                            what we need is a way to write a non-blocking response, so we can write
-                            multiple responses concurrently.
-                        */
-                        
-                        http_response* res = build_response(ctx);
-
-                        struct epoll_event add_write_event;
-                        add_write_event.events = EPOLLOUT; 
-                        add_write_event.data.ptr = res;
-
-                        /*
-                            on the same file descriptor we can attach everything, we can also listen to changes on a certain
-                            data structure! 
-                            that's what we did with the "ptr" attribute of the epoll_event: 
-                            we put our response there so, when there is data being written on that data structure, the epoll will trigger
-                            a new event!
-                            we will write data as soon as we process the request, so the epoll will trigger instantly.
-
-                            this method makes us able to write the response chunk by chunk (check (**) down below), without blocking other requests in the loop!
-                        */
-
-                        if(epoll_ctl(current_handler->epoll_fd, EPOLL_CTL_MOD, current_handler->events[i].data.fd, &add_write_event) < 0){
-                            perror("cannot set epoll descriptor ready for writing\n");
-                            continue;
-                        }
-
-                    }else{
-
-                        /*
-                            something bad happened to our client, let's ignore its request
-                        */
-                        epoll_ctl(current_handler->epoll_fd, EPOLL_CTL_DEL, current_handler->events[i].data.fd, NULL);
-                        close(current_handler->events[i].data.fd);
+                /*
+                    something bad happened to our client, let's ignore its request
+                */
+                handler_close_connection(current_handler, ctx);
 
-                    }
-                    
-                }else if (received_bytes == 0){
-                    
-                    epoll_ctl(current_handler->epoll_fd, EPOLL_CTL_DEL, current_handler->events[i].data.fd, NULL);
-                    close(current_handler->events[i].data.fd);
+            }else if(events & EPOLLIN){
 
-                }
-            }else if(events == EPOLLOUT){
+                ssize_t received_bytes;
+                bool too_big = false;
 
                 /*
-                    (**) here we are, consuming what we wrote (an http response) on the epoll! 
-                    this part of the loop enables us, as already mentioned, to stream the http response to the client without blocking 
-                    other input or output streams!
-                    with the use of the "stream_ptr" variable (check lib/h/http_response.h, comment 2) we can efficiently keep track
-                    of the chunk we are writing to the client, incrementing it whenever we write some bytes!
-
-                    note how we write data: we use the streamed_response->stringified buffer + the stream_ptr (basically an offset), 
-                    because in this way we keep track of what we already wrote (by summing stream_ptr).
+                    since we are in edge-triggered mode, we must consume the request at its
+                    fullest before exiting this loop.
+                    to do so, we must read bytes until EAGAIN (or EWOULDBLOCK) isn't returned
                 */
+                while((received_bytes = recv(ctx->fd, current_handler->request_buffer, current_handler->request_buffer_size, 0)) > 0){
 
-                http_response* streamed_response = (http_response*) current_handler->events[i].data.ptr;
-                int written_bytes = send(
-                    streamed_response->socket, 
-                    streamed_response->stringified + streamed_response->stream_ptr, 
-                    streamed_response->full_length,
-                    0
-                );
-                if(written_bytes >= 0){
-                    streamed_response->stream_ptr += written_bytes; // here we update our pointer!
-                    if(streamed_response->stream_ptr == streamed_response->full_length){
-                        /*
-                            we wrote everything, so we need to close the connection (we only implemented Connection: close)
-                        */
-
-                        if(epoll_ctl(current_handler->epoll_fd, EPOLL_CTL_DEL, streamed_response->socket, NULL) < 0){
-                            perror("cannot close epoll fd\n");
-                        }
-                        close(streamed_response->socket);
+                    write_to_context(ctx, current_handler->request_buffer, received_bytes);
+                    metrics_add(&current_handler->metrics, METRIC_BYTES_RECEIVED, received_bytes);
 
-                    }
-                }else if(written_bytes == -1){
-                    if(errno == EAGAIN || errno == EWOULDBLOCK){
-                        // the socket is not available yet
+                    if(ctx->http2 || handler_http2_preface(current_handler, ctx)){
+                        // frames are taken as they come, the buffer only keeps the beginning of the next one
+                        http2_receive(current_handler, ctx);
                         continue;
-                    }else{
-                        perror("send failed");
                     }
+
+                    if(ctx->length > current_handler->max_request_size){
+                        too_big = true;
+                        break;
+                    }
+
+                }
+
+                if(received_bytes == 0){
+
+                    // the client closed the connection
+                    handler_close_connection(current_handler, ctx);
+                    continue;
+
+                }
+
+                if(ctx->proxy){
+
+                    // the next request came in while the upstream is answering this one: it waits in the buffer
+                    if(too_big || (received_bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) handler_close_connection(current_handler, ctx);
+                    continue;
+
                 }
 
-            }else{
                 /*
-                    something bad happened to our client, let's ignore its request
+                    the while has ended so we stopped reading.
+                    we could've encountered an error, so we must check for it!
                 */
-                if(epoll_ctl(current_handler->epoll_fd, EPOLL_CTL_DEL, current_handler->events[i].data.fd, NULL) < 0){
-                    perror("cannot close epoll fd\n");
+                if(!too_big && received_bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK){
+
+                    handler_close_connection(current_handler, ctx);
+                    continue;
+
                 }
-                close(current_handler->events[i].data.fd);
+
+                if(ctx->http2){
+
+                    // whatever the frames asked for (responses, SETTINGS and PING acks, WINDOW_UPDATEs...) goes out now
+                    handler_write(current_handler, ctx);
+
+                }else if(handler_next_response(current_handler, ctx, NULL)){
+
+                    /*
+                        we have a whole request, so we try to write the response right away (check handler_write):
+                        if the socket can't take all of it, the rest is written chunk by chunk on EPOLLOUT (check (**) down below),
+                        without blocking other requests in the loop!
+                    */
+                    handler_write(current_handler, ctx);
+
+                }else if(too_big){
+
+                    // the request is too big and we can't even find where it ends: reply and close
+                    handler_request_started(current_handler, ctx);
+                    context_consume(ctx, ctx->length);
+                    ctx->response = http_response_bad_request(ctx);
+                    handler_write(current_handler, ctx);
+
+                }else{
+
+                    // the request is not complete yet, wait for the rest of it
+                    handler_await_request(current_handler, ctx);
+
+                }
+
+            }else if(events & EPOLLOUT){
+
+                /*
+                    (**) here we are, consuming what we wrote (an http response) on the epoll!
+                    this part of the loop enables us, as already mentioned, to stream the http response to the client without blocking
+                    other input or output streams!
+                    the response is a chain of pieces (check lib/h/http_response.h, comment 2): whenever we write some bytes
+                    the written pieces are dropped from the chain, so we efficiently keep track of what we already wrote.
+                    file bodies work the same way, only the position is body_offset (check handler_stream_response).
+                */
+
+                handler_write(current_handler, ctx);
 
             }
         }
+
+        handler_expire_deadlines(current_handler, handler_close_connection);
+        if(current_handler->proxy) proxy_expire(&current_handler->proxy_pool, current_handler, handler_write);
+        handler_collect(current_handler);
+
+        long round_time = load_loop_done(&current_handler->load, &round_start);
+        metrics_round_done(&current_handler->metrics, round_time);
     }
 
+    free(current_handler->request_buffer);
+    current_handler->request_buffer = NULL;
     pthread_exit(0);
 
 }
 
-void handler_init(handler* handler, int max_events, int buf_size, int max_request_size){
+void handler_init(handler* handler, int id, const server_config* config, int listen_fd, file_cache* cache, metrics_registry* registry, const proxy* proxy, path_index* index, access_log* log){
 
+    /*
+        the handler copies what it needs from the config (it's read in the hot path),
+        only the www path is borrowed: the server's copy of the config lives as long as the handlers do.
+    */
+
+    io_engine engine = config->engine;
+    accept_strategy strategy = config->strategy;
+    int buf_size = config->request_buffer_size;
+    struct epoll_event source_event;
+
+    handler->id = id;
     handler->thread = (pthread_t*) malloc(sizeof(pthread_t));
     handler->active = true;
-    handler->max_events = max_events;
-    handler->epoll_fd = epoll_create1(0);
+    handler->max_events = config->handler_queue_size;
+    handler->epoll_fd = -1;
     handler->request_buffer_size = buf_size;
-    handler->max_request_size = max_request_size;
-    handler->events = malloc(sizeof(struct epoll_event) * max_events);
-    
+    handler->max_request_size = config->max_request_size;
+    handler->events = NULL;
+    handler->header_timeout = config->header_timeout;
+    handler->keep_alive_timeout = config->keep_alive_timeout;
+    handler->write_timeout = config->write_timeout;
+    handler->keep_alive_max_requests = config->keep_alive_max_requests;
+    handler->write_high_watermark = config->write_high_watermark;
+    timer_wheel_init(&handler->timers, timer_wheel_clock_ms());
+    handler->strategy = strategy;
+    handler->listen_fd = listen_fd;
+    handler->engine = engine;
+    handler->uring = NULL;
+    handler->www_path = config->www_path;
+    handler->www_path_length = strlen(config->www_path);
+    handler->cache = cache;
+    handler->index = index;
+    handler->log = log ? access_log_ring_get(log, id) : NULL;
+    http_date_init(&handler->date);
+    load_init(&handler->load);
+    metrics_init(&handler->metrics);
+    handler->registry = registry;
+    handler->proxy = proxy;
+    handler->closed = NULL;
+    handler->http2 = config->http2 && engine == IO_ENGINE_EPOLL;
+    handler->http2_max_streams = config->http2_max_streams;
+    metrics_register(registry, id, &handler->metrics, &handler->load);
+    handler_memory_init(
+        &handler->memory,
+        engine == IO_ENGINE_URING ? uring_engine_connection_size() : sizeof(connection_context), // the io_uring engine keeps more state per connection
+        sizeof(http_response),
+        buf_size
+    );
+
+    if(pipe2(handler->inbox, O_NONBLOCK | O_CLOEXEC) < 0){
+        perror("cannot create handler's inbox\n");
+        exit(-1);
+    }
+
+    if(engine == IO_ENGINE_URING){
+
+        /*
+            the ring is created by the handler's thread (check uring_engine_run), the engine
+            reads the inbox with the ring, so its end of the pipe must block (io_uring takes care of waiting).
+        */
+        fcntl(handler->inbox[0], F_SETFL, 0);
+        pthread_create(handler->thread, NULL, uring_engine_run, (void*) handler);
+        return;
+
+    }
+
+    handler->epoll_fd = epoll_create1(0);
+    handler->events = malloc(sizeof(struct epoll_event) * handler->max_events);
+
+    if(handler->epoll_fd < 0){
+        perror("cannot create handler's epoll\n");
+        exit(-1);
+    }
+    socket_options_epoll(handler->epoll_fd, config); // busy-poll, if it's on
+    if(proxy) proxy_pool_init(&handler->proxy_pool, proxy, config->proxy_pool_size, handler->epoll_fd);
+
+    source_event.events = EPOLLIN;
+    source_event.data.ptr = &handler->inbox;
+    if(epoll_ctl(handler->epoll_fd, EPOLL_CTL_ADD, handler->inbox[0], &source_event) < 0){
+        perror("cannot add inbox to epoll\n");
+        exit(-1);
+    }
+
+    if(strategy != ACCEPT_DISPATCH){
+
+        /*
+            the listening socket is level-triggered: if we stop accepting because we ran out of descriptors
+            we'll be notified again.
+            with a shared socket, EPOLLEXCLUSIVE avoids waking up every handler for the same connection.
+        */
+        source_event.events = strategy == ACCEPT_EXCLUSIVE ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLIN;
+        source_event.data.ptr = &handler->listen_fd;
+        if(epoll_ctl(handler->epoll_fd, EPOLL_CTL_ADD, listen_fd, &source_event) < 0){
+            perror("cannot add listening socket to epoll\n");
+            exit(-1);
+        }
+
+    }
+
     pthread_create(handler->thread, NULL, handler_process_request, (void*) handler);
 
-}
\ No newline at end of file
+}
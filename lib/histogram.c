@@ -0,0 +1,162 @@
+#include "h/histogram.h"
+#include <string.h>
+#include <math.h>
+
+#define TICKS_PER_HALF_DISTANCE 5 // percentile rows printed for every halving of the distance to 100% (like HdrHistogram)
+
+static int histogram_index(uint64_t value){
+
+    /*
+        small values are their own index. a bigger one keeps its top HISTOGRAM_SUB_BITS bits ("top", between
+        HISTOGRAM_HALF and 2 * HISTOGRAM_HALF) and every power of two gets HISTOGRAM_HALF buckets after the previous one.
+    */
+    if(value < 2 * HISTOGRAM_HALF) return value;
+
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - HISTOGRAM_SUB_BITS + 1;
+
+    return HISTOGRAM_HALF * (magnitude - HISTOGRAM_SUB_BITS + 1) + (int) (value >> shift);
+
+}
+
+static uint64_t histogram_highest_value(int index){
+
+    // the biggest value that lands in the bucket (it's what the bucket is reported as)
+    if(index < 2 * HISTOGRAM_HALF) return index;
+
+    int magnitude = index / HISTOGRAM_HALF + HISTOGRAM_SUB_BITS - 2;
+    int shift = magnitude - HISTOGRAM_SUB_BITS + 1;
+    uint64_t top = index % HISTOGRAM_HALF + HISTOGRAM_HALF;
+
+    return ((top + 1) << shift) - 1;
+
+}
+
+void histogram_init(histogram* h){
+
+    memset(h->counts, 0, sizeof(h->counts));
+    h->total = 0;
+    h->min = UINT64_MAX;
+    h->max = 0;
+    h->sum = 0;
+    h->sum_squares = 0;
+
+}
+
+void histogram_record(histogram* h, uint64_t value){
+
+    h->counts[histogram_index(value)] += 1;
+    h->total += 1;
+    if(value < h->min) h->min = value;
+    if(value > h->max) h->max = value;
+    h->sum += value;
+    h->sum_squares += (double) value * value;
+
+}
+
+void histogram_merge(histogram* into, const histogram* from){
+
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++) into->counts[i] += from->counts[i];
+    into->total += from->total;
+    if(from->min < into->min) into->min = from->min;
+    if(from->max > into->max) into->max = from->max;
+    into->sum += from->sum;
+    into->sum_squares += from->sum_squares;
+
+}
+
+static int histogram_percentile_index(const histogram* h, double percentile, uint64_t* below){
+
+    // the first bucket where at least "percentile"% of the values have been seen (at least one value)
+    uint64_t wanted = (uint64_t) ceil(percentile / 100.0 * h->total);
+    uint64_t seen = 0;
+
+    if(wanted == 0) wanted = 1;
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++){
+        seen += h->counts[i];
+        if(seen >= wanted){
+            if(below) *below = seen;
+            return i;
+        }
+    }
+
+    if(below) *below = seen;
+    return HISTOGRAM_BUCKETS - 1;
+
+}
+
+uint64_t histogram_percentile(const histogram* h, double percentile){
+
+    if(h->total == 0) return 0;
+
+    uint64_t value = histogram_highest_value(histogram_percentile_index(h, percentile, NULL));
+    return value > h->max ? h->max : value; // the last bucket is reported as the exact max
+
+}
+
+uint64_t histogram_count_at_most(const histogram* h, uint64_t value){
+
+    // the values up to "value" (the ones sharing its bucket count too: they are within the bucket's error)
+    int last = histogram_index(value);
+    uint64_t count = 0;
+
+    for(int i = 0; i <= last; i++) count += h->counts[i];
+    return count;
+
+}
+
+double histogram_mean(const histogram* h){
+
+    return h->total ? h->sum / h->total : 0;
+
+}
+
+double histogram_stddev(const histogram* h){
+
+    if(h->total == 0) return 0;
+
+    double mean = histogram_mean(h);
+    double variance = h->sum_squares / h->total - mean * mean;
+    return variance > 0 ? sqrt(variance) : 0;
+
+}
+
+void histogram_print_distribution(const histogram* h, FILE* out, double unit){
+
+    /*
+        the percentile distribution in HdrHistogram's text format (the ".hgrm" files its plotter reads),
+        values are divided by "unit" (1e6 turns nanoseconds into milliseconds).
+        rows get denser as the percentile gets closer to 100, so the tail is where the detail is.
+    */
+
+    fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+    double percentile = 0;
+    while(h->total > 0){
+
+        uint64_t below;
+        int index = histogram_percentile_index(h, percentile, &below);
+        uint64_t value = histogram_highest_value(index);
+        if(value > h->max) value = h->max;
+
+        if(below == h->total){
+            fprintf(out, "%12.3f %14.12f %10llu\n", value / unit, 1.0, (unsigned long long) below);
+            break;
+        }
+
+        double fraction = (double) below / h->total;
+        fprintf(out, "%12.3f %14.12f %10llu %14.2f\n", value / unit, fraction, (unsigned long long) below, 1 / (1 - fraction));
+
+        // every row skips to the next percentile tick past what this bucket already covers
+        while(percentile <= fraction * 100){
+            double halvings = floor(log2(100 / (100 - percentile)));
+            percentile += 100 / (TICKS_PER_HALF_DISTANCE * pow(2, halvings + 1));
+        }
+
+    }
+
+    fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", histogram_mean(h) / unit, histogram_stddev(h) / unit);
+    fprintf(out, "#[Max     = %12.3f, Total count    = %12llu]\n", (h->total ? h->max : 0) / unit, (unsigned long long) h->total);
+    fprintf(out, "#[Buckets = %12d, SubBuckets     = %12d]\n", HISTOGRAM_BUCKETS / HISTOGRAM_HALF, 2 * HISTOGRAM_HALF);
+
+}
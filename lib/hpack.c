@@ -0,0 +1,476 @@
+#include "h/hpack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+static const hpack_field static_table[HPACK_STATIC_ENTRIES + 1] = {
+    { NULL, 0, NULL, 0 }, // indexes start from 1
+#define FIELD(name, value) { name, sizeof(name) - 1, value, sizeof(value) - 1 }
+    FIELD(":authority", ""), FIELD(":method", "GET"), FIELD(":method", "POST"), FIELD(":path", "/"),
+    FIELD(":path", "/index.html"), FIELD(":scheme", "http"), FIELD(":scheme", "https"), FIELD(":status", "200"),
+    FIELD(":status", "204"), FIELD(":status", "206"), FIELD(":status", "304"), FIELD(":status", "400"),
+    FIELD(":status", "404"), FIELD(":status", "500"), FIELD("accept-charset", ""), FIELD("accept-encoding", "gzip, deflate"),
+    FIELD("accept-language", ""), FIELD("accept-ranges", ""), FIELD("accept", ""), FIELD("access-control-allow-origin", ""),
+    FIELD("age", ""), FIELD("allow", ""), FIELD("authorization", ""), FIELD("cache-control", ""),
+    FIELD("content-disposition", ""), FIELD("content-encoding", ""), FIELD("content-language", ""), FIELD("content-length", ""),
+    FIELD("content-location", ""), FIELD("content-range", ""), FIELD("content-type", ""), FIELD("cookie", ""),
+    FIELD("date", ""), FIELD("etag", ""), FIELD("expect", ""), FIELD("expires", ""),
+    FIELD("from", ""), FIELD("host", ""), FIELD("if-match", ""), FIELD("if-modified-since", ""),
+    FIELD("if-none-match", ""), FIELD("if-range", ""), FIELD("if-unmodified-since", ""), FIELD("last-modified", ""),
+    FIELD("link", ""), FIELD("location", ""), FIELD("max-forwards", ""), FIELD("proxy-authenticate", ""),
+    FIELD("proxy-authorization", ""), FIELD("range", ""), FIELD("referer", ""), FIELD("refresh", ""),
+    FIELD("retry-after", ""), FIELD("server", ""), FIELD("set-cookie", ""), FIELD("strict-transport-security", ""),
+    FIELD("transfer-encoding", ""), FIELD("user-agent", ""), FIELD("vary", ""), FIELD("via", ""),
+    FIELD("www-authenticate", ""),
+#undef FIELD
+};
+
+/*
+    the Huffman code (RFC 7541, appendix B): every byte's code and its length in bits, then EOS (256).
+*/
+static const struct {
+    uint32_t code;
+    uint8_t length;
+} huffman_codes[257] = {
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 },
+    { 0xfffffe6, 28 }, { 0xfffffe7, 28 }, { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+    { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 }, { 0xfffffed, 28 }, { 0xfffffee, 28 },
+    { 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 },
+    { 0xffffffa, 28 }, { 0xffffffb, 28 }, { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+    { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 }, { 0x3fa, 10 }, { 0x3fb, 10 },
+    { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 },
+    { 0x1c, 6 }, { 0x1d, 6 }, { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+    { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 }, { 0x1ffa, 13 }, { 0x21, 6 },
+    { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 },
+    { 0x69, 7 }, { 0x6a, 7 }, { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+    { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 }, { 0xfc, 8 }, { 0x73, 7 },
+    { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 },
+    { 0x25, 6 }, { 0x26, 6 }, { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+    { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 }, { 0x2b, 6 }, { 0x76, 7 },
+    { 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 },
+    { 0x1ffd, 13 }, { 0xffffffc, 28 }, { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+    { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 }, { 0x3fffd6, 22 }, { 0x7fffda, 23 },
+    { 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 },
+    { 0x7fffe2, 23 }, { 0x7fffe3, 23 }, { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+    { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 }, { 0x3fffda, 22 }, { 0x1fffdd, 21 },
+    { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 },
+    { 0x7fffeb, 23 }, { 0x7fffec, 23 }, { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+    { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 },
+    { 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 },
+    { 0x3fffe8, 22 }, { 0x1ffffec, 25 }, { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+    { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 }, { 0x7fff2, 19 }, { 0x1fffe3, 21 },
+    { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 },
+    { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 }, { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+    { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 },
+    { 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 },
+    { 0x7ffffe9, 27 }, { 0x7ffffea, 27 }, { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+    { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 }, { 0x3fffffff, 30 },
+};
+
+/*
+    the Huffman decoder's state machine: a state is an internal node of the code's tree (0 is the root) and it has a step
+    for each of the 16 nibbles, telling where the nibble leads and the byte it completes on the way (codes are 5 bits
+    at least, so a nibble completes one of them at most).
+*/
+#define HUFFMAN_EMIT 1
+#define HUFFMAN_FAIL 2 // EOS inside a string
+
+typedef struct {
+    uint8_t state;
+    uint8_t flags;
+    uint8_t symbol;
+} huffman_step;
+
+static huffman_step huffman_steps[256][16];
+static bool huffman_accepting[256]; // a string can end here: the root, or up to 7 bits of EOS (all ones) as padding
+
+__attribute__((constructor))
+static void hpack_build_huffman(void){
+
+    // the tree: internal nodes are numbered from 1 (0 is the root, never a child), leaves are -(symbol + 1)
+    static int16_t tree[256][2];
+    int nodes = 1;
+
+    for(int symbol = 0; symbol < 257; symbol++){
+        uint32_t code = huffman_codes[symbol].code;
+        int node = 0;
+        for(int bit = huffman_codes[symbol].length - 1; bit > 0; bit--){
+            int branch = (code >> bit) & 1;
+            if(!tree[node][branch]) tree[node][branch] = nodes++;
+            node = tree[node][branch];
+        }
+        tree[node][code & 1] = -(symbol + 1);
+    }
+
+    for(int node = 0, depth = 0; depth <= 7; depth++){
+        huffman_accepting[node] = true;
+        node = tree[node][1];
+    }
+
+    for(int state = 0; state < nodes; state++){
+        for(int nibble = 0; nibble < 16; nibble++){
+            huffman_step* step = &huffman_steps[state][nibble];
+            int current = state;
+            for(int bit = 3; bit >= 0; bit--){
+                int next = tree[current][(nibble >> bit) & 1];
+                if(next >= 0){
+                    current = next;
+                    continue;
+                }
+                if(-next - 1 == 256){
+                    step->flags |= HUFFMAN_FAIL;
+                }else{
+                    step->flags |= HUFFMAN_EMIT;
+                    step->symbol = -next - 1;
+                }
+                current = 0;
+            }
+            step->state = current;
+        }
+    }
+
+}
+
+static long hpack_huffman_decode(const uint8_t* in, size_t length, char* out){
+
+    // returns the decoded length, -1 if the string isn't valid (EOS in it, or a padding that isn't a prefix of EOS)
+    char* start = out;
+    uint8_t state = 0;
+
+    for(size_t i = 0; i < length; i++){
+        const huffman_step* high = &huffman_steps[state][in[i] >> 4];
+        const huffman_step* low = &huffman_steps[high->state][in[i] & 0xf];
+        if((high->flags | low->flags) & HUFFMAN_FAIL) return -1;
+        if(high->flags & HUFFMAN_EMIT) *out++ = high->symbol;
+        if(low->flags & HUFFMAN_EMIT) *out++ = low->symbol;
+        state = low->state;
+    }
+
+    return huffman_accepting[state] ? out - start : -1;
+
+}
+
+static bool hpack_integer(const uint8_t** in, const uint8_t* end, int prefix, uint32_t* value){
+
+    // an integer with a "prefix" bits prefix: values that don't fit go on in the next bytes, 7 bits at a time
+    uint32_t max = (1u << prefix) - 1;
+    uint32_t result;
+
+    if(*in >= end) return false;
+    result = *(*in)++ & max;
+
+    if(result == max){
+        for(int shift = 0; ; shift += 7){
+            if(*in >= end || shift > 21) return false; // 28 bits are more than anything we'd accept
+            uint8_t byte = *(*in)++;
+            result += (uint32_t) (byte & 0x7f) << shift;
+            if(!(byte & 0x80)) break;
+        }
+    }
+
+    *value = result;
+    return true;
+
+}
+
+static bool hpack_string(hpack_decoder* decoder, const uint8_t** in, const uint8_t* end, size_t* scratch_used, const char** string, size_t* length){
+
+    // plain strings are handed out where they are, Huffman ones are decoded in the scratch buffer
+    bool huffman;
+    uint32_t string_length;
+
+    if(*in >= end) return false;
+    huffman = **in & 0x80;
+    if(!hpack_integer(in, end, 7, &string_length) || string_length > (size_t) (end - *in)) return false;
+
+    if(!huffman){
+        *string = (const char*) *in;
+        *length = string_length;
+        *in += string_length;
+        return true;
+    }
+
+    char* out = decoder->scratch + *scratch_used;
+    long decoded = hpack_huffman_decode(*in, string_length, out);
+    if(decoded < 0) return false;
+
+    *string = out;
+    *length = decoded;
+    *scratch_used += decoded;
+    *in += string_length;
+    return true;
+
+}
+
+static hpack_entry* hpack_entry_at(hpack_decoder* decoder, uint32_t index){
+
+    // 0 is the newest entry
+    return &decoder->entries[(decoder->first + decoder->count - 1 - index) % HPACK_TABLE_ENTRIES];
+
+}
+
+static void hpack_shrink(hpack_decoder* decoder, size_t max_size){
+
+    // the oldest entries go until the table fits
+    while(decoder->size > max_size){
+        hpack_entry* oldest = &decoder->entries[decoder->first];
+        decoder->size -= oldest->name_length + oldest->value_length + 32;
+        decoder->first = (decoder->first + 1) % HPACK_TABLE_ENTRIES;
+        decoder->count--;
+    }
+
+}
+
+static void hpack_insert(hpack_decoder* decoder, hpack_field* field){
+
+    /*
+        the field goes in the table, "field" is pointed to the table's copy.
+        the name may be a table entry that's evicted to make room: its bytes are still there, but the new entry
+        may land on them, so it's moved first (the value never comes from the table).
+        in a ring twice as big as the table the new entry always fits in one piece once the old ones are evicted:
+        the free bytes are at least HPACK_TABLE_SIZE + length, split in two pieces at most, and one of them
+        is at least as long as the entry. if it doesn't fit anyway, entries keep going until it does.
+    */
+
+    size_t length = field->name_length + field->value_length;
+    uint32_t position = 0;
+
+    if(length + 32 > decoder->max_size){
+        // bigger than the whole table: the table is emptied and the field isn't kept
+        hpack_shrink(decoder, 0);
+        return;
+    }
+    hpack_shrink(decoder, decoder->max_size - length - 32);
+
+    while(decoder->count > 0){
+        hpack_entry* oldest = &decoder->entries[decoder->first];
+        hpack_entry* newest = hpack_entry_at(decoder, 0);
+        uint32_t start = oldest->offset;
+        uint32_t end = newest->offset + newest->name_length + newest->value_length;
+
+        if(start <= end){
+            // the live bytes are in one piece: there's room after them, or before them
+            if(sizeof(decoder->bytes) - end >= length){ position = end; break; }
+            if(start >= length){ position = 0; break; }
+        }else if(start - end >= length){
+            // they wrapped around: the room is between the newest and the oldest
+            position = end;
+            break;
+        }
+        hpack_shrink(decoder, decoder->size - (oldest->name_length + oldest->value_length + 32));
+    }
+
+    char* name = decoder->bytes + position;
+    memmove(name, field->name, field->name_length);
+    memcpy(name + field->name_length, field->value, field->value_length);
+
+    hpack_entry* entry = &decoder->entries[(decoder->first + decoder->count) % HPACK_TABLE_ENTRIES];
+    entry->offset = position;
+    entry->name_length = field->name_length;
+    entry->value_length = field->value_length;
+    decoder->count++;
+    decoder->size += length + 32;
+
+    field->name = name;
+    field->value = name + field->name_length;
+
+}
+
+static bool hpack_lookup(hpack_decoder* decoder, uint32_t index, hpack_field* field){
+
+    // static entries first (1 to 61), then the dynamic ones from the newest
+    if(index == 0) return false;
+    if(index <= HPACK_STATIC_ENTRIES){
+        *field = static_table[index];
+        return true;
+    }
+
+    index -= HPACK_STATIC_ENTRIES + 1;
+    if(index >= (uint32_t) decoder->count) return false;
+
+    hpack_entry* entry = hpack_entry_at(decoder, index);
+    field->name = decoder->bytes + entry->offset;
+    field->name_length = entry->name_length;
+    field->value = field->name + entry->name_length;
+    field->value_length = entry->value_length;
+    return true;
+
+}
+
+void hpack_decoder_init(hpack_decoder* decoder){
+
+    decoder->first = 0;
+    decoder->count = 0;
+    decoder->size = 0;
+    decoder->max_size = HPACK_TABLE_SIZE;
+    decoder->scratch = NULL;
+    decoder->scratch_size = 0;
+
+}
+
+void hpack_decoder_free(hpack_decoder* decoder){
+
+    free(decoder->scratch);
+    decoder->scratch = NULL;
+    decoder->scratch_size = 0;
+
+}
+
+hpack_result hpack_decode(hpack_decoder* decoder, const uint8_t** in, const uint8_t* end, hpack_field* field){
+
+    /*
+        decodes the field at "in" (moved past it), HPACK_SIZE_UPDATE if it was a table size update instead.
+        the field's strings point to the static table, the dynamic one, the block itself or the scratch buffer.
+    */
+
+    uint8_t first = **in;
+    uint32_t index;
+    size_t scratch_used = 0;
+    size_t scratch_needed = (end - *in) * 8 / 5 + 2; // what the rest of the block can decode to, at most
+
+    if(scratch_needed > decoder->scratch_size){
+        // grown once for the whole field: its name must not move while its value is decoded
+        char* scratch = realloc(decoder->scratch, scratch_needed);
+        if(!scratch){
+            perror("system is out of memory!\n");
+            exit(-1);
+        }
+        decoder->scratch = scratch;
+        decoder->scratch_size = scratch_needed;
+    }
+
+    if(first & 0x80){
+        // 1xxxxxxx: a whole field from a table
+        if(!hpack_integer(in, end, 7, &index) || !hpack_lookup(decoder, index, field)) return HPACK_ERROR;
+        return HPACK_FIELD;
+    }
+
+    if((first & 0xe0) == 0x20){
+        // 001xxxxx: the client shrinks (or grows back) its table, up to the size we allow
+        if(!hpack_integer(in, end, 5, &index) || index > HPACK_TABLE_SIZE) return HPACK_ERROR;
+        decoder->max_size = index;
+        hpack_shrink(decoder, index);
+        return HPACK_SIZE_UPDATE;
+    }
+
+    /*
+        a literal: 01xxxxxx is added to the table, 0000xxxx and 0001xxxx (never indexed) aren't.
+        its name is a table's entry, or a string of its own when the index is 0.
+    */
+    bool indexing = (first & 0xc0) == 0x40;
+    if(!hpack_integer(in, end, indexing ? 6 : 4, &index)) return HPACK_ERROR;
+
+    if(index > 0){
+        hpack_field named;
+        if(!hpack_lookup(decoder, index, &named)) return HPACK_ERROR;
+        field->name = named.name;
+        field->name_length = named.name_length;
+    }else if(!hpack_string(decoder, in, end, &scratch_used, &field->name, &field->name_length)){
+        return HPACK_ERROR;
+    }
+    if(!hpack_string(decoder, in, end, &scratch_used, &field->value, &field->value_length)) return HPACK_ERROR;
+
+    if(indexing) hpack_insert(decoder, field);
+    return HPACK_FIELD;
+
+}
+
+static size_t hpack_encode_integer(char* out, uint8_t first, int prefix, size_t value){
+
+    uint8_t* bytes = (uint8_t*) out;
+    size_t max = (1u << prefix) - 1;
+    size_t length = 1;
+
+    if(value < max){
+        bytes[0] = first | value;
+        return 1;
+    }
+
+    bytes[0] = first | max;
+    value -= max;
+    while(value >= 128){
+        bytes[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    bytes[length++] = value;
+    return length;
+
+}
+
+size_t hpack_encode_status(char* out, int status){
+
+    // the usual statuses are in the static table (8 to 14), the others are ":status" (8) with a literal value
+    int index;
+
+    switch(status){
+        case 200: index = 8; break;
+        case 204: index = 9; break;
+        case 206: index = 10; break;
+        case 304: index = 11; break;
+        case 400: index = 12; break;
+        case 404: index = 13; break;
+        case 500: index = 14; break;
+        default: index = 0;
+    }
+
+    if(index){
+        out[0] = (char) (0x80 | index);
+        return 1;
+    }
+
+    out[0] = 0x08;
+    out[1] = 3;
+    out[2] = '0' + (status / 100) % 10;
+    out[3] = '0' + (status / 10) % 10;
+    out[4] = '0' + status % 10;
+    return 5;
+
+}
+
+static int hpack_static_name(const char* name, size_t length){
+
+    // the index of a (regular) header's name in the static table, 0 if it isn't there
+    for(int i = 15; i <= HPACK_STATIC_ENTRIES; i++){
+        if(static_table[i].name_length == length && strncasecmp(static_table[i].name, name, length) == 0) return i;
+    }
+    return 0;
+
+}
+
+size_t hpack_encode_field(char* out, const char* name, size_t name_length, const char* value, size_t value_length){
+
+    /*
+        a literal without indexing (0000xxxx): with the static table's index for its name when it has one,
+        with its name (lowercase, like HTTP/2 wants it) otherwise. never Huffman-coded.
+        it writes HPACK_FIELD_MAX(name_length, value_length) bytes at most.
+    */
+
+    int index = hpack_static_name(name, name_length);
+    size_t length;
+
+    if(index){
+        length = hpack_encode_integer(out, 0x00, 4, index);
+    }else{
+        out[0] = 0x00;
+        length = 1 + hpack_encode_integer(out + 1, 0x00, 7, name_length);
+        for(size_t i = 0; i < name_length; i++) out[length + i] = tolower((unsigned char) name[i]);
+        length += name_length;
+    }
+
+    length += hpack_encode_integer(out + length, 0x00, 7, value_length);
+    memcpy(out + length, value, value_length);
+    return length + value_length;
+
+}
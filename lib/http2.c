@@ -0,0 +1,1395 @@
+#define _GNU_SOURCE
+#include "h/http2.h"
+#include "h/handler.h"
+#include "h/connection_context.h"
+#include "h/http_response.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+typedef enum {
+    FRAME_DATA,
+    FRAME_HEADERS,
+    FRAME_PRIORITY,
+    FRAME_RST_STREAM,
+    FRAME_SETTINGS,
+    FRAME_PUSH_PROMISE,
+    FRAME_PING,
+    FRAME_GOAWAY,
+    FRAME_WINDOW_UPDATE,
+    FRAME_CONTINUATION
+} http2_frame_type;
+
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1 // SETTINGS and PING
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+typedef enum {
+    SETTINGS_HEADER_TABLE_SIZE = 1,
+    SETTINGS_ENABLE_PUSH,
+    SETTINGS_MAX_CONCURRENT_STREAMS,
+    SETTINGS_INITIAL_WINDOW_SIZE,
+    SETTINGS_MAX_FRAME_SIZE,
+    SETTINGS_MAX_HEADER_LIST_SIZE
+} http2_setting;
+
+typedef enum {
+    ERROR_NONE,
+    ERROR_PROTOCOL,
+    ERROR_INTERNAL,
+    ERROR_FLOW_CONTROL,
+    ERROR_SETTINGS_TIMEOUT,
+    ERROR_STREAM_CLOSED,
+    ERROR_FRAME_SIZE,
+    ERROR_REFUSED_STREAM,
+    ERROR_CANCEL,
+    ERROR_COMPRESSION,
+    ERROR_CONNECT,
+    ERROR_ENHANCE_YOUR_CALM
+} http2_error;
+
+#define HTTP2_WINDOW_MAX 0x7fffffffL
+#define HTTP2_SETTINGS_MAX 64 // settings in an HTTP2-Settings header (a client sends a handful)
+
+static const char upgrade_response[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+
+static uint32_t http2_read32(const unsigned char* bytes){
+
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+
+}
+
+static void http2_write32(unsigned char* bytes, uint32_t value){
+
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+
+}
+
+static void http2_frame_head(unsigned char* head, size_t length, int type, int flags, uint32_t stream){
+
+    head[0] = length >> 16;
+    head[1] = length >> 8;
+    head[2] = length;
+    head[3] = type;
+    head[4] = flags;
+    http2_write32(head + 5, stream & 0x7fffffff);
+
+}
+
+static char* http2_output_reserve(http2_session* session, size_t bytes){
+
+    /*
+        room for "bytes" more at the end of the output: what was written is dropped first,
+        then the buffer grows (a client that keeps asking without reading is dropped, check HTTP2_OUTPUT_MAX).
+    */
+
+    if(session->output_sent == session->output_length){
+        session->output_sent = session->output_length = 0;
+    }else if(session->output_sent > 0 && session->output_length + bytes > session->output_size){
+        memmove(session->output, session->output + session->output_sent, session->output_length - session->output_sent);
+        session->output_length -= session->output_sent;
+        session->output_sent = 0;
+    }
+
+    if(session->output_length + bytes > session->output_size){
+        size_t size = session->output_size ? session->output_size : 4096;
+        while(size < session->output_length + bytes) size *= 2;
+        char* output = realloc(session->output, size);
+        if(!output){
+            perror("system is out of memory!\n");
+            exit(-1);
+        }
+        session->output = output;
+        session->output_size = size;
+    }
+
+    return session->output + session->output_length;
+
+}
+
+static void http2_output_frame(http2_session* session, int type, int flags, uint32_t stream, const void* payload, size_t length){
+
+    unsigned char* out = (unsigned char*) http2_output_reserve(session, HTTP2_FRAME_HEAD + length);
+
+    http2_frame_head(out, length, type, flags, stream);
+    if(length) memcpy(out + HTTP2_FRAME_HEAD, payload, length);
+    session->output_length += HTTP2_FRAME_HEAD + length;
+
+}
+
+static void http2_reset_stream(http2_session* session, uint32_t stream, http2_error error){
+
+    unsigned char payload[4];
+    http2_write32(payload, error);
+    http2_output_frame(session, FRAME_RST_STREAM, 0, stream, payload, sizeof(payload));
+
+}
+
+static void http2_window_update(http2_session* session, uint32_t stream, uint32_t increment){
+
+    unsigned char payload[4];
+    http2_write32(payload, increment);
+    http2_output_frame(session, FRAME_WINDOW_UPDATE, 0, stream, payload, sizeof(payload));
+
+}
+
+static http2_stream* http2_find_stream(http2_session* session, uint32_t id){
+
+    // there are max_streams of them at most, and most of the time just a few
+    for(int i = 0; i < session->stream_count; i++){
+        if(session->streams[i]->id == id) return session->streams[i];
+    }
+    return NULL;
+
+}
+
+static void http2_make_ready(http2_session* session, http2_stream* stream){
+
+    // the stream joins the ring's end if it has something to write and the window to write it
+    if(stream->ready || stream->reset || !stream->response || stream->body_left == 0 || stream->window <= 0) return;
+
+    stream->ready = true;
+    stream->next_ready = NULL;
+    if(session->ready_last) session->ready_last->next_ready = stream;
+    else session->ready_first = stream;
+    session->ready_last = stream;
+
+}
+
+static http2_stream* http2_pop_ready(http2_session* session){
+
+    http2_stream* stream = session->ready_first;
+
+    session->ready_first = stream->next_ready;
+    if(!session->ready_first) session->ready_last = NULL;
+    stream->ready = false;
+    stream->next_ready = NULL;
+    return stream;
+
+}
+
+static void http2_unready(http2_session* session, http2_stream* stream){
+
+    http2_stream* previous = NULL;
+
+    if(!stream->ready) return;
+    for(http2_stream* current = session->ready_first; current; previous = current, current = current->next_ready){
+        if(current != stream) continue;
+        if(previous) previous->next_ready = stream->next_ready;
+        else session->ready_first = stream->next_ready;
+        if(session->ready_last == stream) session->ready_last = previous;
+        break;
+    }
+    stream->ready = false;
+    stream->next_ready = NULL;
+
+}
+
+static http2_stream* http2_open_stream(handler* current_handler, http2_session* session, uint32_t id){
+
+    /*
+        a stream gets a connection context of its own (from the handler's slab, it doesn't count as a connection):
+        its buffer will hold the request, its arena whatever the response needs.
+        the client's address is the connection's, so it's looked up once for all the streams.
+    */
+
+    http2_stream* stream = malloc(sizeof(http2_stream));
+    connection_context* ctx = slab_alloc(&current_handler->memory.connections);
+
+    if(!stream){
+        perror("system is out of memory!\n");
+        exit(-1);
+    }
+
+    context_init(ctx, &current_handler->memory, &current_handler->date, &current_handler->load, current_handler->request_buffer_size);
+    ctx->fd = session->ctx->fd;
+    ctx->peer_family = session->ctx->peer_family;
+    ctx->peer_port = session->ctx->peer_port;
+    memcpy(ctx->peer_address, session->ctx->peer_address, sizeof(ctx->peer_address));
+
+    stream->id = id;
+    stream->ctx = ctx;
+    stream->response = NULL;
+    stream->window = session->initial_window;
+    stream->body_left = 0;
+    stream->batched = 0;
+    stream->batched_chain = 0;
+    stream->batched_file = 0;
+    stream->request_ended = false;
+    stream->head_only = false;
+    stream->ready = false;
+    stream->reset = false;
+    stream->next_ready = NULL;
+
+    session->streams[session->stream_count++] = stream;
+    metrics_add(&current_handler->metrics, METRIC_HTTP2_STREAMS, 1);
+    return stream;
+
+}
+
+static void http2_close_stream(http2_session* session, http2_stream* stream){
+
+    // the stream is gone: its context goes back to the handler, with the response and whatever it holds
+    for(int i = 0; i < session->stream_count; i++){
+        if(session->streams[i] != stream) continue;
+        session->streams[i] = session->streams[--session->stream_count];
+        break;
+    }
+
+    http2_unready(session, stream);
+    if(stream->response) http_response_destroy(stream->response);
+    context_release(stream->ctx);
+    free(stream);
+
+}
+
+static void http2_cancel_stream(http2_session* session, http2_stream* stream){
+
+    // a frame of the stream that's being written can't be cut: then the stream goes once its frames are out
+    if(stream->batched > 0){
+        stream->reset = true;
+        http2_unready(session, stream);
+        return;
+    }
+    http2_close_stream(session, stream);
+
+}
+
+static void http2_goaway(http2_session* session, http2_error error){
+
+    /*
+        the last stream we'll answer is the last one the client opened. a GOAWAY for an error breaks the session:
+        its streams are dropped, what the client sends from now on is ignored and the connection is closed once it's out.
+    */
+
+    unsigned char payload[8];
+
+    if(session->broken) return;
+
+    http2_write32(payload, session->last_stream_id);
+    http2_write32(payload + 4, error);
+    http2_output_frame(session, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+    session->going_away = true;
+
+    if(error == ERROR_NONE) return;
+    session->broken = true;
+    session->block_stream = 0;
+    for(int i = session->stream_count - 1; i >= 0; i--) http2_cancel_stream(session, session->streams[i]);
+
+}
+
+static void http2_stream_done(handler* current_handler, http2_session* session, http2_stream* stream){
+
+    /*
+        the stream's response is out: it's counted and logged like an HTTP/1.1 one.
+        a client that's still sending a request body can finish it, its DATA is thrown away (check http2_on_data).
+    */
+
+    http_response* res = stream->response;
+    connection_context* ctx = session->ctx;
+
+    metrics_response_done(&current_handler->metrics, res->status, stream->ctx->request_started_ns);
+    handler_log_response(current_handler, stream->ctx, res->status, res->content_length);
+    ctx->peer_family = stream->ctx->peer_family;
+    ctx->peer_port = stream->ctx->peer_port;
+    memcpy(ctx->peer_address, stream->ctx->peer_address, sizeof(ctx->peer_address));
+
+    ctx->requests_served += 1;
+    handler_clear_deadline(current_handler, ctx); // the idle time starts over from this response
+
+    http2_close_stream(session, stream);
+
+}
+
+static bool http2_apply_settings(http2_session* session, const unsigned char* payload, size_t length, http2_error* error){
+
+    // the client's settings, 6 bytes each: only the ones that change what we send matter
+    for(size_t i = 0; i + 6 <= length; i += 6){
+
+        int id = payload[i] << 8 | payload[i + 1];
+        uint32_t value = http2_read32(payload + i + 2);
+
+        switch(id){
+
+            case SETTINGS_ENABLE_PUSH:
+                if(value > 1){
+                    *error = ERROR_PROTOCOL;
+                    return false;
+                }
+                break;
+
+            case SETTINGS_INITIAL_WINDOW_SIZE: {
+                // every stream's window moves by the difference, even below 0
+                if(value > HTTP2_WINDOW_MAX){
+                    *error = ERROR_FLOW_CONTROL;
+                    return false;
+                }
+                long delta = (long) value - session->initial_window;
+                session->initial_window = value;
+                for(int s = 0; s < session->stream_count; s++){
+                    http2_stream* stream = session->streams[s];
+                    stream->window += delta;
+                    if(stream->window > HTTP2_WINDOW_MAX){
+                        *error = ERROR_FLOW_CONTROL;
+                        return false;
+                    }
+                    http2_make_ready(session, stream);
+                }
+                break;
+            }
+
+            case SETTINGS_MAX_FRAME_SIZE:
+                if(value < HTTP2_MAX_FRAME || value > 16777215){
+                    *error = ERROR_PROTOCOL;
+                    return false;
+                }
+                session->max_frame = value;
+                break;
+
+            default:
+                // the table size is the client's decoder's business (we don't use the dynamic table), the others we don't need
+                break;
+
+        }
+
+    }
+
+    return true;
+
+}
+
+static void http2_output_settings(http2_session* session, int max_header_list){
+
+    // ours: how many streams a client can open at once, and how big a request can be
+    unsigned char payload[12];
+
+    payload[0] = 0;
+    payload[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    http2_write32(payload + 2, session->max_streams);
+    payload[6] = 0;
+    payload[7] = SETTINGS_MAX_HEADER_LIST_SIZE;
+    http2_write32(payload + 8, max_header_list);
+    http2_output_frame(session, FRAME_SETTINGS, 0, 0, payload, sizeof(payload));
+
+}
+
+static http2_session* http2_session_create(handler* current_handler, connection_context* ctx){
+
+    http2_session* session = malloc(sizeof(http2_session));
+
+    if(!session){
+        perror("system is out of memory!\n");
+        exit(-1);
+    }
+
+    session->ctx = ctx;
+    session->preface = false;
+    session->settings = false;
+    session->going_away = false;
+    session->broken = false;
+    session->last_stream_id = 0;
+    session->max_frame = HTTP2_MAX_FRAME;
+    session->initial_window = HTTP2_WINDOW;
+    session->window = HTTP2_WINDOW;
+    session->received = 0;
+    session->max_streams = current_handler->http2_max_streams;
+    session->streams = malloc(sizeof(http2_stream*) * session->max_streams);
+    session->stream_count = 0;
+    session->ready_first = session->ready_last = NULL;
+    session->block_stream = 0;
+    session->block_end_stream = false;
+    session->block = NULL;
+    session->block_length = 0;
+    session->block_size = 0;
+    hpack_decoder_init(&session->decoder);
+    session->output = NULL;
+    session->output_length = 0;
+    session->output_sent = 0;
+    session->output_size = 0;
+    session->frame_count = 0;
+
+    if(!session->streams){
+        perror("system is out of memory!\n");
+        exit(-1);
+    }
+
+    ctx->http2 = session;
+    metrics_add(&current_handler->metrics, METRIC_HTTP2_SESSIONS, 1);
+    return session;
+
+}
+
+void http2_session_destroy(handler* current_handler, http2_session* session){
+
+    // the connection is closed: the streams go with it, written or not
+    session->ctx->http2 = NULL;
+    for(int i = session->stream_count - 1; i >= 0; i--) http2_close_stream(session, session->streams[i]);
+    hpack_decoder_free(&session->decoder);
+    free(session->streams);
+    free(session->block);
+    free(session->output);
+    free(session);
+
+}
+
+static void http2_append(connection_context* ctx, const char* data, size_t length){
+
+    // the stream's request grows a piece at a time, write_to_context takes a buffer's worth at most
+    while(length > 0){
+        size_t piece = length < (size_t) ctx->buf_size ? length : (size_t) ctx->buf_size;
+        write_to_context(ctx, (char*) data, piece);
+        data += piece;
+        length -= piece;
+    }
+
+}
+
+typedef enum {
+    BLOCK_OK,
+    BLOCK_TOO_BIG, // the request is bigger than "max-request": it gets a 431
+    BLOCK_MALFORMED, // a request HTTP/2 doesn't allow: the stream is reset
+    BLOCK_BROKEN // the block can't be decoded: the connection's table is lost, so is the connection
+} http2_block_result;
+
+static bool http2_valid(const char* text, size_t length, bool name){
+
+    // nothing that could break the rebuilt head: no line breaks, no NUL, and no colon or space in a name
+    for(size_t i = 0; i < length; i++){
+        char c = text[i];
+        if(c == '\r' || c == '\n' || c == '\0' || (name && (c == ':' || c == ' ' || c == '\t'))) return false;
+    }
+    return true;
+
+}
+
+static bool http2_hop_by_hop(const char* name, size_t length){
+
+    // headers that only mean something to HTTP/1.1 connections (HTTP/2 doesn't allow them, we just ignore them)
+    return (length == 10 && strncasecmp(name, "connection", 10) == 0)
+           || (length == 10 && strncasecmp(name, "keep-alive", 10) == 0)
+           || (length == 7 && strncasecmp(name, "upgrade", 7) == 0)
+           || (length == 16 && strncasecmp(name, "proxy-connection", 16) == 0)
+           || (length == 17 && strncasecmp(name, "transfer-encoding", 17) == 0);
+
+}
+
+static http2_block_result http2_decode_block(handler* current_handler, http2_session* session, connection_context* target){
+
+    /*
+        the header block, decoded into "target"'s buffer as an HTTP/1.1 head (NULL: decoded only to keep the table in sync).
+        the pseudo-headers come first: they're kept in the arena until the first regular header (or the end of the block),
+        then they become the request line and the Host header.
+        everything is decoded even when the request is too big or malformed, the table must see every field.
+    */
+
+    const uint8_t* in = session->block;
+    const uint8_t* end = session->block + session->block_length;
+    hpack_field field;
+    http_view method = { NULL, 0 }, path = { NULL, 0 }, authority = { NULL, 0 };
+    bool regular = false; // the pseudo-headers are over
+    bool malformed = false;
+    size_t size = 0;
+    size_t max_size = current_handler->max_request_size;
+
+    while(in < end){
+
+        hpack_result result = hpack_decode(&session->decoder, &in, end, &field);
+        if(result == HPACK_ERROR) return BLOCK_BROKEN;
+        if(result == HPACK_SIZE_UPDATE || !target || malformed) continue;
+
+        if(field.name_length > 0 && field.name[0] == ':'){
+
+            // :method, :path, :authority (:scheme is always "http" here) before any regular header
+            http_view* pseudo = NULL;
+            if(field.name_length == 7 && memcmp(field.name, ":method", 7) == 0) pseudo = &method;
+            else if(field.name_length == 5 && memcmp(field.name, ":path", 5) == 0) pseudo = &path;
+            else if(field.name_length == 10 && memcmp(field.name, ":authority", 10) == 0) pseudo = &authority;
+            else if(field.name_length != 7 || memcmp(field.name, ":scheme", 7) != 0) malformed = true;
+
+            if(regular || (pseudo && pseudo->ptr) || !http2_valid(field.value, field.value_length, pseudo != &authority)){
+                malformed = true;
+            }else if(pseudo){
+                char* copy = arena_alloc(&target->arena, field.value_length + 1);
+                memcpy(copy, field.value, field.value_length);
+                *pseudo = (http_view) { copy, field.value_length };
+            }
+            continue;
+
+        }
+
+        if(!regular){
+            // the request line (and Host) go first
+            if(!method.ptr || !path.ptr || method.length == 0 || path.length == 0){
+                malformed = true;
+                continue;
+            }
+            size = method.length + path.length + authority.length + 20;
+            if(size <= max_size){
+                http2_append(target, method.ptr, method.length);
+                http2_append(target, " ", 1);
+                http2_append(target, path.ptr, path.length);
+                http2_append(target, " HTTP/1.1\r\n", 11);
+                if(authority.ptr){
+                    http2_append(target, "host: ", 6);
+                    http2_append(target, authority.ptr, authority.length);
+                    http2_append(target, "\r\n", 2);
+                }
+            }
+            regular = true;
+        }
+
+        if(!http2_valid(field.name, field.name_length, true) || field.name_length == 0 || !http2_valid(field.value, field.value_length, false)){
+            malformed = true;
+            continue;
+        }
+        if(http2_hop_by_hop(field.name, field.name_length)) continue;
+
+        size += field.name_length + field.value_length + 4;
+        if(size > max_size) continue;
+        http2_append(target, field.name, field.name_length);
+        http2_append(target, ": ", 2);
+        http2_append(target, field.value, field.value_length);
+        http2_append(target, "\r\n", 2);
+
+    }
+
+    if(!target) return BLOCK_OK;
+
+    if(!malformed && !regular){
+        // a request with pseudo-headers only
+        if(!method.ptr || !path.ptr || method.length == 0 || path.length == 0) return BLOCK_MALFORMED;
+        size = method.length + path.length + authority.length + 20;
+        if(size <= max_size){
+            http2_append(target, method.ptr, method.length);
+            http2_append(target, " ", 1);
+            http2_append(target, path.ptr, path.length);
+            http2_append(target, " HTTP/1.1\r\n", 11);
+            if(authority.ptr){
+                http2_append(target, "host: ", 6);
+                http2_append(target, authority.ptr, authority.length);
+                http2_append(target, "\r\n", 2);
+            }
+        }
+    }
+
+    if(malformed) return BLOCK_MALFORMED;
+    if(size > max_size) return BLOCK_TOO_BIG;
+    http2_append(target, "\r\n", 2);
+    return BLOCK_OK;
+
+}
+
+static void http2_output_headers(http2_session* session, uint32_t id, const char* block, size_t length, bool end_stream){
+
+    // a HEADERS frame, and as many CONTINUATION as the client's frame size asks for
+    size_t offset = 0;
+    int type = FRAME_HEADERS;
+
+    do{
+        size_t piece = length - offset < session->max_frame ? length - offset : session->max_frame;
+        int flags = (type == FRAME_HEADERS && end_stream ? FLAG_END_STREAM : 0) | (offset + piece == length ? FLAG_END_HEADERS : 0);
+        http2_output_frame(session, type, flags, id, block + offset, piece);
+        offset += piece;
+        type = FRAME_CONTINUATION;
+    }while(offset < length);
+
+}
+
+static void http2_respond(handler* current_handler, http2_session* session, http2_stream* stream, http_response* res){
+
+    /*
+        the response's HTTP/1.1 head is taken out of its chain and turned into a HEADERS frame
+        (without the headers HTTP/2 doesn't have): what's left in the chain, and in the file, is the body.
+    */
+
+    char head[HTTP2_HEAD_MAX];
+    char block[3 * HTTP2_HEAD_MAX]; // a field takes 8 bytes more than its line at most, and a line is 4 bytes at least
+    size_t head_length = 0, head_end = 0, block_length = 0;
+
+    stream->response = res;
+
+    for(int i = res->iov_next; i < res->iov_count && !head_end; i++){
+        size_t piece = res->iov[i].iov_len < sizeof(head) - head_length ? res->iov[i].iov_len : sizeof(head) - head_length;
+        size_t from = head_length > 3 ? head_length - 3 : 0;
+        memcpy(head + head_length, res->iov[i].iov_base, piece);
+        head_length += piece;
+        char* found = memmem(head + from, head_length - from, "\r\n\r\n", 4);
+        if(found) head_end = found + 4 - head;
+    }
+
+    if(!head_end || head_end < 12){
+        // it can't happen with our heads, but nothing can be sent if it does
+        http2_reset_stream(session, stream->id, ERROR_INTERNAL);
+        http2_close_stream(session, stream);
+        return;
+    }
+
+    block_length = hpack_encode_status(block, res->status);
+    for(char* line = memmem(head, head_end, "\r\n", 2) + 2; line < head + head_end - 2; ){
+        char* line_end = memmem(line, head + head_end - line, "\r\n", 2);
+        char* colon = memchr(line, ':', line_end - line);
+        if(colon){
+            char* value = colon + 1;
+            char* value_end = line_end;
+            while(value < value_end && (*value == ' ' || *value == '\t')) value++;
+            while(value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+            if(!http2_hop_by_hop(line, colon - line)){
+                block_length += hpack_encode_field(block + block_length, line, colon - line, value, value_end - value);
+            }
+        }
+        line = line_end + 2;
+    }
+
+    http_response_advance(res, head_end);
+    stream->body_left = stream->head_only ? 0 : res->content_length;
+    http2_output_headers(session, stream->id, block, block_length, stream->body_left == 0);
+
+    if(stream->body_left == 0) http2_stream_done(current_handler, session, stream);
+    else http2_make_ready(session, stream);
+
+}
+
+static void http2_serve(handler* current_handler, http2_session* session, http2_stream* stream, http2_block_result block){
+
+    /*
+        the stream's request is in its context: it's answered like an HTTP/1.1 one would be.
+        the response is ready right away (the file is opened here if it's not cached), it only has to be written.
+    */
+
+    connection_context* ctx = stream->ctx;
+    http_request* req = &ctx->request;
+    int head_length = block == BLOCK_OK ? http_request_parse(req, ctx->data, ctx->length) : HTTP_PARSE_ERROR;
+    http_response* res;
+
+    handler_request_started(current_handler, ctx);
+    if(current_handler->log && head_length > 0) handler_log_request(current_handler, ctx);
+
+    if(block == BLOCK_TOO_BIG){
+        res = http_response_canned(431, ctx, true);
+    }else if(head_length <= 0){
+        res = http_response_bad_request(ctx);
+    }else if(current_handler->proxy && proxy_match(current_handler->proxy, req)){
+        // the proxy writes HTTP/1.1 straight to the socket
+        res = http_response_canned(421, ctx, true);
+    }else{
+        res = build_response(current_handler, ctx, req, NULL);
+    }
+
+    stream->head_only = head_length > 0 && req->method_name.length == 4 && memcmp(req->method_name.ptr, "HEAD", 4) == 0;
+    http_request_init(req);
+    context_consume(ctx, ctx->length);
+    http2_respond(current_handler, session, stream, res);
+
+}
+
+static void http2_block_done(handler* current_handler, http2_session* session){
+
+    /*
+        a whole header block is in: a new stream (its request), or trailers of an open one.
+        streams over SETTINGS_MAX_CONCURRENT_STREAMS, or opened after a GOAWAY, are refused (their block is decoded all the same).
+    */
+
+    uint32_t id = session->block_stream;
+    bool end_stream = session->block_end_stream;
+    http2_block_result result;
+
+    session->block_stream = 0;
+
+    if(id <= session->last_stream_id){
+        http2_stream* stream = http2_find_stream(session, id);
+        if(http2_decode_block(current_handler, session, NULL) == BLOCK_BROKEN){
+            http2_goaway(session, ERROR_COMPRESSION);
+        }else if(!stream){
+            http2_goaway(session, ERROR_STREAM_CLOSED);
+        }else if(!end_stream){
+            http2_reset_stream(session, id, ERROR_PROTOCOL);
+            http2_cancel_stream(session, stream);
+        }else{
+            stream->request_ended = true;
+        }
+        return;
+    }
+
+    session->last_stream_id = id;
+
+    if(session->going_away || session->stream_count == session->max_streams){
+        if(http2_decode_block(current_handler, session, NULL) == BLOCK_BROKEN) http2_goaway(session, ERROR_COMPRESSION);
+        else if(!session->going_away) http2_reset_stream(session, id, ERROR_REFUSED_STREAM);
+        return;
+    }
+
+    http2_stream* stream = http2_open_stream(current_handler, session, id);
+    stream->request_ended = end_stream;
+
+    result = http2_decode_block(current_handler, session, stream->ctx);
+    if(result == BLOCK_BROKEN){
+        http2_goaway(session, ERROR_COMPRESSION);
+        return;
+    }
+    if(result == BLOCK_MALFORMED){
+        http2_reset_stream(session, id, ERROR_PROTOCOL);
+        http2_close_stream(session, stream);
+        return;
+    }
+
+    // like keep-alive-requests on an HTTP/1.1 connection: this is the last stream the session takes
+    if(session->ctx->requests_served + session->stream_count >= current_handler->keep_alive_max_requests) http2_goaway(session, ERROR_NONE);
+
+    http2_serve(current_handler, session, stream, result);
+
+}
+
+static void http2_block_append(handler* current_handler, http2_session* session, const unsigned char* fragment, size_t length){
+
+    // a block can't be decoded before it's whole: its fragments are kept, up to about a request's worth
+    size_t limit = current_handler->max_request_size + HTTP2_MAX_FRAME;
+
+    if(session->block_length + length > limit){
+        http2_goaway(session, ERROR_ENHANCE_YOUR_CALM);
+        return;
+    }
+    if(session->block_length + length > session->block_size){
+        size_t size = session->block_size ? session->block_size : 1024;
+        while(size < session->block_length + length) size *= 2;
+        unsigned char* block = realloc(session->block, size);
+        if(!block){
+            perror("system is out of memory!\n");
+            exit(-1);
+        }
+        session->block = block;
+        session->block_size = size;
+    }
+
+    if(length == 0) return;
+    memcpy(session->block + session->block_length, fragment, length);
+    session->block_length += length;
+
+}
+
+static void http2_on_headers(handler* current_handler, http2_session* session, int flags, uint32_t id, const unsigned char* payload, size_t length){
+
+    // padding and priority are skipped, we don't prioritize (every stream gets its turn)
+    size_t start = 0, end = length;
+
+    if(id == 0 || !(id & 1)){
+        http2_goaway(session, ERROR_PROTOCOL);
+        return;
+    }
+    if(flags & FLAG_PADDED){
+        if(length < 1 || payload[0] >= length){
+            http2_goaway(session, ERROR_PROTOCOL);
+            return;
+        }
+        start = 1;
+        end -= payload[0];
+    }
+    if(flags & FLAG_PRIORITY){
+        if(end - start < 5){
+            http2_goaway(session, ERROR_PROTOCOL);
+            return;
+        }
+        start += 5;
+    }
+
+    session->block_stream = id;
+    session->block_end_stream = flags & FLAG_END_STREAM;
+    session->block_length = 0;
+    http2_block_append(current_handler, session, payload + start, end - start);
+    if(!session->broken && (flags & FLAG_END_HEADERS)) http2_block_done(current_handler, session);
+
+}
+
+static void http2_on_data(http2_session* session, int flags, uint32_t id, const unsigned char* payload, size_t length){
+
+    /*
+        request bodies aren't read (we only serve GET), but their bytes count against our windows:
+        they're given back right away to the stream (if it's still open) and, half a window at a time, to the connection.
+    */
+
+    http2_stream* stream;
+
+    if(id == 0 || ((flags & FLAG_PADDED) && (length < 1 || payload[0] >= length))){
+        http2_goaway(session, ERROR_PROTOCOL);
+        return;
+    }
+    if(id > session->last_stream_id){
+        http2_goaway(session, ERROR_PROTOCOL); // a stream that was never opened
+        return;
+    }
+
+    session->received += length;
+    if(session->received >= HTTP2_WINDOW / 2){
+        http2_window_update(session, 0, session->received);
+        session->received = 0;
+    }
+
+    stream = http2_find_stream(session, id);
+    if(!stream){
+        // answered already, the rest of the body is welcome all the same
+        if(!(flags & FLAG_END_STREAM) && length > 0) http2_window_update(session, id, length);
+        return;
+    }
+    if(stream->reset) return;
+    if(stream->request_ended){
+        http2_reset_stream(session, id, ERROR_STREAM_CLOSED);
+        http2_cancel_stream(session, stream);
+        return;
+    }
+    if(flags & FLAG_END_STREAM) stream->request_ended = true;
+    else if(length > 0) http2_window_update(session, id, length);
+
+}
+
+static void http2_on_window_update(http2_session* session, uint32_t id, const unsigned char* payload, size_t length){
+
+    uint32_t increment;
+    http2_stream* stream;
+
+    if(length != 4){
+        http2_goaway(session, ERROR_FRAME_SIZE);
+        return;
+    }
+    increment = http2_read32(payload) & 0x7fffffff;
+
+    if(id == 0){
+        if(increment == 0 || session->window + (long) increment > HTTP2_WINDOW_MAX){
+            http2_goaway(session, increment == 0 ? ERROR_PROTOCOL : ERROR_FLOW_CONTROL);
+            return;
+        }
+        session->window += increment;
+        return;
+    }
+
+    if(id > session->last_stream_id){
+        http2_goaway(session, ERROR_PROTOCOL);
+        return;
+    }
+    stream = http2_find_stream(session, id);
+    if(!stream || stream->reset) return;
+
+    if(increment == 0 || stream->window + (long) increment > HTTP2_WINDOW_MAX){
+        http2_reset_stream(session, id, increment == 0 ? ERROR_PROTOCOL : ERROR_FLOW_CONTROL);
+        http2_cancel_stream(session, stream);
+        return;
+    }
+    stream->window += increment;
+    http2_make_ready(session, stream);
+
+}
+
+static void http2_on_frame(handler* current_handler, http2_session* session, int type, int flags, uint32_t id, const unsigned char* payload, size_t length){
+
+    http2_error error;
+    http2_stream* stream;
+
+    // the first frame must be SETTINGS, and nothing can come between a HEADERS and its CONTINUATIONs
+    if(!session->settings && type != FRAME_SETTINGS){
+        http2_goaway(session, ERROR_PROTOCOL);
+        return;
+    }
+    if(session->block_stream && (type != FRAME_CONTINUATION || id != session->block_stream)){
+        http2_goaway(session, ERROR_PROTOCOL);
+        return;
+    }
+
+    switch(type){
+
+        case FRAME_DATA:
+            http2_on_data(session, flags, id, payload, length);
+            break;
+
+        case FRAME_HEADERS:
+            http2_on_headers(current_handler, session, flags, id, payload, length);
+            break;
+
+        case FRAME_CONTINUATION:
+            if(!session->block_stream){
+                http2_goaway(session, ERROR_PROTOCOL);
+                break;
+            }
+            http2_block_append(current_handler, session, payload, length);
+            if(!session->broken && (flags & FLAG_END_HEADERS)) http2_block_done(current_handler, session);
+            break;
+
+        case FRAME_PRIORITY:
+            if(id == 0) http2_goaway(session, ERROR_PROTOCOL);
+            break;
+
+        case FRAME_RST_STREAM:
+            if(id == 0 || length != 4 || id > session->last_stream_id){
+                http2_goaway(session, id == 0 || length == 4 ? ERROR_PROTOCOL : ERROR_FRAME_SIZE);
+                break;
+            }
+            if((stream = http2_find_stream(session, id))) http2_cancel_stream(session, stream);
+            break;
+
+        case FRAME_SETTINGS:
+            if(id != 0 || (flags & FLAG_ACK ? length != 0 : length % 6 != 0)){
+                http2_goaway(session, id != 0 ? ERROR_PROTOCOL : ERROR_FRAME_SIZE);
+                break;
+            }
+            if(flags & FLAG_ACK) break;
+            if(!http2_apply_settings(session, payload, length, &error)){
+                http2_goaway(session, error);
+                break;
+            }
+            session->settings = true;
+            http2_output_frame(session, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+            break;
+
+        case FRAME_PING:
+            if(id != 0 || length != 8){
+                http2_goaway(session, id != 0 ? ERROR_PROTOCOL : ERROR_FRAME_SIZE);
+                break;
+            }
+            if(!(flags & FLAG_ACK)) http2_output_frame(session, FRAME_PING, FLAG_ACK, 0, payload, length);
+            break;
+
+        case FRAME_GOAWAY:
+            // the client is leaving: the streams it opened are answered, then the connection is closed
+            if(id != 0) http2_goaway(session, ERROR_PROTOCOL);
+            else session->going_away = true;
+            break;
+
+        case FRAME_WINDOW_UPDATE:
+            http2_on_window_update(session, id, payload, length);
+            break;
+
+        case FRAME_PUSH_PROMISE:
+            // clients can't push
+            http2_goaway(session, ERROR_PROTOCOL);
+            break;
+
+        default:
+            // unknown frames are ignored
+            break;
+
+    }
+
+}
+
+void http2_receive(handler* current_handler, connection_context* ctx){
+
+    /*
+        takes every whole frame in the connection's buffer (the preface first), what's left is the beginning of the next one.
+        whatever the frames ask for is queued for http2_send: nothing is written here.
+    */
+
+    http2_session* session = ctx->http2;
+    const unsigned char* data = (const unsigned char*) ctx->data;
+    size_t length = ctx->length;
+    size_t offset = 0;
+
+    if(!session->preface && !session->broken){
+        size_t compared = length < HTTP2_PREFACE_LENGTH ? length : HTTP2_PREFACE_LENGTH;
+        if(memcmp(data, HTTP2_PREFACE, compared) != 0) http2_goaway(session, ERROR_PROTOCOL);
+        else if(length < HTTP2_PREFACE_LENGTH) return;
+        session->preface = true;
+        offset = HTTP2_PREFACE_LENGTH;
+    }
+
+    while(!session->broken && length - offset >= HTTP2_FRAME_HEAD){
+
+        const unsigned char* head = data + offset;
+        size_t frame_length = head[0] << 16 | head[1] << 8 | head[2];
+
+        if(frame_length > HTTP2_MAX_FRAME){
+            http2_goaway(session, ERROR_FRAME_SIZE);
+            break;
+        }
+        if(length - offset - HTTP2_FRAME_HEAD < frame_length) break;
+
+        http2_on_frame(current_handler, session, head[3], head[4], http2_read32(head + 5) & 0x7fffffff, head + HTTP2_FRAME_HEAD, frame_length);
+        offset += HTTP2_FRAME_HEAD + frame_length;
+
+    }
+
+    // once the session is broken the rest is thrown away
+    context_consume(ctx, session->broken ? ctx->length : (int) offset);
+
+}
+
+bool http2_is_preface(const char* data, size_t length){
+
+    // the bytes so far could be the client's preface (prior knowledge)
+    return memcmp(data, HTTP2_PREFACE, length < HTTP2_PREFACE_LENGTH ? length : HTTP2_PREFACE_LENGTH) == 0;
+
+}
+
+void http2_start(handler* current_handler, connection_context* ctx){
+
+    // prior knowledge: the connection starts with the preface, our SETTINGS go out first
+    http2_session* session = http2_session_create(current_handler, ctx);
+    http2_output_settings(session, current_handler->max_request_size);
+
+}
+
+bool http2_upgrade_requested(http_request* req){
+
+    /*
+        "Upgrade: h2c", "Connection: Upgrade, HTTP2-Settings" and the settings themselves.
+        only bodiless GETs are upgraded (we'd have to read the body before the session starts).
+    */
+
+    return req->method == GET
+           && http_request_has_token(req, "Upgrade", "h2c") && http_request_has_token(req, "Connection", "HTTP2-Settings")
+           && http_request_header(req, "HTTP2-Settings") && !req->transfer_encoding && req->content_length <= 0;
+
+}
+
+static long http2_base64url(const char* in, size_t length, unsigned char* out, size_t size){
+
+    // HTTP2-Settings is base64url, padding left out (it's tolerated)
+    unsigned int bits = 0;
+    int count = 0;
+    size_t written = 0;
+
+    for(size_t i = 0; i < length && in[i] != '='; i++){
+        char c = in[i];
+        int value;
+        if(c >= 'A' && c <= 'Z') value = c - 'A';
+        else if(c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if(c >= '0' && c <= '9') value = c - '0' + 52;
+        else if(c == '-' || c == '+') value = 62;
+        else if(c == '_' || c == '/') value = 63;
+        else return -1;
+
+        bits = (bits << 6 | value) & 0xffff;
+        count += 6;
+        if(count >= 8){
+            count -= 8;
+            if(written == size) return -1;
+            out[written++] = bits >> count;
+        }
+    }
+
+    return written;
+
+}
+
+bool http2_upgrade(handler* current_handler, connection_context* ctx, int head_length){
+
+    /*
+        the request asked for h2c (check http2_upgrade_requested): a 101, our SETTINGS, then its response as stream 1.
+        the client's preface follows. returns false if its settings are wrong: then it's answered over HTTP/1.1.
+    */
+
+    http_view* header = http_request_header(&ctx->request, "HTTP2-Settings");
+    unsigned char settings[HTTP2_SETTINGS_MAX * 6];
+    long settings_length = http2_base64url(header->ptr, header->length, settings, sizeof(settings));
+    http2_session* session;
+    http2_error error;
+
+    if(settings_length < 0 || settings_length % 6 != 0) return false;
+
+    session = http2_session_create(current_handler, ctx);
+    if(!http2_apply_settings(session, settings, settings_length, &error)){
+        http2_session_destroy(current_handler, session);
+        return false;
+    }
+
+    memcpy(http2_output_reserve(session, sizeof(upgrade_response) - 1), upgrade_response, sizeof(upgrade_response) - 1);
+    session->output_length += sizeof(upgrade_response) - 1;
+    http2_output_settings(session, current_handler->max_request_size);
+
+    // the request is stream 1, half closed already: its bytes are copied in the stream's context and parsed again there
+    http2_stream* stream = http2_open_stream(current_handler, session, 1);
+    session->last_stream_id = 1;
+    stream->request_ended = true;
+    http2_append(stream->ctx, ctx->data, head_length);
+    http2_serve(current_handler, session, stream, BLOCK_OK);
+
+    return true;
+
+}
+
+static size_t http2_chain_left(const http_response* res){
+
+    size_t left = 0;
+    for(int i = res->iov_next; i < res->iov_count; i++) left += res->iov[i].iov_len;
+    return left;
+
+}
+
+static int http2_chain_slice(const http_response* res, size_t skip, size_t length, struct iovec* iov){
+
+    // the pieces of the chain from "skip" for "length" bytes
+    int count = 0;
+
+    for(int i = res->iov_next; i < res->iov_count && length > 0; i++){
+        size_t piece = res->iov[i].iov_len;
+        if(skip >= piece){
+            skip -= piece;
+            continue;
+        }
+        size_t taken = piece - skip < length ? piece - skip : length;
+        iov[count].iov_base = (char*) res->iov[i].iov_base + skip;
+        iov[count++].iov_len = taken;
+        length -= taken;
+        skip = 0;
+    }
+
+    return count;
+
+}
+
+static bool http2_next_frame(http2_session* session, http2_frame* frame){
+
+    /*
+        the next DATA frame: from the first stream of the ring, which goes back at its end (if it has more to write),
+        so streams take turns a frame at a time. a frame is as big as the client's frame size, the stream's window,
+        the connection's window and what's left of the body let it, and it comes from one place: the chain or the file.
+        a stream whose next bytes can't be batched yet (a multipart body's next part, after frames of its own) waits for the next batch.
+    */
+
+    int turns = 0;
+
+    while(session->ready_first && session->window > 0 && turns++ < session->stream_count){
+
+        http2_stream* stream = session->ready_first;
+        http_response* res = stream->response;
+        size_t chain = http2_chain_left(res) - stream->batched_chain;
+        off_t file = (res->file_fd >= 0 ? res->body_end - res->body_offset : 0) - stream->batched_file;
+        size_t limit = session->max_frame;
+        bool from_file = false;
+
+        if(stream->window <= 0){
+            http2_pop_ready(session);
+            continue;
+        }
+        if(chain == 0 && file <= 0 && stream->batched == 0 && http_response_next_part(res)){
+            chain = http2_chain_left(res);
+            file = res->file_fd >= 0 ? res->body_end - res->body_offset : 0;
+        }
+
+        if(stream->window < (long) limit) limit = stream->window;
+        if(session->window < (long) limit) limit = session->window;
+        if(stream->body_left < (off_t) limit) limit = stream->body_left;
+
+        if(chain > 0){
+            if(chain < limit) limit = chain;
+        }else if(file > 0 && stream->batched_file == 0){
+            if(file < (off_t) limit) limit = file;
+            from_file = true;
+        }else{
+            // its bytes are behind the batch: another stream goes first
+            http2_pop_ready(session);
+            http2_make_ready(session, stream);
+            continue;
+        }
+
+        http2_pop_ready(session);
+        stream->batched++;
+        if(from_file) stream->batched_file += limit;
+        else stream->batched_chain += limit;
+        stream->body_left -= limit;
+        stream->window -= limit;
+        session->window -= limit;
+
+        frame->stream = stream;
+        frame->head_sent = 0;
+        frame->length = limit;
+        frame->sent = 0;
+        frame->file = from_file;
+        frame->last = stream->body_left == 0;
+        http2_frame_head(frame->head, limit, FRAME_DATA, frame->last ? FLAG_END_STREAM : 0, stream->id);
+
+        if(!frame->last) http2_make_ready(session, stream);
+        return true;
+
+    }
+
+    return false;
+
+}
+
+static void http2_fill_batch(http2_session* session, size_t budget){
+
+    // frames from the ring until the batch (or the round's budget) is full, a frame from a file ends it
+    size_t bytes = 0;
+
+    while(session->frame_count < HTTP2_BATCH && bytes < budget){
+        http2_frame* frame = &session->frames[session->frame_count];
+        if(!http2_next_frame(session, frame)) break;
+        session->frame_count++;
+        bytes += HTTP2_FRAME_HEAD + frame->length;
+        if(frame->file) break;
+    }
+
+}
+
+static void http2_frame_done(handler* current_handler, http2_session* session, http2_frame* frame){
+
+    http2_stream* stream = frame->stream;
+
+    stream->batched--;
+    if(stream->reset){
+        if(stream->batched == 0) http2_close_stream(session, stream);
+        return;
+    }
+    if(frame->last) http2_stream_done(current_handler, session, stream);
+    else http2_make_ready(session, stream);
+
+}
+
+static void http2_written(handler* current_handler, http2_session* session, size_t written, bool output_first){
+
+    /*
+        "written" bytes went out: the output's first (if it was in front), then the batch's frames in order.
+        the chain of a frame's stream moves forward with its bytes, finished frames leave the batch.
+    */
+
+    int done = 0;
+
+    if(output_first){
+        size_t taken = session->output_length - session->output_sent < written ? session->output_length - session->output_sent : written;
+        session->output_sent += taken;
+        written -= taken;
+    }
+
+    for(int i = 0; i < session->frame_count && written > 0; i++){
+
+        http2_frame* frame = &session->frames[i];
+        size_t taken = HTTP2_FRAME_HEAD - frame->head_sent < written ? HTTP2_FRAME_HEAD - frame->head_sent : written;
+
+        frame->head_sent += taken;
+        written -= taken;
+        if(frame->file) break; // its payload goes with sendfile()
+
+        taken = frame->length - frame->sent < written ? frame->length - frame->sent : written;
+        if(taken > 0){
+            http_response_advance(frame->stream->response, taken);
+            frame->sent += taken;
+            frame->stream->batched_chain -= taken;
+            written -= taken;
+        }
+
+    }
+
+    while(done < session->frame_count && session->frames[done].head_sent == HTTP2_FRAME_HEAD && session->frames[done].sent == session->frames[done].length){
+        http2_frame_done(current_handler, session, &session->frames[done]);
+        done++;
+    }
+    if(done > 0){
+        session->frame_count -= done;
+        memmove(session->frames, session->frames + done, sizeof(http2_frame) * session->frame_count);
+    }
+
+}
+
+bool http2_waiting(const http2_session* session){
+
+    // streams with a body to send, waiting for a WINDOW_UPDATE
+    return session->stream_count > 0;
+
+}
+
+http2_result http2_send(handler* current_handler, http2_session* session){
+
+    /*
+        writes what the session has, up to write_high_watermark bytes: the output (control frames and heads) and
+        batches of DATA frames, in a single sendmsg() as long as their bodies are in memory.
+        a frame whose body is in a file ends its batch: its head goes with MSG_MORE and sendfile() sends the body right after it.
+        returns HTTP2_DONE when there's nothing left that can be written now.
+    */
+
+    size_t budget = current_handler->write_high_watermark;
+    struct iovec iov[1 + HTTP2_BATCH * (HTTP_RESPONSE_IOVECS + 1)];
+
+    if(session->output_length - session->output_sent > HTTP2_OUTPUT_MAX) return HTTP2_CLOSE; // it asks without reading
+
+    while(true){
+
+        /*
+            bodies wait for the client's SETTINGS: after an Upgrade, a client may not be ready to take more than the 101,
+            our SETTINGS and stream 1's HEADERS before its preface is out (curl can't).
+        */
+        if(session->frame_count == 0 && session->settings && !session->broken && budget > 0) http2_fill_batch(session, budget);
+
+        bool output_first = session->output_sent < session->output_length && (session->frame_count == 0 || session->frames[0].head_sent == 0);
+        if(!output_first && session->frame_count == 0){
+            if(session->going_away && session->stream_count == 0) return HTTP2_CLOSE;
+            if(budget == 0 && session->ready_first) return HTTP2_YIELD; // the batch took the whole round
+            return HTTP2_DONE;
+        }
+        if(budget == 0) return HTTP2_YIELD;
+
+        int count = 0;
+        size_t total = 0;
+        http2_frame* file_frame = NULL;
+
+        if(output_first){
+            iov[count].iov_base = session->output + session->output_sent;
+            iov[count++].iov_len = session->output_length - session->output_sent;
+        }
+        for(int i = 0; i < session->frame_count; i++){
+            http2_frame* frame = &session->frames[i];
+            if(frame->head_sent < HTTP2_FRAME_HEAD){
+                iov[count].iov_base = frame->head + frame->head_sent;
+                iov[count++].iov_len = HTTP2_FRAME_HEAD - frame->head_sent;
+            }
+            if(frame->file){
+                file_frame = frame;
+                break;
+            }
+            // the stream's earlier frames in the batch come first in its chain
+            size_t skip = 0;
+            for(int j = 0; j < i; j++){
+                if(session->frames[j].stream == frame->stream) skip += session->frames[j].length - session->frames[j].sent;
+            }
+            count += http2_chain_slice(frame->stream->response, skip, frame->length - frame->sent, iov + count);
+        }
+        for(int i = 0; i < count; i++) total += iov[i].iov_len;
+
+        if(total > 0){
+            struct msghdr message = { 0 };
+            message.msg_iov = iov;
+            message.msg_iovlen = count;
+
+            ssize_t written = sendmsg(session->ctx->fd, &message, MSG_NOSIGNAL | (file_frame ? MSG_MORE : 0));
+            if(written < 0){
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? HTTP2_BLOCKED : HTTP2_ERROR;
+            }
+            metrics_add(&current_handler->metrics, METRIC_BYTES_SENT, written);
+            budget = (size_t) written < budget ? budget - written : 0;
+            http2_written(current_handler, session, written, output_first);
+            continue;
+        }
+
+        if(file_frame){
+            http2_stream* stream = file_frame->stream;
+            http_response* res = stream->response;
+            size_t left = file_frame->length - file_frame->sent;
+
+            ssize_t sent_bytes = sendfile(session->ctx->fd, res->file_fd, &res->body_offset, left < budget ? left : budget);
+            if(sent_bytes < 0){
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? HTTP2_BLOCKED : HTTP2_ERROR;
+            }
+            if(sent_bytes == 0){
+                // the file has been truncated under our feet: the frame can't be finished
+                return HTTP2_ERROR;
+            }
+            metrics_add(&current_handler->metrics, METRIC_BYTES_SENT, sent_bytes);
+            budget -= sent_bytes;
+            file_frame->sent += sent_bytes;
+            stream->batched_file -= sent_bytes;
+            if(file_frame->sent == file_frame->length){
+                session->frame_count = 0; // it's the batch's last frame, and the ones before it are out
+                http2_frame_done(current_handler, session, file_frame);
+            }
+        }
+
+    }
+
+}
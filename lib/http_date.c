@@ -0,0 +1,120 @@
+#include "h/http_date.h"
+#include <string.h>
+
+static const char* week_days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char* months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+static char* put_two_digits(char* out, int value){
+
+    out[0] = '0' + value / 10;
+    out[1] = '0' + value % 10;
+    return out + 2;
+
+}
+
+int http_date_write(char* out, time_t second){
+
+    /*
+        IMF-fixdate (RFC 9110), always in GMT and always in english:
+        strftime would follow the locale, so the date is written by hand.
+        writes HTTP_DATE_VALUE_LENGTH characters (not null-terminated) and returns how many they are.
+    */
+
+    struct tm gmt_time;
+    char* start = out;
+
+    gmtime_r(&second, &gmt_time);
+
+    memcpy(out, week_days[gmt_time.tm_wday], 3);
+    out += 3;
+    memcpy(out, ", ", 2);
+    out = put_two_digits(out + 2, gmt_time.tm_mday);
+    *out++ = ' ';
+    memcpy(out, months[gmt_time.tm_mon], 3);
+    out += 3;
+    *out++ = ' ';
+    out = put_two_digits(out, (gmt_time.tm_year + 1900) / 100);
+    out = put_two_digits(out, (gmt_time.tm_year + 1900) % 100);
+    *out++ = ' ';
+    out = put_two_digits(out, gmt_time.tm_hour);
+    *out++ = ':';
+    out = put_two_digits(out, gmt_time.tm_min);
+    *out++ = ':';
+    out = put_two_digits(out, gmt_time.tm_sec);
+    memcpy(out, " GMT", 4);
+
+    return out + 4 - start;
+
+}
+
+static void http_date_format(http_date* date, time_t second){
+
+    memcpy(date->header, "Date: ", 6);
+    int length = http_date_write(date->header + 6, second);
+    memcpy(date->header + 6 + length, "\r\n", 3); // terminator included
+
+    date->second = second;
+
+}
+
+static int parse_digits(const char* text, int count){
+
+    int value = 0;
+    for(int i = 0; i < count; i++){
+        if(text[i] < '0' || text[i] > '9') return -1;
+        value = value * 10 + text[i] - '0';
+    }
+    return value;
+
+}
+
+time_t http_date_parse(const char* text, size_t length){
+
+    /*
+        the other way around, for If-Modified-Since: only IMF-fixdate is understood.
+        clients send back the Last-Modified they got from us, so the obsolete formats
+        (RFC 850 and asctime) would only come from very old ones, and not understanding a date
+        just means sending the whole file.
+        returns -1 if "text" isn't a date.
+    */
+
+    struct tm gmt_time;
+    int month = -1;
+
+    if(length != HTTP_DATE_VALUE_LENGTH || text[3] != ',' || text[4] != ' ' || text[7] != ' ' || text[11] != ' '
+       || text[16] != ' ' || text[19] != ':' || text[22] != ':' || memcmp(text + 25, " GMT", 4) != 0) return -1;
+
+    for(int i = 0; i < 12 && month < 0; i++){
+        if(memcmp(text + 8, months[i], 3) == 0) month = i;
+    }
+
+    memset(&gmt_time, 0, sizeof(gmt_time));
+    gmt_time.tm_mday = parse_digits(text + 5, 2);
+    gmt_time.tm_mon = month;
+    gmt_time.tm_year = parse_digits(text + 12, 4) - 1900;
+    gmt_time.tm_hour = parse_digits(text + 17, 2);
+    gmt_time.tm_min = parse_digits(text + 20, 2);
+    gmt_time.tm_sec = parse_digits(text + 23, 2);
+
+    if(month < 0 || gmt_time.tm_mday < 1 || gmt_time.tm_year < 0 || gmt_time.tm_hour < 0 || gmt_time.tm_min < 0 || gmt_time.tm_sec < 0) return -1;
+
+    return timegm(&gmt_time);
+
+}
+
+void http_date_init(http_date* date){
+
+    date->second = -1;
+    http_date_update(date);
+
+}
+
+void http_date_update(http_date* date){
+
+    // the coarse clock is read from the vDSO without a syscall, its resolution is more than enough here
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+    if(now.tv_sec != date->second) http_date_format(date, now.tv_sec);
+
+}
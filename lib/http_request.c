@@ -1,99 +1,540 @@
 #include "h/http_request.h"
-#include "h/connection_context.h"
 #include "h/utils.h"
+#include "h/http_date.h"
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
-#include <errno.h>
+#include <strings.h>
+#include <immintrin.h>
 
 #define FILENAME_MAX_LEN 1024
-#define WWW_PATH ""
+#define OFFSET_MAX ((off_t) INT64_MAX) // off_t is 64 bits wide on the (64 bits) systems epolly runs on
 
-static int http_request_parse_method(http_request* req);
-static int http_request_parse_filename(http_request* req);
-int http_request_create(http_request* req, connection_context* ctx){
+/*
+    looking for a single character is what the parser does all the time (line endings, spaces, colons),
+    so that's the part that gets vectorized: 32 bytes at a time with AVX2, 16 with SSE4.2.
+    the scalar version takes care of the tail (and of older CPUs).
+*/
 
-    /*
-        logic that parses an http request 
-        returns NULL (malformed request) if:
-            - request is empty or has no lines
-            - request has an invalid method
+static const char* find_char_scalar(const char* p, const char* end, char c){
+
+    while(p < end){
+        if(*p == c) return p;
+        p++;
+    }
+    return NULL;
+
+}
+
+__attribute__((target("sse4.2")))
+static const char* find_char_sse42(const char* p, const char* end, char c){
+
+    __m128i needle = _mm_set1_epi8(c);
+
+    while(end - p >= 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*) p);
+        int index = _mm_cmpestri(needle, 1, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if(index < 16) return p + index;
+        p += 16;
+    }
+    return find_char_scalar(p, end, c);
+
+}
+
+__attribute__((target("avx2")))
+static const char* find_char_avx2(const char* p, const char* end, char c){
+
+    __m256i needle = _mm256_set1_epi8(c);
+
+    while(end - p >= 32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) p);
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if(mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return find_char_sse42(p, end, c);
+
+}
+
+static const char* (*find_char)(const char* p, const char* end, char c) = find_char_scalar;
+static http_simd_level simd_level = HTTP_SIMD_SCALAR;
+
+__attribute__((constructor))
+static void http_request_select_simd(void){
+
+    // the best implementation the CPU supports is picked once, before main() runs
+    if(!http_request_use_simd(HTTP_SIMD_AVX2) && !http_request_use_simd(HTTP_SIMD_SSE42)){
+        http_request_use_simd(HTTP_SIMD_SCALAR);
+    }
+
+}
 
-        return the request but with an errno attached if:
-            - the method is unimplemented (we only have GET lol)
+bool http_request_use_simd(http_simd_level level){
+
+    __builtin_cpu_init();
+
+    switch(level){
+        case HTTP_SIMD_AVX2:
+            if(!__builtin_cpu_supports("avx2")) return false;
+            find_char = find_char_avx2;
+        break;
+        case HTTP_SIMD_SSE42:
+            if(!__builtin_cpu_supports("sse4.2")) return false;
+            find_char = find_char_sse42;
+        break;
+        default:
+            find_char = find_char_scalar;
+    }
+
+    simd_level = level;
+    return true;
+
+}
+
+http_simd_level http_request_simd_level(void){
+
+    return simd_level;
+
+}
+
+void http_request_init(http_request* req){
+
+    req->method = UNIMPLEMENTED_METHOD;
+    req->method_name = (http_view) { NULL, 0 };
+    req->path = (http_view) { NULL, 0 };
+    req->version = (http_view) { NULL, 0 };
+    req->minor_version = 1;
+    req->headers_num = 0;
+    req->keep_alive = false;
+    req->content_length = -1;
+    req->transfer_encoding = false;
+    req->base = NULL;
+    req->line_start = 0;
+    req->scanned = 0;
+    req->state = PARSING_REQUEST_LINE;
+
+}
+
+static void http_view_rebase(http_view* view, const char* old_base, const char* new_base){
+
+    if(view->ptr) view->ptr = new_base + ((uintptr_t) view->ptr - (uintptr_t) old_base);
+
+}
+
+static void http_request_rebase(http_request* req, const char* new_base){
+
+    /*
+        the receive buffer has been reallocated since the last call:
+        the lines we already parsed are at the same offsets, only the base moved.
     */
+    http_view_rebase(&req->method_name, req->base, new_base);
+    http_view_rebase(&req->path, req->base, new_base);
+    http_view_rebase(&req->version, req->base, new_base);
+    for(int i = 0; i < req->headers_num; i++){
+        http_view_rebase(&req->headers[i].name, req->base, new_base);
+        http_view_rebase(&req->headers[i].value, req->base, new_base);
+    }
+    req->base = new_base;
 
-    if(ctx->length == 0) return -1;
-    
-    req->bytes = malloc(sizeof(char) * ctx->length + 1);
-    memcpy(req->bytes, ctx->data, ctx->length + 1); // copy the request so we can free the context data later
-    req->length = ctx->length;
-    req->bytes[req->length + 1] = '\0'; // terminate the string
-    req->lines_num = count_lines(req->bytes, req->length);
-    req->filename_max_length = FILENAME_MAX_LEN;
+}
+
+static bool http_view_equals(http_view view, const char* string, size_t length){
+
+    return view.length == length && strncasecmp(view.ptr, string, length) == 0;
+
+}
+
+static bool http_view_has_token(http_view view, const char* token, size_t length){
 
-    if(req->lines_num == 0){
-        free(req);
-        return -1;
+    // "token" is an item of a comma separated list (e.g. "Connection: keep-alive, Upgrade"), tokens are case insensitive
+    const char* item = view.ptr;
+    const char* end = view.ptr + view.length;
+
+    while(item < end){
+        const char* comma = memchr(item, ',', end - item);
+        const char* item_end = comma ? comma : end;
+        while(item < item_end && (*item == ' ' || *item == '\t')) item++;
+        const char* trimmed = item_end;
+        while(trimmed > item && (trimmed[-1] == ' ' || trimmed[-1] == '\t')) trimmed--;
+        if((size_t) (trimmed - item) == length && strncasecmp(item, token, length) == 0) return true;
+        item = item_end + 1;
     }
+    return false;
+
+}
 
-    req->lines = bytes_to_lines(req->bytes, req->length, req->lines_num);
-    
-    if(http_request_parse_method(req) < 0){
-        errno = 1;
+static bool http_view_to_offset(http_view view, off_t max, off_t* value){
+
+    // digits only: no sign, no spaces, no lists ("5, 5"), and nothing bigger than "max"
+    if(view.length == 0) return false;
+    *value = 0;
+    for(size_t i = 0; i < view.length; i++){
+        if(view.ptr[i] < '0' || view.ptr[i] > '9' || *value > (max - (view.ptr[i] - '0')) / 10) return false;
+        *value = *value * 10 + view.ptr[i] - '0';
     }
-    if(http_request_parse_filename(req) < 0){
-        errno = 2;
+    return true;
+
+}
+
+static int http_request_parse_request_line(http_request* req, const char* line, size_t length){
+
+    /*
+        METHOD SP request-target SP HTTP/1.x
+    */
+    const char* end = line + length;
+    const char* method_end = find_char(line, end, ' ');
+    if(!method_end || method_end == line) return HTTP_PARSE_ERROR;
+
+    const char* path = method_end + 1;
+    const char* path_end = find_char(path, end, ' ');
+    if(!path_end || path_end == path || *path != '/') return HTTP_PARSE_ERROR;
+
+    const char* version = path_end + 1;
+    size_t version_length = end - version;
+    if(version_length != 8 || memcmp(version, "HTTP/1.", 7) != 0 || (version[7] != '0' && version[7] != '1')) return HTTP_PARSE_ERROR;
+
+    req->method_name = (http_view) { line, method_end - line };
+    req->method = (req->method_name.length == 3 && memcmp(line, "GET", 3) == 0) ? GET : UNIMPLEMENTED_METHOD;
+    req->path = (http_view) { path, path_end - path };
+    req->version = (http_view) { version, version_length };
+    req->minor_version = version[7] - '0';
+
+    /*
+        HTTP/1.1 connections are persistent unless the client says otherwise,
+        HTTP/1.0 connections are closed unless the client asks for keep-alive.
+    */
+    req->keep_alive = req->minor_version == 1;
+
+    return 0;
+
+}
+
+static int http_request_parse_header(http_request* req, const char* line, size_t length){
+
+    /*
+        name ":" OWS value OWS
+    */
+    const char* end = line + length;
+    const char* colon = find_char(line, end, ':');
+
+    // no name, whitespace before the colon or obsolete line folding: all rejected
+    if(!colon || colon == line || colon[-1] == ' ' || colon[-1] == '\t' || *line == ' ' || *line == '\t') return HTTP_PARSE_ERROR;
+    if(req->headers_num == HTTP_MAX_HEADERS) return HTTP_PARSE_ERROR;
+
+    const char* value = colon + 1;
+    while(value < end && (*value == ' ' || *value == '\t')) value++;
+    while(end > value && (end[-1] == ' ' || end[-1] == '\t')) end--;
+
+    http_header* header = &req->headers[req->headers_num++];
+    header->name = (http_view) { line, colon - line };
+    header->value = (http_view) { value, end - value };
+
+    if(http_view_equals(header->name, "Connection", 10)){
+        if(http_view_has_token(header->value, "close", 5)) req->keep_alive = false;
+        else if(http_view_has_token(header->value, "keep-alive", 10)) req->keep_alive = true;
+    }else if(http_view_equals(header->name, "Content-Length", 14)){
+        /*
+            where the request ends depends on it: a second Content-Length (even with the same value)
+            or one next to a Transfer-Encoding could be read differently by a proxy in front of us, so they are rejected.
+            so are lengths above HTTP_MAX_CONTENT_LENGTH: the callers add the head's length to it.
+        */
+        if(req->content_length >= 0 || req->transfer_encoding || !http_view_to_offset(header->value, HTTP_MAX_CONTENT_LENGTH, &req->content_length)) return HTTP_PARSE_ERROR;
+    }else if(http_view_equals(header->name, "Transfer-Encoding", 17)){
+        if(req->content_length >= 0) return HTTP_PARSE_ERROR;
+        req->transfer_encoding = true;
     }
+
     return 0;
 
 }
 
-int http_request_parse_filename(http_request* req){
+int http_request_parse(http_request* req, const char* data, size_t length){
+
+    /*
+        parses the request at the beginning of "data", one line at a time.
+        returns the length of the request head once the empty line has been found,
+        HTTP_PARSE_INCOMPLETE if more bytes are needed (call it again with the same request and the grown buffer)
+        or HTTP_PARSE_ERROR.
 
-    int i = 0, 
-        www_path_len = strlen(WWW_PATH), 
-        k = www_path_len;
+        whatever comes after the head belongs to the next (pipelined) request and is not touched.
+    */
 
-    char* first_line = req->lines[0];
+    if(req->base && req->base != data) http_request_rebase(req, data);
+    req->base = data;
 
-    char filename[www_path_len + req->filename_max_length];
-    bzero(filename, www_path_len + req->filename_max_length);
-    strncpy(filename, WWW_PATH, www_path_len);
+    const char* end = data + length;
 
-    while(first_line[i] != '/'){
-        i++;
-    } // we searched for the /, now we can start reading the filename
+    while(true){
 
-    while(first_line[i] != ' '){
-        if(i == req->filename_max_length){
-            return -1;
+        // the part of the line we already scanned can't contain a newline, we skip it
+        const char* newline = find_char(data + req->line_start + req->scanned, end, '\n');
+        if(!newline){
+            req->scanned = length - req->line_start;
+            return HTTP_PARSE_INCOMPLETE;
         }
-        filename[k] = first_line[i];
-        i++;
-        k++;
-    }
-    
-    req->filename = malloc(sizeof(char) * www_path_len + k);
-    strncpy(req->filename, filename, www_path_len + k);
-    req->filename_actual_length = www_path_len + k;
-    return 0;
+
+        const char* line = data + req->line_start;
+        size_t line_length = newline - line;
+        if(line_length > 0 && line[line_length - 1] == '\r') line_length--; // a lone \n is tolerated
+
+        req->line_start = newline + 1 - data;
+        req->scanned = 0;
+
+        if(req->state == PARSING_REQUEST_LINE){
+
+            if(line_length == 0) continue; // empty lines before the request line are ignored
+            if(http_request_parse_request_line(req, line, line_length) < 0) return HTTP_PARSE_ERROR;
+            req->state = PARSING_HEADERS;
+
+        }else{
+
+            if(line_length == 0) return req->line_start; // the empty line: the head is over
+            if(http_request_parse_header(req, line, line_length) < 0) return HTTP_PARSE_ERROR;
+
+        }
+
+    }
+
+}
+
+http_view* http_request_header(http_request* req, const char* name){
+
+    // the value of the first header called "name" (case insensitive), NULL if the client didn't send it
+    size_t length = strlen(name);
+    for(int i = 0; i < req->headers_num; i++){
+        if(http_view_equals(req->headers[i].name, name, length)) return &req->headers[i].value;
+    }
+    return NULL;
+
+}
+
+bool http_request_has_token(http_request* req, const char* name, const char* token){
+
+    // "token" is in one of the comma-separated lists of the headers called "name" (case insensitive, Connection: Upgrade, HTTP2-Settings)
+    size_t name_length = strlen(name);
+    size_t token_length = strlen(token);
+
+    for(int i = 0; i < req->headers_num; i++){
+        if(http_view_equals(req->headers[i].name, name, name_length) && http_view_has_token(req->headers[i].value, token, token_length)) return true;
+    }
+    return false;
+
+}
+
+static bool http_view_zero_quality(const char* params, const char* end){
+
+    // ";q=0", ";q=0.0", ";q=0.00" or ";q=0.000" mean "not acceptable"
+    const char* q = params;
+    while(q < end && (*q == ';' || *q == ' ' || *q == '\t')) q++;
+    if(end - q < 3 || (q[0] != 'q' && q[0] != 'Q') || q[1] != '=' || q[2] != '0') return false;
+    for(q += 3; q < end && (*q == '.' || *q == '0'); q++);
+    return q == end || *q == ' ' || *q == '\t' || *q == ';';
+
+}
+
+unsigned int http_request_accepted_encodings(http_request* req){
+
+    /*
+        the codings listed in Accept-Encoding (a bit per content_encoding, check ENCODING_BIT):
+        "gzip, deflate, br;q=1.0, *;q=0.1". anything with q=0 is refused, "*" stands for the codings
+        that aren't listed. identity is always acceptable, so its bit is always set.
+    */
+
+    http_view* header = http_request_header(req, "Accept-Encoding");
+    unsigned int accepted = ENCODING_BIT(ENCODING_IDENTITY);
+    unsigned int listed = 0;
+    bool wildcard = false;
+
+    if(!header) return accepted;
+
+    const char* token = header->ptr;
+    const char* end = header->ptr + header->length;
+
+    while(token < end){
+
+        while(token < end && (*token == ' ' || *token == '\t' || *token == ',')) token++;
+        const char* token_end = token;
+        while(token_end < end && *token_end != ',') token_end++;
+        const char* name_end = token;
+        while(name_end < token_end && *name_end != ';' && *name_end != ' ' && *name_end != '\t') name_end++;
+
+        http_view name = { token, name_end - token };
+        bool refused = http_view_zero_quality(name_end, token_end);
+        unsigned int bit = 0;
+
+        if(http_view_equals(name, "br", 2)) bit = ENCODING_BIT(ENCODING_BROTLI);
+        else if(http_view_equals(name, "gzip", 4) || http_view_equals(name, "x-gzip", 6)) bit = ENCODING_BIT(ENCODING_GZIP);
+        else if(http_view_equals(name, "*", 1)) wildcard = !refused;
+
+        listed |= bit;
+        if(!refused) accepted |= bit;
+        token = token_end;
+
+    }
+
+    if(wildcard) accepted |= ~listed & (ENCODING_BIT(ENCODING_GZIP) | ENCODING_BIT(ENCODING_BROTLI));
+    return accepted;
+
+}
+
+void http_request_conditions(http_request* req, http_conditions* conditions){
+
+    http_view* if_none_match = http_request_header(req, "If-None-Match");
+    http_view* if_modified_since = http_request_header(req, "If-Modified-Since");
+    http_view* range = http_request_header(req, "Range");
+    http_view* if_range = range ? http_request_header(req, "If-Range") : NULL;
+
+    conditions->if_none_match = if_none_match ? if_none_match->ptr : NULL;
+    conditions->if_none_match_length = if_none_match ? if_none_match->length : 0;
+    conditions->if_modified_since = if_modified_since ? http_date_parse(if_modified_since->ptr, if_modified_since->length) : -1;
+    conditions->range = range ? range->ptr : NULL;
+    conditions->range_length = range ? range->length : 0;
+    conditions->if_range = if_range ? if_range->ptr : NULL;
+    conditions->if_range_length = if_range ? if_range->length : 0;
+
+}
+
+bool http_conditions_not_modified(const http_conditions* conditions, const char* etag, size_t etag_length, time_t last_modified){
+
+    /*
+        whether the client's copy is still good (RFC 9110, 13.2.2), for a GET:
+            - If-None-Match wins if it's there: one of its entity tags must match "etag" (quotes included),
+              with the weak comparison ("W/" is ignored), "*" matches anything.
+            - otherwise If-Modified-Since: the file must not have changed after that date.
+    */
+
+    if(conditions->if_none_match){
+
+        const char* tag = conditions->if_none_match;
+        const char* end = tag + conditions->if_none_match_length;
+
+        while(tag < end){
+            while(tag < end && (*tag == ' ' || *tag == '\t' || *tag == ',')) tag++;
+            if(tag < end && *tag == '*') return true;
+            if(end - tag > 2 && tag[0] == 'W' && tag[1] == '/') tag += 2;
+
+            const char* tag_end = tag;
+            if(tag_end < end && *tag_end == '"'){
+                tag_end = memchr(tag_end + 1, '"', end - tag_end - 1);
+                tag_end = tag_end ? tag_end + 1 : end;
+            }else{
+                while(tag_end < end && *tag_end != ',') tag_end++;
+            }
+
+            if((size_t) (tag_end - tag) == etag_length && memcmp(tag, etag, etag_length) == 0) return true;
+            tag = tag_end;
+        }
+
+        return false;
+
+    }
+
+    return conditions->if_modified_since >= 0 && last_modified <= conditions->if_modified_since;
 
 }
 
-int http_request_parse_method(http_request* req){
-    
-    int line_len = strlen(req->lines[0]);
-    char* first_line = malloc(sizeof(char) * line_len); // again, strtok_r destroys the string
-    char* method, *temp;
+static bool parse_offset(const char** text, const char* end, off_t* value){
+
+    // a non-negative decimal number, false if there's none (or it doesn't fit)
+    const char* digit = *text;
+    *value = 0;
+
+    for(; digit < end && *digit >= '0' && *digit <= '9'; digit++){
+        if(*value > (OFFSET_MAX - 9) / 10) return false;
+        *value = *value * 10 + *digit - '0';
+    }
+    if(digit == *text) return false;
+
+    *text = digit;
+    return true;
+
+}
+
+int http_conditions_ranges(const http_conditions* conditions, off_t size, const char* etag, size_t etag_length, time_t last_modified, http_range* ranges){
+
+    /*
+        the parts of a "size" bytes file (tagged "etag", modified at "last_modified") the client asked for,
+        in the order it asked for them (at most HTTP_RANGES_MAX of them, written in "ranges"):
+            "bytes=0-99" the first hundred bytes, "bytes=100-" everything after them, "bytes=-100" the last hundred.
+        returns:
+            - 0 if the whole file must be sent: there's no Range, it isn't made of bytes, it's malformed
+              (RFC 9110 says to ignore it then), it has too many parts, or If-Range says the file changed
+              (a strong ETag compared strongly, or exactly the Last-Modified date).
+            - HTTP_RANGES_UNSATISFIABLE if none of the parts is inside the file (the answer is a 416).
+            - how many parts there are otherwise (the ones that start past the end are dropped, the others are cut to it).
+    */
+
+    const char* text = conditions->range;
+    const char* end = text + conditions->range_length;
+    int count = 0;
+    bool asked = false;
+
+    if(!text || conditions->range_length < 6 || strncasecmp(text, "bytes=", 6) != 0) return 0;
+
+    if(conditions->if_range){
+        bool same = conditions->if_range[0] == '"'
+            ? conditions->if_range_length == etag_length && memcmp(conditions->if_range, etag, etag_length) == 0
+            : http_date_parse(conditions->if_range, conditions->if_range_length) == last_modified;
+        if(!same) return 0;
+    }
+
+    for(text += 6; text < end;){
+
+        off_t first, last = OFFSET_MAX;
+
+        while(text < end && (*text == ' ' || *text == '\t' || *text == ',')) text++;
+        if(text == end) break;
+
+        if(*text == '-'){
+            // a suffix: the last "first" bytes
+            text++;
+            if(!parse_offset(&text, end, &first)) return 0;
+            if(first == 0){
+                // "-0" is never satisfiable
+                asked = true;
+                continue;
+            }
+            first = first < size ? size - first : 0;
+            last = size - 1;
+        }else{
+            if(!parse_offset(&text, end, &first) || text == end || *text++ != '-') return 0;
+            if(text < end && *text >= '0' && *text <= '9' && !parse_offset(&text, end, &last)) return 0;
+            if(last < first) return 0;
+        }
 
-    strncpy(first_line, req->lines[0], line_len);
-    method = strtok_r(first_line, " ", &temp);
+        while(text < end && (*text == ' ' || *text == '\t')) text++;
+        if(text < end && *text != ',') return 0;
+
+        asked = true;
+        if(first >= size) continue;
+        if(count == HTTP_RANGES_MAX) return 0;
+        ranges[count].start = first;
+        ranges[count].end = (last >= size ? size - 1 : last) + 1;
+        count++;
 
-    if(strcmp("GET", method) == 0){
-        req->method = GET;
-        return 0;
     }
 
-    return -1;
+    if(count == 0) return asked ? HTTP_RANGES_UNSATISFIABLE : 0;
+    return count;
+
+}
+
+int http_request_filename(http_request* req, const char* www_path, size_t www_path_len, char* filename, size_t size){
+
+    /*
+        writes the path of the requested file (www_path + decoded and normalized url path) in "filename".
+        returns its length, or a http_filename_result.
+    */
+
+    if(req->path.length > FILENAME_MAX_LEN || www_path_len + req->path.length + 1 > size) return HTTP_FILENAME_TOO_LONG;
+
+    memcpy(filename, www_path, www_path_len);
+    memcpy(filename + www_path_len, req->path.ptr, req->path.length);
+
+    // the url path is normalized, so every file has a single name (the file cache and the path index rely on it)
+    int length = normalize_path(filename + www_path_len, req->path.length);
+    if(length < 0) return HTTP_FILENAME_INVALID;
+
+    return www_path_len + length;
 
 }
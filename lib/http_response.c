@@ -1,132 +1,573 @@
 #include "h/http_response.h"
 #include "h/http_request.h"
+#include "h/connection_context.h"
+#include "h/http_date.h"
+#include "h/utils.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <stdint.h>
 
-char* default_headers = "Connection: close\nServer: epolly/0.0.1\n";
+/*
+    the headers that never change are pushed in the chain as they are: their lengths are known at compile time.
+*/
+static const char server_header[] = "Server: epolly/0.0.1\r\n";
+static const char keep_alive_header[] = "Connection: keep-alive\r\n";
+static const char close_header[] = "Connection: close\r\n";
+static const char content_length_name[] = "Content-Length: ";
 
-static char* stringify_status(int status);
 
-http_response* http_response_create(int status, char* headers, char* body, int socket_fd){
+/*
+    every status we know about, in order. their status lines (and, for errors, the whole response
+    but the Date) are serialized once before main() runs (check http_response_build_statuses),
+    so answering with them is just pointing the chain at shared read-only bytes.
+*/
+static const struct {
+    int code;
+    const char* reason;
+} status_table[] = {
+    {100, "Continue"},
+    {101, "Switching Protocols"},
+    {200, "OK"},
+    {201, "Created"},
+    {202, "Accepted"},
+    {203, "Non-Authoritative Information"},
+    {204, "No Content"},
+    {205, "Reset Content"},
+    {206, "Partial Content"},
+    {300, "Multiple Choices"},
+    {301, "Moved Permanently"},
+    {302, "Found"},
+    {303, "See Other"},
+    {304, "Not Modified"},
+    {307, "Temporary Redirect"},
+    {308, "Permanent Redirect"},
+    {400, "Bad Request"},
+    {401, "Unauthorized"},
+    {402, "Payment Required"},
+    {403, "Forbidden"},
+    {404, "Not Found"},
+    {405, "Method Not Allowed"},
+    {406, "Not Acceptable"},
+    {407, "Proxy Authentication Required"},
+    {408, "Request Timeout"},
+    {409, "Conflict"},
+    {410, "Gone"},
+    {411, "Length Required"},
+    {412, "Precondition Failed"},
+    {413, "Content Too Large"},
+    {414, "URI Too Long"},
+    {415, "Unsupported Media Type"},
+    {416, "Range Not Satisfiable"},
+    {417, "Expectation Failed"},
+    {421, "Misdirected Request"},
+    {422, "Unprocessable Content"},
+    {426, "Upgrade Required"},
+    {428, "Precondition Required"},
+    {429, "Too Many Requests"},
+    {431, "Request Header Fields Too Large"},
+    {500, "Internal Server Error"},
+    {501, "Not Implemented"},
+    {502, "Bad Gateway"},
+    {503, "Service Unavailable"},
+    {504, "Gateway Timeout"},
+    {505, "HTTP Version Not Supported"},
+};
+
+#define HTTP_STATUS_MAX 600
+
+typedef struct {
+    char* line; // "HTTP/1.1 <code> <reason>\r\n", NULL if the code isn't in the table
+    size_t line_length;
+    /*
+        error statuses only: the full response, minus the Date, in two pieces.
+        head[keep_alive] is the status line, Server and Connection,
+        tail is Content-Length, Content-Type, the empty line and the error page.
+    */
+    char* head[2];
+    size_t head_length[2];
+    char* tail;
+    size_t tail_length;
+    size_t body_length; // the error page alone, it's the response's content_length
+} http_status;
+
+static http_status statuses[HTTP_STATUS_MAX]; // indexed by code, written once before main() and never again
+
+static const http_status* http_status_get(int status){
+
+    // unknown statuses become 500s, like they always did
+    if(status < 0 || status >= HTTP_STATUS_MAX || !statuses[status].line) return &statuses[500];
+    return &statuses[status];
+
+}
+
+static char* http_status_format(int* length, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void http_response_push(http_response* res, const char* piece, size_t length){
+
+    res->iov[res->iov_count].iov_base = (void*) piece;
+    res->iov[res->iov_count].iov_len = length;
+    res->iov_count += 1;
+
+}
+
+static http_response* http_response_alloc(int status, off_t content_length, connection_context* ctx, bool keep_alive){
+
+    http_response* res = (http_response*) slab_alloc(&ctx->memory->responses);
+
+    res->status = status;
+    res->content_length = content_length;
+    res->socket = ctx->fd; // we need this for data-streaming purposes
+    res->memory = ctx->memory;
+    res->arena = &ctx->arena;
+    res->load = ctx->load;
+    res->iov_count = 0;
+    res->iov_next = 0;
+    res->keep_alive = keep_alive;
+    res->file_fd = -1;
+    res->cache_entry = NULL;
+    res->body_offset = 0;
+    res->body_end = 0;
+    res->parts = NULL;
+    res->part_count = 0;
+    res->part_next = 0;
+    load_add(&res->load->pending_bytes, content_length);
+
+    return res;
+
+}
+
+static void http_response_push_connection(http_response* res, bool keep_alive){
+
+    if(keep_alive) http_response_push(res, keep_alive_header, sizeof(keep_alive_header) - 1);
+    else http_response_push(res, close_header, sizeof(close_header) - 1);
+
+}
+
+static void http_response_push_dynamic_headers(http_response* res, const http_date* date, bool content_length){
+
+    /*
+        the only headers that depend on the response: Date (copied from the handler's, which is
+        refreshed by the event loop) and, unless it's already in a cached head, Content-Length.
+        a copy of the Date is kept because a slow response may still be written when the handler's one changes.
+    */
+
+    char* headers = res->dynamic_headers;
+    char* out = headers;
+
+    memcpy(out, date->header, HTTP_DATE_LENGTH);
+    out += HTTP_DATE_LENGTH;
+    if(content_length){
+        memcpy(out, content_length_name, sizeof(content_length_name) - 1);
+        out += sizeof(content_length_name) - 1;
+        out += format_unsigned(out, res->content_length);
+        memcpy(out, "\r\n", 2);
+        out += 2;
+    }
+
+    http_response_push(res, headers, out - headers);
+
+}
+
+static http_response* http_response_init(int status, char* headers, off_t content_length, connection_context* ctx, bool keep_alive){
+
+    /*
+        builds the head of the response: status line, headers (Content-Length included) and the empty line.
+        headers: a null-terminated string representing the additional response headers (each one terminated by \r\n),
+        it's borrowed, so it must outlive the response (it's always a string literal around here)
+        keep_alive: whether the connection will stay open once the response has been written
+    */
+
+    http_response* res = http_response_alloc(status, content_length, ctx, keep_alive);
+    const http_status* entry = http_status_get(status);
+
+    /*
+        keep-alive clients rely on Content-Length to know where the response ends!
+    */
+    http_response_push(res, entry->line, entry->line_length);
+    http_response_push(res, server_header, sizeof(server_header) - 1);
+    http_response_push_connection(res, keep_alive);
+    http_response_push_dynamic_headers(res, ctx->date, status != 304); // a 304 has no body, and no length for it
+    if(headers)
+        http_response_push(res, headers, strlen(headers));
+    http_response_push(res, "\r\n", 2); // the empty line between headers and body
+
+    return res;
+
+}
+
+http_response* http_response_create(int status, char* headers, const char* body, size_t body_length, connection_context* ctx, bool keep_alive){
 
     /*
         status: the HTTP status
-        body: a null-terminated string representing the response body
-        headers: a null-terminated string representing the response headers
+        body: the response body, "body_length" bytes (the caller knows it, the body is never scanned).
+        it's not copied, so it must outlive the response (error pages are string literals)
+        headers: a null-terminated string representing the response headers (each one terminated by \r\n)
+        ctx: the connection the response will be written to (its memory is used for the response)
+        keep_alive: whether the connection will stay open once the response has been written
+    */
+
+    http_response* res = http_response_init(status, headers, body_length, ctx, keep_alive);
+
+    http_response_push(res, body, body_length);
+
+    return res;
+
+}
+
+http_response* http_response_create_file(int status, char* headers, int file_fd, off_t file_size, connection_context* ctx, bool keep_alive){
+
+    /*
+        a response whose body is the content of "file_fd" (which is now owned by the response).
+        the file is never read in userspace: only the head goes in the chain, the body will be
+        sent with sendfile() (check (3. ) in h/http_response.h), so binary files are fine too.
+    */
+
+    http_response* res = http_response_init(status, headers, file_size, ctx, keep_alive);
+
+    res->file_fd = file_fd;
+    res->body_end = file_size;
+
+    return res;
+
+}
+
+http_response* http_response_create_cached(file_cache_entry* entry, const file_cache_variant* variant, connection_context* ctx, bool keep_alive){
+
+    /*
+        a response for a file cache hit: the entry already holds the status line and the
+        headers that never change (check http_response_serialize_head), we only add what
+        depends on this response (Connection and Date).
+        the body is borrowed from the entry (or from "variant", one of its compressed copies, if it's not NULL),
+        whose reference is now owned by the response.
+    */
+
+    char* head = variant ? variant->head : entry->head;
+    int head_length = variant ? variant->head_length : entry->head_length;
+    char* body = variant ? variant->body : entry->body;
+    off_t body_length = variant ? variant->body_length : entry->body_length;
+    http_response* res = http_response_alloc(200, body_length, ctx, keep_alive);
+
+    res->cache_entry = entry;
+
+    http_response_push(res, head, head_length);
+    http_response_push_connection(res, keep_alive);
+    http_response_push_dynamic_headers(res, ctx->date, false);
+    http_response_push(res, "\r\n", 2);
+    http_response_push(res, body, body_length);
+
+    return res;
+
+}
+
+http_response* http_response_create_not_modified(file_cache_entry* entry, const file_cache_variant* variant, connection_context* ctx, bool keep_alive){
+
+    /*
+        the client's copy of the entry (or of "variant") is still good: the 304 was serialized with the entry,
+        only Connection and Date are added. the response owns the entry's reference, like a cached one.
+    */
+
+    http_response* res = http_response_alloc(304, 0, ctx, keep_alive);
+
+    res->cache_entry = entry;
+
+    http_response_push(res, variant ? variant->not_modified : entry->not_modified, variant ? variant->not_modified_length : entry->not_modified_length);
+    http_response_push_connection(res, keep_alive);
+    http_response_push_dynamic_headers(res, ctx->date, false);
+    http_response_push(res, "\r\n", 2);
+
+    return res;
+
+}
+
+char* http_response_serialize_head(int status, char* headers, off_t content_length, int* head_length){
+
+    /*
+        the part of a response that only depends on the content: status line, Server, Content-Length
+        and the additional headers. it's what the file cache stores next to the file's bytes.
+        a negative "content_length" leaves Content-Length out (304s don't have one).
+    */
+
+    char* status_line = http_status_get(status)->line;
+    char content_length_header[48] = "";
+
+    if(content_length >= 0) snprintf(content_length_header, sizeof(content_length_header), "Content-Length: %lld\r\n", (long long) content_length);
+
+    int length = snprintf(NULL, 0, "%s%s%s%s", status_line, server_header, content_length_header, headers ? headers : "");
+    char* head = malloc(sizeof(char) * (length + 1));
+
+    snprintf(head, length + 1, "%s%s%s%s", status_line, server_header, content_length_header, headers ? headers : "");
+    *head_length = length;
+
+    return head;
+
+}
+
+http_response* http_response_create_ranges(file_cache_entry* entry, int file_fd, char* headers, char* mime_type, off_t size,
+                                           const http_range* ranges, int range_count, connection_context* ctx, bool keep_alive){
+
+    /*
+        a 206 with the "ranges" of a "size" bytes file: the body comes from "entry" (whose reference is now the response's)
+        or, if it's NULL, from "file_fd" (owned by the response). "headers" (the validators, check file_cache_validators)
+        must outlive the response, Content-Type and Content-Range are added here.
+        a single range is the body itself, more than one make a multipart/byteranges body: every part gets its
+        own Content-Type and Content-Range, and they are written one after the other (check (5. ) in h/http_response.h).
     */
 
-    http_response* res = (http_response*) malloc(sizeof(http_response));
-    char date_buf[255];
+    http_response* res;
+    size_t headers_length = strlen(headers);
+    size_t mime_type_length = strlen(mime_type);
+    char* all_headers;
+
+    if(range_count == 1){
+
+        const http_range* range = &ranges[0];
+        size_t size_limit = headers_length + mime_type_length + 80;
+
+        all_headers = arena_alloc(&ctx->arena, size_limit);
+        snprintf(all_headers, size_limit, "%s%sContent-Range: bytes %lld-%lld/%lld\r\n", mime_type, headers,
+                 (long long) range->start, (long long) range->end - 1, (long long) size);
+        res = http_response_init(206, all_headers, range->end - range->start, ctx, keep_alive);
+
+        if(entry){
+            res->cache_entry = entry;
+            http_response_push(res, entry->body + range->start, range->end - range->start);
+        }else{
+            res->file_fd = file_fd;
+            res->body_offset = range->start;
+            res->body_end = range->end;
+        }
+
+        return res;
+
+    }
+
+    /*
+        the boundary must not show up in the parts: 20 hex digits mixed from the time, the connection and its
+        request count are as good as random here (a file would have to contain them right after a CRLF and two dashes).
+    */
+    char boundary[24];
+    unsigned long long random = (unsigned long long) ctx->date->second * 6364136223846793005ULL ^ (unsigned long long) (uintptr_t) ctx ^ (unsigned long long) ctx->requests_served << 40;
+    snprintf(boundary, sizeof(boundary), "%016llx%04x", random, (unsigned) (size & 0xffff));
+
+    http_response_part* parts = arena_alloc(&ctx->arena, sizeof(http_response_part) * (range_count + 1));
+    off_t content_length = 0;
+
+    for(int i = 0; i < range_count; i++){
+        size_t size_limit = mime_type_length + sizeof(boundary) + 96;
+        parts[i].head = arena_alloc(&ctx->arena, size_limit);
+        parts[i].head_length = snprintf(parts[i].head, size_limit, "\r\n--%s\r\n%sContent-Range: bytes %lld-%lld/%lld\r\n\r\n", boundary, mime_type,
+                                        (long long) ranges[i].start, (long long) ranges[i].end - 1, (long long) size);
+        parts[i].start = ranges[i].start;
+        parts[i].end = ranges[i].end;
+        content_length += parts[i].head_length + parts[i].end - parts[i].start;
+    }
+
+    parts[range_count].head = arena_alloc(&ctx->arena, sizeof(boundary) + 8);
+    parts[range_count].head_length = snprintf(parts[range_count].head, sizeof(boundary) + 8, "\r\n--%s--\r\n", boundary);
+    parts[range_count].start = parts[range_count].end = 0;
+    content_length += parts[range_count].head_length;
+
+    size_t size_limit = headers_length + sizeof(boundary) + 64;
+    all_headers = arena_alloc(&ctx->arena, size_limit);
+    snprintf(all_headers, size_limit, "Content-Type: multipart/byteranges; boundary=%s\r\n%s", boundary, headers);
+    res = http_response_init(206, all_headers, content_length, ctx, keep_alive);
+
+    res->cache_entry = entry;
+    res->file_fd = entry ? -1 : file_fd;
+    res->parts = parts;
+    res->part_count = range_count + 1;
+
+    return res;
+
+}
+
+http_response* http_response_range_not_satisfiable(off_t size, connection_context* ctx, bool keep_alive){
+
+    // none of the ranges is inside the file: a 416 tells the client how big it is
+    char* headers = arena_alloc(&ctx->arena, 48);
+
+    snprintf(headers, 48, "Content-Range: bytes */%lld\r\n", (long long) size);
+    return http_response_create(416, headers, "", 0, ctx, keep_alive);
+
+}
+
+bool http_response_chain_written(http_response* res){
+
+    return res->iov_next == res->iov_count;
 
-    time_t now = time(NULL);
-    struct tm* gmt_time = gmtime(&now);
-    strftime(date_buf, 255, "Date: %a, %d %b %Y %H:%M:%S %Z\n", gmt_time);
+}
+
+bool http_response_next_part(http_response* res){
 
-    res->socket = socket_fd; // we need this for data-streaming purposes
-    res->stream_ptr = 0;
-    res->content_length = strlen(body);
-    res->date_header = date_buf;
-    res->date_header_length = strlen(date_buf);
+    /*
+        called by the engines when everything they had to write has been written: if the body is multipart
+        and there's a part left, the chain (or the file's window) is refilled with it.
+        returns false if the response is over.
+    */
 
-    int content_length_header_length = snprintf(NULL, 0, "%d", res->content_length);
-    char* content_length_header = malloc(sizeof(char) * (content_length_header_length + 18)); // 17 is "Content-Length: " + terminator
+    if(res->part_next == res->part_count || !http_response_chain_written(res) || res->body_offset < res->body_end) return false;
 
-    snprintf(content_length_header, content_length_header_length + 18, "Content-Length: %d\n", res->content_length);
+    http_response_part* part = &res->parts[res->part_next++];
 
-    if(headers){
-        res->headers_length = strlen(headers) + strlen(default_headers) + content_length_header_length + 18 + res->date_header_length;
+    res->iov_count = 0;
+    res->iov_next = 0;
+    http_response_push(res, part->head, part->head_length);
+    if(res->cache_entry){
+        http_response_push(res, res->cache_entry->body + part->start, part->end - part->start);
     }else{
-        res->headers_length = strlen(default_headers) + content_length_header_length + 18 + res->date_header_length;
+        res->body_offset = part->start;
+        res->body_end = part->end;
     }
-    
-    res->headers = malloc(sizeof(char) * (res->headers_length + 1));
-    res->body = malloc(sizeof(char) * (res->content_length + 1));
-    res->status = status;
 
-    strncpy(res->headers, default_headers, strlen(default_headers));
-    strncpy(res->headers, res->date_header, res->date_header_length);
-    strncat(res->headers, content_length_header, content_length_header_length);
+    return true;
+
+}
+
+void http_response_advance(http_response* res, size_t written_bytes){
+
+    /*
+        "written_bytes" of the chain reached the socket: fully written pieces are skipped
+        and the piece we stopped in is cut, so the next write starts right where this one ended.
+    */
+
+    while(written_bytes > 0 && res->iov_next < res->iov_count){
+        struct iovec* piece = &res->iov[res->iov_next];
+        if(written_bytes < piece->iov_len){
+            piece->iov_base = (char*) piece->iov_base + written_bytes;
+            piece->iov_len -= written_bytes;
+            return;
+        }
+        written_bytes -= piece->iov_len;
+        res->iov_next += 1;
+    }
+
+    // empty pieces (an empty body, for example) don't need a write
+    while(res->iov_next < res->iov_count && res->iov[res->iov_next].iov_len == 0) res->iov_next += 1;
+
+}
+
+void http_response_destroy(http_response* res){
 
-    if(headers) 
-        strncpy(res->headers, headers, res->headers_length);
-    
-    strncpy(res->body, body, res->content_length);
+    // dynamic headers live in the response itself: nothing to free one by one
+    if(res->file_fd >= 0) close(res->file_fd);
+    if(res->cache_entry) file_cache_release(res->cache_entry);
+    load_add(&res->load->pending_bytes, -res->content_length);
+    arena_reset(res->arena);
+    slab_free(&res->memory->responses, res);
+
+}
+
+http_response* http_response_canned(int status, connection_context* ctx, bool keep_alive){
+
+    /*
+        an error response: everything but the Date was serialized at startup,
+        so the chain is two shared pieces around a copy of the handler's Date.
+        statuses without a canned page (not an error, or not in the table) get the 500 one.
+    */
+
+    const http_status* entry = http_status_get(status);
+    if(!entry->tail) entry = &statuses[500];
+
+    http_response* res = http_response_alloc(entry - statuses, entry->body_length, ctx, keep_alive);
+
+    memcpy(res->dynamic_headers, ctx->date->header, HTTP_DATE_LENGTH);
+    http_response_push(res, entry->head[keep_alive], entry->head_length[keep_alive]);
+    http_response_push(res, res->dynamic_headers, HTTP_DATE_LENGTH);
+    http_response_push(res, entry->tail, entry->tail_length);
 
-    res->stringified = http_response_stringify(res);
-    res->full_length = strlen(res->stringified);
-    
     return res;
 
 }
 
-char* http_response_stringify(http_response* res){
-    
-    char* status_line = stringify_status(res->status); 
-    int status_line_length = strlen(status_line);
-    int total_length = res->content_length + res->headers_length + status_line_length;
-    char* response_string = malloc(sizeof(char) * total_length);
+static char* http_status_format(int* length, const char* format, ...){
+
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(NULL, 0, format, args);
+    va_end(args);
 
-    bzero(response_string, total_length);
-    strncat(response_string, status_line, status_line_length);
-    strncat(response_string, res->headers, res->headers_length);
-    strncat(response_string, "\n\r\n", 4);
-    strncat(response_string, res->body, res->content_length);
+    char* out = malloc(size + 1);
+    if(!out){
+        perror("system is out of memory!\n");
+        exit(-1);
+    }
+    va_start(args, format);
+    vsnprintf(out, size + 1, format, args);
+    va_end(args);
 
-    return response_string;
+    *length = size;
+    return out;
 
 }
 
-char* stringify_status(int status){
+__attribute__((constructor))
+static void http_response_build_statuses(void){
 
-    // no time for a hashmap, sorry
-    switch(status){
-        case 200:
-            return "HTTP/1.1 200 OK\n";
-        case 400:
-            return "HTTP/1.1 400 Bad Request\n";
-        case 404:
-            return "HTTP/1.1 404 Not Found\n";
-        case 501:
-            return "HTTP/1.1 501 Not Implemented\n";
-        default:
-            return "HTTP/1.1 500 Internal Server Error\n";
+    // this is the only place where status lines and error pages are formatted
+
+    int length;
+    for(size_t i = 0; i < sizeof(status_table) / sizeof(status_table[0]); i++){
+        int code = status_table[i].code;
+        const char* reason = status_table[i].reason;
+        http_status* entry = &statuses[code];
+
+        entry->line = http_status_format(&length, "HTTP/1.1 %d %s\r\n", code, reason);
+        entry->line_length = length;
+        if(code < 400) continue;
+
+        entry->head[false] = http_status_format(&length, "%s%s%s", entry->line, server_header, close_header);
+        entry->head_length[false] = length;
+        entry->head[true] = http_status_format(&length, "%s%s%s", entry->line, server_header, keep_alive_header);
+        entry->head_length[true] = length;
+
+        int body_length = snprintf(NULL, 0, "<html><h1>%d - %s</h1></html>", code, reason);
+        entry->tail = http_status_format(
+            &length,
+            "%s%d\r\nContent-Type: text/html\r\n\r\n<html><h1>%d - %s</h1></html>",
+            content_length_name, body_length, code, reason
+        );
+        entry->tail_length = length;
+        entry->body_length = body_length;
     }
 
 }
 
-http_response* http_response_bad_request(int socket_fd){
-    
-    return 
-        http_response_create(400, NULL, "<html><h1>400 - Bad Request </h1></html>", socket_fd);
-    
+http_response* http_response_bad_request(connection_context* ctx){
+
+    return
+        http_response_canned(400, ctx, false);
+
 }
 
-http_response* http_response_filename_too_long(int socket_fd){
-    
-    return 
-        http_response_create(413, NULL, "<html><h1>413 - Request filename is too long </h1></html>", socket_fd);
-    
+http_response* http_response_filename_too_long(connection_context* ctx){
+
+    return
+        http_response_canned(413, ctx, false);
+
 }
 
-http_response* http_response_uninmplemented_method(int socket_fd){
-    
-    return 
-        http_response_create(501, NULL, "<html><h1>501 - Not Implemented </h1></html>", socket_fd);
-    
+http_response* http_response_uninmplemented_method(connection_context* ctx){
+
+    // the request may have a body we don't read (a POST...): the connection can't be trusted to be at a request's start
+    return
+        http_response_canned(501, ctx, false);
+
 }
 
-http_response* http_response_internal_server_error(int socket_fd){
-    
-    return 
-        http_response_create(500, NULL, "<html><h1>500 - Internal Server Error </h1></html>", socket_fd);
-    
+http_response* http_response_internal_server_error(connection_context* ctx){
+
+    return
+        http_response_canned(500, ctx, false);
+
 }
 
-http_response* http_response_not_found(int socket_fd){
-    
-    return 
-        http_response_create(404, NULL, "<html><h1>404 - Not Found </h1></html>", socket_fd);
-    
-}
\ No newline at end of file
+http_response* http_response_not_found(connection_context* ctx, bool keep_alive){
+
+    return
+        http_response_canned(404, ctx, keep_alive);
+
+}
@@ -0,0 +1,60 @@
+#include "h/load.h"
+
+void load_init(handler_load* load){
+
+    atomic_init(&load->connections, 0);
+    atomic_init(&load->pending_bytes, 0);
+    atomic_init(&load->loop_latency_us, 0);
+    atomic_init(&load->assigned, 0);
+
+}
+
+void load_add(atomic_long* counter, long delta){
+
+    atomic_fetch_add_explicit(counter, delta, memory_order_relaxed);
+
+}
+
+long load_get(atomic_long* counter){
+
+    return atomic_load_explicit(counter, memory_order_relaxed);
+
+}
+
+void load_loop_start(struct timespec* start){
+
+    clock_gettime(CLOCK_MONOTONIC, start);
+
+}
+
+long load_loop_done(handler_load* load, const struct timespec* start){
+
+    /*
+        a round of the event loop (from the wakeup to the next wait) has been handled.
+        the latency is an exponential moving average (1/8 of the new sample), so a single slow round
+        doesn't scare the dispatcher away, but a handler stuck on big responses does.
+        only the handler's thread writes it, so there's no need for a read-modify-write.
+        returns how long the round took (in nanoseconds), for the handler's metrics.
+    */
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long elapsed_ns = (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+    long sample = elapsed_ns / 1000;
+    long average = load_get(&load->loop_latency_us);
+
+    atomic_store_explicit(&load->loop_latency_us, average + (sample - average) / 8, memory_order_relaxed);
+
+    return elapsed_ns;
+
+}
+
+long load_score(handler_load* load){
+
+    return
+        load_get(&load->connections)
+        + load_get(&load->pending_bytes) / LOAD_BYTES_PER_CONNECTION
+        + load_get(&load->loop_latency_us) / LOAD_LATENCY_PER_CONNECTION_US;
+
+}
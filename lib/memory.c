@@ -0,0 +1,201 @@
+#include "h/memory.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define ALIGNMENT 16
+#define ARENA_BLOCK_SIZE 4096 // bytes, header included
+#define OBJECTS_PER_CHUNK 64
+
+static size_t align_up(size_t size){
+
+    return (size + ALIGNMENT - 1) & ~((size_t) ALIGNMENT - 1);
+
+}
+
+void slab_init(slab* slab, size_t object_size, int objects_per_chunk){
+
+    // every object must be able to hold the free list's pointer
+    slab->object_size = align_up(object_size < sizeof(void*) ? sizeof(void*) : object_size);
+    slab->objects_per_chunk = objects_per_chunk;
+    slab->free_list = NULL;
+    slab->chunks = NULL;
+    slab->stats = (slab_stats) { 0, 0, 0, 0 };
+
+}
+
+static void slab_grow(slab* slab){
+
+    /*
+        a new chunk: a pointer to the previous chunk (padded to keep the objects aligned)
+        followed by "objects_per_chunk" objects, which are all pushed on the free list.
+    */
+    char* chunk = malloc(ALIGNMENT + slab->object_size * slab->objects_per_chunk);
+    if(!chunk){
+        perror("system is out of memory!\n");
+        exit(-1);
+    }
+
+    *(void**) chunk = slab->chunks;
+    slab->chunks = chunk;
+    slab->stats.chunks += 1;
+
+    for(int i = slab->objects_per_chunk - 1; i >= 0; i--){
+        void* object = chunk + ALIGNMENT + i * slab->object_size;
+        *(void**) object = slab->free_list;
+        slab->free_list = object;
+    }
+
+}
+
+void* slab_alloc(slab* slab){
+
+    if(!slab->free_list) slab_grow(slab);
+
+    void* object = slab->free_list;
+    slab->free_list = *(void**) object;
+
+    slab->stats.allocations += 1;
+    slab->stats.in_use += 1;
+    if(slab->stats.in_use > slab->stats.peak) slab->stats.peak = slab->stats.in_use;
+
+    return object;
+
+}
+
+void slab_free(slab* slab, void* object){
+
+    *(void**) object = slab->free_list;
+    slab->free_list = object;
+    slab->stats.in_use -= 1;
+
+}
+
+void arena_init(arena* arena, slab* blocks, arena_stats* stats){
+
+    // no block is taken until the first allocation, idle connections don't hold any
+    arena->blocks = blocks;
+    arena->stats = stats;
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->large = NULL;
+
+}
+
+void* arena_alloc(arena* arena, size_t size){
+
+    size_t block_capacity = arena->blocks->object_size - sizeof(arena_block);
+
+    size = align_up(size);
+    arena->stats->allocations += 1;
+    arena->stats->bytes += size;
+
+    if(size > block_capacity){
+        // too big for any block: it gets its own allocation, released on reset
+        arena_large* large = malloc(align_up(sizeof(arena_large)) + size);
+        if(!large){
+            perror("system is out of memory!\n");
+            exit(-1);
+        }
+        large->next = arena->large;
+        arena->large = large;
+        arena->stats->oversized += 1;
+        return (char*) large + align_up(sizeof(arena_large));
+    }
+
+    if(!arena->current){
+        arena->first = slab_alloc(arena->blocks);
+        arena->first->next = NULL;
+        arena->first->used = 0;
+        arena->current = arena->first;
+    }
+
+    if(arena->current->used + size > block_capacity){
+        // the current block is full: move to the next one (reusing the blocks kept from previous responses)
+        if(!arena->current->next){
+            arena_block* block = slab_alloc(arena->blocks);
+            block->next = NULL;
+            arena->current->next = block;
+        }
+        arena->current = arena->current->next;
+        arena->current->used = 0;
+    }
+
+    void* ptr = arena->current->data + arena->current->used;
+    arena->current->used += size;
+    return ptr;
+
+}
+
+void arena_reset(arena* arena){
+
+    /*
+        everything allocated so far is gone at once: the blocks stay linked to the arena and
+        will be filled again from the first one.
+    */
+    while(arena->large){
+        arena_large* next = arena->large->next;
+        free(arena->large);
+        arena->large = next;
+    }
+
+    if(arena->first){
+        arena->first->used = 0;
+        arena->current = arena->first;
+    }
+    arena->stats->resets += 1;
+
+}
+
+void arena_release(arena* arena){
+
+    // the connection is gone: its blocks go back to the handler
+    arena_reset(arena);
+
+    arena_block* block = arena->first;
+    while(block){
+        arena_block* next = block->next;
+        slab_free(arena->blocks, block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+
+}
+
+void handler_memory_init(handler_memory* memory, size_t connection_size, size_t response_size, size_t buffer_size){
+
+    slab_init(&memory->connections, connection_size, OBJECTS_PER_CHUNK);
+    slab_init(&memory->responses, response_size, OBJECTS_PER_CHUNK);
+    slab_init(&memory->buffers, buffer_size, OBJECTS_PER_CHUNK);
+    slab_init(&memory->arena_blocks, ARENA_BLOCK_SIZE, OBJECTS_PER_CHUNK);
+    memory->arenas = (arena_stats) { 0, 0, 0, 0 };
+
+}
+
+static void slab_print_stats(slab* slab, const char* name, int handler_id, FILE* out){
+
+    fprintf(
+        out,
+        "handler %d: %-12s in_use=%zu peak=%zu allocations=%zu chunks=%zu (%zu bytes)\n",
+        handler_id, name,
+        slab->stats.in_use, slab->stats.peak, slab->stats.allocations, slab->stats.chunks,
+        slab->stats.chunks * (ALIGNMENT + slab->object_size * slab->objects_per_chunk)
+    );
+
+}
+
+void handler_memory_print_stats(handler_memory* memory, int handler_id, FILE* out){
+
+    slab_print_stats(&memory->connections, "connections", handler_id, out);
+    slab_print_stats(&memory->responses, "responses", handler_id, out);
+    slab_print_stats(&memory->buffers, "buffers", handler_id, out);
+    slab_print_stats(&memory->arena_blocks, "arena_blocks", handler_id, out);
+    fprintf(
+        out,
+        "handler %d: %-12s allocations=%zu bytes=%zu resets=%zu oversized=%zu\n",
+        handler_id, "arenas",
+        memory->arenas.allocations, memory->arenas.bytes, memory->arenas.resets, memory->arenas.oversized
+    );
+
+}
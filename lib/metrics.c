@@ -0,0 +1,300 @@
+#include "h/metrics.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define METRICS_PAGE_FIXED 16384 // the aggregated histograms and the headers of every metric
+#define METRICS_PAGE_PER_HANDLER 4096 // every handler's lines (a few hundred bytes in practice)
+
+typedef struct {
+    const char* name; // Prometheus, "epolly_" is prepended
+    const char* key; // JSON
+    const char* help;
+} metric_info;
+
+static const metric_info counter_info[METRIC_COUNTERS] = {
+    [METRIC_REQUESTS] = {"requests_total", "requests", "Responses fully written."},
+    [METRIC_BYTES_RECEIVED] = {"received_bytes_total", "bytes_received", "Bytes read from clients."},
+    [METRIC_BYTES_SENT] = {"sent_bytes_total", "bytes_sent", "Bytes written to clients."},
+    [METRIC_CONNECTIONS_ACCEPTED] = {"connections_accepted_total", "connections_accepted", "Connections taken by the handler."},
+    [METRIC_CONNECTIONS_CLOSED] = {"connections_closed_total", "connections_closed", "Connections closed by the handler."},
+    [METRIC_ACCEPT_ERRORS] = {"accept_errors_total", "accept_errors", "Failed accepts (out of descriptors or memory)."},
+    [METRIC_SEND_BLOCKED] = {"send_blocked_total", "send_blocked", "Writes that found the socket full."},
+    [METRIC_TIMEOUTS_HEADER] = {"header_timeouts_total", "header_timeouts", "Connections closed because a request head was too slow."},
+    [METRIC_TIMEOUTS_IDLE] = {"idle_timeouts_total", "idle_timeouts", "Keep-alive connections closed while idle."},
+    [METRIC_TIMEOUTS_WRITE] = {"write_timeouts_total", "write_timeouts", "Connections closed because a response made no progress."},
+    [METRIC_LOOP_ROUNDS] = {"loop_rounds_total", "loop_rounds", "Rounds of the event loop."},
+    [METRIC_ACCESS_LOG_DROPPED] = {"access_log_dropped_total", "access_log_dropped", "Access log records dropped because the log was behind."},
+    [METRIC_HTTP2_SESSIONS] = {"http2_sessions_total", "http2_sessions", "Connections that switched to HTTP/2."},
+    [METRIC_HTTP2_STREAMS] = {"http2_streams_total", "http2_streams", "HTTP/2 streams opened by clients."}
+};
+
+// the Prometheus histograms' buckets, in seconds
+static const double latency_buckets[] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+#define LATENCY_BUCKETS (sizeof(latency_buckets) / sizeof(latency_buckets[0]))
+
+static unsigned long metrics_get(const atomic_ulong* counter){
+
+    return atomic_load_explicit(counter, memory_order_relaxed);
+
+}
+
+void metrics_init(handler_metrics* metrics){
+
+    for(int i = 0; i < METRIC_COUNTERS; i++) atomic_init(&metrics->counters[i], 0);
+    for(int i = 0; i < METRICS_STATUS_CLASSES; i++) atomic_init(&metrics->statuses[i], 0);
+    histogram_init(&metrics->request_latency);
+    histogram_init(&metrics->loop_time);
+    metrics->round_ns = 0;
+    metrics->pending_count = 0;
+
+}
+
+metrics_registry* metrics_registry_create(int num_handlers){
+
+    metrics_registry* registry = malloc(sizeof(metrics_registry));
+    if(registry) registry->handlers = calloc(num_handlers, sizeof(metrics_source));
+    if(!registry || !registry->handlers){
+        perror("system is out of memory!\n");
+        exit(-1);
+    }
+
+    registry->num_handlers = num_handlers;
+    atomic_init(&registry->dispatcher_accept_errors, 0);
+
+    return registry;
+
+}
+
+void metrics_register(metrics_registry* registry, int id, handler_metrics* metrics, handler_load* load){
+
+    registry->handlers[id].metrics = metrics;
+    registry->handlers[id].load = load;
+
+}
+
+#ifndef METRICS_DISABLED
+
+void metrics_add(handler_metrics* metrics, metric_counter counter, unsigned long value){
+
+    // only the handler's thread writes its counters: no need for an atomic add (and its locked instruction)
+    atomic_ulong* target = &metrics->counters[counter];
+    atomic_store_explicit(target, atomic_load_explicit(target, memory_order_relaxed) + value, memory_order_relaxed);
+
+}
+
+void metrics_round_start(handler_metrics* metrics, const struct timespec* start){
+
+    // the round's clock is when its requests are considered complete (so a request doesn't cost a clock read)
+    metrics->round_ns = start->tv_sec * 1000000000ULL + start->tv_nsec;
+
+}
+
+static void metrics_record_pending(handler_metrics* metrics, unsigned long long now_ns){
+
+    for(int i = 0; i < metrics->pending_count; i++){
+        unsigned long long started_ns = metrics->pending[i];
+        histogram_record(&metrics->request_latency, now_ns > started_ns ? now_ns - started_ns : 0);
+    }
+    metrics->pending_count = 0;
+
+}
+
+void metrics_round_done(handler_metrics* metrics, long elapsed_ns){
+
+    // the round is over: its responses are timed with its end
+    metrics_record_pending(metrics, metrics->round_ns + (elapsed_ns > 0 ? elapsed_ns : 0));
+    metrics_add(metrics, METRIC_LOOP_ROUNDS, 1);
+    histogram_record(&metrics->loop_time, elapsed_ns > 0 ? elapsed_ns : 0);
+
+}
+
+void metrics_response_done(handler_metrics* metrics, int status, unsigned long long started_ns){
+
+    int class = status >= 100 && status < 600 ? status / 100 : 0;
+    atomic_ulong* target = &metrics->statuses[class];
+
+    metrics_add(metrics, METRIC_REQUESTS, 1);
+    atomic_store_explicit(target, atomic_load_explicit(target, memory_order_relaxed) + 1, memory_order_relaxed);
+
+    if(metrics->pending_count == METRICS_PENDING){
+        // a very busy round: the ones waiting are timed now
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        metrics_record_pending(metrics, now.tv_sec * 1000000000ULL + now.tv_nsec);
+    }
+    metrics->pending[metrics->pending_count++] = started_ns;
+
+}
+
+#endif
+
+/*
+    the page is written in a buffer sized by metrics_page_size, anything past its end is cut
+    (it can't happen with the sizes above, but a truncated page is better than an overflow).
+*/
+typedef struct {
+    char* data;
+    size_t length;
+    size_t size;
+} metrics_page;
+
+static void page_printf(metrics_page* page, const char* format, ...){
+
+    if(page->length + 1 >= page->size) return;
+
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(page->data + page->length, page->size - page->length, format, args);
+    va_end(args);
+
+    if(written > 0) page->length += (size_t) written < page->size - page->length ? (size_t) written : page->size - page->length - 1;
+
+}
+
+size_t metrics_page_size(const metrics_registry* registry){
+
+    return METRICS_PAGE_FIXED + (size_t) registry->num_handlers * METRICS_PAGE_PER_HANDLER;
+
+}
+
+static void render_prometheus_histogram(metrics_page* page, const char* name, const char* help, const histogram* h){
+
+    page_printf(page, "# HELP epolly_%s %s\n# TYPE epolly_%s histogram\n", name, help, name);
+    for(size_t i = 0; i < LATENCY_BUCKETS; i++){
+        page_printf(page, "epolly_%s_bucket{le=\"%g\"} %llu\n", name, latency_buckets[i], (unsigned long long) histogram_count_at_most(h, latency_buckets[i] * 1e9));
+    }
+    page_printf(page, "epolly_%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) h->total);
+    page_printf(page, "epolly_%s_sum %.9f\n", name, h->sum / 1e9);
+    page_printf(page, "epolly_%s_count %llu\n", name, (unsigned long long) h->total);
+
+}
+
+static void render_prometheus(metrics_page* page, const metrics_registry* registry, const histogram* latency, const histogram* loop_time){
+
+    static const char* status_classes[METRICS_STATUS_CLASSES] = { "other", "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+    for(int c = 0; c < METRIC_COUNTERS; c++){
+        page_printf(page, "# HELP epolly_%s %s\n# TYPE epolly_%s counter\n", counter_info[c].name, counter_info[c].help, counter_info[c].name);
+        for(int i = 0; i < registry->num_handlers; i++){
+            page_printf(page, "epolly_%s{handler=\"%d\"} %lu\n", counter_info[c].name, i, metrics_get(&registry->handlers[i].metrics->counters[c]));
+        }
+    }
+
+    page_printf(page, "# HELP epolly_responses_total Responses fully written, by status class.\n# TYPE epolly_responses_total counter\n");
+    for(int i = 0; i < registry->num_handlers; i++){
+        for(int s = 0; s < METRICS_STATUS_CLASSES; s++){
+            page_printf(page, "epolly_responses_total{handler=\"%d\",code=\"%s\"} %lu\n", i, status_classes[s], metrics_get(&registry->handlers[i].metrics->statuses[s]));
+        }
+    }
+
+    page_printf(page, "# HELP epolly_dispatcher_accept_errors_total Failed accepts in the dispatcher.\n# TYPE epolly_dispatcher_accept_errors_total counter\n");
+    page_printf(page, "epolly_dispatcher_accept_errors_total %lu\n", metrics_get(&registry->dispatcher_accept_errors));
+
+    page_printf(page, "# HELP epolly_open_connections Connections the handler is serving.\n# TYPE epolly_open_connections gauge\n");
+    for(int i = 0; i < registry->num_handlers; i++){
+        page_printf(page, "epolly_open_connections{handler=\"%d\"} %ld\n", i, load_get(&registry->handlers[i].load->connections));
+    }
+    page_printf(page, "# HELP epolly_pending_bytes Bodies of the responses being written.\n# TYPE epolly_pending_bytes gauge\n");
+    for(int i = 0; i < registry->num_handlers; i++){
+        page_printf(page, "epolly_pending_bytes{handler=\"%d\"} %ld\n", i, load_get(&registry->handlers[i].load->pending_bytes));
+    }
+
+    render_prometheus_histogram(page, "request_duration_seconds", "Time from a complete request to its last byte written.", latency);
+    render_prometheus_histogram(page, "loop_duration_seconds", "Time a round of the event loop takes.", loop_time);
+
+}
+
+static void render_json_distribution(metrics_page* page, const char* key, const histogram* h, bool last){
+
+    // milliseconds, so the numbers can be read at a glance
+    page_printf(
+        page,
+        "\"%s\":{\"count\":%llu,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p99.9\":%.3f,\"max\":%.3f}%s",
+        key, (unsigned long long) h->total, histogram_mean(h) / 1e6,
+        histogram_percentile(h, 50) / 1e6, histogram_percentile(h, 90) / 1e6, histogram_percentile(h, 99) / 1e6,
+        histogram_percentile(h, 99.9) / 1e6, (h->total ? h->max : 0) / 1e6, last ? "" : ","
+    );
+
+}
+
+static void render_json_counters(metrics_page* page, const unsigned long* counters, const unsigned long* statuses){
+
+    for(int c = 0; c < METRIC_COUNTERS; c++) page_printf(page, "\"%s\":%lu,", counter_info[c].key, counters[c]);
+    page_printf(page, "\"statuses\":{\"1xx\":%lu,\"2xx\":%lu,\"3xx\":%lu,\"4xx\":%lu,\"5xx\":%lu,\"other\":%lu},", statuses[1], statuses[2], statuses[3], statuses[4], statuses[5], statuses[0]);
+
+}
+
+static void render_json(metrics_page* page, const metrics_registry* registry, const histogram* latency, const histogram* loop_time){
+
+    unsigned long totals[METRIC_COUNTERS] = { 0 };
+    unsigned long total_statuses[METRICS_STATUS_CLASSES] = { 0 };
+    long open_connections = 0;
+
+    page_printf(page, "{\"handlers\":[");
+    for(int i = 0; i < registry->num_handlers; i++){
+
+        handler_metrics* metrics = registry->handlers[i].metrics;
+        unsigned long counters[METRIC_COUNTERS];
+        unsigned long statuses[METRICS_STATUS_CLASSES];
+        long connections = load_get(&registry->handlers[i].load->connections);
+
+        for(int c = 0; c < METRIC_COUNTERS; c++) totals[c] += counters[c] = metrics_get(&metrics->counters[c]);
+        for(int s = 0; s < METRICS_STATUS_CLASSES; s++) total_statuses[s] += statuses[s] = metrics_get(&metrics->statuses[s]);
+        open_connections += connections;
+
+        page_printf(page, "%s{\"id\":%d,", i ? "," : "", i);
+        render_json_counters(page, counters, statuses);
+        page_printf(page, "\"open_connections\":%ld,\"pending_bytes\":%ld,", connections, load_get(&registry->handlers[i].load->pending_bytes));
+        render_json_distribution(page, "request_latency_ms", &metrics->request_latency, false);
+        render_json_distribution(page, "loop_time_ms", &metrics->loop_time, true);
+        page_printf(page, "}");
+
+    }
+
+    page_printf(page, "],\"total\":{");
+    render_json_counters(page, totals, total_statuses);
+    page_printf(page, "\"open_connections\":%ld,\"dispatcher_accept_errors\":%lu,", open_connections, metrics_get(&registry->dispatcher_accept_errors));
+    render_json_distribution(page, "request_latency_ms", latency, false);
+    render_json_distribution(page, "loop_time_ms", loop_time, true);
+    page_printf(page, "}}\n");
+
+}
+
+size_t metrics_render(const metrics_registry* registry, metrics_format format, char* out, size_t size){
+
+    /*
+        called by a handler to answer METRICS_PATH: the other handlers keep writing their blocks meanwhile,
+        nobody waits for anybody. the histograms of every handler are added up for the totals
+        (a histogram's counts are words that only grow, so a racing read is just a bit behind).
+        returns the length of the page, which is null-terminated.
+    */
+
+    metrics_page page = { out, 0, size };
+    histogram* latency = malloc(sizeof(histogram));
+    histogram* loop_time = malloc(sizeof(histogram));
+
+    if(!latency || !loop_time){
+        perror("system is out of memory!\n");
+        exit(-1);
+    }
+
+    histogram_init(latency);
+    histogram_init(loop_time);
+    for(int i = 0; i < registry->num_handlers; i++){
+        histogram_merge(latency, &registry->handlers[i].metrics->request_latency);
+        histogram_merge(loop_time, &registry->handlers[i].metrics->loop_time);
+    }
+
+    out[0] = '\0';
+    if(format == METRICS_JSON) render_json(&page, registry, latency, loop_time);
+    else render_prometheus(&page, registry, latency, loop_time);
+
+    free(latency);
+    free(loop_time);
+
+    return page.length;
+
+}
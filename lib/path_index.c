@@ -0,0 +1,488 @@
+#define _GNU_SOURCE // O_DIRECTORY, fdopendir
+#include "h/path_index.h"
+#include "h/file_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+
+#define PATH_INDEX_DEPTH 32 // symlinked directories are followed, this stops loops
+#define PATH_INDEX_KEYS_PER_BUCKET 2
+#define PATH_INDEX_SEED_TRIES (1 << 24) // per bucket, before a new salt is tried
+#define PATH_INDEX_SALTS 8
+#define PATH_INDEX_QUIET_MS 100 // a burst of changes (a deploy) is rebuilt once, after it's over
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*
+    what a build collects before the table is laid out: paths are offsets in a growing buffer
+*/
+typedef struct {
+    path_index_entry* entries;
+    size_t* path_offsets;
+    uint32_t count;
+    uint32_t capacity;
+    char* paths;
+    size_t paths_length;
+    size_t paths_capacity;
+    int fd_budget; // descriptors this build can still keep open
+    int max_files;
+    int inotify_fd;
+    bool too_many;
+} path_index_scan;
+
+static void* path_index_watch_loop(void* i);
+
+static uint64_t path_index_hash(const char* path, size_t length){
+
+    // FNV-1a, like the file cache's
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < length; i++){
+        hash ^= (unsigned char) path[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+
+}
+
+static uint64_t path_index_mix(uint64_t x){
+
+    // splitmix64's finalizer: every bit of the input moves every bit of the output
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+
+}
+
+static uint32_t path_index_bucket(const path_index_snapshot* snapshot, uint64_t hash){
+
+    return path_index_mix(hash ^ snapshot->salt) % snapshot->bucket_count;
+
+}
+
+static uint32_t path_index_slot(const path_index_snapshot* snapshot, uint64_t hash, uint32_t seed){
+
+    return path_index_mix(hash ^ (snapshot->salt + (seed + 1) * 0x9e3779b97f4a7c15ULL)) % snapshot->count;
+
+}
+
+static void path_index_add(path_index_scan* scan, const char* path, size_t length, int fd, const struct stat* file_stat){
+
+    if(scan->count == scan->capacity){
+        scan->capacity = scan->capacity ? scan->capacity * 2 : 256;
+        scan->entries = realloc(scan->entries, scan->capacity * sizeof(path_index_entry));
+        scan->path_offsets = realloc(scan->path_offsets, scan->capacity * sizeof(size_t));
+    }
+    if(scan->paths_length + length + 1 > scan->paths_capacity){
+        scan->paths_capacity = (scan->paths_length + length + 1) * 2;
+        scan->paths = realloc(scan->paths, scan->paths_capacity);
+    }
+
+    path_index_entry* entry = &scan->entries[scan->count];
+    memcpy(scan->paths + scan->paths_length, path, length + 1);
+    scan->path_offsets[scan->count++] = scan->paths_length;
+    scan->paths_length += length + 1;
+
+    entry->path_length = length;
+    entry->hash = path_index_hash(path, length);
+    entry->fd = fd;
+    entry->file_stat = *file_stat;
+
+}
+
+static void path_index_walk(path_index_scan* scan, int dir_fd, const char* dir_filename, char* path, size_t path_length, int depth){
+
+    /*
+        every regular file under dir_fd (its url path starts with "path", which ends with a slash).
+        the directory is watched before it's read: a file created while we're reading it is either
+        in this build or it triggers the next one.
+    */
+
+    DIR* dir = fdopendir(dir_fd);
+    struct dirent* dirent;
+    char filename[PATH_MAX];
+
+    if(!dir){
+        close(dir_fd);
+        return;
+    }
+    if(scan->inotify_fd >= 0) inotify_add_watch(scan->inotify_fd, dir_filename, WATCH_MASK);
+
+    while(!scan->too_many && (dirent = readdir(dir))){
+
+        const char* name = dirent->d_name;
+        size_t name_length = strlen(name);
+        struct stat file_stat;
+
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if(path_length + name_length + 1 >= PATH_MAX) continue;
+        if(fstatat(dir_fd, name, &file_stat, 0) < 0) continue; // a dangling symlink, or it's gone already
+
+        memcpy(path + path_length, name, name_length + 1);
+
+        if(S_ISREG(file_stat.st_mode)){
+            if(scan->count == (uint32_t) scan->max_files){
+                scan->too_many = true;
+                break;
+            }
+            int fd = -1;
+            if(scan->fd_budget > 0 && (fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC)) >= 0) scan->fd_budget--;
+            path_index_add(scan, path, path_length + name_length, fd, &file_stat);
+        }else if(S_ISDIR(file_stat.st_mode) && depth < PATH_INDEX_DEPTH){
+            int child_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if(child_fd < 0) continue;
+            snprintf(filename, sizeof(filename), "%s/%s", dir_filename, name);
+            path[path_length + name_length] = '/';
+            path[path_length + name_length + 1] = '\0';
+            path_index_walk(scan, child_fd, filename, path, path_length + name_length + 1, depth + 1);
+        }
+
+    }
+
+    closedir(dir); // closes dir_fd too
+
+}
+
+static bool path_index_place(path_index_snapshot* snapshot, path_index_entry* entries){
+
+    /*
+        hash and displace: the keys are split in buckets (about PATH_INDEX_KEYS_PER_BUCKET keys each),
+        then, from the biggest bucket to the smallest, every bucket gets the first seed that sends all of its keys
+        to free slots. the big buckets go first, while there's room; the last ones are singletons, and a singleton
+        only needs one free slot out of those left. the table ends up with exactly one key per slot.
+        false if a bucket can't be placed with this salt.
+    */
+
+    uint32_t n = snapshot->count;
+    uint32_t* bucket_sizes = calloc(snapshot->bucket_count, sizeof(uint32_t));
+    uint32_t* bucket_starts = calloc(snapshot->bucket_count + 1, sizeof(uint32_t));
+    uint32_t* members = malloc(n * sizeof(uint32_t)); // the keys of every bucket, bucket after bucket
+    uint32_t* order = malloc(snapshot->bucket_count * sizeof(uint32_t));
+    uint32_t* slots; // where the keys of the bucket being placed go
+    bool* taken = calloc(n, sizeof(bool));
+    uint32_t max_size = 0;
+    bool placed = true;
+
+    for(uint32_t i = 0; i < n; i++) bucket_sizes[path_index_bucket(snapshot, entries[i].hash)]++;
+    for(uint32_t b = 0; b < snapshot->bucket_count; b++){
+        bucket_starts[b + 1] = bucket_starts[b] + bucket_sizes[b];
+        if(bucket_sizes[b] > max_size) max_size = bucket_sizes[b];
+        bucket_sizes[b] = 0;
+    }
+    for(uint32_t i = 0; i < n; i++){
+        uint32_t b = path_index_bucket(snapshot, entries[i].hash);
+        members[bucket_starts[b] + bucket_sizes[b]++] = i;
+    }
+    slots = malloc(max_size * sizeof(uint32_t));
+
+    // buckets by size, biggest first (a counting sort: sizes are small)
+    uint32_t position = 0;
+    for(uint32_t size = max_size; size > 0; size--){
+        for(uint32_t b = 0; b < snapshot->bucket_count; b++){
+            if(bucket_sizes[b] == size) order[position++] = b;
+        }
+    }
+    for(uint32_t b = 0; b < snapshot->bucket_count; b++) snapshot->seeds[b] = 0;
+
+    for(uint32_t o = 0; o < position && placed; o++){
+
+        uint32_t b = order[o];
+        uint32_t size = bucket_sizes[b];
+        uint32_t seed;
+
+        for(seed = 0; seed < PATH_INDEX_SEED_TRIES; seed++){
+            uint32_t k;
+            for(k = 0; k < size; k++){
+                uint32_t slot = path_index_slot(snapshot, entries[members[bucket_starts[b] + k]].hash, seed);
+                bool clash = taken[slot];
+                for(uint32_t j = 0; j < k && !clash; j++) clash = slots[j] == slot;
+                if(clash) break;
+                slots[k] = slot;
+            }
+            if(k == size) break;
+        }
+
+        if(seed == PATH_INDEX_SEED_TRIES){
+            placed = false;
+            break;
+        }
+        snapshot->seeds[b] = seed;
+        for(uint32_t k = 0; k < size; k++){
+            taken[slots[k]] = true;
+            snapshot->entries[slots[k]] = entries[members[bucket_starts[b] + k]];
+        }
+
+    }
+
+    free(bucket_sizes);
+    free(bucket_starts);
+    free(members);
+    free(order);
+    free(slots);
+    free(taken);
+    return placed;
+
+}
+
+static void path_index_free(path_index_snapshot* snapshot){
+
+    if(!snapshot) return;
+    for(uint32_t i = 0; i < snapshot->count; i++){
+        if(snapshot->entries[i].fd >= 0) close(snapshot->entries[i].fd);
+    }
+    free(snapshot->entries);
+    free(snapshot->seeds);
+    free(snapshot->paths);
+    free(snapshot);
+
+}
+
+static path_index_snapshot* path_index_build(path_index* index, int fd_budget){
+
+    /*
+        a new snapshot of the tree. NULL if it can't be indexed (it's unreadable or too big):
+        lookups then leave everything to the filesystem, like there was no index.
+    */
+
+    path_index_scan scan = { 0 };
+    char path[PATH_MAX] = "/";
+    int root_fd = open(index->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if(root_fd < 0){
+        perror("path index: cannot open the root");
+        return NULL;
+    }
+
+    scan.fd_budget = fd_budget;
+    scan.max_files = index->max_files;
+    scan.inotify_fd = index->inotify_fd;
+    path_index_walk(&scan, root_fd, index->root, path, 1, 0);
+
+    path_index_snapshot* snapshot = NULL;
+
+    if(scan.too_many){
+        fprintf(stderr, "path index: more than %d files under %s, not indexing them\n", index->max_files, index->root);
+    }else{
+
+        snapshot = calloc(1, sizeof(path_index_snapshot));
+        snapshot->count = scan.count;
+        snapshot->bucket_count = scan.count / PATH_INDEX_KEYS_PER_BUCKET + 1;
+        snapshot->entries = calloc(scan.count ? scan.count : 1, sizeof(path_index_entry));
+        snapshot->seeds = calloc(snapshot->bucket_count, sizeof(uint32_t));
+        snapshot->paths = scan.paths;
+        scan.paths = NULL;
+        for(uint32_t i = 0; i < scan.count; i++) scan.entries[i].path = snapshot->paths + scan.path_offsets[i];
+
+        bool placed = scan.count == 0;
+        for(int salt = 0; salt < PATH_INDEX_SALTS && !placed; salt++){
+            snapshot->salt = path_index_mix(salt + 1);
+            placed = path_index_place(snapshot, scan.entries);
+        }
+
+        if(!placed){
+            fprintf(stderr, "path index: cannot hash the paths under %s, not indexing them\n", index->root);
+            free(snapshot->entries);
+            free(snapshot->seeds);
+            free(snapshot->paths);
+            free(snapshot);
+            snapshot = NULL;
+        }
+
+    }
+
+    if(!snapshot){
+        for(uint32_t i = 0; i < scan.count; i++){
+            if(scan.entries[i].fd >= 0) close(scan.entries[i].fd);
+        }
+    }
+    free(scan.entries);
+    free(scan.path_offsets);
+    free(scan.paths);
+    return snapshot;
+
+}
+
+static int path_index_fd_budget(void){
+
+    /*
+        the index never takes more than a quarter of the descriptors we may open:
+        two snapshots are alive during a rebuild, and the rest is for the connections.
+    */
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur == RLIM_INFINITY) return 1024;
+    return limit.rlim_cur / 4;
+
+}
+
+path_index* path_index_create(const server_config* config, file_cache* cache){
+
+    path_index* index = calloc(1, sizeof(path_index));
+    index->cache = cache;
+    index->www_path = config->www_path;
+
+    // the root without its trailing slashes: paths are joined to it with one
+    snprintf(index->root, sizeof(index->root), "%s", config->www_path);
+    index->root_length = strlen(index->root);
+    while(index->root_length > 1 && index->root[index->root_length - 1] == '/') index->root[--index->root_length] = '\0';
+    index->max_files = config->path_index_max_files;
+    pthread_rwlock_init(&index->lock, NULL);
+
+    index->inotify_fd = inotify_init1(IN_CLOEXEC);
+    if(index->inotify_fd < 0){
+        perror("cannot initialize inotify\n");
+        exit(-1);
+    }
+
+    index->snapshot = path_index_build(index, path_index_fd_budget());
+    if(index->snapshot){
+        uint32_t open_files = 0;
+        for(uint32_t i = 0; i < index->snapshot->count; i++) open_files += index->snapshot->entries[i].fd >= 0;
+        fprintf(stderr, "path index: %u files under %s (%u kept open)\n", index->snapshot->count, index->root, open_files);
+    }
+
+    if(pthread_create(&index->watcher, NULL, path_index_watch_loop, (void*) index) != 0){
+        perror("cannot start the path index watcher\n");
+        exit(-1);
+    }
+
+    return index;
+
+}
+
+static const path_index_entry* path_index_find(const path_index_snapshot* snapshot, const char* path, size_t length){
+
+    // a key that isn't in the table lands on some other key's slot: the comparison tells them apart
+    if(snapshot->count == 0) return NULL;
+
+    uint64_t hash = path_index_hash(path, length);
+    uint32_t seed = snapshot->seeds[path_index_bucket(snapshot, hash)];
+    const path_index_entry* entry = &snapshot->entries[path_index_slot(snapshot, hash, seed)];
+
+    if(entry->hash != hash || entry->path_length != length || memcmp(entry->path, path, length) != 0) return NULL;
+    return entry;
+
+}
+
+bool path_index_contains(path_index* index, const char* path, size_t length){
+
+    // false only if the file surely isn't there (without a snapshot we can't tell)
+    bool found = true;
+
+    pthread_rwlock_rdlock(&index->lock);
+    if(index->snapshot) found = path_index_find(index->snapshot, path, length) != NULL;
+    pthread_rwlock_unlock(&index->lock);
+
+    return found;
+
+}
+
+static bool path_index_same_file(const struct stat* a, const struct stat* b){
+
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size
+           && a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+
+}
+
+int path_index_open(path_index* index, const char* path, size_t length, struct stat* file_stat){
+
+    /*
+        a descriptor of the file (the caller owns it) and its metadata, fstat'ed now: no path walk.
+        it's a dup() of the index's, its offset is shared, so it's only read with pread() and sendfile().
+        -1 if the index doesn't have it open, or if the file isn't the one that was indexed anymore
+        (rewritten in place, or unlinked because a rename replaced it): the caller opens it the usual way.
+    */
+    int fd = -1;
+    struct stat indexed;
+
+    pthread_rwlock_rdlock(&index->lock);
+    const path_index_entry* entry = index->snapshot ? path_index_find(index->snapshot, path, length) : NULL;
+    if(entry && entry->fd >= 0 && (fd = fcntl(entry->fd, F_DUPFD_CLOEXEC, 0)) >= 0) indexed = entry->file_stat;
+    pthread_rwlock_unlock(&index->lock);
+
+    if(fd >= 0 && (fstat(fd, file_stat) < 0 || file_stat->st_nlink == 0 || !path_index_same_file(file_stat, &indexed))){
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+
+}
+
+static void path_index_invalidate(path_index* index, const path_index_snapshot* old, const path_index_snapshot* snapshot){
+
+    /*
+        the files of the old snapshot that are gone or changed in the new one leave the file cache (which also
+        bumps its generation, so loads that started before are not inserted). without an old snapshot the index
+        didn't hand out anything, without a new one we can't tell what changed: the whole cache goes.
+    */
+    char filename[PATH_MAX];
+    size_t www_path_length = strlen(index->www_path);
+
+    if(!index->cache || !old) return;
+    if(!snapshot){
+        file_cache_flush(index->cache);
+        return;
+    }
+
+    for(uint32_t i = 0; i < old->count; i++){
+        const path_index_entry* before = &old->entries[i];
+        const path_index_entry* after = path_index_find(snapshot, before->path, before->path_length);
+        if(after && path_index_same_file(&after->file_stat, &before->file_stat)) continue;
+        if(www_path_length + before->path_length + 1 > sizeof(filename)) continue;
+        memcpy(filename, index->www_path, www_path_length);
+        memcpy(filename + www_path_length, before->path, before->path_length);
+        filename[www_path_length + before->path_length] = '\0';
+        file_cache_invalidate(index->cache, filename);
+    }
+
+}
+
+static void* path_index_watch_loop(void* i){
+
+    /*
+        the watcher thread: any change under the root means a new snapshot.
+        the events themselves don't matter (we rebuild from scratch), we only wait for them to stop
+        coming for PATH_INDEX_QUIET_MS, so copying a whole site rebuilds the index once.
+    */
+
+    path_index* index = (path_index*) i;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd watch = { .fd = index->inotify_fd, .events = POLLIN };
+
+    while(true){
+
+        ssize_t length = read(index->inotify_fd, buf, sizeof(buf));
+        if(length <= 0){
+            if(length < 0 && errno == EINTR) continue;
+            perror("cannot read inotify events\n");
+            return NULL;
+        }
+
+        while(poll(&watch, 1, PATH_INDEX_QUIET_MS) > 0){
+            if(read(index->inotify_fd, buf, sizeof(buf)) <= 0) break;
+        }
+
+        path_index_snapshot* snapshot = path_index_build(index, path_index_fd_budget());
+
+        pthread_rwlock_wrlock(&index->lock);
+        path_index_snapshot* old = index->snapshot;
+        index->snapshot = snapshot;
+        pthread_rwlock_unlock(&index->lock);
+
+        // nobody can be looking at the old one anymore: lookups copy what they need before they unlock
+        path_index_invalidate(index, old, snapshot);
+        path_index_free(old);
+
+    }
+
+    return NULL;
+
+}
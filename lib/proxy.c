@@ -0,0 +1,933 @@
+#define _GNU_SOURCE // splice, F_SETPIPE_SZ, memmem
+#include "h/proxy.h"
+#include "h/handler.h"
+#include "h/connection_context.h"
+#include "h/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define PROXY_CHUNK_LINE_MAX 1024 // a chunk's size line (and the trailers of the last one) must fit here
+#define PROXY_HEALTH_RESPONSE 64 // the health checks only read the status line
+
+typedef enum {
+    PROXY_DEADLINE_CONNECT,
+    PROXY_DEADLINE_READ,
+    PROXY_DEADLINE_IDLE
+} proxy_deadline;
+
+static void* proxy_health_loop(void* p);
+
+static void proxy_resolve(proxy_upstream* upstream, const char* name){
+
+    // "unix:/run/app.sock" or "host:port", resolved once at startup (a name that doesn't resolve is a configuration error)
+    snprintf(upstream->name, sizeof(upstream->name), "%s", name);
+    memset(&upstream->address, 0, sizeof(upstream->address));
+
+    if(strncmp(name, "unix:", 5) == 0){
+        struct sockaddr_un* address = (struct sockaddr_un*) &upstream->address;
+        if(strlen(name + 5) >= sizeof(address->sun_path)){
+            fprintf(stderr, "proxy: the socket path of %s is too long\n", name);
+            exit(-1);
+        }
+        address->sun_family = AF_UNIX;
+        strcpy(address->sun_path, name + 5);
+        upstream->address_length = sizeof(struct sockaddr_un);
+        return;
+    }
+
+    char host[128];
+    const char* colon = strrchr(name, ':');
+    struct addrinfo hints = { 0 };
+    struct addrinfo* result;
+
+    if(!colon || colon == name || colon[1] == '\0'){
+        fprintf(stderr, "proxy: %s should be host:port or unix:/path\n", name);
+        exit(-1);
+    }
+    snprintf(host, sizeof(host), "%.*s", (int) (colon - name), name);
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int error = getaddrinfo(host, colon + 1, &hints, &result);
+    if(error != 0){
+        fprintf(stderr, "proxy: cannot resolve %s: %s\n", name, gai_strerror(error));
+        exit(-1);
+    }
+
+    memcpy(&upstream->address, result->ai_addr, result->ai_addrlen);
+    upstream->address_length = result->ai_addrlen;
+    freeaddrinfo(result);
+
+}
+
+proxy* proxy_create(const server_config* config){
+
+    /*
+        the routes from the config, with their upstreams resolved.
+        an upstream that appears in many routes is the same one (one pool, one health flag).
+    */
+
+    proxy* p = calloc(1, sizeof(proxy));
+
+    p->connect_timeout = config->proxy_connect_timeout;
+    p->read_timeout = config->proxy_read_timeout;
+    p->idle_timeout = config->keep_alive_timeout;
+    p->health_interval = config->proxy_health_interval;
+    snprintf(p->health_path, sizeof(p->health_path), "%s", config->proxy_health_path);
+
+    for(int i = 0; i < config->proxy_route_count; i++){
+
+        const proxy_route_config* route_config = &config->proxy_routes[i];
+        proxy_route* route = &p->routes[p->route_count++];
+
+        snprintf(route->prefix, sizeof(route->prefix), "%s", route_config->prefix);
+        route->prefix_length = strlen(route->prefix);
+
+        for(int j = 0; j < route_config->upstream_count; j++){
+            proxy_upstream* upstream = NULL;
+            for(int k = 0; k < p->upstream_count && !upstream; k++){
+                if(strcmp(p->upstreams[k].name, route_config->upstreams[j]) == 0) upstream = &p->upstreams[k];
+            }
+            if(!upstream){
+                upstream = &p->upstreams[p->upstream_count];
+                upstream->id = p->upstream_count++;
+                proxy_resolve(upstream, route_config->upstreams[j]);
+                atomic_init(&upstream->healthy, true); // until a check says otherwise
+            }
+            route->upstreams[route->upstream_count++] = upstream;
+        }
+
+    }
+
+    if(p->health_interval > 0 && pthread_create(&p->health_thread, NULL, proxy_health_loop, (void*) p) != 0){
+        perror("cannot start the proxy health checks\n");
+        exit(-1);
+    }
+
+    return p;
+
+}
+
+static bool proxy_check(const proxy* p, const proxy_upstream* upstream){
+
+    /*
+        a blocking GET on a socket of its own (the health thread has nothing else to do),
+        every step bounded by the connect timeout. any 2xx or 3xx means the upstream is fine.
+    */
+
+    char request[PATH_MAX + 128];
+    char response[PROXY_HEALTH_RESPONSE + 1];
+    struct timeval timeout = { p->connect_timeout, 0 };
+    int fd = socket(upstream->address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nUser-Agent: epolly-health\r\n\r\n", p->health_path);
+    ssize_t received = 0;
+    bool healthy = false;
+
+    if(fd < 0) return false;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)); // connect() honors it too
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if(connect(fd, (const struct sockaddr*) &upstream->address, upstream->address_length) == 0
+       && send(fd, request, length, MSG_NOSIGNAL) == length){
+        ssize_t result;
+        while(received < 12 && (result = recv(fd, response + received, PROXY_HEALTH_RESPONSE - received, 0)) > 0) received += result;
+        // "HTTP/1.1 200"
+        healthy = received >= 12 && strncmp(response, "HTTP/1.", 7) == 0 && (response[9] == '2' || response[9] == '3');
+    }
+
+    close(fd);
+    return healthy;
+
+}
+
+static void* proxy_health_loop(void* pr){
+
+    proxy* p = (proxy*) pr;
+
+    while(true){
+
+        for(int i = 0; i < p->upstream_count; i++){
+            proxy_upstream* upstream = &p->upstreams[i];
+            bool healthy = proxy_check(p, upstream);
+            if(atomic_exchange(&upstream->healthy, healthy) != healthy){
+                fprintf(stderr, "proxy: %s is %s\n", upstream->name, healthy ? "back up" : "down");
+            }
+        }
+
+        sleep(p->health_interval);
+
+    }
+
+    return NULL;
+
+}
+
+void proxy_pool_init(proxy_pool* pool, const proxy* proxy, int pool_size, int epoll_fd){
+
+    pool->proxy = proxy;
+    pool->size = pool_size;
+    pool->next_upstream = 0;
+    pool->epoll_fd = epoll_fd;
+    pool->closed = NULL;
+    timer_wheel_init(&pool->timers, timer_wheel_clock_ms());
+    for(int i = 0; i < PROXY_UPSTREAMS; i++){
+        pool->idle[i] = NULL;
+        pool->idle_count[i] = 0;
+    }
+
+}
+
+const proxy_route* proxy_match(const proxy* proxy, const http_request* req){
+
+    // the longest prefix wins ("/api/v2/" over "/api/")
+    const proxy_route* best = NULL;
+
+    for(int i = 0; i < proxy->route_count; i++){
+        const proxy_route* route = &proxy->routes[i];
+        if(req->path.length >= route->prefix_length && memcmp(req->path.ptr, route->prefix, route->prefix_length) == 0
+           && (!best || route->prefix_length > best->prefix_length)){
+            best = route;
+        }
+    }
+
+    return best;
+
+}
+
+static bool proxy_view_is(http_view view, const char* text){
+
+    size_t length = strlen(text);
+    return view.length == length && strncasecmp(view.ptr, text, length) == 0;
+
+}
+
+static bool proxy_has_token(const char* value, size_t value_length, const char* token, size_t token_length){
+
+    // "close" in "Connection: keep-alive, close" (comma separated, case insensitive)
+    size_t i = 0;
+
+    while(i < value_length){
+        while(i < value_length && (value[i] == ' ' || value[i] == ',' || value[i] == '\t')) i++;
+        size_t start = i;
+        while(i < value_length && value[i] != ',' && value[i] != ' ' && value[i] != '\t') i++;
+        if(i - start == token_length && strncasecmp(value + start, token, token_length) == 0) return true;
+    }
+
+    return false;
+
+}
+
+static bool proxy_hop_by_hop(const char* name, size_t length, const char* connection, size_t connection_length){
+
+    /*
+        these only concern a single connection, they are never forwarded (neither are the ones that Connection lists).
+        Transfer-Encoding isn't here: a chunked response goes to the client as it is.
+    */
+    static const char* const names[] = { "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Upgrade", NULL };
+
+    for(int i = 0; names[i]; i++){
+        if(strlen(names[i]) == length && strncasecmp(names[i], name, length) == 0) return true;
+    }
+    return connection && proxy_has_token(connection, connection_length, name, length);
+
+}
+
+long proxy_request_length(const http_request* req, int head_length){
+
+    /*
+        the head and its body: a Content-Length body is forwarded with the head, once it's all in the buffer.
+        -1 if the length can't be known (a chunked body). the parser already refused broken, repeated
+        or huge lengths (above HTTP_MAX_CONTENT_LENGTH), so adding the head can't overflow.
+    */
+    if(req->transfer_encoding) return -1;
+    return head_length + (req->content_length > 0 ? req->content_length : 0);
+
+}
+
+static void proxy_copy_request(proxy_connection* conn, const http_request* req, const char* request, int head_length, size_t length){
+
+    /*
+        the request line as the client sent it (in HTTP/1.1), the end-to-end headers,
+        our own Connection (the upstream connection is pooled, whatever the client wants), then the body.
+    */
+
+    const http_view* connection = NULL;
+    bool host = false;
+    size_t size = req->method_name.length + req->path.length + 64 + (length - head_length);
+
+    for(int i = 0; i < req->headers_num; i++){
+        if(proxy_view_is(req->headers[i].name, "Connection")) connection = &req->headers[i].value;
+        if(proxy_view_is(req->headers[i].name, "Host")) host = true;
+        size += req->headers[i].name.length + req->headers[i].value.length + 4;
+    }
+
+    char* out = malloc(size);
+    char* start = out;
+
+    out += sprintf(out, "%.*s %.*s HTTP/1.1\r\n", (int) req->method_name.length, req->method_name.ptr, (int) req->path.length, req->path.ptr);
+    for(int i = 0; i < req->headers_num; i++){
+        const http_header* header = &req->headers[i];
+        if(proxy_hop_by_hop(header->name.ptr, header->name.length, connection ? connection->ptr : NULL, connection ? connection->length : 0)) continue;
+        memcpy(out, header->name.ptr, header->name.length);
+        out += header->name.length;
+        memcpy(out, ": ", 2);
+        out += 2;
+        memcpy(out, header->value.ptr, header->value.length);
+        out += header->value.length;
+        memcpy(out, "\r\n", 2);
+        out += 2;
+    }
+    if(!host) out += sprintf(out, "Host: localhost\r\n"); // HTTP/1.0 clients may not send it, HTTP/1.1 upstreams want it
+    out += sprintf(out, "Connection: keep-alive\r\n\r\n");
+    memcpy(out, request + head_length, length - head_length);
+    out += length - head_length;
+
+    conn->request = start;
+    conn->request_length = out - start;
+    conn->request_sent = 0;
+    conn->head_request = proxy_view_is(req->method_name, "HEAD");
+
+}
+
+static void* proxy_event_data(proxy_connection* conn){
+
+    return (void*) ((uintptr_t) conn | PROXY_EVENT_TAG);
+
+}
+
+bool proxy_is_upstream(const void* source){
+
+    return ((uintptr_t) source & PROXY_EVENT_TAG) != 0;
+
+}
+
+static void proxy_schedule(proxy_pool* pool, proxy_connection* conn, proxy_deadline kind){
+
+    int seconds;
+    switch(kind){
+        case PROXY_DEADLINE_CONNECT: seconds = pool->proxy->connect_timeout; break;
+        case PROXY_DEADLINE_READ: seconds = pool->proxy->read_timeout; break;
+        default: seconds = pool->proxy->idle_timeout;
+    }
+
+    timer_schedule(&pool->timers, &conn->deadline, timer_wheel_clock_ms(), seconds * 1000UL, kind);
+
+}
+
+static bool proxy_connect(proxy_pool* pool, proxy_connection* conn){
+
+    /*
+        a new non-blocking socket to the connection's upstream: a Unix socket (or a TCP one, on loopback, sometimes)
+        connects right away, otherwise the connect completes with an EPOLLOUT (check proxy_on_event).
+        the socket stays in the epoll, edge-triggered for both directions, until it's closed: waiting for
+        the other direction never costs an epoll_ctl().
+        false if the upstream refused it.
+    */
+
+    const proxy_upstream* upstream = conn->upstream;
+    int fd = socket(upstream->address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if(fd < 0){
+        perror("cannot create an upstream socket");
+        return false;
+    }
+    if(upstream->address.ss_family != AF_UNIX){
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+
+    if(connect(fd, (const struct sockaddr*) &upstream->address, upstream->address_length) == 0){
+        conn->state = PROXY_SENDING;
+    }else if(errno == EINPROGRESS){
+        conn->state = PROXY_CONNECTING;
+    }else{
+        close(fd);
+        return false;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = proxy_event_data(conn);
+    if(epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0){
+        perror("cannot add upstream descriptor to epoll");
+        close(fd);
+        return false;
+    }
+
+    conn->fd = fd;
+    conn->reused = false;
+    proxy_schedule(pool, conn, conn->state == PROXY_CONNECTING ? PROXY_DEADLINE_CONNECT : PROXY_DEADLINE_READ);
+    return true;
+
+}
+
+static void proxy_mark_down(proxy_pool* pool, proxy_upstream* upstream){
+
+    // the health checks will bring it back (without them, nothing would: the upstream stays in the rotation)
+    if(pool->proxy->health_interval > 0 && atomic_exchange(&upstream->healthy, false)){
+        fprintf(stderr, "proxy: %s refused a connection, it's down until the next health check\n", upstream->name);
+    }
+
+}
+
+static void proxy_close(proxy_pool* pool, proxy_connection* conn){
+
+    /*
+        the socket is closed now, the connection itself at the end of the event loop's round (check proxy_collect):
+        its event may still be waiting in the batch the handler is going through.
+    */
+    timer_cancel(&pool->timers, &conn->deadline);
+    if(conn->fd >= 0) close(conn->fd);
+    if(conn->pipe[0] >= 0){
+        close(conn->pipe[0]);
+        close(conn->pipe[1]);
+    }
+    free(conn->request);
+    free(conn->head);
+    conn->fd = -1;
+    conn->pipe[0] = conn->pipe[1] = -1;
+    conn->request = NULL;
+    conn->head = NULL;
+    conn->client = NULL;
+    conn->next = pool->closed;
+    pool->closed = conn;
+
+}
+
+void proxy_collect(proxy_pool* pool){
+
+    while(pool->closed){
+        proxy_connection* conn = pool->closed;
+        pool->closed = conn->next;
+        free(conn);
+    }
+
+}
+
+static proxy_connection* proxy_take_idle(proxy_pool* pool, proxy_upstream* upstream){
+
+    proxy_connection* conn = pool->idle[upstream->id];
+    if(!conn) return NULL;
+
+    pool->idle[upstream->id] = conn->next;
+    pool->idle_count[upstream->id] -= 1;
+    timer_cancel(&pool->timers, &conn->deadline);
+    conn->next = NULL;
+    conn->reused = true;
+    conn->state = PROXY_SENDING;
+    proxy_schedule(pool, conn, PROXY_DEADLINE_READ);
+    return conn;
+
+}
+
+static void proxy_drop_idle(proxy_pool* pool, proxy_connection* conn){
+
+    // an idle connection the upstream closed (or that timed out): out of the pool
+    proxy_connection** link = &pool->idle[conn->upstream->id];
+    while(*link && *link != conn) link = &(*link)->next;
+    if(*link){
+        *link = conn->next;
+        pool->idle_count[conn->upstream->id] -= 1;
+    }
+    proxy_close(pool, conn);
+
+}
+
+proxy_connection* proxy_start(proxy_pool* pool, const proxy_route* route, connection_context* client,
+                              const http_request* req, const char* request, int head_length, size_t length, bool keep_alive){
+
+    /*
+        the next healthy upstream of the route (round-robin) answers the request:
+        with one of its idle connections if there are any, with a new one otherwise.
+        NULL if none of them can take it (the client gets a 503).
+    */
+
+    for(int attempt = 0; attempt < route->upstream_count; attempt++){
+
+        proxy_upstream* upstream = route->upstreams[pool->next_upstream++ % route->upstream_count];
+        if(!atomic_load_explicit(&upstream->healthy, memory_order_relaxed)) continue;
+
+        proxy_connection* conn = proxy_take_idle(pool, upstream);
+        if(!conn){
+            conn = calloc(1, sizeof(proxy_connection));
+            conn->upstream = upstream;
+            conn->fd = -1;
+            conn->pipe[0] = conn->pipe[1] = -1;
+            timer_init(&conn->deadline);
+            if(!proxy_connect(pool, conn)){
+                proxy_mark_down(pool, upstream);
+                free(conn);
+                continue;
+            }
+        }
+
+        conn->client = client;
+        conn->keep_alive = keep_alive;
+        conn->timed_out = false;
+        conn->failed = false;
+        conn->status = 0;
+        conn->client_head = NULL;
+        conn->client_head_sent = 0;
+        conn->pipe_fill = 0;
+        conn->body_sent = 0;
+        proxy_copy_request(conn, req, request, head_length, length);
+        return conn;
+
+    }
+
+    return NULL;
+
+}
+
+static bool proxy_retry(proxy_pool* pool, proxy_connection* conn){
+
+    /*
+        a pooled connection broke before the response started: the upstream closed it while it was idle
+        (its keep-alive timeout may be shorter than ours), so the request is sent again on a new connection.
+        only once, and never with a connection that was new already.
+    */
+
+    if(!conn->reused || conn->state > PROXY_READING_HEAD) return false;
+
+    epoll_ctl(pool->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    conn->request_sent = 0;
+    if(!proxy_connect(pool, conn)){
+        proxy_mark_down(pool, conn->upstream);
+        return false;
+    }
+    return true;
+
+}
+
+connection_context* proxy_on_event(proxy_pool* pool, const void* source, uint32_t events){
+
+    /*
+        an event on an upstream socket: returns the client whose response can go on (NULL if there's none).
+        the reading and the writing are done by proxy_advance, here we only learn how a connect went
+        and drop idle connections that the upstream closed.
+    */
+
+    proxy_connection* conn = (proxy_connection*) ((uintptr_t) source & ~(uintptr_t) PROXY_EVENT_TAG);
+
+    if(conn->fd < 0) return NULL; // closed earlier in this round
+
+    if(!conn->client){
+        // an idle connection only hears from the upstream when it's closing it (EPOLLOUT edges are the send buffer emptying)
+        if(events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) proxy_drop_idle(pool, conn);
+        return NULL;
+    }
+
+    if(conn->state == PROXY_CONNECTING){
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if(getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) error = errno;
+        if(error != 0){
+            proxy_mark_down(pool, conn->upstream);
+            conn->failed = true;
+        }else if(events & EPOLLOUT){
+            conn->state = PROXY_SENDING;
+        }
+    }
+
+    return conn->client;
+
+}
+
+static bool proxy_parse_head(proxy_connection* conn, char* head, size_t length){
+
+    /*
+        the upstream's head, rewritten for the client in its arena: the status line (in HTTP/1.1),
+        the end-to-end headers and our own Connection. the body's framing comes from here too.
+        false if it's not a response we understand.
+    */
+
+    char* line_end = memmem(head, length, "\r\n", 2);
+    char* end = head + length;
+    const char* connection = NULL;
+    size_t connection_length = 0;
+    bool chunked = false;
+    long content_length = -1;
+
+    if(!line_end || length < 12 || strncmp(head, "HTTP/1.", 7) != 0 || head[8] != ' ') return false;
+    conn->status = atoi(head + 9);
+    if(conn->status < 100 || conn->status > 599) return false;
+    conn->upstream_keep_alive = head[7] == '1'; // HTTP/1.0 closes unless it says otherwise
+
+    /*
+        the Connection header first: the headers it lists are dropped too.
+        so is Content-Length if the body is chunked (RFC 9112, 6.3): the client must only see the framing we use.
+    */
+    for(char* line = line_end + 2; line < end - 2;){
+        char* next = memmem(line, end - line, "\r\n", 2);
+        char* colon = memchr(line, ':', next - line);
+        if(colon && colon - line == 10 && strncasecmp(line, "Connection", 10) == 0){
+            connection = colon + 1;
+            connection_length = next - connection;
+            if(proxy_has_token(connection, connection_length, "close", 5)) conn->upstream_keep_alive = false;
+            if(proxy_has_token(connection, connection_length, "keep-alive", 10)) conn->upstream_keep_alive = true;
+        }else if(colon && colon - line == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0){
+            chunked = chunked || proxy_has_token(colon + 1, next - colon - 1, "chunked", 7);
+        }
+        line = next + 2;
+    }
+
+    char* out = arena_alloc(&conn->client->arena, length + 32);
+    conn->client_head = out;
+
+    memcpy(out, "HTTP/1.1", 8);
+    memcpy(out + 8, head + 8, line_end + 2 - (head + 8));
+    out += line_end + 2 - head;
+
+    for(char* line = line_end + 2; line < end - 2;){
+        char* next = memmem(line, end - line, "\r\n", 2);
+        char* colon = memchr(line, ':', next - line);
+        line_end = next + 2;
+        if(!colon) return false;
+
+        size_t name_length = colon - line;
+        const char* value = colon + 1;
+        while(value < next && (*value == ' ' || *value == '\t')) value++;
+
+        if(proxy_hop_by_hop(line, name_length, connection, connection_length)){
+            line = line_end;
+            continue;
+        }
+        if(name_length == 14 && strncasecmp(line, "Content-Length", 14) == 0){
+            if(chunked){
+                line = line_end;
+                continue;
+            }
+            content_length = strtol(value, NULL, 10);
+            if(content_length < 0) return false;
+        }
+
+        memcpy(out, line, line_end - line);
+        out += line_end - line;
+        line = line_end;
+    }
+
+    conn->remaining = 0;
+    conn->last_chunk = false;
+    if(conn->head_request || conn->status == 204 || conn->status == 304 || conn->status < 200){
+        conn->framing = PROXY_BODY_NONE;
+    }else if(chunked){
+        conn->framing = PROXY_BODY_CHUNKED; // it wins over a Content-Length (which the client would ignore anyway)
+    }else if(content_length >= 0){
+        conn->framing = PROXY_BODY_LENGTH;
+        conn->remaining = content_length;
+    }else{
+        conn->framing = PROXY_BODY_CLOSE;
+        conn->upstream_keep_alive = false;
+        conn->keep_alive = false; // the client can only see where the body ends if we close the connection
+    }
+
+    out += sprintf(out, "Connection: %s\r\n\r\n", conn->keep_alive ? "keep-alive" : "close");
+    conn->client_head_length = out - conn->client_head;
+    conn->client_head_sent = 0;
+    return true;
+
+}
+
+static proxy_result proxy_read_head(proxy_pool* pool, proxy_connection* conn){
+
+    /*
+        the head is peeked at until it's all there, then exactly its bytes are taken:
+        the body stays in the socket, for splice.
+        interim responses (100 Continue...) are skipped.
+    */
+
+    if(!conn->head) conn->head = malloc(PROXY_HEAD_MAX);
+
+    while(true){
+
+        ssize_t peeked = recv(conn->fd, conn->head, PROXY_HEAD_MAX, MSG_PEEK);
+        if(peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return PROXY_WAIT_UPSTREAM;
+        if(peeked <= 0){
+            // the upstream closed the connection (or broke it) without answering
+            return proxy_retry(pool, conn) ? PROXY_WAIT_UPSTREAM : PROXY_FAILED;
+        }
+
+        char* head_end = memmem(conn->head, peeked, "\r\n\r\n", 4);
+        if(!head_end) return peeked == PROXY_HEAD_MAX ? PROXY_FAILED : PROXY_WAIT_UPSTREAM;
+
+        size_t head_length = head_end + 4 - conn->head;
+        if(recv(conn->fd, conn->head, head_length, 0) != (ssize_t) head_length) return PROXY_FAILED;
+        conn->reused = false; // the upstream answered: whatever happens now, the request isn't sent again
+
+        if(!proxy_parse_head(conn, conn->head, head_length)) return PROXY_FAILED;
+        if(conn->status >= 200) break;
+        if(conn->status == 101) return PROXY_FAILED; // upgrades (websockets) aren't proxied
+        arena_reset(&conn->client->arena);
+
+    }
+
+    conn->state = PROXY_WRITING_HEAD;
+    return PROXY_DONE;
+
+}
+
+static proxy_result proxy_next_chunk(proxy_connection* conn){
+
+    /*
+        "1a2b;ext=1\r\n" <bytes> "\r\n", or "0\r\n" <trailers> "\r\n" at the end: the size line is peeked at,
+        then the whole chunk (size line, bytes and CRLF) is spliced as it is.
+    */
+
+    char* line = conn->head;
+    ssize_t peeked = recv(conn->fd, line, PROXY_CHUNK_LINE_MAX, MSG_PEEK);
+    if(peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return PROXY_WAIT_UPSTREAM;
+    if(peeked <= 0) return PROXY_FAILED;
+
+    char* line_end = memmem(line, peeked, "\r\n", 2);
+    if(!line_end) return peeked == PROXY_CHUNK_LINE_MAX ? PROXY_FAILED : PROXY_WAIT_UPSTREAM;
+
+    char* digits_end;
+    long size = strtol(line, &digits_end, 16);
+    if(digits_end == line || size < 0) return PROXY_FAILED;
+
+    if(size > 0){
+        conn->remaining = (line_end + 2 - line) + size + 2;
+        return PROXY_DONE;
+    }
+
+    char* trailers_end = memmem(line_end, peeked - (line_end - line), "\r\n\r\n", 4);
+    if(!trailers_end) return peeked == PROXY_CHUNK_LINE_MAX ? PROXY_FAILED : PROXY_WAIT_UPSTREAM;
+    conn->remaining = trailers_end + 4 - line;
+    conn->last_chunk = true;
+    return PROXY_DONE;
+
+}
+
+static bool proxy_body_done(const proxy_connection* conn){
+
+    switch(conn->framing){
+        case PROXY_BODY_NONE: return true;
+        case PROXY_BODY_LENGTH: return conn->remaining == 0;
+        case PROXY_BODY_CHUNKED: return conn->last_chunk && conn->remaining == 0;
+        default: return conn->last_chunk; // PROXY_BODY_CLOSE: set when the upstream closes
+    }
+
+}
+
+static proxy_result proxy_stream_body(handler* current_handler, proxy_connection* conn){
+
+    /*
+        upstream -> pipe -> client, never through userspace. the pipe is always drained before it's filled again,
+        so an EAGAIN from the first splice means the upstream has nothing, from the second that the client is full.
+    */
+
+    size_t budget = current_handler->write_high_watermark;
+    int client_fd = conn->client->fd;
+
+    if(conn->pipe[0] < 0){
+        if(pipe2(conn->pipe, O_CLOEXEC | O_NONBLOCK) < 0){
+            perror("cannot create the proxy's pipe");
+            return PROXY_FAILED;
+        }
+        fcntl(conn->pipe[1], F_SETPIPE_SZ, PROXY_PIPE_SIZE); // best effort, a smaller pipe only means more splices
+    }
+
+    while(true){
+
+        while(conn->pipe_fill > 0){
+            unsigned int more = proxy_body_done(conn) ? 0 : SPLICE_F_MORE;
+            ssize_t moved = splice(conn->pipe[0], NULL, client_fd, NULL, conn->pipe_fill, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | more);
+            if(moved < 0) return errno == EAGAIN ? PROXY_WAIT_CLIENT : PROXY_FAILED;
+            metrics_add(&current_handler->metrics, METRIC_BYTES_SENT, moved);
+            conn->body_sent += moved;
+            conn->pipe_fill -= moved;
+            budget = (size_t) moved < budget ? budget - moved : 0;
+        }
+
+        if(proxy_body_done(conn)) return PROXY_DONE;
+        if(budget == 0) return PROXY_YIELD;
+
+        if(conn->framing == PROXY_BODY_CHUNKED && conn->remaining == 0){
+            proxy_result result = proxy_next_chunk(conn);
+            if(result != PROXY_DONE) return result;
+        }
+
+        size_t wanted = conn->framing == PROXY_BODY_CLOSE || conn->remaining > PROXY_PIPE_SIZE ? PROXY_PIPE_SIZE : (size_t) conn->remaining;
+        ssize_t moved = splice(conn->fd, NULL, conn->pipe[1], NULL, wanted, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(moved < 0) return errno == EAGAIN ? PROXY_WAIT_UPSTREAM : PROXY_FAILED;
+        if(moved == 0){
+            // the upstream closed: that's the end of the body only if nothing else tells where it ends
+            if(conn->framing != PROXY_BODY_CLOSE) return PROXY_FAILED;
+            conn->last_chunk = true;
+            continue;
+        }
+        conn->pipe_fill += moved;
+        if(conn->framing != PROXY_BODY_CLOSE) conn->remaining -= moved;
+
+    }
+
+}
+
+proxy_result proxy_advance(handler* current_handler, proxy_connection* conn){
+
+    /*
+        takes the exchange as far as it can go without blocking, returns what it's waiting for.
+        while it waits for the upstream the read deadline runs, while it waits for the client
+        the client's write deadline does (it's the handler's).
+    */
+
+    proxy_pool* pool = &current_handler->proxy_pool;
+    proxy_result result = PROXY_DONE;
+
+    if(conn->failed) return PROXY_FAILED;
+
+    while(result == PROXY_DONE){
+
+        switch(conn->state){
+
+            case PROXY_CONNECTING:
+                return PROXY_WAIT_UPSTREAM; // the connect deadline is running already
+
+            case PROXY_SENDING:
+                while(conn->request_sent < conn->request_length){
+                    ssize_t sent = send(conn->fd, conn->request + conn->request_sent, conn->request_length - conn->request_sent, MSG_NOSIGNAL);
+                    if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                        result = PROXY_WAIT_UPSTREAM;
+                        break;
+                    }
+                    if(sent < 0){
+                        result = proxy_retry(pool, conn) ? PROXY_WAIT_UPSTREAM : PROXY_FAILED;
+                        break;
+                    }
+                    conn->request_sent += sent;
+                }
+                if(result == PROXY_DONE) conn->state = PROXY_READING_HEAD;
+                break;
+
+            case PROXY_READING_HEAD:
+                result = proxy_read_head(pool, conn);
+                break;
+
+            case PROXY_WRITING_HEAD:
+                while(conn->client_head_sent < conn->client_head_length){
+                    int more = conn->framing == PROXY_BODY_NONE ? 0 : MSG_MORE;
+                    ssize_t sent = send(conn->client->fd, conn->client_head + conn->client_head_sent,
+                                        conn->client_head_length - conn->client_head_sent, MSG_NOSIGNAL | more);
+                    if(sent < 0){
+                        result = errno == EAGAIN || errno == EWOULDBLOCK ? PROXY_WAIT_CLIENT : PROXY_FAILED;
+                        break;
+                    }
+                    metrics_add(&current_handler->metrics, METRIC_BYTES_SENT, sent);
+                    conn->client_head_sent += sent;
+                }
+                if(result == PROXY_DONE) conn->state = PROXY_BODY;
+                break;
+
+            case PROXY_BODY:
+                result = proxy_stream_body(current_handler, conn);
+                if(result == PROXY_DONE){
+                    timer_cancel(&pool->timers, &conn->deadline);
+                    return PROXY_DONE;
+                }
+                break;
+
+            default:
+                return PROXY_FAILED;
+
+        }
+
+    }
+
+    if(result == PROXY_WAIT_UPSTREAM){
+        if(conn->state != PROXY_CONNECTING) proxy_schedule(pool, conn, PROXY_DEADLINE_READ); // something arrived: it starts over
+    }else{
+        timer_cancel(&pool->timers, &conn->deadline);
+    }
+
+    return result;
+
+}
+
+int proxy_failure_status(const proxy_connection* conn){
+
+    return conn->timed_out ? 504 : 502;
+
+}
+
+bool proxy_response_started(const proxy_connection* conn){
+
+    return conn->client_head_sent > 0;
+
+}
+
+void proxy_finish(proxy_pool* pool, proxy_connection* conn){
+
+    /*
+        the response is over: the connection goes back to the pool, unless the upstream wants it closed
+        or the pool is full already. idle connections stay in the epoll: if the upstream closes one, we'll know.
+    */
+
+    int id = conn->upstream->id;
+
+    free(conn->request);
+    conn->request = NULL;
+    conn->client = NULL;
+    conn->client_head = NULL;
+
+    if(!conn->upstream_keep_alive || pool->idle_count[id] >= pool->size){
+        proxy_close(pool, conn);
+        return;
+    }
+
+    conn->state = PROXY_IDLE;
+    conn->next = pool->idle[id];
+    pool->idle[id] = conn;
+    pool->idle_count[id] += 1;
+    proxy_schedule(pool, conn, PROXY_DEADLINE_IDLE);
+
+}
+
+void proxy_abort(proxy_pool* pool, proxy_connection* conn){
+
+    // the exchange is given up halfway: the upstream connection can't be reused
+    proxy_close(pool, conn);
+
+}
+
+int proxy_wait_timeout(proxy_pool* pool){
+
+    return timer_wheel_timeout(&pool->timers, timer_wheel_clock_ms());
+
+}
+
+void proxy_expire(proxy_pool* pool, handler* current_handler, void (*resume)(handler*, connection_context*)){
+
+    /*
+        idle connections that reached the idle timeout are closed, exchanges that reached theirs fail:
+        "resume" takes the client from there (a 504, or a closed connection if the response had started).
+    */
+
+    timer* expired;
+
+    timer_wheel_advance(&pool->timers, timer_wheel_clock_ms());
+    while((expired = timer_wheel_next_expired(&pool->timers))){
+        proxy_connection* conn = (proxy_connection*) ((char*) expired - offsetof(proxy_connection, deadline));
+        if(!conn->client){
+            proxy_drop_idle(pool, conn);
+            continue;
+        }
+        conn->timed_out = true;
+        conn->failed = true;
+        resume(current_handler, conn->client);
+    }
+
+}
@@ -1,6 +1,9 @@
+#define _GNU_SOURCE // accept4
 #include "h/server.h"
 #include "h/handler.h"
 #include "h/utils.h"
+#include "h/uring.h"
+#include "h/socket_options.h"
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netinet/in.h>
@@ -9,14 +12,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
 
-static int create_socket(short port);
+static int create_socket(const server_config* config, bool reuse_port);
 
-static int create_socket(short port){
+static int create_socket(const server_config* config, bool reuse_port){
 
-    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    /*
+        with "ipv6 = on" the socket listens on [::] and takes IPv4 clients too (as ::ffff:a.b.c.d),
+        as long as IPV6_V6ONLY is off; otherwise it's an IPv4 socket on 0.0.0.0.
+        the socket is non-blocking from the start, no fcntl() needed.
+    */
+    int family = config->ipv6 ? AF_INET6 : AF_INET;
+    int socket_fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     int socket_opt = 1;
-    struct sockaddr_in server_address;
+    struct sockaddr_storage server_address;
+    socklen_t address_length;
 
     if(socket_fd < 0){
         perror("error while opening socket\n");
@@ -29,43 +42,76 @@ static int create_socket(short port){
         exit(-1); 
     }
 
-    bzero((struct sockaddr_in *) &server_address, sizeof(server_address)); // clear server_address' struct
-    server_address.sin_family = AF_INET; // IPv4 
-    server_address.sin_addr.s_addr = INADDR_ANY; // mapped on 0.0.0.0, listening on every interface
-    server_address.sin_port = htons(port); // HTTP port;
+    /*
+        many sockets can be bound to the same port, every one with its own accept queue:
+        the kernel will spread incoming connections among them.
+    */
+    if (reuse_port && setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &socket_opt, sizeof(socket_opt)) < 0) {
+        perror("error while setting SO_REUSEPORT\n");
+        exit(-1); 
+    }
+
+    // the tuning from the config, accepted sockets inherit it (check h/socket_options.h)
+    socket_options_listener(socket_fd, config);
+
+    bzero(&server_address, sizeof(server_address)); // clear server_address' struct
+
+    if(config->ipv6){
+        int v6_only = 0; // the default comes from net.ipv6.bindv6only, we want both families whatever it says
+        if(setsockopt(socket_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6_only, sizeof(v6_only)) < 0){
+            perror("error while setting IPV6_V6ONLY\n");
+            exit(-1);
+        }
+        struct sockaddr_in6* address6 = (struct sockaddr_in6 *) &server_address;
+        address6->sin6_family = AF_INET6;
+        address6->sin6_addr = in6addr_any; // [::], every interface
+        address6->sin6_port = htons(config->port);
+        address_length = sizeof(struct sockaddr_in6);
+    }else{
+        struct sockaddr_in* address = (struct sockaddr_in *) &server_address;
+        address->sin_family = AF_INET; // IPv4 
+        address->sin_addr.s_addr = INADDR_ANY; // mapped on 0.0.0.0, listening on every interface
+        address->sin_port = htons(config->port); // HTTP port;
+        address_length = sizeof(struct sockaddr_in);
+    }
 
     /* 
-        note: the casting from "sockaddr_in" to "sockaddr" is made because sockaddr is a generic address structure,
+        note: the casting from "sockaddr_in" (or "sockaddr_in6") to "sockaddr" is made because sockaddr is a generic address structure,
         whereas sockaddr_in is a specific one (used for INTERNET communications - "_in" stands for that!).
         the functions "bind" and "accept" are generic, so they accept a sockaddr struct! 
+        sockaddr_storage is big enough for any of them.
     */
 
-    if(bind(socket_fd, (struct sockaddr *) &server_address, sizeof(server_address)) < 0){
+    if(bind(socket_fd, (struct sockaddr *) &server_address, address_length) < 0){
         perror("error while binding server's port\n");
         exit(-1);
     }
 
-    // listen for connection on port 80 for a maximum of 128 queued connections at a time
+    // listen for connections, with at most "backlog" of them waiting to be accepted (the kernel caps it at somaxconn)
 
-    if(listen(socket_fd, 128) < 0){
+    if(listen(socket_fd, config->listen_backlog) < 0){
         perror("error while listening\n");
         exit(-1);
     }
 
-    make_nonblocking(socket_fd);
-
     return socket_fd;
 
 }
 
-server* server_init(
-        short port, 
-        int max_events, 
-        int num_handlers,
-        int max_epoll_handler_queue_size,
-        int request_buffer_size,
-        int max_request_size
-    ){
+static server* stats_server; // the server whose handlers print their stats on SIGUSR1
+static volatile sig_atomic_t stats_requested = 0; // the main thread prints the load of every handler (check server_loop)
+
+static void server_on_stats_signal(int signal){
+
+    // kill -USR1 <pid>: every handler prints its allocator counters (check handler_request_stats)
+    for(int i = 0; i < stats_server->num_handlers; i++){
+        handler_request_stats(&stats_server->handlers[i]);
+    }
+    stats_requested = 1;
+
+}
+
+server* server_init(const server_config* config){
 
     /*
         this creates a file descriptor that serves as an endpoint for communication; 
@@ -73,92 +119,255 @@ server* server_init(
 
         since this socket will support a single protocol, the "protocol" argument is set to 0.        
         
+        with ACCEPT_REUSEPORT every handler gets its own socket, so there's no shared one.
     */
     server* http_server = (server *) malloc(sizeof(server));
-
-    http_server->max_connection_events = max_events;
-    http_server->socket_fd = create_socket(port);
-    http_server->epoll_fd = epoll_create1(0);
-    http_server->connection_events = malloc(sizeof(struct epoll_event) * http_server->max_connection_events);
+    accept_strategy strategy = config->strategy;
+
+    http_server->config = *config;
+    http_server->port = config->port;
+    http_server->max_connection_events = config->max_events;
+    http_server->max_request_size = config->max_request_size;
+    http_server->strategy = strategy;
+    http_server->socket_fd = strategy == ACCEPT_REUSEPORT ? -1 : create_socket(config, false);
+    http_server->epoll_fd = -1;
+    http_server->connection_events = NULL;
     http_server->active = false;
-    http_server->num_handlers = num_handlers;
+    http_server->num_handlers = config->num_handlers;
     http_server->selector = 0;
-    http_server->handlers = (handler *) malloc(sizeof(handler) * http_server->num_handlers);
+    http_server->random_state = (unsigned int) (time(NULL) ^ getpid()) | 1; // xorshift never leaves 0, so it can't start there
+    http_server->policy = config->policy;
+    // the handlers' load counters must start on a cache line (check h/load.h)
+    http_server->handlers = (handler *) aligned_alloc(LOAD_CACHE_LINE, sizeof(handler) * http_server->num_handlers);
+    http_server->cache = file_cache_create(&http_server->config); // every handler shares the same cache
+    /*
+        the files under the root are indexed (and kept open) once, for every handler. a server without a root
+        serves the whole filesystem: that's not something to walk.
+    */
+    http_server->index = NULL;
+    if(http_server->config.path_index && http_server->config.www_path[0]) http_server->index = path_index_create(&http_server->config, http_server->cache);
+    http_server->log = http_server->config.access_log[0] ? access_log_create(&http_server->config, http_server->num_handlers) : NULL;
+    http_server->registry = metrics_registry_create(http_server->num_handlers); // the handlers register their metrics in it
 
-    if(http_server->epoll_fd < 0){
-        perror("cannot create epoll\n");
-        exit(-1);
-    }
+    if(strategy == ACCEPT_DISPATCH){
+
+        // only the dispatcher needs an epoll of its own
+        http_server->epoll_fd = epoll_create1(0);
+        http_server->connection_events = malloc(sizeof(struct epoll_event) * http_server->max_connection_events);
 
-    struct epoll_event on_socket_conn;
+        if(http_server->epoll_fd < 0){
+            perror("cannot create epoll\n");
+            exit(-1);
+        }
 
-    on_socket_conn.events = EPOLLIN; // only poll input events (such as new connections!)
-    on_socket_conn.data.fd = http_server->socket_fd; // poll only on the socket descriptor!
+        struct epoll_event on_socket_conn;
 
-    // add an epoll to the kernel
-    if(epoll_ctl(http_server->epoll_fd, EPOLL_CTL_ADD, http_server->socket_fd, &on_socket_conn) < 0){
+        on_socket_conn.events = EPOLLIN; // only poll input events (such as new connections!)
+        on_socket_conn.data.fd = http_server->socket_fd; // poll only on the socket descriptor!
 
-        perror("cannot add epoll on socket\n");
-        exit(-1);
+        // add an epoll to the kernel
+        if(epoll_ctl(http_server->epoll_fd, EPOLL_CTL_ADD, http_server->socket_fd, &on_socket_conn) < 0){
+
+            perror("cannot add epoll on socket\n");
+            exit(-1);
+
+        }
 
     }
 
+    if(http_server->config.engine == IO_ENGINE_URING && !uring_supported()){
+        fprintf(stderr, "io_uring is not available, falling back to epoll\n");
+        http_server->config.engine = IO_ENGINE_EPOLL;
+    }
+
+    // the upstream sockets live in the handlers' epolls (check h/proxy.h)
+    http_server->proxy = NULL;
+    if(http_server->config.proxy_route_count > 0){
+        if(http_server->config.engine == IO_ENGINE_URING){
+            fprintf(stderr, "proxy routes need the epoll engine, falling back to epoll\n");
+            http_server->config.engine = IO_ENGINE_EPOLL;
+        }
+        http_server->proxy = proxy_create(&http_server->config);
+    }
+
+    // HTTP/2 sessions read and write in the same round (check h/http2.h), the io_uring engine has one operation per connection
+    if(http_server->config.http2 && http_server->config.engine == IO_ENGINE_URING){
+        fprintf(stderr, "HTTP/2 needs the epoll engine, it's off with io_uring\n");
+        http_server->config.http2 = 0;
+    }
+
+    /*
+        handlers' threads inherit the signal mask: SIGUSR1 is blocked while they are created,
+        so it's always the main thread that handles it and wakes up to print the load.
+    */
+    sigset_t stats_signal;
+    sigemptyset(&stats_signal);
+    sigaddset(&stats_signal, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &stats_signal, NULL);
+
     /* initialize handlers */
     for(int i = 0; i < http_server->num_handlers; i++){
-        handler_init(&http_server->handlers[i], max_epoll_handler_queue_size, request_buffer_size, max_request_size);
+
+        int listen_fd;
+        switch(strategy){
+            case ACCEPT_REUSEPORT: listen_fd = create_socket(config, true); break;
+            case ACCEPT_EXCLUSIVE: listen_fd = http_server->socket_fd; break;
+            default: listen_fd = -1;
+        }
+
+        handler_init(&http_server->handlers[i], i, &http_server->config, listen_fd, http_server->cache, http_server->registry, http_server->proxy, http_server->index, http_server->log);
+
+    }
+
+    pthread_sigmask(SIG_UNBLOCK, &stats_signal, NULL);
+
+    struct sigaction on_stats = { 0 };
+    on_stats.sa_handler = server_on_stats_signal;
+    on_stats.sa_flags = SA_RESTART;
+    sigemptyset(&on_stats.sa_mask);
+    stats_server = http_server;
+    if(sigaction(SIGUSR1, &on_stats, NULL) < 0){
+        perror("cannot install the stats signal handler\n");
+        exit(-1);
     }
 
     return http_server;
 
 }
 
-void server_on_connection(server* server){
+static unsigned int server_random(server* server){
 
-    /* 
-        a new connection is being notified!
-        i should handle it!
+    // xorshift32: we only need two handlers that aren't always the same ones
+    unsigned int x = server->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    server->random_state = x;
+    return x;
+
+}
+
+static handler* server_select_handler(server* server){
+
+    /*
+        the scores are read while the handlers keep working, so they may be a bit behind:
+        that's fine, they only need to tell a busy handler from an idle one.
     */
-    struct sockaddr_in client_in;
-    int client_len = sizeof(client_in);
-    
-    int client_fd = accept(server->socket_fd, (struct sockaddr *) &client_in, (socklen_t *) &client_len);
 
-    if(client_fd < 0){
-        if(errno != EAGAIN || errno != EWOULDBLOCK){
-            perror("error while accepting\n");
-            exit(-1);
+    int selected = 0;
+    int count = server->num_handlers;
+
+    switch(server->policy){
+        case DISPATCH_LEAST_LOADED: {
+            long best = load_score(&server->handlers[0].load);
+            for(int i = 1; i < count && best > 0; i++){
+                long score = load_score(&server->handlers[i].load);
+                if(score < best){
+                    best = score;
+                    selected = i;
+                }
+            }
+            break;
         }
-        return;
+        case DISPATCH_TWO_CHOICES: {
+            if(count == 1) break;
+            int first = server_random(server) % count;
+            int second = server_random(server) % (count - 1);
+            if(second >= first) second += 1; // two different handlers
+            selected = load_score(&server->handlers[second].load) < load_score(&server->handlers[first].load) ? second : first;
+            break;
+        }
+        default:
+            selected = server->selector;
+            server->selector = (server->selector + 1) % count;
     }
 
-    /* 
-        let's make a new epoll, only that, this time, we are going to monitor the client
-        that just connected!
-    */
-    
+    return &server->handlers[selected];
+
+}
+
+void server_print_load(server* server, FILE* out){
+
     /*
-        client descriptor *must* be non-blocking because
+        one line per handler and one for the whole server, telling how evenly the work is spread:
+        "imbalance" is the busiest handler divided by the average one (1.00 is a perfect spread).
+    */
+
+    long min_connections = -1, max_connections = 0, total_connections = 0;
+    long max_pending = 0, total_pending = 0;
+
+    for(int i = 0; i < server->num_handlers; i++){
+        handler_load* load = &server->handlers[i].load;
+        long connections = load_get(&load->connections);
+        long pending = load_get(&load->pending_bytes);
+
+        fprintf(
+            out,
+            "handler %d: %-12s connections=%ld pending_bytes=%ld loop_latency=%ldus assigned=%ld score=%ld\n",
+            i, "load", connections, pending, load_get(&load->loop_latency_us), load_get(&load->assigned), load_score(load)
+        );
+
+        if(min_connections < 0 || connections < min_connections) min_connections = connections;
+        if(connections > max_connections) max_connections = connections;
+        if(pending > max_pending) max_pending = pending;
+        total_connections += connections;
+        total_pending += pending;
+    }
+
+    double mean_connections = (double) total_connections / server->num_handlers;
+    double mean_pending = (double) total_pending / server->num_handlers;
+
+    fprintf(
+        out,
+        "server: load connections min=%ld max=%ld mean=%.1f imbalance=%.2f pending_bytes max=%ld mean=%.0f imbalance=%.2f\n",
+        min_connections, max_connections, mean_connections, mean_connections > 0 ? max_connections / mean_connections : 1.0,
+        max_pending, mean_pending, mean_pending > 0 ? max_pending / mean_pending : 1.0
+    );
+
+}
+
+void server_on_connection(server* server){
+
+    /* 
+        new connections are being notified!
+        i should handle them all (until EAGAIN), so a burst of connections costs a single wakeup.
+
+        client descriptors *must* be non-blocking because
         we need to wait for EAGAIN (or EWOULDBLOCK) to drain
-        the request (and of course we need non-blocking io). 
+        the request (and of course we need non-blocking io): accept4 does that for us.
     */
-    make_nonblocking(client_fd);
 
-    struct epoll_event client_event;
-    
-    client_event.events = EPOLLIN | EPOLLET; // edge-triggered mode for the current descriptor (EAGAIN)
-    client_event.data.fd = client_fd;
+    while(true){
 
-    handler selected_handler = server->handlers[server->selector];
-    server->selector = (server->selector + 1) % server->num_handlers;
+        int client_fd = accept4(server->socket_fd, NULL, NULL, SOCK_NONBLOCK);
 
-    if(epoll_ctl(selected_handler.epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event) < 0){ // adding a new epoll (EPOLL_CTL_ADD)
-        perror("cannot add client descriptor to epoll");
-        exit(-1);
-    }
+        if(client_fd < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                return; // no more pending connections
+            }
+            if(errno == EINTR || errno == ECONNABORTED || errno == EPROTO){
+                continue; // this client is gone, try with the next one
+            }
+            // out of descriptors or memory: don't kill the server, we'll try again on the next wakeup
+            atomic_fetch_add_explicit(&server->registry->dispatcher_accept_errors, 1, memory_order_relaxed);
+            perror("error while accepting\n");
+            return;
+        }
+
+        /*
+            the connection is handed to the selected handler, which will add it to its own epoll
+            (check handler_dispatch in handler.c).
+        */
+        handler* selected_handler = server_select_handler(server);
 
-    
-                    
-    // thanks for connecting!
+        if(!handler_dispatch(selected_handler, client_fd)){
+            perror("cannot dispatch client descriptor");
+            close(client_fd);
+        }
+
+        // thanks for connecting!
+
+    }
 
 }
 
@@ -166,11 +375,33 @@ void server_loop(server* server){
 
     server->active = true;
 
+    if(server->strategy != ACCEPT_DISPATCH){
+
+        /*
+            handlers accept their connections by themselves,
+            the main thread has nothing else to do but wait for signals.
+        */
+        while(server->active){
+            pause();
+            if(stats_requested){
+                stats_requested = 0;
+                server_print_load(server, stderr);
+            }
+        }
+        return;
+
+    }
+
     while(server->active){
 
         // infinitely wait for I/O events on the monitored descriptor (the socket!)
         int received_events = epoll_wait(server->epoll_fd, server->connection_events, server->max_connection_events, -1); 
 
+        if(stats_requested){
+            stats_requested = 0;
+            server_print_load(server, stderr);
+        }
+
         for(int i = 0; i < received_events; i++){
 
             if(server->connection_events[i].data.fd == server->socket_fd){
@@ -0,0 +1,96 @@
+#include "h/socket_options.h"
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69 // Linux 5.11
+#endif
+
+#ifndef EPIOCSPARAMS
+// Linux 6.9, the libc headers may not have it yet
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+static void socket_option(int socket_fd, int level, int name, int value, const char* what){
+
+    if(setsockopt(socket_fd, level, name, &value, sizeof(value)) < 0){
+        fprintf(stderr, "error while setting %s: ", what);
+        perror(NULL);
+        exit(-1);
+    }
+
+}
+
+void socket_options_listener(int socket_fd, const server_config* config){
+
+    /*
+        only what the config asks for is set, everything else is left to the kernel's defaults (and sysctls).
+        the options that only make sense for a listening socket (defer accept, fast open) are set here too, before listen().
+    */
+
+    if(config->tcp_nodelay) socket_option(socket_fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+
+    /*
+        the kernel waits up to this many seconds for the first bytes before queueing the connection for accept(),
+        after that it's queued anyway (the header timeout takes it from there).
+        a connection that never sends anything never costs a wakeup, an accept() and an epoll_ctl().
+    */
+    if(config->defer_accept > 0) socket_option(socket_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, config->defer_accept, "TCP_DEFER_ACCEPT");
+
+    // how many Fast Open connections may wait for their handshake to complete
+    if(config->fast_open > 0) socket_option(socket_fd, IPPROTO_TCP, TCP_FASTOPEN, config->fast_open, "TCP_FASTOPEN");
+
+    // the kernel doubles these (for its bookkeeping), and it stops autotuning the ones that are set
+    if(config->send_buffer > 0) socket_option(socket_fd, SOL_SOCKET, SO_SNDBUF, (int) config->send_buffer, "SO_SNDBUF");
+    if(config->receive_buffer > 0) socket_option(socket_fd, SOL_SOCKET, SO_RCVBUF, (int) config->receive_buffer, "SO_RCVBUF");
+
+    /*
+        a non-blocking recv() on an empty socket polls the device queue once before giving up.
+        values above net.core.busy_read need CAP_NET_ADMIN.
+    */
+    if(config->busy_poll > 0){
+        socket_option(socket_fd, SOL_SOCKET, SO_BUSY_POLL, config->busy_poll, "SO_BUSY_POLL");
+        if(config->prefer_busy_poll) socket_option(socket_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1, "SO_PREFER_BUSY_POLL");
+    }
+
+    /*
+        the low watermark: a socket is reported writable only once fewer than this many bytes are waiting to be sent,
+        so a slow client doesn't wake us up for every few KB it reads, and the kernel doesn't queue megabytes for it.
+    */
+    if(config->write_low_watermark > 0){
+        socket_option(socket_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (int) config->write_low_watermark, "TCP_NOTSENT_LOWAT");
+    }
+
+}
+
+void socket_options_epoll(int epoll_fd, const server_config* config){
+
+    /*
+        the socket options only busy poll inside recv(): most of the time a handler is sleeping in epoll_wait(),
+        so the handler's epoll is asked to busy poll the queues of its sockets for busy_poll microseconds before sleeping.
+        older kernels (before 6.9) only do it if net.core.busy_poll is set: we say so and go on without it.
+    */
+
+    if(config->busy_poll <= 0) return;
+
+    struct epoll_params params = { 0 };
+    params.busy_poll_usecs = config->busy_poll;
+    params.busy_poll_budget = 0; // the kernel's default (8 packets)
+    params.prefer_busy_poll = config->prefer_busy_poll ? 1 : 0;
+
+    if(ioctl(epoll_fd, EPIOCSPARAMS, &params) < 0){
+        perror("cannot make the epoll busy poll (net.core.busy_poll still works)");
+    }
+
+}
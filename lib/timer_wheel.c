@@ -0,0 +1,211 @@
+#include "h/timer_wheel.h"
+#include <time.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_TICKS ((1UL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+unsigned long timer_wheel_clock_ms(void){
+
+    // the coarse clock is plenty for deadlines of seconds, and it doesn't cost a syscall
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+
+}
+
+static void timer_list_init(timer* sentinel){
+
+    sentinel->prev = sentinel;
+    sentinel->next = sentinel;
+    sentinel->list = sentinel;
+
+}
+
+static bool timer_list_empty(timer* sentinel){
+
+    return sentinel->next == sentinel;
+
+}
+
+static void timer_link(timer* sentinel, timer* t){
+
+    t->prev = sentinel->prev;
+    t->next = sentinel;
+    sentinel->prev->next = t;
+    sentinel->prev = t;
+    t->list = sentinel;
+
+}
+
+static void timer_unlink(timer_wheel* wheel, timer* t){
+
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+
+    // the slot's bit goes away with its last timer (the sentinel's position tells which slot it is)
+    if(t->list != &wheel->expired && timer_list_empty(t->list)){
+        size_t index = t->list - &wheel->slots[0][0];
+        wheel->occupied[index / TIMER_WHEEL_SLOTS] &= ~(1ULL << (index % TIMER_WHEEL_SLOTS));
+    }
+
+    t->prev = NULL;
+    t->next = NULL;
+    t->list = NULL;
+
+}
+
+static void timer_place(timer_wheel* wheel, timer* t){
+
+    /*
+        the level is the first one whose round covers the distance to the deadline,
+        the slot is the deadline's tick as seen by that level.
+    */
+
+    unsigned long delta = t->expires - wheel->now;
+    int level = 0;
+
+    while(level < TIMER_WHEEL_LEVELS - 1 && delta >= 1UL << (TIMER_WHEEL_SLOT_BITS * (level + 1))) level += 1;
+
+    int slot = (t->expires >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+    timer_link(&wheel->slots[level][slot], t);
+    wheel->occupied[level] |= 1ULL << slot;
+
+}
+
+void timer_wheel_init(timer_wheel* wheel, unsigned long now_ms){
+
+    wheel->start_ms = now_ms;
+    wheel->now = 0;
+    wheel->count = 0;
+
+    for(int level = 0; level < TIMER_WHEEL_LEVELS; level++){
+        wheel->occupied[level] = 0;
+        for(int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) timer_list_init(&wheel->slots[level][slot]);
+    }
+    timer_list_init(&wheel->expired);
+
+}
+
+void timer_init(timer* t){
+
+    t->prev = NULL;
+    t->next = NULL;
+    t->list = NULL;
+    t->expires = 0;
+    t->kind = 0;
+
+}
+
+bool timer_scheduled(timer* t){
+
+    return t->next != NULL;
+
+}
+
+void timer_schedule(timer_wheel* wheel, timer* t, unsigned long now_ms, unsigned long delay_ms, int kind){
+
+    /*
+        (re)schedules the timer "delay_ms" after "now_ms", rounded up to the next tick, so it never fires early.
+        the wheel may be a bit behind the clock (it's advanced once per loop), that's why the caller tells the time.
+    */
+    unsigned long expires = (now_ms - wheel->start_ms + delay_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+
+    if(expires <= wheel->now) expires = wheel->now + 1;
+    if(expires - wheel->now > MAX_TICKS) expires = wheel->now + MAX_TICKS;
+
+    timer_cancel(wheel, t);
+    t->expires = expires;
+    t->kind = kind;
+    timer_place(wheel, t);
+    wheel->count += 1;
+
+}
+
+void timer_cancel(timer_wheel* wheel, timer* t){
+
+    if(!timer_scheduled(t)) return;
+
+    timer_unlink(wheel, t);
+    wheel->count -= 1;
+
+}
+
+static void timer_move_all(timer_wheel* wheel, timer* from, timer* to){
+
+    while(!timer_list_empty(from)){
+        timer* t = from->next;
+        timer_unlink(wheel, t);
+        if(to) timer_link(to, t);
+        else timer_place(wheel, t);
+    }
+
+}
+
+void timer_wheel_advance(timer_wheel* wheel, unsigned long now_ms){
+
+    /*
+        processes every tick up to now: coarser levels hand their current slot down first
+        (a timer may go down more than one level in the same tick), then the first level's slot is due.
+        due timers are moved to the expired list, the caller takes them with timer_wheel_next_expired().
+    */
+
+    unsigned long target = (now_ms - wheel->start_ms) / TIMER_WHEEL_TICK_MS;
+
+    if(wheel->count == 0){
+        // nothing to fire, no matter how much time went by
+        wheel->now = target;
+        return;
+    }
+
+    while(wheel->now < target){
+
+        wheel->now += 1;
+
+        for(int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--){
+            if((wheel->now & ((1UL << (TIMER_WHEEL_SLOT_BITS * level)) - 1)) != 0) continue;
+            int slot = (wheel->now >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+            if(wheel->occupied[level] & (1ULL << slot)) timer_move_all(wheel, &wheel->slots[level][slot], NULL);
+        }
+
+        int slot = wheel->now & SLOT_MASK;
+        if(wheel->occupied[0] & (1ULL << slot)) timer_move_all(wheel, &wheel->slots[0][slot], &wheel->expired);
+
+    }
+
+}
+
+timer* timer_wheel_next_expired(timer_wheel* wheel){
+
+    /*
+        one at a time: handling an expired timer may cancel others (even expired ones),
+        so the list is never walked behind the caller's back.
+    */
+
+    if(timer_list_empty(&wheel->expired)) return NULL;
+
+    timer* t = wheel->expired.next;
+    timer_unlink(wheel, t);
+    wheel->count -= 1;
+
+    return t;
+
+}
+
+int timer_wheel_timeout(timer_wheel* wheel, unsigned long now_ms){
+
+    /*
+        how long the event loop can sleep (in ms, -1 means forever): until the next non-empty slot
+        of the first level or, if there's none in this round, until the round ends and the next level cascades.
+    */
+
+    if(wheel->count == 0) return -1;
+    if(!timer_list_empty(&wheel->expired)) return 0;
+
+    unsigned long index = wheel->now & SLOT_MASK;
+    uint64_t later = index == SLOT_MASK ? 0 : wheel->occupied[0] & (~0ULL << (index + 1));
+    unsigned long ticks = later ? __builtin_ctzll(later) - index : TIMER_WHEEL_SLOTS - index;
+    long wakeup_ms = (long) ((wheel->now + ticks) * TIMER_WHEEL_TICK_MS) - (long) (now_ms - wheel->start_ms);
+
+    return wakeup_ms > 0 ? wakeup_ms : 0;
+
+}
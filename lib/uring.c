@@ -0,0 +1,289 @@
+#include "h/uring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#define RING_FLAGS (IORING_SETUP_SUBMIT_ALL | IORING_SETUP_CQSIZE)
+#define CQ_ENTRIES_PER_SQE 4 // multishot operations post many completions for a single submission
+
+static int io_uring_setup(unsigned entries, struct io_uring_params* params){
+
+    return (int) syscall(SYS_io_uring_setup, entries, params);
+
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t arg_size){
+
+    return (int) syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args){
+
+    return (int) syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+
+}
+
+bool uring_supported(void){
+
+    /*
+        the engine needs: multishot accept and recv, provided buffer rings, EXT_ARG waits
+        and async openat/statx/read/splice.
+        there is no feature flag for multishot recv, but it came in the same kernel (6.0) as SEND_ZC,
+        so the probe looks for that opcode too.
+    */
+    static const int needed_ops[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_OPENAT, IORING_OP_STATX,
+        IORING_OP_READ, IORING_OP_SPLICE, IORING_OP_ASYNC_CANCEL, IORING_OP_CLOSE, IORING_OP_SEND_ZC
+    };
+    unsigned needed_features = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_FAST_POLL;
+    struct io_uring_params params;
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe;
+    bool supported = true;
+
+    memset(&params, 0, sizeof(params));
+    int fd = io_uring_setup(4, &params);
+    if(fd < 0) return false; // old kernel, or io_uring is disabled (seccomp, sysctl...)
+
+    if((params.features & needed_features) != needed_features){
+        close(fd);
+        return false;
+    }
+
+    probe = calloc(1, probe_size);
+    if(io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) < 0){
+        supported = false;
+    }else{
+        for(size_t i = 0; i < sizeof(needed_ops) / sizeof(needed_ops[0]); i++){
+            int op = needed_ops[i];
+            if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) supported = false;
+        }
+    }
+
+    free(probe);
+    close(fd);
+    return supported;
+
+}
+
+int uring_init(uring* ring, unsigned entries){
+
+    /*
+        the ring should be created by the thread that will use it: with SINGLE_ISSUER and DEFER_TASKRUN
+        the kernel runs completion work only when we ask for events, right in our thread,
+        instead of interrupting us whenever something completes.
+        older kernels don't know these flags, so we retry without them.
+        returns -errno on failure.
+    */
+    unsigned extra_flags[] = {
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_COOP_TASKRUN,
+        0
+    };
+    struct io_uring_params params;
+    int fd = -1;
+
+    for(size_t i = 0; i < sizeof(extra_flags) / sizeof(extra_flags[0]) && fd < 0; i++){
+        memset(&params, 0, sizeof(params));
+        params.flags = RING_FLAGS | extra_flags[i];
+        params.cq_entries = entries * CQ_ENTRIES_PER_SQE;
+        fd = io_uring_setup(entries, &params);
+        if(fd < 0 && errno != EINVAL) return -errno;
+    }
+    if(fd < 0) return -errno;
+
+    memset(ring, 0, sizeof(uring));
+    ring->fd = fd;
+    ring->features = params.features;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        // both queues live in the same mapping
+        if(ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED) goto fail;
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        ring->cq_ring = ring->sq_ring;
+    }else{
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED) goto fail;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED) goto fail;
+
+    ring->sq_head = (unsigned*) ((char*) ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned*) ((char*) ring->sq_ring + params.sq_off.tail);
+    ring->sq_array = (unsigned*) ((char*) ring->sq_ring + params.sq_off.array);
+    ring->sq_mask = *(unsigned*) ((char*) ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    ring->cq_head = (unsigned*) ((char*) ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned*) ((char*) ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*) ((char*) ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) ((char*) ring->cq_ring + params.cq_off.cqes);
+
+    // the n-th slot of the submission queue always points to the n-th SQE, so it's filled once
+    for(unsigned i = 0; i < ring->sq_entries; i++) ring->sq_array[i] = i;
+
+    return 0;
+
+fail:
+    {
+        int error = -errno;
+        uring_destroy(ring);
+        return error;
+    }
+
+}
+
+void uring_destroy(uring* ring){
+
+    if(ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    if(ring->fd >= 0) close(ring->fd);
+    ring->fd = -1;
+
+}
+
+static int uring_submit(uring* ring, unsigned wait_nr, struct __kernel_timespec* timeout){
+
+    // everything the kernel didn't consume yet (an interrupted enter may leave something behind)
+    unsigned to_submit = ring->sq_local_tail - atomic_load_explicit((_Atomic unsigned*) ring->sq_head, memory_order_acquire);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct io_uring_getevents_arg arg;
+
+    // the kernel must see the SQEs before it sees the new tail
+    atomic_store_explicit((_Atomic unsigned*) ring->sq_tail, ring->sq_local_tail, memory_order_release);
+
+    if(to_submit == 0 && wait_nr == 0) return 0;
+
+    ring->enters += 1;
+    if(timeout){
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long long) timeout;
+        return io_uring_enter(ring->fd, to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+    return io_uring_enter(ring->fd, to_submit, wait_nr, flags, NULL, 0);
+
+}
+
+struct io_uring_sqe* uring_get_sqe(uring* ring){
+
+    /*
+        returns a zeroed SQE, it will be submitted with the next uring_submit_and_wait().
+        if the submission queue is full what we have is submitted right away.
+    */
+
+    unsigned head = atomic_load_explicit((_Atomic unsigned*) ring->sq_head, memory_order_acquire);
+
+    while(ring->sq_local_tail - head >= ring->sq_entries){
+        if(uring_submit(ring, 0, NULL) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return NULL;
+        head = atomic_load_explicit((_Atomic unsigned*) ring->sq_head, memory_order_acquire);
+    }
+
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+    ring->sq_local_tail += 1;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    return sqe;
+
+}
+
+int uring_submit_and_wait(uring* ring, unsigned wait_nr, int timeout_ms){
+
+    /*
+        submits everything that has been queued and waits for "wait_nr" completions
+        (or less, if "timeout_ms" is not negative and expires first).
+        returns -errno on failure (EINTR and ETIME are not really failures).
+    */
+
+    struct __kernel_timespec timeout;
+
+    if(timeout_ms >= 0){
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    }
+
+    int result = uring_submit(ring, wait_nr, timeout_ms >= 0 ? &timeout : NULL);
+    return result < 0 ? -errno : result;
+
+}
+
+struct io_uring_cqe* uring_peek_cqe(uring* ring){
+
+    unsigned tail = atomic_load_explicit((_Atomic unsigned*) ring->cq_tail, memory_order_acquire);
+
+    if(*ring->cq_head == tail) return NULL;
+    return &ring->cqes[*ring->cq_head & ring->cq_mask];
+
+}
+
+void uring_cqe_seen(uring* ring){
+
+    // the CQE has been consumed: its slot goes back to the kernel
+    atomic_store_explicit((_Atomic unsigned*) ring->cq_head, *ring->cq_head + 1, memory_order_release);
+
+}
+
+int uring_buffer_ring_init(uring* ring, uring_buffer_ring* buffers, unsigned short group, unsigned count, unsigned buffer_size){
+
+    struct io_uring_buf_reg reg;
+
+    buffers->count = count;
+    buffers->buffer_size = buffer_size;
+    buffers->group = group;
+    buffers->tail = 0;
+    buffers->ring_size = count * sizeof(struct io_uring_buf);
+
+    // the ring must be page aligned
+    buffers->ring = mmap(NULL, buffers->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buffers->ring == MAP_FAILED) return -errno;
+
+    buffers->buffers = malloc((size_t) count * buffer_size);
+    if(!buffers->buffers) return -ENOMEM;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) buffers->ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if(io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return -errno;
+
+    for(unsigned i = 0; i < count; i++) uring_buffer_recycle(buffers, i);
+
+    return 0;
+
+}
+
+char* uring_buffer(uring_buffer_ring* buffers, unsigned short id){
+
+    return buffers->buffers + (size_t) id * buffers->buffer_size;
+
+}
+
+void uring_buffer_recycle(uring_buffer_ring* buffers, unsigned short id){
+
+    // the buffer goes back to the kernel, which can fill it again
+    struct io_uring_buf* buf = &buffers->ring->bufs[buffers->tail & (buffers->count - 1)];
+
+    buf->addr = (unsigned long) uring_buffer(buffers, id);
+    buf->len = buffers->buffer_size;
+    buf->bid = id;
+    buffers->tail += 1;
+    atomic_store_explicit((_Atomic unsigned short*) &buffers->ring->tail, buffers->tail, memory_order_release);
+
+}
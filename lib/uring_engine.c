@@ -0,0 +1,720 @@
+#define _GNU_SOURCE // statx, splice
+#include "h/uring_engine.h"
+#include "h/uring.h"
+#include "h/handler.h"
+#include "h/connection_context.h"
+#include "h/http_response.h"
+#include "h/file_cache.h"
+#include "h/utils.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/*
+    the io_uring engine.
+    instead of waiting for readiness and then calling recv/send/open/read ourselves (one syscall each),
+    operations are queued on the handler's ring and the kernel performs them; a single io_uring_enter()
+    submits everything queued during a loop iteration and waits for the next completions.
+
+        - connections are accepted with a multishot accept: one submission, a completion for every client.
+        - every connection has a multishot recv that picks buffers from a ring of provided buffers
+          only when bytes arrive, so idle connections don't pin any buffer.
+        - a response's chain goes out with a single sendmsg, file bodies are spliced by operations linked to it,
+          so the whole response is submitted at once.
+        - files that aren't cached are opened, stat'ed and read asynchronously (openat/statx/read),
+          big files are spliced to the socket through a pipe.
+
+    an operation's user_data is the connection it belongs to (slab objects are 16 bytes aligned)
+    with the operation's type in the low bits.
+*/
+
+#define RING_ENTRIES 1024
+#define RECV_BUFFERS 256 // provided buffers per handler (a power of 2), "request_buffer_size" bytes each
+#define BUFFER_GROUP 0
+#define SPLICE_CHUNK (256 * 1024) // bytes moved through the pipe with a single splice
+#define INBOX_BATCH 64
+#define OP_MASK 15
+
+typedef enum {
+    OP_IGNORE, // completions nobody cares about (cancellations, closes)
+    OP_ACCEPT,
+    OP_INBOX,
+    OP_RECV,
+    OP_SENDMSG,
+    OP_SPLICE_IN, // file -> pipe
+    OP_SPLICE_OUT, // pipe -> socket
+    OP_OPEN,
+    OP_STATX,
+    OP_READ
+} uring_op;
+
+typedef struct uring_engine {
+    uring ring;
+    uring_buffer_ring buffers;
+    int inbox[INBOX_BATCH]; // where dispatched descriptors are read
+    unsigned long completions;
+    unsigned long responses;
+} uring_engine;
+
+typedef struct {
+    connection_context ctx; // it comes first: the engine's connections are connection contexts too
+    int inflight; // submitted operations still waiting for their (last) completion
+    int writes; // the ones writing the response: the next part is queued when they are all done
+    bool recv_armed; // the multishot recv is active
+    bool closing; // the connection is freed as soon as nothing is in flight
+    bool failed; // a write failed, the connection is closed once the writes in flight are done
+    /*
+        a request that missed the cache: the file is opened, stat'ed and (if it can be cached) read
+        before a response exists.
+    */
+    bool opening;
+    file_miss miss;
+    int file_fd;
+    struct statx stat;
+    char* file_body;
+    off_t file_read;
+    unsigned long generation;
+    struct msghdr message; // the response chain being sent
+    // big files go file -> pipe -> socket
+    int pipe[2];
+    size_t pipe_fill;
+} uring_connection;
+
+static void uring_close_connection(handler* current_handler, connection_context* ctx);
+static void uring_next(handler* current_handler, uring_connection* conn);
+
+size_t uring_engine_connection_size(void){
+
+    return sizeof(uring_connection);
+
+}
+
+static struct io_uring_sqe* uring_queue(handler* current_handler, uring_connection* conn, uring_op op){
+
+    struct io_uring_sqe* sqe = uring_get_sqe(&current_handler->uring->ring);
+    if(!sqe){
+        perror("cannot submit to the ring\n");
+        exit(-1);
+    }
+
+    sqe->user_data = (unsigned long) conn | op;
+    if(conn) conn->inflight += 1;
+
+    return sqe;
+
+}
+
+static void uring_arm_accept(handler* current_handler){
+
+    struct io_uring_sqe* sqe = uring_queue(current_handler, NULL, OP_ACCEPT);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = current_handler->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC; // no SOCK_NONBLOCK: the ring does the waiting
+
+}
+
+static void uring_arm_inbox(handler* current_handler){
+
+    struct io_uring_sqe* sqe = uring_queue(current_handler, NULL, OP_INBOX);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = current_handler->inbox[0];
+    sqe->addr = (unsigned long) current_handler->uring->inbox;
+    sqe->len = sizeof(current_handler->uring->inbox);
+    sqe->off = -1; // pipes have no offset
+
+}
+
+static void uring_arm_recv(handler* current_handler, uring_connection* conn){
+
+    struct io_uring_sqe* sqe = uring_queue(current_handler, conn, OP_RECV);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->ctx.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    conn->recv_armed = true;
+
+}
+
+static void uring_cancel_recv(handler* current_handler, uring_connection* conn){
+
+    struct io_uring_sqe* sqe = uring_queue(current_handler, NULL, OP_IGNORE);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (unsigned long) conn | OP_RECV;
+
+}
+
+static void uring_close_fd(handler* current_handler, int fd){
+
+    // nobody waits for a close
+    struct io_uring_sqe* sqe = uring_queue(current_handler, NULL, OP_IGNORE);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+
+}
+
+static void uring_add_connection(handler* current_handler, int client_fd){
+
+    uring_connection* conn = slab_alloc(&current_handler->memory.connections);
+
+    context_init(&conn->ctx, &current_handler->memory, &current_handler->date, &current_handler->load, current_handler->request_buffer_size);
+    conn->ctx.fd = client_fd;
+    conn->inflight = 0;
+    conn->writes = 0;
+    conn->recv_armed = false;
+    conn->closing = false;
+    conn->failed = false;
+    conn->opening = false;
+    conn->miss.filename = NULL;
+    conn->file_fd = -1;
+    conn->file_body = NULL;
+    conn->pipe[0] = -1;
+    conn->pipe[1] = -1;
+    conn->pipe_fill = 0;
+    metrics_add(&current_handler->metrics, METRIC_CONNECTIONS_ACCEPTED, 1);
+
+    uring_arm_recv(current_handler, conn);
+    handler_await_request(current_handler, &conn->ctx);
+
+}
+
+static void uring_free_connection(handler* current_handler, uring_connection* conn){
+
+    // nothing is in flight anymore, so nothing can point to the connection
+    if(conn->ctx.response) http_response_destroy(conn->ctx.response);
+    if(conn->file_fd >= 0) uring_close_fd(current_handler, conn->file_fd);
+    if(conn->pipe[0] >= 0) uring_close_fd(current_handler, conn->pipe[0]);
+    if(conn->pipe[1] >= 0) uring_close_fd(current_handler, conn->pipe[1]);
+    free(conn->file_body);
+    uring_close_fd(current_handler, conn->ctx.fd);
+    metrics_add(&current_handler->metrics, METRIC_CONNECTIONS_CLOSED, 1);
+    context_destroy(&conn->ctx);
+
+}
+
+static void uring_close_connection(handler* current_handler, connection_context* ctx){
+
+    /*
+        whatever is still in flight on the socket is cancelled: the connection is freed
+        when the last completion arrives (check uring_engine_run).
+    */
+    uring_connection* conn = (uring_connection*) ctx;
+    if(conn->closing) return;
+
+    conn->closing = true;
+    handler_clear_deadline(current_handler, ctx);
+
+    if(conn->inflight == 0){
+        uring_free_connection(current_handler, conn);
+        return;
+    }
+
+    struct io_uring_sqe* sqe = uring_queue(current_handler, NULL, OP_IGNORE);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = ctx->fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+
+}
+
+static struct io_uring_sqe* uring_splice(handler* current_handler, uring_connection* conn, uring_op op, int fd_in, long long off_in, int fd_out, unsigned length){
+
+    struct io_uring_sqe* sqe = uring_queue(current_handler, conn, op);
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = off_in;
+    sqe->fd = fd_out;
+    sqe->off = -1;
+    sqe->len = length;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    conn->writes += 1;
+
+    return sqe;
+
+}
+
+static void uring_finish_response(handler* current_handler, uring_connection* conn){
+
+    bool keep_alive = conn->ctx.response->keep_alive;
+
+    metrics_response_done(&current_handler->metrics, conn->ctx.response->status, conn->ctx.request_started_ns);
+    handler_log_response(current_handler, &conn->ctx, conn->ctx.response->status, conn->ctx.response->content_length);
+    http_response_destroy(conn->ctx.response);
+    conn->ctx.response = NULL;
+    conn->ctx.requests_served += 1;
+    current_handler->uring->responses += 1;
+
+    if(!keep_alive){
+        uring_close_connection(current_handler, &conn->ctx);
+    }else{
+        uring_next(current_handler, conn);
+    }
+
+}
+
+static void uring_send_response(handler* current_handler, uring_connection* conn){
+
+    /*
+        queues whatever is left of the response. the operations are linked, so they run in order:
+        if one of them falls short (or fails) the ones behind it are cancelled, and once all of them
+        have completed we come back here to queue the rest.
+    */
+
+    http_response* res = conn->ctx.response;
+    struct io_uring_sqe* previous = NULL;
+    struct io_uring_sqe* sqe;
+
+    if(!http_response_chain_written(res)){
+
+        // the message must stay valid until the kernel is done with it, so it lives in the connection
+        memset(&conn->message, 0, sizeof(conn->message));
+        conn->message.msg_iov = res->iov + res->iov_next;
+        conn->message.msg_iovlen = res->iov_count - res->iov_next;
+
+        sqe = uring_queue(current_handler, conn, OP_SENDMSG);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->ctx.fd;
+        sqe->addr = (unsigned long) &conn->message;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        if((res->file_fd >= 0 && res->body_offset < res->body_end) || res->part_next < res->part_count){
+            // the head waits for the first bytes of the body (check handler_stream_response)
+            sqe->msg_flags |= MSG_MORE;
+        }
+        conn->writes += 1;
+        previous = sqe;
+
+    }
+
+    if(res->file_fd >= 0 && (res->body_offset < res->body_end || conn->pipe_fill > 0)){
+
+        if(conn->pipe[0] < 0){
+            if(pipe2(conn->pipe, O_CLOEXEC) < 0){
+                perror("cannot create splice pipe");
+                uring_close_connection(current_handler, &conn->ctx);
+                return;
+            }
+            fcntl(conn->pipe[1], F_SETPIPE_SZ, SPLICE_CHUNK); // best effort, a smaller pipe only means more splices
+        }
+
+        if(previous) previous->flags |= IOSQE_IO_LINK;
+        if(conn->pipe_fill == 0){
+            off_t remaining = res->body_end - res->body_offset;
+            unsigned chunk = remaining < SPLICE_CHUNK ? remaining : SPLICE_CHUNK;
+            sqe = uring_splice(current_handler, conn, OP_SPLICE_IN, res->file_fd, res->body_offset, conn->pipe[1], chunk);
+            sqe->flags |= IOSQE_IO_LINK;
+            uring_splice(current_handler, conn, OP_SPLICE_OUT, conn->pipe[0], -1, conn->ctx.fd, chunk);
+        }else{
+            // the socket didn't take the whole pipe last time
+            uring_splice(current_handler, conn, OP_SPLICE_OUT, conn->pipe[0], -1, conn->ctx.fd, conn->pipe_fill);
+        }
+
+    }
+
+    if(conn->writes == 0){
+        // everything has been written (unless there's another part of a multipart body)
+        if(http_response_next_part(res)) uring_send_response(current_handler, conn);
+        else uring_finish_response(current_handler, conn);
+    }
+
+}
+
+static void uring_respond(handler* current_handler, uring_connection* conn, http_response* res){
+
+    conn->opening = false;
+    conn->ctx.response = res;
+    uring_send_response(current_handler, conn);
+
+}
+
+static void uring_open(handler* current_handler, uring_connection* conn){
+
+    struct io_uring_sqe* sqe = uring_queue(current_handler, conn, OP_OPEN);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long) conn->miss.filename; // it's in the arena, so it stays valid until the response is done
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    conn->opening = true;
+
+}
+
+static void uring_read(handler* current_handler, uring_connection* conn){
+
+    struct io_uring_sqe* sqe = uring_queue(current_handler, conn, OP_READ);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = conn->file_fd;
+    sqe->addr = (unsigned long) (conn->file_body + conn->file_read);
+    sqe->len = conn->stat.stx_size - conn->file_read;
+    sqe->off = conn->file_read;
+
+}
+
+static void uring_next(handler* current_handler, uring_connection* conn){
+
+    /*
+        the connection isn't writing anything: if a whole request is there, we start answering it,
+        otherwise we wait for more bytes.
+    */
+
+    if(conn->closing || conn->opening || conn->ctx.response) return;
+
+    if(!handler_next_response(current_handler, &conn->ctx, &conn->miss)){
+
+        if(conn->ctx.length > current_handler->max_request_size){
+            // the request is too big and we can't even find where it ends: reply and close
+            context_consume(&conn->ctx, conn->ctx.length);
+            handler_set_deadline(current_handler, &conn->ctx, DEADLINE_WRITE);
+            handler_request_started(current_handler, &conn->ctx);
+            uring_respond(current_handler, conn, http_response_bad_request(&conn->ctx));
+            return;
+        }
+
+        handler_await_request(current_handler, &conn->ctx);
+        if(!conn->recv_armed) uring_arm_recv(current_handler, conn);
+        return;
+
+    }
+
+    handler_set_deadline(current_handler, &conn->ctx, DEADLINE_WRITE);
+
+    if(conn->ctx.response){
+        uring_send_response(current_handler, conn);
+    }else{
+        uring_open(current_handler, conn);
+    }
+
+}
+
+static void uring_on_recv(handler* current_handler, uring_connection* conn, struct io_uring_cqe* cqe){
+
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    if(!more) conn->recv_armed = false;
+
+    if(cqe->res > 0){
+        unsigned short buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if(!conn->closing) write_to_context(&conn->ctx, uring_buffer(&current_handler->uring->buffers, buffer_id), cqe->res);
+        metrics_add(&current_handler->metrics, METRIC_BYTES_RECEIVED, cqe->res);
+        uring_buffer_recycle(&current_handler->uring->buffers, buffer_id);
+    }
+
+    if(conn->closing) return;
+
+    if(cqe->res == 0){
+        // the client closed the connection
+        uring_close_connection(current_handler, &conn->ctx);
+        return;
+    }
+
+    if(cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED){
+        uring_close_connection(current_handler, &conn->ctx);
+        return;
+    }
+
+    if(conn->ctx.response || conn->opening){
+        /*
+            we are busy answering: pipelined bytes are kept for later, but if too many of them pile up
+            we stop reading, so the client waits (the recv is armed again by uring_next).
+        */
+        if(conn->ctx.length > current_handler->max_request_size){
+            if(conn->recv_armed) uring_cancel_recv(current_handler, conn);
+        }else if(!conn->recv_armed){
+            uring_arm_recv(current_handler, conn);
+        }
+        return;
+    }
+
+    uring_next(current_handler, conn);
+    if(!conn->closing && !conn->recv_armed && conn->ctx.length <= current_handler->max_request_size){
+        // the multishot recv stopped (it ran out of buffers, for example): start it again
+        uring_arm_recv(current_handler, conn);
+    }
+
+}
+
+static void uring_on_write(handler* current_handler, uring_connection* conn, uring_op op, int result){
+
+    http_response* res = conn->ctx.response;
+    conn->writes -= 1;
+
+    if(result == -ECANCELED){
+        // something before it in the chain fell short, it will be queued again
+    }else if(result <= 0){
+        conn->failed = true; // 0 means the file has been truncated (splice) or the socket is gone
+    }else if(op == OP_SENDMSG){
+        /*
+            the chain is sent with MSG_WAITALL, so there's no progress to see before the whole chain is out:
+            a cached body has to reach the client within a single write timeout.
+        */
+        http_response_advance(res, result);
+    }else if(op == OP_SPLICE_IN){
+        res->body_offset += result;
+        conn->pipe_fill += result;
+    }else{
+        conn->pipe_fill -= result;
+    }
+
+    if(result > 0 && op != OP_SPLICE_IN) metrics_add(&current_handler->metrics, METRIC_BYTES_SENT, result);
+
+    if(result > 0 && !conn->closing) handler_set_deadline(current_handler, &conn->ctx, DEADLINE_WRITE); // the client is reading
+    if(conn->writes > 0 || conn->closing) return;
+
+    if(conn->failed){
+        uring_close_connection(current_handler, &conn->ctx);
+    }else{
+        // what the socket didn't take is queued again: that's our EAGAIN
+        if(!http_response_chain_written(res) || conn->pipe_fill > 0) metrics_add(&current_handler->metrics, METRIC_SEND_BLOCKED, 1);
+        uring_send_response(current_handler, conn);
+    }
+
+}
+
+static void uring_on_open(handler* current_handler, uring_connection* conn, int result){
+
+    if(conn->closing){
+        if(result >= 0) conn->file_fd = result; // closed with the connection
+        return;
+    }
+
+    if(result < 0){
+        uring_respond(current_handler, conn, http_response_not_found(&conn->ctx, conn->miss.keep_alive));
+        return;
+    }
+
+    conn->file_fd = result;
+
+    struct io_uring_sqe* sqe = uring_queue(current_handler, conn, OP_STATX);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = conn->file_fd;
+    sqe->addr = (unsigned long) "";
+    sqe->statx_flags = AT_EMPTY_PATH;
+    sqe->len = STATX_TYPE | STATX_SIZE | STATX_INO | STATX_MTIME; // the last two make the validators
+    sqe->off = (unsigned long) &conn->stat;
+
+}
+
+static void uring_on_statx(handler* current_handler, uring_connection* conn, int result){
+
+    if(conn->closing) return;
+
+    if(result < 0 || !S_ISREG(conn->stat.stx_mode)){
+        // directories (and other funny things) can be opened, but they can't be served
+        uring_close_fd(current_handler, conn->file_fd);
+        conn->file_fd = -1;
+        uring_respond(current_handler, conn, http_response_not_found(&conn->ctx, conn->miss.keep_alive));
+        return;
+    }
+
+    if(conn->stat.stx_size > current_handler->cache->max_entry_size){
+        // too big for the cache: the response owns the descriptor and the body will be spliced from it
+        http_response* res = handler_file_response(
+            current_handler, &conn->ctx, conn->miss.filename, conn->file_fd, conn->stat.stx_ino, conn->stat.stx_size,
+            conn->stat.stx_mtime.tv_sec, &conn->miss.conditions, conn->miss.keep_alive
+        );
+        conn->file_fd = -1;
+        uring_respond(current_handler, conn, res);
+        return;
+    }
+
+    conn->generation = file_cache_prepare(current_handler->cache, conn->miss.filename);
+    conn->file_body = malloc(conn->stat.stx_size + 1);
+    conn->file_read = 0;
+
+    if(conn->stat.stx_size == 0){
+        file_cache_entry* entry = file_cache_insert(
+            current_handler->cache, conn->miss.filename, conn->file_body, 0, conn->stat.stx_ino, conn->stat.stx_mtime.tv_sec, conn->generation
+        );
+        conn->file_body = NULL;
+        uring_close_fd(current_handler, conn->file_fd);
+        conn->file_fd = -1;
+        uring_respond(current_handler, conn, handler_cached_response(
+            current_handler, &conn->ctx, entry, conn->miss.accepted_encodings, &conn->miss.conditions, conn->miss.keep_alive
+        ));
+        return;
+    }
+
+    uring_read(current_handler, conn);
+
+}
+
+static void uring_on_read(handler* current_handler, uring_connection* conn, int result){
+
+    if(conn->closing) return;
+
+    if(result <= 0){
+        free(conn->file_body);
+        conn->file_body = NULL;
+        uring_close_fd(current_handler, conn->file_fd);
+        conn->file_fd = -1;
+        uring_respond(current_handler, conn, http_response_internal_server_error(&conn->ctx));
+        return;
+    }
+
+    conn->file_read += result;
+    if(conn->file_read < (off_t) conn->stat.stx_size){
+        uring_read(current_handler, conn);
+        return;
+    }
+
+    // the cache owns the body now
+    file_cache_entry* entry = file_cache_insert(
+        current_handler->cache, conn->miss.filename, conn->file_body, conn->file_read, conn->stat.stx_ino, conn->stat.stx_mtime.tv_sec, conn->generation
+    );
+    conn->file_body = NULL;
+    uring_close_fd(current_handler, conn->file_fd);
+    conn->file_fd = -1;
+    uring_respond(current_handler, conn, handler_cached_response(
+        current_handler, &conn->ctx, entry, conn->miss.accepted_encodings, &conn->miss.conditions, conn->miss.keep_alive
+    ));
+
+}
+
+static void uring_on_inbox(handler* current_handler, int result){
+
+    uring_engine* engine = current_handler->uring;
+
+    for(int i = 0; i < result / (int) sizeof(int); i++){
+
+        if(engine->inbox[i] == HANDLER_INBOX_STATS){
+            handler_memory_print_stats(&current_handler->memory, current_handler->id, stderr);
+            handler_print_deadline_stats(current_handler, stderr);
+            fprintf(
+                stderr,
+                "handler %d: %-12s enters=%lu completions=%lu responses=%lu\n",
+                current_handler->id, "io_uring", engine->ring.enters, engine->completions, engine->responses
+            );
+        }else{
+            // the dispatcher accepted it with accept4(SOCK_NONBLOCK), but here the ring does the waiting
+            fcntl(engine->inbox[i], F_SETFL, 0);
+            uring_add_connection(current_handler, engine->inbox[i]);
+        }
+
+    }
+
+    uring_arm_inbox(current_handler);
+
+}
+
+static void uring_on_completion(handler* current_handler, struct io_uring_cqe* cqe){
+
+    uring_op op = cqe->user_data & OP_MASK;
+    uring_connection* conn = (uring_connection*) (cqe->user_data & ~(unsigned long long) OP_MASK);
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    switch(op){
+        case OP_IGNORE:
+            return;
+        case OP_ACCEPT:
+            if(cqe->res >= 0){
+                handler_assign(current_handler);
+                uring_add_connection(current_handler, cqe->res);
+            }else if(cqe->res != -EINTR && cqe->res != -ECONNABORTED){
+                metrics_add(&current_handler->metrics, METRIC_ACCEPT_ERRORS, 1);
+                errno = -cqe->res;
+                perror("error while accepting\n");
+            }
+            if(!more) uring_arm_accept(current_handler);
+            return;
+        case OP_INBOX:
+            uring_on_inbox(current_handler, cqe->res);
+            return;
+        default:
+            break;
+    }
+
+    /*
+        the operation stays in flight while its completion is handled (even if it's the last one),
+        so a connection closed by the handling code isn't freed under our feet.
+    */
+    switch(op){
+        case OP_RECV:
+            uring_on_recv(current_handler, conn, cqe);
+            break;
+        case OP_SENDMSG:
+        case OP_SPLICE_IN:
+        case OP_SPLICE_OUT:
+            uring_on_write(current_handler, conn, op, cqe->res);
+            break;
+        case OP_OPEN:
+            uring_on_open(current_handler, conn, cqe->res);
+            break;
+        case OP_STATX:
+            uring_on_statx(current_handler, conn, cqe->res);
+            break;
+        case OP_READ:
+            uring_on_read(current_handler, conn, cqe->res);
+            break;
+        default:
+            break;
+    }
+
+    if(!more) conn->inflight -= 1;
+    if(conn->closing && conn->inflight == 0){
+        uring_free_connection(current_handler, conn);
+    }
+
+}
+
+void* uring_engine_run(void* h){
+
+    handler* current_handler = (handler*) h;
+    uring_engine* engine = malloc(sizeof(uring_engine));
+    struct io_uring_cqe* cqe;
+    struct timespec round_start;
+    int result;
+
+    if((result = uring_init(&engine->ring, RING_ENTRIES)) < 0){
+        errno = -result;
+        perror("cannot create handler's io_uring\n");
+        exit(-1);
+    }
+    if((result = uring_buffer_ring_init(&engine->ring, &engine->buffers, BUFFER_GROUP, RECV_BUFFERS, current_handler->request_buffer_size)) < 0){
+        errno = -result;
+        perror("cannot register handler's receive buffers\n");
+        exit(-1);
+    }
+    engine->completions = 0;
+    engine->responses = 0;
+    current_handler->uring = engine;
+
+    uring_arm_inbox(current_handler);
+    if(current_handler->strategy != ACCEPT_DISPATCH) uring_arm_accept(current_handler);
+
+    while(current_handler->active){
+
+        /*
+            everything queued during the last round is submitted, and we wait for at least one completion
+            with the same syscall.
+            we sleep until the next deadline is due (or forever, if there are none).
+        */
+        int timeout = handler_wait_timeout(current_handler);
+        result = uring_submit_and_wait(&engine->ring, 1, timeout);
+        http_date_update(&current_handler->date);
+        load_loop_start(&round_start);
+        metrics_round_start(&current_handler->metrics, &round_start);
+        if(result < 0 && result != -EINTR && result != -ETIME && result != -EBUSY){
+            errno = -result;
+            perror("io_uring_enter failed\n");
+        }
+
+        while((cqe = uring_peek_cqe(&engine->ring))){
+            struct io_uring_cqe completion = *cqe; // handlers may queue new operations, the slot is released first
+            uring_cqe_seen(&engine->ring);
+            engine->completions += 1;
+            uring_on_completion(current_handler, &completion);
+        }
+
+        handler_expire_deadlines(current_handler, uring_close_connection);
+
+        long round_time = load_loop_done(&current_handler->load, &round_start);
+        metrics_round_done(&current_handler->metrics, round_time);
+
+    }
+
+    pthread_exit(0);
+
+}
@@ -1,140 +1,190 @@
 #include "h/utils.h"
-#include <fcntl.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
 #include <unistd.h>
 
-void make_nonblocking(int fd){
+char* filename_to_mimetype_header(char* filename){
 
-    int flags = fcntl(fd, F_GETFL, 0); // manipulate file descriptor with some flags
-    if(flags == -1){
-        perror("cannot get file descriptor's flags\n");
-        exit(-1);
-    }
+    char* file_extension = filename_to_extension(filename);
 
-    if(fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1){
-        perror("cannot set socket to non-blocking\n");
-        exit(-1);
-    }
+    // again, no hashmap, sorry...
+
+    if(!file_extension)
+        return "Content-Type: application/octet-stream\r\n";
+    if(strcmp(".html", file_extension) == 0) 
+        return "Content-Type: text/html; charset=utf-8\r\n";
+    if(strcmp(".txt", file_extension) == 0)
+        return "Content-Type: text/plain; charset=utf-8\r\n";
+    if(strcmp(".jpg", file_extension) == 0)
+        return "Content-Type: image/jpeg\r\n";
+    if(strcmp(".jpeg", file_extension) == 0)
+        return "Content-Type: image/jpeg\r\n";
+    if(strcmp(".css", file_extension) == 0)
+        return "Content-Type: text/css\r\n";
+    if(strcmp(".js", file_extension) == 0 || strcmp(".mjs", file_extension) == 0)
+        return "Content-Type: text/javascript; charset=utf-8\r\n";
+    if(strcmp(".json", file_extension) == 0)
+        return "Content-Type: application/json\r\n";
+    if(strcmp(".svg", file_extension) == 0)
+        return "Content-Type: image/svg+xml\r\n";
+    if(strcmp(".xml", file_extension) == 0)
+        return "Content-Type: application/xml\r\n";
+    if(strcmp(".wasm", file_extension) == 0)
+        return "Content-Type: application/wasm\r\n";
+    if(strcmp(".png", file_extension) == 0)
+        return "Content-Type: image/png\r\n";
+    if(strcmp(".gif", file_extension) == 0)
+        return "Content-Type: image/gif\r\n";
+    if(strcmp(".webp", file_extension) == 0)
+        return "Content-Type: image/webp\r\n";
+    if(strcmp(".ico", file_extension) == 0)
+        return "Content-Type: image/x-icon\r\n";
+    if(strcmp(".woff2", file_extension) == 0)
+        return "Content-Type: font/woff2\r\n";
+    if(strcmp(".pdf", file_extension) == 0)
+        return "Content-Type: application/pdf\r\n";
+    if(strcmp(".mp4", file_extension) == 0)
+        return "Content-Type: video/mp4\r\n";
+    
+    return "Content-Type: application/octet-stream\r\n"; // the default for many webservers
 
 }
 
-int count_lines(char* bytes, size_t byte_len){
+char* filename_to_extension(char* filename){
 
-    char* copy = malloc(sizeof(char) * byte_len); // strch destroys the string, so we make a copy of it
-    char* next;
-    int count = 0;
+    /*
+        returns a pointer to the extension (dot included) inside "filename", nothing is allocated.
+        the dot must be in the last path segment and can't be its first character (".bashrc" has no extension).
+        returns NULL if there's no extension.
+    */
+    char* last_segment = strrchr(filename, '/');
+    char* dot;
 
-    copy = memcpy(copy, bytes, byte_len);
-    next = strchr(copy, '\n');
+    last_segment = last_segment ? last_segment + 1 : filename;
+    dot = strrchr(last_segment, '.');
 
-    while(next != NULL){
-        count++;
-        next = strchr(next + 1, '\n');
-    }
+    if(!dot || dot == last_segment) return NULL;
 
-    free(copy);
-    return count;
+    return dot;
 
 }
 
-char** bytes_to_lines(char* bytes, size_t byte_len, int lines_num){
-
-    unsigned int i = 0, line_len = 0;
-    char** lines = (char**) malloc(sizeof(char*) * lines_num);
-    char* copy = malloc(sizeof(char) * byte_len); // strtok_r destroys the string too :(
-    char* temp;
-    
-    strncpy(copy, bytes, byte_len);
-    
-    char* part = strtok_r(copy, "\n", &temp);
-    
-    do{
-        line_len = strlen(part);
-        lines[i] = malloc(sizeof(char) * line_len);
-        strncpy(lines[i], part, line_len);
-        i++;
-    }while ((part = strtok_r(NULL, "\n", &temp)) != NULL);
+int format_unsigned(char* out, unsigned long long value){
+
+    /*
+        writes "value" in decimal (not null-terminated) and returns how many digits were written.
+        digits are produced two at a time from a lookup table, from the right, so there are
+        half the divisions of the usual loop and no format string to parse (check http_response.c).
+    */
+
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char buffer[20];
+    char* end = buffer + sizeof(buffer);
+    char* start = end;
+
+    while(value >= 100){
+        int pair = (value % 100) * 2;
+        value /= 100;
+        start -= 2;
+        start[0] = pairs[pair];
+        start[1] = pairs[pair + 1];
+    }
+    if(value >= 10){
+        start -= 2;
+        start[0] = pairs[value * 2];
+        start[1] = pairs[value * 2 + 1];
+    }else{
+        *--start = '0' + value;
+    }
 
-    return lines;
+    memcpy(out, start, end - start);
+    return end - start;
 
 }
 
-char* filename_to_mimetype_header(char* filename){
+static int hex_digit(char c){
 
-    char* file_extension = filename_to_extension(filename);
-
-    // again, no hashmap, sorry...
-
-    if(strcmp(".html", file_extension) == 0) 
-        return "Content-Type: text/html; charset=utf-8\n";
-    if(strcmp(".txt", file_extension) == 0)
-        return "Content-Type: text/plain; charset=utf-8\n";
-    if(strcmp(".jpg", file_extension) == 0)
-        return "Content-Type: image/jpeg\n";
-    if(strcmp(".jpeg", file_extension) == 0)
-        return "Content-Type: image/jpeg\n";
-    if(strcmp(".css", file_extension) == 0)
-        return "Content-Type: text/css\n";
-    
-    return "Content-Type: application/octet-stream\n"; // the default for many webservers
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
 
 }
 
-char* filename_to_extension(char* filename){
+static bool normalize_segment(char* path, int* write, int* segment_start){
+
+    /*
+        the segment that was just written (from segment_start to write) is complete:
+        "." goes away, ".." takes the previous segment with it. false if ".." would climb above the root.
+    */
 
-    int len = strlen(filename), i = len - 1, end, ext_length = 0;
-    char* ext;
+    int length = *write - *segment_start;
+    const char* segment = path + *segment_start;
 
-    while(filename[i] != '.' && i >= 0){
-        i--;
+    if(length == 1 && segment[0] == '.'){
+        *write = *segment_start;
+    }else if(length == 2 && segment[0] == '.' && segment[1] == '.'){
+        if(*segment_start <= 1) return false;
+        *write = *segment_start - 1; // the slash before ".."
+        while(*write > 0 && path[*write - 1] != '/') (*write)--;
     }
 
-    if(i == 0) return NULL;
-    end = i;
-    ext_length = len - end;
-    ext = malloc(sizeof(char) * ext_length + 1);
-    ext = strncpy(ext, filename + end, ext_length);
-    ext[ext_length] = 0;
-    
-    return ext;
+    *segment_start = *write;
+    return true;
 
 }
 
-char* read_whole_file(int fd){
+int normalize_path(char* path, int length){
+
+    /*
+        decodes and normalizes an url path in place (it must start with '/'), in a single pass,
+        so the same file always has the same name:
+            - the query string (and the fragment) is dropped
+            - percent-escapes are decoded, before anything else looks at the bytes ("%2e%2e" is "..", "%2f" is a slash)
+            - repeated slashes are collapsed
+            - "." segments are removed and ".." segments remove the previous one
+        the output is never longer than what has been read, so it can be written over the input.
+        returns the new length, or -1 if the path can't name a file under the root:
+        a ".." above it, a malformed escape or an escaped NUL.
+    */
 
-    char* string = malloc(sizeof(char) * 8092);
-    char buffer[4096];
-    int result;
-    int total_bytes_read, current_bufferized_bytes;
-    void* next_ptr;
+    int read = 1, write = 1, segment_start = 1;
 
-    bzero(buffer, 4096);
-    bzero(string, 8092);
+    if(length == 0 || path[0] != '/') return -1;
 
-    while((result = read(fd, buffer, 4096))){
+    while(read < length && path[read] != '?' && path[read] != '#'){
 
-        total_bytes_read += result;
-        current_bufferized_bytes += result;
-        if(current_bufferized_bytes >= 8092){
-        
-            next_ptr = (char*) realloc(string, total_bytes_read + 8092);
-            if(!next_ptr){
-                perror("system is out of memory!\n");
-                exit(-1);
-            }
-            string = next_ptr;
-            current_bufferized_bytes = 0;
+        char c = path[read++];
 
+        if(c == '%'){
+            int high = read + 1 < length ? hex_digit(path[read]) : -1;
+            int low = high >= 0 ? hex_digit(path[read + 1]) : -1;
+            if(low < 0 || (high == 0 && low == 0)) return -1;
+            c = (char) (high << 4 | low);
+            read += 2;
         }
 
-        strncat(string, buffer, result);
+        if(c != '/'){
+            path[write++] = c;
+            continue;
+        }
+
+        if(!normalize_segment(path, &write, &segment_start)) return -1;
+        if(path[write - 1] != '/') path[write++] = '/'; // slashes are collapsed
+        segment_start = write;
 
     }
 
-    return string;
+    if(!normalize_segment(path, &write, &segment_start)) return -1;
+    path[write] = '\0';
 
-}
\ No newline at end of file
+    return write;
+
+}
@@ -1,10 +1,3 @@
-#define MAX_EVENTS 128
-#define NUM_HANDLERS 16 // 4 threads that handle epolls
-#define PORT 8080
-#define MAX_EPOLL_HANDLER_QUEUE_SIZE 2048
-#define REQUEST_BUFFER_SIZE 2048
-#define MAX_REQUEST_SIZE 8092
-
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -12,15 +5,27 @@
 #include <errno.h>
 #include "lib/h/connection_context.h"
 #include "lib/h/utils.h"
+#include "lib/h/config.h"
 #include "lib/h/server.h"
 
-int main(void){
+int main(int argc, char** argv){
+
+    /*
+        every setting has a default (check config_defaults in lib/config.c) that can be changed
+        with a flag or in a config file: ./bin/epolly --help lists them all.
+    */
+    server_config config;
+
+    config_defaults(&config);
+    config_load(&config, argc, argv);
 
-    server* http_server = server_init(PORT, MAX_EVENTS, NUM_HANDLERS, MAX_EPOLL_HANDLER_QUEUE_SIZE, REQUEST_BUFFER_SIZE, MAX_REQUEST_SIZE);
-    printf("server is now listening on localhost:%d\n", PORT);
+    server* http_server = server_init(&config);
+    printf("server is now listening on localhost:%d\n", config.port);
+    config_print(&http_server->config, stdout);
+    fflush(stdout);
 
     server_loop(http_server);
 
     return 0;
 
-}
\ No newline at end of file
+}
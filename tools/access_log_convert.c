@@ -0,0 +1,225 @@
+/*
+    turns epolly's binary access log (check lib/h/access_log.h) into text, a line per request:
+
+        127.0.0.1:51234 - [17/Oct/2026:19:58:01.123456 +0000] "GET /index.html" 200 1234 0.000152 h0
+
+    (the client, when the request was complete, method and path, status, body bytes, seconds it took and the handler)
+    or into JSON, an object per line. dropped records show up as a line of their own ("# ..." in text).
+
+    records come a flush at a time, grouped by handler: they are in time order within a handler, not across handlers.
+    files are read in the order they're given (stdin if there are none): a path is defined once per file, but the
+    few requests logged right after a rotation may still use the previous file's definitions, so a rotated file
+    and the ones after it should be converted together.
+
+    make access-log-convert
+    ./bin/access-log-convert [--json] access.log.20261017-195801 access.log
+*/
+#define _GNU_SOURCE
+#include "../lib/h/access_log.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define PATHS_SIZE 65536 // the paths we remember (open addressing, a full table starts over)
+
+typedef struct {
+    uint64_t id;
+    char* path;
+} known_path;
+
+static known_path paths[PATHS_SIZE];
+static int path_count;
+static bool json;
+
+static const char* path_find(uint64_t id){
+
+    for(size_t i = id % PATHS_SIZE; paths[i].id; i = (i + 1) % PATHS_SIZE){
+        if(paths[i].id == id) return paths[i].path;
+    }
+    return NULL;
+
+}
+
+static void path_add(uint64_t id, const char* path, size_t length){
+
+    if(path_count >= PATHS_SIZE / 2){
+        // full enough: the next records define what they need again
+        for(int i = 0; i < PATHS_SIZE; i++) free(paths[i].path);
+        memset(paths, 0, sizeof(paths));
+        path_count = 0;
+    }
+
+    size_t i = id % PATHS_SIZE;
+    while(paths[i].id && paths[i].id != id) i = (i + 1) % PATHS_SIZE;
+    if(!paths[i].id) path_count++;
+    free(paths[i].path);
+    paths[i].id = id;
+    paths[i].path = strndup(path, length);
+
+}
+
+static void print_json_string(const char* text, size_t length){
+
+    putchar('"');
+    for(size_t i = 0; i < length; i++){
+        unsigned char c = text[i];
+        if(c == '"' || c == '\\') printf("\\%c", c);
+        else if(c < 0x20 || c == 0x7f) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+
+}
+
+static void format_time(uint64_t us, char* out, size_t size, bool iso){
+
+    time_t seconds = us / 1000000;
+    struct tm utc;
+    char date[64];
+
+    gmtime_r(&seconds, &utc);
+    strftime(date, sizeof(date), iso ? "%Y-%m-%dT%H:%M:%S" : "%d/%b/%Y:%H:%M:%S", &utc);
+    snprintf(out, size, iso ? "%s.%06uZ" : "%s.%06u +0000", date, (unsigned int) (us % 1000000));
+
+}
+
+static void print_request(const access_log_record* record){
+
+    char address[INET6_ADDRSTRLEN] = "-";
+    char when[96];
+    char path_id[24];
+    char method[sizeof(record->method) + 1] = { 0 };
+    const char* path = record->path_id ? path_find(record->path_id) : "-";
+
+    if(record->family == AF_INET || record->family == AF_INET6) inet_ntop(record->family, record->address, address, sizeof(address));
+    if(!path){
+        snprintf(path_id, sizeof(path_id), "#%016llx", (unsigned long long) record->path_id);
+        path = path_id;
+    }
+    memcpy(method, record->method, sizeof(record->method));
+    if(!method[0]) strcpy(method, "-");
+    format_time(record->timestamp_us, when, sizeof(when), json);
+
+    if(json){
+        printf("{\"time\":\"%s\",\"client\":\"%s\",\"port\":%u,\"handler\":%u,\"method\":", when, address, record->port, record->handler);
+        print_json_string(method, strlen(method));
+        printf(",\"path\":");
+        print_json_string(path, strlen(path));
+        printf(",\"status\":%u,\"bytes\":%llu,\"duration_us\":%u}\n", record->status, (unsigned long long) record->bytes, record->duration_us);
+    }else{
+        printf(record->family == AF_INET6 ? "[%s]:%u" : "%s:%u", address, record->port);
+        printf(" - [%s] \"%s %s\" %u %llu %u.%06u h%u\n", when, method, path, record->status, (unsigned long long) record->bytes,
+               record->duration_us / 1000000, record->duration_us % 1000000, record->handler);
+    }
+
+}
+
+static void print_dropped(const access_log_dropped* dropped){
+
+    char when[96];
+    format_time(dropped->timestamp_us, when, sizeof(when), json);
+
+    if(json) printf("{\"time\":\"%s\",\"handler\":%u,\"dropped\":%llu}\n", when, dropped->handler, (unsigned long long) dropped->count);
+    else printf("# [%s] handler %u dropped %llu records\n", when, dropped->handler, (unsigned long long) dropped->count);
+
+}
+
+static bool convert(FILE* in, const char* name){
+
+    access_log_slot slot;
+    char path[ACCESS_LOG_PATH_MAX + ACCESS_LOG_SLOT];
+    bool first = true;
+
+    while(fread(&slot, sizeof(slot), 1, in) == 1){
+
+        if(first && slot.bytes[0] != ACCESS_LOG_HEADER){
+            fprintf(stderr, "%s: not an epolly access log\n", name);
+            return false;
+        }
+        first = false;
+
+        switch(slot.bytes[0]){
+
+            case ACCESS_LOG_HEADER: {
+                access_log_header* header = (access_log_header*) &slot;
+                if(memcmp(header->magic, ACCESS_LOG_MAGIC, sizeof(header->magic)) != 0 || header->slot_size != ACCESS_LOG_SLOT){
+                    fprintf(stderr, "%s: not an epolly access log\n", name);
+                    return false;
+                }
+                if(header->version != ACCESS_LOG_VERSION){
+                    fprintf(stderr, "%s: version %u, this converter reads version %d\n", name, header->version, ACCESS_LOG_VERSION);
+                    return false;
+                }
+                break;
+            }
+
+            case ACCESS_LOG_REQUEST:
+                print_request((access_log_record*) &slot);
+                break;
+
+            case ACCESS_LOG_PATH: {
+                access_log_path_record* record = (access_log_path_record*) &slot;
+                uint64_t id = record->path_id;
+                size_t length = record->length;
+                size_t copied = length < sizeof(record->path) ? length : sizeof(record->path);
+
+                memcpy(path, record->path, copied);
+                while(copied < length && fread(&slot, sizeof(slot), 1, in) == 1){
+                    size_t piece = length - copied < ACCESS_LOG_SLOT ? length - copied : ACCESS_LOG_SLOT;
+                    memcpy(path + copied, slot.bytes, piece);
+                    copied += piece;
+                }
+                path_add(id, path, copied);
+                break;
+            }
+
+            case ACCESS_LOG_DROPPED:
+                print_dropped((access_log_dropped*) &slot);
+                break;
+
+            default:
+                fprintf(stderr, "%s: unknown record (kind %u), skipped\n", name, slot.bytes[0]);
+
+        }
+
+    }
+
+    return true;
+
+}
+
+int main(int argc, char** argv){
+
+    int files = 0;
+    bool ok = true;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--json") == 0){
+            json = true;
+        }else if(strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0){
+            printf("usage: %s [--json] [file...]\n", argv[0]);
+            return 0;
+        }
+    }
+
+    for(int i = 1; i < argc; i++){
+        if(argv[i][0] == '-' && argv[i][1]) continue;
+        FILE* in = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "rb");
+        files++;
+        if(!in){
+            perror(argv[i]);
+            ok = false;
+            continue;
+        }
+        ok = convert(in, argv[i]) && ok;
+        if(in != stdin) fclose(in);
+    }
+
+    if(files == 0) ok = convert(stdin, "stdin");
+
+    return ok ? 0 : 1;
+
+}